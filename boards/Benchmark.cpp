@@ -0,0 +1,428 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+
+
+The built-in benchmark program measures the CPU and JIT, and the guest's path
+to the NAND flash.  It runs with interrupts masked and touches no SMDK2410
+peripheral other than the NAND flash controller, so the numbers do not depend
+on the LCD, timers or network.  It is laid out in guest RAM as:
+
+  0x30200000 - the driver, which runs each routine in the table with the MMU
+               off, then turns the MMU on with a flat 1:1 section map and runs
+               them all again
+  0x30200800 - the table:  {entrypoint, iteration count} pairs ending with 0.
+               Bit 0 of the entrypoint selects Thumb.
+  0x30201000 - the routines, one per 256-byte slot.  Each is called with the
+               iteration count in R0 and returns with BX LR.
+  0x30300000 - data for the load/store routines, and the NAND routines' sector
+               buffer
+  0x30400000 - the translation table the driver builds
+
+The listings beside each opcode are from the assembler.  Branch targets and
+PC-relative loads are offsets from the start of the routine.
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "MappedIO.h"
+#include "Board.h"
+#include "cpu.h"
+#include "resource.h"
+#include "devices.h"
+#include <intrin.h>
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "benchmark.tmh"
+#include "vsd_logging_inc.h"
+
+#define BENCHMARK_DRIVER_ADDRESS    0x30200000
+#define BENCHMARK_TABLE_ADDRESS     0x30200800
+#define BENCHMARK_ROUTINE_ADDRESS   0x30201000
+#define BENCHMARK_ROUTINE_SLOT_SIZE 0x100
+
+static const unsigned __int32 BenchmarkDriver[] = {
+    0xe59f4098, // 00: ldr r4, [pc, #152]
+    0xe3a05000, // 04: mov r5, #0
+    0xe3a08000, // 08: mov r8, #0
+    0xe59f6090, // 0c: ldr r6, [pc, #144]
+    0xe4967004, // 10: ldr r7, [r6], #4
+    0xe3570000, // 14: cmp r7, #0
+    0x0a000006, // 18: beq 0x38
+    0xe4960004, // 1c: ldr r0, [r6], #4
+    0xe5845000, // 20: str r5, [r4]
+    0xe1a0e00f, // 24: mov lr, pc
+    0xe12fff17, // 28: bx r7
+    0xe5845004, // 2c: str r5, [r4, #4]
+    0xe2855001, // 30: add r5, r5, #1
+    0xeafffff5, // 34: b 0x10
+    0xe3580000, // 38: cmp r8, #0
+    0x1a000003, // 3c: bne 0x50
+    0xe1a0e00f, // 40: mov lr, pc
+    0xea000004, // 44: b 0x5c
+    0xe3a08001, // 48: mov r8, #1
+    0xeaffffee, // 4c: b 0xc
+    0xe3a00000, // 50: mov r0, #0
+    0xe584000c, // 54: str r0, [r4, #12]
+    0xeafffffe, // 58: b 0x58
+    0xe3a005c1, // 5c: mov r0, #0x30400000
+    0xe59f1040, // 60: ldr r1, [pc, #64]
+    0xe3a02000, // 64: mov r2, #0
+    0xe1813a02, // 68: orr r3, r1, r2, lsl #20
+    0xe7803102, // 6c: str r3, [r0, r2, lsl #2]
+    0xe2822001, // 70: add r2, r2, #1
+    0xe3520a01, // 74: cmp r2, #0x1000
+    0x1afffffa, // 78: bne 0x68
+    0xee020f10, // 7c: mcr p15, #0, r0, c2, c0, #0
+    0xe3e01000, // 80: mvn r1, #0
+    0xee031f10, // 84: mcr p15, #0, r1, c3, c0, #0
+    0xe3a01000, // 88: mov r1, #0
+    0xee081f17, // 8c: mcr p15, #0, r1, c8, c7, #0
+    0xee111f10, // 90: mrc p15, #0, r1, c1, c0, #0
+    0xe3811001, // 94: orr r1, r1, #1
+    0xee011f10, // 98: mcr p15, #0, r1, c1, c0, #0
+    0xe12fff1e, // 9c: bx lr
+    0x500f6000, // a0: literal 0x500f6000
+    0x30200800, // a4: literal 0x30200800
+    0x00000c02, // a8: literal 0x00000c02
+};
+
+static const unsigned __int32 BenchmarkArmALU[] = {
+    0xe3a01001, // 00: mov r1, #1
+    0xe3a02002, // 04: mov r2, #2
+    0xe3a03003, // 08: mov r3, #3
+    0xe0811002, // 0c: add r1, r1, r2
+    0xe0222003, // 10: eor r2, r2, r3
+    0xe0433001, // 14: sub r3, r3, r1
+    0xe181c182, // 18: orr r12, r1, r2, lsl #3
+    0xe00220ac, // 1c: and r2, r2, r12, lsr #1
+    0xe2500001, // 20: subs r0, r0, #1
+    0x1afffff8, // 24: bne 0xc
+    0xe12fff1e, // 28: bx lr
+};
+
+static const unsigned __int32 BenchmarkArmLoadStore[] = {
+    0xe59f1020, // 00: ldr r1, [pc, #32]
+    0xe2003fff, // 04: and r3, r0, #0x3fc
+    0xe7912003, // 08: ldr r2, [r1, r3]
+    0xe1d1c0b2, // 0c: ldrh r12, [r1, #2]
+    0xe082200c, // 10: add r2, r2, r12
+    0xe7812003, // 14: str r2, [r1, r3]
+    0xe5c12001, // 18: strb r2, [r1, #1]
+    0xe2500001, // 1c: subs r0, r0, #1
+    0x1afffff7, // 20: bne 0x4
+    0xe12fff1e, // 24: bx lr
+    0x30300000, // 28: literal 0x30300000
+};
+
+static const unsigned __int32 BenchmarkArmLoadStoreMultiple[] = {
+    0xe92d0ff0, // 00: push {r4, r5, r6, r7, r8, r9, r10, r11}
+    0xe59f1018, // 04: ldr r1, [pc, #24]
+    0xe281cb01, // 08: add r12, r1, #0x400
+    0xe89103fc, // 0c: ldm r1, {r2, r3, r4, r5, r6, r7, r8, r9}
+    0xe88c03fc, // 10: stm r12, {r2, r3, r4, r5, r6, r7, r8, r9}
+    0xe2500001, // 14: subs r0, r0, #1
+    0x1afffffb, // 18: bne 0xc
+    0xe8bd0ff0, // 1c: pop {r4, r5, r6, r7, r8, r9, r10, r11}
+    0xe12fff1e, // 20: bx lr
+    0x30300000, // 24: literal 0x30300000
+};
+
+static const unsigned __int32 BenchmarkArmIndirectBranch[] = {
+    0xe3a0c000, // 00: mov r12, #0
+    0xe2003003, // 04: and r3, r0, #3
+    0xe08ff183, // 08: add pc, pc, r3, lsl #3
+    0xe1a00000, // 0c: mov r0, r0
+    0xe28cc001, // 10: add r12, r12, #1
+    0xea000005, // 14: b 0x30
+    0xe28cc002, // 18: add r12, r12, #2
+    0xea000003, // 1c: b 0x30
+    0xe28cc003, // 20: add r12, r12, #3
+    0xea000001, // 24: b 0x30
+    0xe28cc004, // 28: add r12, r12, #4
+    0xeaffffff, // 2c: b 0x30
+    0xe2500001, // 30: subs r0, r0, #1
+    0x1afffff2, // 34: bne 0x4
+    0xe12fff1e, // 38: bx lr
+};
+
+static const unsigned __int32 BenchmarkArmCallReturn[] = {
+    0xe92d4000, // 00: stmdb sp!, {lr}
+    0xe3a0c000, // 04: mov r12, #0
+    0xeb000003, // 08: bl 0x1c
+    0xe2500001, // 0c: subs r0, r0, #1
+    0x1afffffc, // 10: bne 0x8
+    0xe8bd4000, // 14: ldm sp!, {lr}
+    0xe12fff1e, // 18: bx lr
+    0xe28cc001, // 1c: add r12, r12, #1
+    0xe12fff1e, // 20: bx lr
+};
+
+static const unsigned __int32 BenchmarkArmConditional[] = {
+    0xe3a01000, // 00: mov r1, #0
+    0xe3a02000, // 04: mov r2, #0
+    0xe3100001, // 08: tst r0, #1
+    0x12811001, // 0c: addne r1, r1, #1
+    0x02822001, // 10: addeq r2, r2, #1
+    0xe1510002, // 14: cmp r1, r2
+    0xc1a03001, // 18: movgt r3, r1
+    0xd1a03002, // 1c: movle r3, r2
+    0xe2500001, // 20: subs r0, r0, #1
+    0x1afffff7, // 24: bne 0x8
+    0xe12fff1e, // 28: bx lr
+};
+
+static const unsigned __int32 BenchmarkArmMultiply[] = {
+    0xe92d0030, // 00: push {r4, r5}
+    0xe3a01003, // 04: mov r1, #3
+    0xe3a02005, // 08: mov r2, #5
+    0xe3a03000, // 0c: mov r3, #0
+    0xe3a04000, // 10: mov r4, #0
+    0xe3a05000, // 14: mov r5, #0
+    0xe00c0291, // 18: mul r12, r1, r2
+    0xe023329c, // 1c: mla r3, r12, r2, r3
+    0xe0854c91, // 20: umull r4, r5, r1, r12
+    0xe0e54392, // 24: smlal r4, r5, r2, r3
+    0xe16c0281, // 28: smulbb r12, r1, r2
+    0xe10332c1, // 2c: smlabt r3, r1, r2, r3
+    0xe10c1051, // 30: qadd r1, r1, r12
+    0xe2500001, // 34: subs r0, r0, #1
+    0x1afffff6, // 38: bne 0x18
+    0xe8bd0030, // 3c: pop {r4, r5}
+    0xe12fff1e, // 40: bx lr
+};
+
+static const unsigned __int32 BenchmarkThumbALU[] = {
+    0x22022101, // 00: movs r1, #1; 02: movs r2, #2
+    0x18892303, // 04: movs r3, #3; 06: adds r1, r1, r2
+    0x1a5b405a, // 08: eors r2, r3; 0a: subs r3, r3, r1
+    0x430b0052, // 0c: lsls r2, r2, #1; 0e: orrs r3, r1
+    0xd1f83801, // 10: subs r0, #1; 12: bne 0x6
+    0x00004770, // 14: bx lr
+};
+
+static const unsigned __int32 BenchmarkThumbLoadStore[] = {
+    0x23fc4905, // 00: ldr r1, [pc, #20]; 02: movs r3, #252
+    0x58ca4003, // 04: ands r3, r0; 06: ldr r2, [r1, r3]
+    0x50ca3201, // 08: adds r2, #1; 0a: str r2, [r1, r3]
+    0x704b884b, // 0c: ldrh r3, [r1, #2]; 0e: strb r3, [r1, #1]
+    0xd1f63801, // 10: subs r0, #1; 12: bne 0x2
+    0x46c04770, // 14: bx lr; 16: mov r8, r8
+    0x30300000, // 18: literal 0x30300000
+};
+
+static const unsigned __int32 BenchmarkThumbCallReturn[] = {
+    0x2200b500, // 00: push {lr}; 02: movs r2, #0
+    0xf804f000, // 04: bl 0x10
+    0xd1fb3801, // 08: subs r0, #1; 0a: bne 0x4
+    0x4718bc08, // 0c: pop {r3}; 0e: bx r3
+    0x47703201, // 10: adds r2, #1; 12: bx lr
+};
+
+// Reads flash sector 0 the way the SMDK2410 FMD driver does:  CMD_READ and the
+// address through NFCMD and NFADDR, a wait for NFSTAT ready, then one NFDATA
+// access per byte.
+static const unsigned __int32 BenchmarkNANDByteLoop[] = {
+    0xe92d0030, // 00: push {r4, r5}
+    0xe59f1048, // 04: ldr r1, [pc, #72]
+    0xe59f2048, // 08: ldr r2, [pc, #72]
+    0xe3a03000, // 0c: mov r3, #0
+    0xe5c13004, // 10: strb r3, [r1, #4]
+    0xe5c13008, // 14: strb r3, [r1, #8]
+    0xe5c13008, // 18: strb r3, [r1, #8]
+    0xe5c13008, // 1c: strb r3, [r1, #8]
+    0xe591c010, // 20: ldr r12, [r1, #16]
+    0xe31c0001, // 24: tst r12, #1
+    0x0afffffc, // 28: beq 0x20
+    0xe1a04002, // 2c: mov r4, r2
+    0xe3a05f82, // 30: mov r5, #520
+    0xe5d1c00c, // 34: ldrb r12, [r1, #12]
+    0xe4c4c001, // 38: strb r12, [r4], #1
+    0xe2555001, // 3c: subs r5, r5, #1
+    0x1afffffb, // 40: bne 0x34
+    0xe2500001, // 44: subs r0, r0, #1
+    0x1afffff0, // 48: bne 0x10
+    0xe8bd0030, // 4c: pop {r4, r5}
+    0xe12fff1e, // 50: bx lr
+    0x4e000000, // 54: literal 0x4e000000
+    0x30300000, // 58: literal 0x30300000
+};
+
+// Reads flash sector 0 with one NFBULKCONTROL transfer, and reads back the
+// number of sectors moved
+static const unsigned __int32 BenchmarkNANDBulk[] = {
+    0xe59f1024, // 00: ldr r1, [pc, #36]
+    0xe59f2024, // 04: ldr r2, [pc, #36]
+    0xe3a03000, // 08: mov r3, #0
+    0xe5813024, // 0c: str r3, [r1, #36]
+    0xe5812028, // 10: str r2, [r1, #40]
+    0xe3a0c001, // 14: mov r12, #1
+    0xe581c02c, // 18: str r12, [r1, #44]
+    0xe591302c, // 1c: ldr r3, [r1, #44]
+    0xe2500001, // 20: subs r0, r0, #1
+    0x1afffffb, // 24: bne 0x18
+    0xe12fff1e, // 28: bx lr
+    0x4e000000, // 2c: literal 0x4e000000
+    0x30300000, // 30: literal 0x30300000
+};
+
+typedef struct {
+    const char *Name;
+    const unsigned __int32 *Code;
+    size_t CodeSize;
+    bool Thumb;
+    unsigned __int32 InstructionsPerIteration;  // including the loop's SUBS and BNE
+    unsigned __int32 Iterations;
+    unsigned __int32 FlashBytesPerIteration;    // bytes read from the NAND flash, or 0
+} BenchmarkRoutine;
+
+#define BENCHMARK_ROUTINE(Name, Code, Thumb, InstructionsPerIteration, Iterations) \
+    {Name, Code, sizeof(Code), Thumb, InstructionsPerIteration, Iterations, 0}
+#define BENCHMARK_NAND_ROUTINE(Name, Code, InstructionsPerIteration, Iterations) \
+    {Name, Code, sizeof(Code), false, InstructionsPerIteration, Iterations, NAND_SECTOR_SIZE}
+
+static const BenchmarkRoutine BenchmarkRoutines[] = {
+    BENCHMARK_ROUTINE("ARM ALU",                  BenchmarkArmALU,               false, 7, 14000000),
+    BENCHMARK_ROUTINE("ARM load/store",           BenchmarkArmLoadStore,         false, 8, 12000000),
+    BENCHMARK_ROUTINE("ARM LDM/STM",              BenchmarkArmLoadStoreMultiple, false, 4, 10000000),
+    BENCHMARK_ROUTINE("ARM computed branch",      BenchmarkArmIndirectBranch,    false, 6, 10000000),
+    BENCHMARK_ROUTINE("ARM call/return",          BenchmarkArmCallReturn,        false, 5, 10000000),
+    BENCHMARK_ROUTINE("ARM conditional",          BenchmarkArmConditional,       false, 8, 12000000),
+    BENCHMARK_ROUTINE("ARM multiply and DSP",     BenchmarkArmMultiply,          false, 9, 10000000),
+    BENCHMARK_ROUTINE("Thumb ALU",                BenchmarkThumbALU,             true,  7, 14000000),
+    BENCHMARK_ROUTINE("Thumb load/store",         BenchmarkThumbLoadStore,       true,  9, 10000000),
+    // The Thumb BL is counted as the two instructions it is encoded as
+    BENCHMARK_ROUTINE("Thumb call/return",        BenchmarkThumbCallReturn,      true,  6, 10000000),
+    // 4 NFCMD/NFADDR stores, 3 for the NFSTAT wait, 2 to set up the byte loop
+    // and 2 for the sector loop, plus 4 per byte
+    BENCHMARK_NAND_ROUTINE("NAND NFDATA sector read", BenchmarkNANDByteLoop,     11+4*NAND_SECTOR_SIZE, 20000),
+    BENCHMARK_NAND_ROUTINE("NAND NFBULK sector read", BenchmarkNANDBulk,         4, 1000000),
+};
+C_ASSERT(ARRAY_SIZE(BenchmarkRoutines) == BENCHMARK_COUNT);
+
+#undef BENCHMARK_ROUTINE
+#undef BENCHMARK_NAND_ROUTINE
+
+bool __fastcall BenchmarkLoadProgram(void)
+{
+    unsigned __int32 *pTable;
+    void *pDriver;
+
+    pDriver = (void *)BoardMapGuestPhysicalToHostRAM(BENCHMARK_DRIVER_ADDRESS);
+    pTable = (unsigned __int32 *)BoardMapGuestPhysicalToHostRAM(BENCHMARK_TABLE_ADDRESS);
+    if (pDriver == NULL || pTable == NULL) {
+        return false;
+    }
+    ASSERT(sizeof(BenchmarkDriver) <= BENCHMARK_TABLE_ADDRESS-BENCHMARK_DRIVER_ADDRESS);
+    memcpy(pDriver, BenchmarkDriver, sizeof(BenchmarkDriver));
+
+    for (int i=0; i<ARRAY_SIZE(BenchmarkRoutines); ++i) {
+        const BenchmarkRoutine *pRoutine = &BenchmarkRoutines[i];
+        unsigned __int32 RoutineAddress = BENCHMARK_ROUTINE_ADDRESS + i*BENCHMARK_ROUTINE_SLOT_SIZE;
+        void *pRoutineCode = (void *)BoardMapGuestPhysicalToHostRAM(RoutineAddress);
+
+        ASSERT(pRoutine->CodeSize <= BENCHMARK_ROUTINE_SLOT_SIZE);
+        if (pRoutineCode == NULL) {
+            return false;
+        }
+        memcpy(pRoutineCode, pRoutine->Code, pRoutine->CodeSize);
+        *pTable++ = RoutineAddress | (pRoutine->Thumb ? 1 : 0);
+        *pTable++ = pRoutine->Iterations;
+    }
+    *pTable = 0;
+
+    CpuSetInstructionPointer(BENCHMARK_DRIVER_ADDRESS);
+    return true;
+}
+
+void __fastcall IOBenchmark::WriteWord(unsigned __int32 IOAddress, unsigned __int32 Value)
+{
+    switch (IOAddress) {
+    case 0x00: // BENCHBEGIN
+        if (Value >= ARRAY_SIZE(Results)) {
+            TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
+        }
+        CurrentIndex = Value;
+        QueryPerformanceCounter(&StartTime);
+        StartCycles = __rdtsc();
+        break;
+
+    case 0x04: // BENCHEND
+        {
+            unsigned __int64 EndCycles = __rdtsc();
+            LARGE_INTEGER EndTime;
+
+            QueryPerformanceCounter(&EndTime);
+            if (Value != CurrentIndex) {
+                TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
+            }
+            Results[CurrentIndex].Ticks = EndTime.QuadPart - StartTime.QuadPart;
+            Results[CurrentIndex].Cycles = EndCycles - StartCycles;
+        }
+        break;
+
+    case 0x08: // CONSOLE
+        putchar((int)(Value & 0xff));
+        break;
+
+    case 0x0c: // EXIT
+        WriteReport();
+        exit((int)Value);
+        break;
+
+    default:
+        TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
+        break;
+    }
+}
+
+void __fastcall IOBenchmark::WriteReport(void)
+{
+    LARGE_INTEGER Frequency;
+    unsigned __int32 Conditional;
+    unsigned __int32 Predicated;
+    FILE *fp;
+
+    if (_wfopen_s(&fp, Configuration.BenchmarkFileName, L"w")) {
+        ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN, Configuration.BenchmarkFileName);
+        return;
+    }
+    QueryPerformanceFrequency(&Frequency);
+
+    fprintf(fp, "Benchmark\tMMU\tGuest instructions\tSeconds\tGuest MIPS\tHost cycles per guest instruction\tFlash MB/s\n");
+    for (int i=0; i<ARRAY_SIZE(Results); ++i) {
+        const BenchmarkRoutine *pRoutine = &BenchmarkRoutines[i % BENCHMARK_COUNT];
+        unsigned __int64 Instructions;
+        double Seconds;
+
+        if (Results[i].Ticks == 0) {
+            continue;
+        }
+        Instructions = (unsigned __int64)pRoutine->InstructionsPerIteration * pRoutine->Iterations;
+        Seconds = (double)Results[i].Ticks / (double)Frequency.QuadPart;
+        fprintf(fp, "%s\t%s\t%I64u\t%.3f\t%.1f\t%.2f\t",
+                pRoutine->Name, (i < BENCHMARK_COUNT) ? "off" : "on", Instructions, Seconds,
+                (double)Instructions / Seconds / 1000000.0,
+                (double)Results[i].Cycles / (double)Instructions);
+        if (pRoutine->FlashBytesPerIteration) {
+            fprintf(fp, "%.1f", (double)pRoutine->FlashBytesPerIteration * pRoutine->Iterations / Seconds / 1000000.0);
+        }
+        fprintf(fp, "\n");
+    }
+
+    CpuGetPredicationCounts(&Conditional, &Predicated);
+    fprintf(fp, "\nConditional instructions translated\t%u\n", Conditional);
+    fprintf(fp, "Predicated without a branch\t%u\t%.1f%%\n", Predicated,
+            (Conditional) ? 100.0 * (double)Predicated / (double)Conditional : 0.0);
+    fclose(fp);
+}
@@ -0,0 +1,50 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef BENCHMARK_H__
+#define BENCHMARK_H__
+
+// Number of routines in the built-in benchmark program.  Each one runs once with
+// the MMU off and once with it on.
+#define BENCHMARK_COUNT 12
+
+// The device the built-in benchmark program reports through.  The program is
+// loaded by BenchmarkLoadProgram() in place of a .bin file when /benchmark is
+// given.  All registers are write-only:
+//   0x00 BENCHBEGIN - the guest is about to run the routine whose index is written
+//   0x04 BENCHEND   - the routine has returned
+//   0x08 CONSOLE    - the low byte is written to stdout
+//   0x0c EXIT       - writes the report and exits with the value written
+class IOBenchmark : public MappedIODevice {
+public:
+    virtual void __fastcall WriteWord(unsigned __int32 IOAddress, unsigned __int32 Value);
+
+private:
+    void __fastcall WriteReport(void);
+
+    struct BenchmarkResult {
+        unsigned __int64 Ticks;     // QueryPerformanceCounter() ticks, or 0 if it did not run
+        unsigned __int64 Cycles;    // host timestamp counter cycles
+    };
+
+    unsigned __int32 CurrentIndex;
+    LARGE_INTEGER StartTime;
+    unsigned __int64 StartCycles;
+    BenchmarkResult Results[2*BENCHMARK_COUNT];
+};
+
+// Copies the benchmark program into guest RAM and points the CPU at it.  The
+// addresses it uses are those of the SMDK2410 board.
+bool __fastcall BenchmarkLoadProgram(void);
+
+#endif //BENCHMARK_H__
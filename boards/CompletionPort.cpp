@@ -14,49 +14,237 @@
 #include "emulator.h"
 #include "CompletionPort.h"
 
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "completionport.tmh"
+#include "vsd_logging_inc.h"
+
 class EmulatorCompletionPort CompletionPort;
 
+struct WorkItem {
+    COMPLETIONPORT_CALLBACK *pCallback;
+    DWORD dwBytesTransferred;
+    LPOVERLAPPED lpOverlapped;
+    LARGE_INTEGER QueueTime;    // 0 for an I/O completion
+};
+
+// A growable ring of workitems.  Items are always added at the back.  The owning
+// worker removes them from the back, so it runs the most recently queued (and most
+// likely still cached) item next, and other workers steal from the front.
+struct WorkQueue {
+    CRITICAL_SECTION Lock;
+    WorkItem *Items;
+    unsigned __int32 Capacity;  // always a power of two
+    unsigned __int32 Head;      // index of the front item
+    volatile unsigned __int32 Count;
+
+    bool Initialize(void);
+    bool PushBack(const WorkItem *pItem);
+    bool PopBack(WorkItem *pItem);
+    bool PopFront(WorkItem *pItem);
+};
+
+#define WORK_QUEUE_INITIAL_CAPACITY 64
+
+bool WorkQueue::Initialize(void)
+{
+    InitializeCriticalSectionAndSpinCount(&Lock, 1000);
+    Items = (WorkItem *)malloc(WORK_QUEUE_INITIAL_CAPACITY*sizeof(WorkItem));
+    Capacity = WORK_QUEUE_INITIAL_CAPACITY;
+    Head = Count = 0;
+    return (Items != NULL);
+}
+
+bool WorkQueue::PushBack(const WorkItem *pItem)
+{
+    EnterCriticalSection(&Lock);
+    if (Count == Capacity) {
+        // Double the ring, unwrapping it so the front item is at index 0
+        WorkItem *NewItems = (WorkItem *)malloc(Capacity*2*sizeof(WorkItem));
+        if (NewItems == NULL) {
+            LeaveCriticalSection(&Lock);
+            return false;
+        }
+        for (unsigned __int32 i=0; i<Count; ++i) {
+            NewItems[i] = Items[(Head+i) & (Capacity-1)];
+        }
+        free(Items);
+        Items = NewItems;
+        Capacity *= 2;
+        Head = 0;
+    }
+    Items[(Head+Count) & (Capacity-1)] = *pItem;
+    Count++;
+    LeaveCriticalSection(&Lock);
+    return true;
+}
+
+bool WorkQueue::PopBack(WorkItem *pItem)
+{
+    bool Result = false;
+
+    if (Count == 0) {
+        return false;   // cheap check without the lock
+    }
+    EnterCriticalSection(&Lock);
+    if (Count) {
+        Count--;
+        *pItem = Items[(Head+Count) & (Capacity-1)];
+        Result = true;
+    }
+    LeaveCriticalSection(&Lock);
+    return Result;
+}
+
+bool WorkQueue::PopFront(WorkItem *pItem)
+{
+    bool Result = false;
+
+    if (Count == 0) {
+        return false;   // cheap check without the lock
+    }
+    EnterCriticalSection(&Lock);
+    if (Count) {
+        *pItem = Items[Head];
+        Head = (Head+1) & (Capacity-1);
+        Count--;
+        Result = true;
+    }
+    LeaveCriticalSection(&Lock);
+    return Result;
+}
+
+// Spare workers that may run at once, one for each worker blocked in BlockingWait()
+#define MAX_SPARE_WORKERS 16
+
+struct PoolWorker {
+    WorkQueue Queue;                    // Queue.Lock also protects the counters
+    EmulatorCompletionPort *pPool;
+    int Index;
+    bool fSpare;
+    volatile LONG InUse;                // spare only:  a thread owns this slot
+    unsigned __int64 WorkitemsRun;
+    unsigned __int64 CompletionsRun;    // the subset of WorkitemsRun that were I/O completions
+    unsigned __int64 WorkitemsStolen;
+    unsigned __int64 BusyTime;          // performance counter ticks spent in callbacks
+    unsigned __int64 LatencyTotal;      // performance counter ticks from queueing to running
+    unsigned __int64 LatencyCount;
+    unsigned __int64 MaximumLatency;    // since the last GetStatistics() call
+};
+
+// The worker running on the current thread, if any
+static __declspec(thread) PoolWorker *CurrentWorker;
+
 DWORD EmulatorCompletionPort::ThreadPoolWorkerStatic(LPVOID lpvThreadParam)
 {
-    return ((EmulatorCompletionPort*)lpvThreadParam)->ThreadPoolWorker();
+    PoolWorker *pWorker = (PoolWorker *)lpvThreadParam;
+
+    return pWorker->pPool->ThreadPoolWorker(pWorker);
+}
+
+bool EmulatorCompletionPort::FindWorkitem(PoolWorker *pWorker, WorkItem *pItem)
+{
+    if (pWorker->Queue.PopBack(pItem) || pSharedQueue->PopFront(pItem)) {
+        return true;
+    }
+
+    // Steal the oldest workitem from the next busy worker along
+    for (int i=1; i<SlotCount; ++i) {
+        PoolWorker *pVictim = &Workers[(pWorker->Index+i) % SlotCount];
+
+        if (pVictim->Queue.PopFront(pItem)) {
+            EnterCriticalSection(&pWorker->Queue.Lock);
+            pWorker->WorkitemsStolen++;
+            LeaveCriticalSection(&pWorker->Queue.Lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+void EmulatorCompletionPort::RunWorkitem(PoolWorker *pWorker, WorkItem *pItem)
+{
+    LARGE_INTEGER StartTime;
+    LARGE_INTEGER EndTime;
+
+    QueryPerformanceCounter(&StartTime);
+    pItem->pCallback->lpRoutine(pItem->pCallback->lpParameter, pItem->dwBytesTransferred, pItem->lpOverlapped);
+    QueryPerformanceCounter(&EndTime);
+
+    EnterCriticalSection(&pWorker->Queue.Lock);
+    pWorker->WorkitemsRun++;
+    pWorker->BusyTime += EndTime.QuadPart - StartTime.QuadPart;
+    if (pItem->QueueTime.QuadPart == 0) {
+        pWorker->CompletionsRun++;
+    } else {
+        unsigned __int64 Latency = StartTime.QuadPart - pItem->QueueTime.QuadPart;
+
+        pWorker->LatencyTotal += Latency;
+        pWorker->LatencyCount++;
+        if (Latency > pWorker->MaximumLatency) {
+            pWorker->MaximumLatency = Latency;
+        }
+    }
+    LeaveCriticalSection(&pWorker->Queue.Lock);
 }
 
-DWORD WINAPI EmulatorCompletionPort::ThreadPoolWorker()
+DWORD EmulatorCompletionPort::ThreadPoolWorker(PoolWorker *pWorker)
 {
-    InterlockedIncrement((LONG*)&ThreadCount);
+    CurrentWorker = pWorker;
+    TraceNameThread("Worker");
 
     while (1) {
         BOOL b;
         DWORD dwBytesTransferred;
         COMPLETIONPORT_CALLBACK *pCallback;
         LPOVERLAPPED lpOverlapped;
-        int BusyCount;
+        WorkItem Item;
+        DWORD Timeout;
+
+        if (pWorker->fSpare && RetireSpareWorker(pWorker)) {
+            return 0;
+        }
 
-        b = GetQueuedCompletionStatus(hCompletionPort, 
-            &dwBytesTransferred, 
-            (ULONG_PTR*)&pCallback, 
-            &lpOverlapped, 
-            INFINITE);
+        if (FindWorkitem(pWorker, &Item)) {
+            InterlockedDecrement(&QueueDepth);
+            RunWorkitem(pWorker, &Item);
+            // Pick up any I/O completion before the next workitem, so completions
+            // aren't starved while the queues stay busy.
+            Timeout = 0;
+        } else {
+            // Nothing queued.  Announce that this worker is going idle, then look
+            // once more in case a workitem was queued before Submit() could see it.
+            InterlockedIncrement(&IdleWorkerCount);
+            if (QueueDepth > 0) {
+                InterlockedDecrement(&IdleWorkerCount);
+                continue;
+            }
+            Timeout = INFINITE;
+        }
+
+        b = GetQueuedCompletionStatus(hCompletionPort,
+            &dwBytesTransferred,
+            (ULONG_PTR*)&pCallback,
+            &lpOverlapped,
+            Timeout);
+        if (Timeout == INFINITE) {
+            InterlockedDecrement(&IdleWorkerCount);
+        }
         if (b == FALSE) {
-            // We just dequeued a completion notification for a failed I/O.
+            // Either nothing was dequeued, or we just dequeued a completion notification for a failed I/O.
             // Note:  we choose not to call pCallback failed I/Os.  No code currently cares.
             continue;
         }
-
-        BusyCount = (int)InterlockedIncrement((LONG*)&BusyThreadCount);
-        if (BusyCount == ThreadCount && ThreadCount < MaximumThreadCount) {
-            // All threads are currently busy - power up another one
-            HANDLE hThread;
-
-            hThread = CreateThread(NULL, 0, ThreadPoolWorkerStatic, this, 0, NULL);
-            if (hThread != NULL) {
-                CloseHandle(hThread);
-            }
-            // Ignore failure here - just continue running with the current
-            // number of threadpool threads and try again later.
+        if (pCallback == NULL) {
+            // A wakeup posted by Submit()
+            continue;
         }
-        pCallback->lpRoutine(pCallback->lpParameter, dwBytesTransferred, lpOverlapped);
-        InterlockedDecrement((LONG*)&BusyThreadCount);
+
+        Item.pCallback = pCallback;
+        Item.dwBytesTransferred = dwBytesTransferred;
+        Item.lpOverlapped = lpOverlapped;
+        Item.QueueTime.QuadPart = 0;
+        RunWorkitem(pWorker, &Item);
     }
     return 0;
 }
@@ -91,7 +279,15 @@ bool EmulatorCompletionPort::Initialize(void)
         return true;
     }
 
-    BusyThreadCount = 0;
+    IdleWorkerCount = 0;
+    QueueDepth = 0;
+    MaximumQueueDepth = 0;
+    BlockedWorkerCount = 0;
+    SpareWorkerCount = 0;
+    InitializeCriticalSection(&StatisticsLock);
+    SampleBusyTime = SampleLatencyTotal = SampleLatencyCount = 0;
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&SampleTime);
 
     hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
 
@@ -99,25 +295,130 @@ bool EmulatorCompletionPort::Initialize(void)
         return false;
     }
 
-    int CpuCount = GetCurrentProcessCpuCount();
-
+    // All workers are started up front:  growing the pool on demand made latency
+    // spiky exactly when folder sharing and networking were busy at the same time.
     int MinimumThreadCount = 2;
-    MaximumThreadCount = max(MinimumThreadCount, CpuCount);
-    // Consider adding code here to allow the user to override MinimumThreadCount
-    // and MaximumThreadCount via registry keys.
+    int ThreadCount = max(MinimumThreadCount, GetCurrentProcessCpuCount());
+    // Consider adding code here to allow the user to override ThreadCount
+    // via registry keys.
+
+    pSharedQueue = new WorkQueue;
+    Workers = new PoolWorker[ThreadCount+MAX_SPARE_WORKERS];
+    if (pSharedQueue == NULL || Workers == NULL || !pSharedQueue->Initialize()) {
+        goto Error;
+    }
+    for (int i=0; i<ThreadCount+MAX_SPARE_WORKERS; ++i) {
+        memset(&Workers[i], 0, sizeof(Workers[i]));
+        Workers[i].pPool = this;
+        Workers[i].Index = i;
+        Workers[i].fSpare = (i >= ThreadCount);
+        if (!Workers[i].Queue.Initialize()) {
+            goto Error;
+        }
+    }
 
-    for (int i=0; i<MinimumThreadCount; ++i) {
+    // Slots of workers that fail to start below stay empty, so stealing from them
+    // finds nothing.
+    SlotCount = ThreadCount+MAX_SPARE_WORKERS;
+    WorkerCount = ThreadCount;
+    for (int i=0; i<ThreadCount; ++i) {
         HANDLE hThread;
 
-        hThread = CreateThread(NULL, 0, ThreadPoolWorkerStatic, this, 0, NULL);
+        hThread = CreateThread(NULL, 0, ThreadPoolWorkerStatic, &Workers[i], 0, NULL);
         if (hThread == NULL) {
-            CloseHandle(hCompletionPort);
-            hCompletionPort = NULL;
-            return false;
+            if (i < MinimumThreadCount) {
+                // Workers that did start keep waiting on the port, so leave it open
+                return false;
+            }
+            // Run with the workers already started.  The others' queues stay
+            // empty, so nothing is ever queued to them.
+            WorkerCount = i;
+            break;
         }
         CloseHandle(hThread);
     }
     return true;
+
+Error:
+    CloseHandle(hCompletionPort);
+    hCompletionPort = NULL;
+    return false;
+}
+
+// Starts a worker in a free spare slot.  The caller has already counted it in
+// SpareWorkerCount.
+bool EmulatorCompletionPort::StartSpareWorker(void)
+{
+    for (;;) {
+        for (int i=SlotCount-MAX_SPARE_WORKERS; i<SlotCount; ++i) {
+            PoolWorker *pWorker = &Workers[i];
+
+            if (InterlockedCompareExchange(&pWorker->InUse, 1, 0) == 0) {
+                HANDLE hThread = CreateThread(NULL, 0, ThreadPoolWorkerStatic, pWorker, 0, NULL);
+
+                if (hThread == NULL) {
+                    InterlockedExchange(&pWorker->InUse, 0);
+                    return false;
+                }
+                CloseHandle(hThread);
+                return true;
+            }
+        }
+        // Every slot is taken, so a retiring spare has been uncounted but has yet
+        // to release its slot.
+        Sleep(0);
+    }
+}
+
+// Returns true if the spare worker should exit because there are more spares than
+// blocked workers.  Its own queue must be empty first, as only it runs items from
+// the back of it.
+bool EmulatorCompletionPort::RetireSpareWorker(PoolWorker *pWorker)
+{
+    LONG Spares = SpareWorkerCount;
+
+    if (pWorker->Queue.Count != 0 || Spares <= BlockedWorkerCount ||
+        InterlockedCompareExchange(&SpareWorkerCount, Spares-1, Spares) != Spares) {
+        return false;
+    }
+    InterlockedExchange(&pWorker->InUse, 0);
+    return true;
+}
+
+void EmulatorCompletionPort::BlockingWait(HANDLE hObject)
+{
+    LONG Blocked;
+
+    if (CurrentWorker == NULL || CurrentWorker->pPool != this) {
+        WaitForSingleObject(hObject, INFINITE);
+        return;
+    }
+    if (WaitForSingleObject(hObject, 0) != WAIT_TIMEOUT) {
+        return;
+    }
+
+    Blocked = InterlockedIncrement(&BlockedWorkerCount);
+    while (1) {
+        LONG Spares = SpareWorkerCount;
+
+        if (Spares >= Blocked || Spares >= MAX_SPARE_WORKERS) {
+            break;
+        }
+        if (InterlockedCompareExchange(&SpareWorkerCount, Spares+1, Spares) == Spares) {
+            if (!StartSpareWorker()) {
+                InterlockedDecrement(&SpareWorkerCount);
+                LOG_WARN(GENERAL, "Unable to start a spare worker");
+            }
+            break;
+        }
+    }
+
+    WaitForSingleObject(hObject, INFINITE);
+
+    if (InterlockedDecrement(&BlockedWorkerCount) < SpareWorkerCount) {
+        // Wake a worker, which may be an idle spare that can now retire
+        PostQueuedCompletionStatus(hCompletionPort, 0, 0, NULL);
+    }
 }
 
 bool EmulatorCompletionPort::AssociateHandleWithCompletionPort(HANDLE hFile, COMPLETIONPORT_CALLBACK *pCallback)
@@ -138,12 +439,205 @@ bool EmulatorCompletionPort::AssociateHandleWithCompletionPort(HANDLE hFile, COM
     }
 }
 
-bool EmulatorCompletionPort::QueueWorkitem(COMPLETIONPORT_CALLBACK *pCallback)
+bool EmulatorCompletionPort::Submit(COMPLETIONPORT_CALLBACK *pCallback, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
 {
-    BOOL b = PostQueuedCompletionStatus(hCompletionPort, 0, (ULONG_PTR)pCallback, NULL);
+    WorkItem Item;
+    WorkQueue *pQueue;
+    LONG Depth;
+    LONG MaximumDepth;
 
-    if (b == FALSE) {
+    Item.pCallback = pCallback;
+    Item.dwBytesTransferred = dwBytesTransferred;
+    Item.lpOverlapped = lpOverlapped;
+    QueryPerformanceCounter(&Item.QueueTime);
+
+    // A worker queues to its own deque, everyone else to the shared queue
+    if (CurrentWorker != NULL && CurrentWorker->pPool == this) {
+        pQueue = &CurrentWorker->Queue;
+    } else {
+        pQueue = pSharedQueue;
+    }
+    if (!pQueue->PushBack(&Item)) {
         return false;
     }
+
+    Depth = InterlockedIncrement(&QueueDepth);
+    while (Depth > (MaximumDepth = MaximumQueueDepth)) {
+        if (InterlockedCompareExchange(&MaximumQueueDepth, Depth, MaximumDepth) == MaximumDepth) {
+            break;
+        }
+    }
+
+    // QueueDepth was updated with a full barrier, so any worker that went idle
+    // without seeing this workitem is already counted in IdleWorkerCount.
+    if (IdleWorkerCount > 0) {
+        PostQueuedCompletionStatus(hCompletionPort, 0, 0, NULL);
+    }
     return true;
 }
+
+bool EmulatorCompletionPort::QueueWorkitem(COMPLETIONPORT_CALLBACK *pCallback)
+{
+    return Submit(pCallback, 0, NULL);
+}
+
+bool EmulatorCompletionPort::PostCompletion(COMPLETIONPORT_CALLBACK *pCallback, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
+{
+    return Submit(pCallback, dwBytesTransferred, lpOverlapped);
+}
+
+struct ParallelForBatch {
+    COMPLETIONPORT_CALLBACK Callback;
+    PARALLELFOR_ROUTINE Routine;
+    LPVOID lpParameter;
+    unsigned __int32 Count;
+    volatile LONG NextIndex;
+    volatile LONG Running;      // threads currently claiming and running indices
+    volatile LONG RefCount;     // the caller plus each queued helper
+    HANDLE hIdle;               // set whenever Running drops to zero
+};
+
+static void RunParallelFor(ParallelForBatch *pBatch)
+{
+    // Running is raised before any index is claimed, so once the caller has seen
+    // every index claimed it only has to wait for Running to drop to zero.
+    InterlockedIncrement(&pBatch->Running);
+    while (1) {
+        unsigned __int32 Index = (unsigned __int32)InterlockedIncrement(&pBatch->NextIndex)-1;
+
+        if (Index >= pBatch->Count) {
+            break;
+        }
+        pBatch->Routine(pBatch->lpParameter, Index);
+    }
+    if (InterlockedDecrement(&pBatch->Running) == 0) {
+        SetEvent(pBatch->hIdle);
+    }
+}
+
+static void ReleaseParallelFor(ParallelForBatch *pBatch)
+{
+    if (InterlockedDecrement(&pBatch->RefCount) == 0) {
+        CloseHandle(pBatch->hIdle);
+        delete pBatch;
+    }
+}
+
+void EmulatorCompletionPort::ParallelForHelperStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
+{
+    ParallelForBatch *pBatch = (ParallelForBatch *)lpParameter;
+
+    // A helper that starts after the caller has finished finds no index left, and
+    // just drops its reference.
+    RunParallelFor(pBatch);
+    ReleaseParallelFor(pBatch);
+}
+
+void EmulatorCompletionPort::ParallelFor(unsigned __int32 Count, PARALLELFOR_ROUTINE Routine, LPVOID lpParameter)
+{
+    ParallelForBatch *pBatch;
+    unsigned __int32 HelperCount;
+
+    pBatch = (Count > 1 && hCompletionPort) ? new ParallelForBatch : NULL;
+    if (pBatch) {
+        pBatch->hIdle = CreateEvent(NULL, FALSE, FALSE, NULL); // Auto-reset, initially unsignalled
+        if (pBatch->hIdle == NULL) {
+            delete pBatch;
+            pBatch = NULL;
+        }
+    }
+    if (pBatch == NULL) {
+        // Not worth queueing, or out of resources:  run everything here
+        for (unsigned __int32 i=0; i<Count; ++i) {
+            Routine(lpParameter, i);
+        }
+        return;
+    }
+
+    pBatch->Callback.lpRoutine = ParallelForHelperStatic;
+    pBatch->Callback.lpParameter = pBatch;
+    pBatch->Routine = Routine;
+    pBatch->lpParameter = lpParameter;
+    pBatch->Count = Count;
+    pBatch->NextIndex = 0;
+    pBatch->Running = 0;
+    HelperCount = min(Count-1, (unsigned __int32)WorkerCount);
+    pBatch->RefCount = 1+HelperCount;
+
+    for (unsigned __int32 i=0; i<HelperCount; ++i) {
+        if (!QueueWorkitem(&pBatch->Callback)) {
+            ReleaseParallelFor(pBatch);
+        }
+    }
+
+    RunParallelFor(pBatch);
+    while (pBatch->Running != 0) {
+        WaitForSingleObject(pBatch->hIdle, INFINITE);
+    }
+    ReleaseParallelFor(pBatch);
+}
+
+void EmulatorCompletionPort::GetStatistics(WorkerPoolStatistics *pStatistics)
+{
+    LARGE_INTEGER Now;
+    unsigned __int64 WorkitemsRun = 0;
+    unsigned __int64 CompletionsRun = 0;
+    unsigned __int64 WorkitemsStolen = 0;
+    unsigned __int64 BusyTime = 0;
+    unsigned __int64 LatencyTotal = 0;
+    unsigned __int64 LatencyCount = 0;
+    unsigned __int64 MaximumLatency = 0;
+    unsigned __int64 Elapsed;
+    LONG Depth;
+
+    memset(pStatistics, 0, sizeof(*pStatistics));
+    if (hCompletionPort == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&StatisticsLock);
+    QueryPerformanceCounter(&Now);
+    for (int i=0; i<SlotCount; ++i) {
+        PoolWorker *pWorker = &Workers[i];
+
+        EnterCriticalSection(&pWorker->Queue.Lock);
+        WorkitemsRun += pWorker->WorkitemsRun;
+        CompletionsRun += pWorker->CompletionsRun;
+        WorkitemsStolen += pWorker->WorkitemsStolen;
+        BusyTime += pWorker->BusyTime;
+        LatencyTotal += pWorker->LatencyTotal;
+        LatencyCount += pWorker->LatencyCount;
+        MaximumLatency = max(MaximumLatency, pWorker->MaximumLatency);
+        pWorker->MaximumLatency = 0;
+        LeaveCriticalSection(&pWorker->Queue.Lock);
+    }
+
+    // The depth can briefly read as negative while a workitem is between its
+    // queue and the counter.
+    Depth = max(QueueDepth, 0);
+    Elapsed = Now.QuadPart - SampleTime.QuadPart;
+
+    pStatistics->WorkitemsRun = WorkitemsRun;
+    pStatistics->WorkitemsQueued = WorkitemsRun - CompletionsRun + Depth;
+    pStatistics->WorkitemsStolen = WorkitemsStolen;
+    pStatistics->WorkerCount = WorkerCount + SpareWorkerCount;
+    pStatistics->QueueDepth = Depth;
+    pStatistics->MaximumQueueDepth = MaximumQueueDepth;
+    if (LatencyCount > SampleLatencyCount) {
+        pStatistics->AverageLatency = (unsigned __int32)((LatencyTotal-SampleLatencyTotal)*1000000/(LatencyCount-SampleLatencyCount)/Frequency.QuadPart);
+    }
+    pStatistics->MaximumLatency = (unsigned __int32)(MaximumLatency*1000000/Frequency.QuadPart);
+    if (Elapsed) {
+        pStatistics->Utilization = (unsigned __int32)((BusyTime-SampleBusyTime)*100/(Elapsed*WorkerCount));
+    }
+
+    SampleBusyTime = BusyTime;
+    SampleLatencyTotal = LatencyTotal;
+    SampleLatencyCount = LatencyCount;
+    SampleTime = Now;
+    LeaveCriticalSection(&StatisticsLock);
+
+    LOG_VERBOSE(GENERAL, "Worker pool: depth %d (max %d), latency %dus (max %dus), utilization %d%%",
+                pStatistics->QueueDepth, pStatistics->MaximumQueueDepth,
+                pStatistics->AverageLatency, pStatistics->MaximumLatency, pStatistics->Utilization);
+}
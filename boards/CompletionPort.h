@@ -15,11 +15,36 @@
 #define COMPLETIONPORT_H__
 
 typedef void (__fastcall *COMPLETIONPORT_ROUTINE)(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
-typedef struct { 
+typedef struct {
     COMPLETIONPORT_ROUTINE lpRoutine;
     LPVOID lpParameter;
 } COMPLETIONPORT_CALLBACK;
 
+typedef void (__fastcall *PARALLELFOR_ROUTINE)(LPVOID lpParameter, unsigned __int32 Index);
+
+struct WorkerPoolStatistics {
+    unsigned __int64 WorkitemsQueued;
+    unsigned __int64 WorkitemsRun;      // including I/O completions
+    unsigned __int64 WorkitemsStolen;   // run by a worker other than the one they were queued to
+    unsigned __int32 WorkerCount;
+    unsigned __int32 QueueDepth;        // queued but not yet running
+    unsigned __int32 MaximumQueueDepth;
+    // Over the interval since the previous GetStatistics() call
+    unsigned __int32 AverageLatency;    // microseconds from queueing to running
+    unsigned __int32 MaximumLatency;    // microseconds
+    unsigned __int32 Utilization;       // percent of worker time spent in callbacks
+};
+
+struct WorkItem;
+struct WorkQueue;
+struct PoolWorker;
+
+// The emulator's worker pool.  Each worker owns a deque of workitems:  workitems
+// queued from a worker go to the back of its own deque and are run from the back,
+// workitems queued from any other thread go to a shared queue, and a worker with
+// nothing to do steals from the front of the other workers' deques.  Idle workers
+// wait in the I/O completion port, so completions for handles associated with it
+// are run by whichever worker is idle, and queueing a workitem wakes one of them.
 class EmulatorCompletionPort {
 public:
     EmulatorCompletionPort() { hCompletionPort = NULL; }
@@ -28,18 +53,53 @@ public:
     bool Initialize(void);
     bool AssociateHandleWithCompletionPort(HANDLE hFile, COMPLETIONPORT_CALLBACK *pCallback);
     bool QueueWorkitem(COMPLETIONPORT_CALLBACK *pCallback);
+    // Completes an operation that was not issued against an associated handle
+    bool PostCompletion(COMPLETIONPORT_CALLBACK *pCallback, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
+
+    // Calls Routine(lpParameter, Index) for each Index in [0, Count), spread across
+    // the calling thread and any idle workers, and returns once all calls are done.
+    // The calling thread runs whatever the workers don't pick up, so this completes
+    // even if every worker is blocked.
+    void ParallelFor(unsigned __int32 Count, PARALLELFOR_ROUTINE Routine, LPVOID lpParameter);
+
+    // Waits for hObject.  A callback that waits for other workitems must use this:
+    // while a worker is blocked here a spare worker runs in its place, so the pool
+    // never runs out of workers to finish what the blocked ones wait for.
+    void BlockingWait(HANDLE hObject);
+
+    void GetStatistics(WorkerPoolStatistics *pStatistics);
 
 private:
     HANDLE hCompletionPort;
-    int ThreadCount;
-    int MaximumThreadCount;
-    int BusyThreadCount;
+    int WorkerCount;
+    int SlotCount;                      // WorkerCount, plus the spare workers' slots
+    PoolWorker *Workers;
+    WorkQueue *pSharedQueue;            // workitems queued from outside the pool
+    volatile LONG IdleWorkerCount;      // workers waiting in the completion port
+    volatile LONG QueueDepth;
+    volatile LONG MaximumQueueDepth;
+    volatile LONG BlockedWorkerCount;   // workers waiting in BlockingWait()
+    volatile LONG SpareWorkerCount;     // spare workers running or starting
+
+    // GetStatistics() sampling state
+    CRITICAL_SECTION StatisticsLock;
+    unsigned __int64 SampleBusyTime;
+    unsigned __int64 SampleLatencyTotal;
+    unsigned __int64 SampleLatencyCount;
+    LARGE_INTEGER SampleTime;
+    LARGE_INTEGER Frequency;
+
+    bool Submit(COMPLETIONPORT_CALLBACK *pCallback, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
+    bool FindWorkitem(PoolWorker *pWorker, WorkItem *pItem);
+    void RunWorkitem(PoolWorker *pWorker, WorkItem *pItem);
+    bool StartSpareWorker(void);
+    bool RetireSpareWorker(PoolWorker *pWorker);
 
     static DWORD WINAPI ThreadPoolWorkerStatic(LPVOID lpvThreadParam);
-    DWORD WINAPI ThreadPoolWorker();
+    DWORD ThreadPoolWorker(PoolWorker *pWorker);
+    static void __fastcall ParallelForHelperStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
 };
 
 extern class EmulatorCompletionPort CompletionPort;
 
 #endif // COMPLETIONPORT_H__
-
@@ -81,6 +81,9 @@ MIDL_DEFINE_GUID(IID, IID_IDeviceEmulatorDebuggerHaltNotificationSink,0x4de85c9d
 MIDL_DEFINE_GUID(IID, IID_IDeviceEmulatorDebugger,0x1b48cad4,0xd013,0x4b98,0xb5,0x05,0x76,0x16,0x2f,0x09,0xe8,0xe9);
 
 
+MIDL_DEFINE_GUID(IID, IID_IDeviceEmulatorDebugger2,0xf3198f19,0x0932,0x499a,0x86,0x1d,0x94,0x26,0x07,0x82,0x96,0xa8);
+
+
 MIDL_DEFINE_GUID(IID, IID_IDeviceEmulatorItem,0x9c06bd4c,0x12b3,0x4991,0xa5,0x12,0x8c,0x48,0x84,0xec,0x8b,0xb5);
 
 
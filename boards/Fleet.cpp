@@ -0,0 +1,178 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "MappedIO.h"
+#include "Board.h"
+#include "resource.h"
+#include "Devices.h"
+#include "Fleet.h"
+#include <shlwapi.h>
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "fleet.tmh"
+#include "vsd_logging_inc.h"
+
+static unsigned __int32 FleetChildIndex;    // 1-based, or 0 if this emulator isn't a fleet child
+static GUID FleetChildVMID;
+static HANDLE FleetSharedSections[FleetSectionCount];
+
+bool FleetParseChildArguments(__in_z const wchar_t *Index, __in_z wchar_t *VMID, __in_z const wchar_t *Sections)
+{
+    wchar_t *EndCharacter;
+
+    FleetChildIndex = wcstoul(Index, &EndCharacter, 10);
+    if (*EndCharacter != '\0' || FleetChildIndex == 0) {
+        return false;
+    }
+    if (FAILED(IIDFromString(VMID, &FleetChildVMID))) {
+        return false;
+    }
+    for (int i=0; i<FleetSectionCount; ++i) {
+        FleetSharedSections[i] = (HANDLE)(size_t)_wcstoui64(Sections, &EndCharacter, 16);
+        if (*EndCharacter != ((i == FleetSectionCount-1) ? '\0' : ',')) {
+            return false;
+        }
+        Sections = EndCharacter+1;
+    }
+    return true;
+}
+
+bool FleetIsChild(void)
+{
+    return FleetChildIndex != 0;
+}
+
+HANDLE FleetGetSharedSection(FleetSection Section)
+{
+    ASSERT(FleetIsChild());
+    return FleetSharedSections[Section];
+}
+
+// Formats "name.<index>.ext" from FileName for this child
+static bool FleetChildFileName(__in_z const wchar_t *FileName, __out_ecount(Length) wchar_t *ChildFileName, size_t Length)
+{
+    const wchar_t *Extension = PathFindExtensionW(FileName);
+
+    return SUCCEEDED(StringCchPrintfW(ChildFileName, Length, L"%.*s.%u%s",
+                                      (int)(Extension-FileName), FileName, FleetChildIndex, Extension));
+}
+
+bool FleetChildAssumeIdentity(void)
+{
+    // The saved state carries the launcher's VMID
+    Configuration.VMID = FleetChildVMID;
+
+    // Guest MAC addresses are cached per VMID (see SetCachedMACAddress()).  Drop the
+    // restored ones so that VPCNetDriver::PowerOn() looks up or generates an address
+    // for this child instead of registering a duplicate of the launcher's.
+    memset(Configuration.NE2000MACAddress, 0, sizeof(Configuration.NE2000MACAddress));
+    memset(CS8900IO.MacAddress, 0, sizeof(CS8900IO.MacAddress));
+
+    // Save to "name.<index>.ext" so that the children don't overwrite each other
+    // or the state they were launched from.  The same goes for the flash image,
+    // and with it the flash journal, whose name is derived from the image's.
+    // "temp.bin" is the name IOLCDController::onID_FLASH_SAVE() uses when none
+    // was given.
+    wchar_t ChildStateFileName[MAX_PATH];
+    wchar_t ChildFlashFileName[MAX_PATH];
+    const wchar_t *FlashFileName = (Configuration.isFlashStateFileSpecified()) ? Configuration.getFlashStateFile() : L"temp.bin";
+
+    if (!FleetChildFileName(Configuration.getSaveStateFileName(), ChildStateFileName, ARRAY_SIZE(ChildStateFileName)) ||
+        !FleetChildFileName(FlashFileName, ChildFlashFileName, ARRAY_SIZE(ChildFlashFileName))) {
+        return false;
+    }
+    if (!Configuration.setSaveStateFileName(ChildStateFileName) ||
+        !Configuration.setFlashStateFile(ChildFlashFileName)) {
+        return false;
+    }
+    LOG_INFO(GENERAL, "Fleet child %u saves to %S and its flash to %S", FleetChildIndex, ChildStateFileName, ChildFlashFileName);
+    return true;
+}
+
+bool FleetLaunch(__in_z const wchar_t *CommandLine)
+{
+    HANDLE Sections[FleetSectionCount];
+    wchar_t ModuleName[MAX_PATH];
+    wchar_t *ChildCommandLine = NULL;
+    HANDLE *phChildren = NULL;
+    unsigned __int32 Launched = 0;
+    bool result = false;
+
+    ASSERT(!FleetIsChild() && Configuration.FleetSize != 0);
+
+    DWORD dw = GetModuleFileNameW(NULL, ModuleName, ARRAY_SIZE(ModuleName));
+    if (dw == 0 || dw == ARRAY_SIZE(ModuleName)) {
+        return false;
+    }
+
+    // Room for the quoted EXE name, the launcher's own arguments, and
+    // " /fleetchild 4294967295 {GUID} h,h,h"
+    size_t cchChildCommandLine = wcslen(ModuleName) + wcslen(CommandLine) + 128;
+    ChildCommandLine = new wchar_t[cchChildCommandLine];
+    phChildren = new HANDLE[Configuration.FleetSize];
+    if (ChildCommandLine == NULL || phChildren == NULL) {
+        goto Exit;
+    }
+
+    if (!BoardShareGuestMemory(Sections)) {
+        goto Exit;
+    }
+
+    for (Launched=0; Launched < Configuration.FleetSize; ++Launched) {
+        GUID VMID;
+        wchar_t VMIDString[40]; // large enough for a GUID - "{c200e360-38c5-11ce-ae62-08002b2b79ef}"
+        STARTUPINFOW StartupInfo;
+        PROCESS_INFORMATION ProcessInformation;
+
+        if (FAILED(CoCreateGuid(&VMID)) ||
+            StringFromGUID2(VMID, VMIDString, ARRAY_SIZE(VMIDString)) == 0) {
+            break;
+        }
+        // The child sees the launcher's "/fleet count" too, and ignores it
+        if (FAILED(StringCchPrintfW(ChildCommandLine, cchChildCommandLine, L"\"%s\" %s /fleetchild %u %s %Ix,%Ix,%Ix",
+                                    ModuleName, CommandLine, Launched+1, VMIDString,
+                                    (size_t)Sections[FleetSectionFlash],
+                                    (size_t)Sections[FleetSectionRAM],
+                                    (size_t)Sections[FleetSectionRAMExtension]))) {
+            break;
+        }
+
+        memset(&StartupInfo, 0, sizeof(StartupInfo));
+        StartupInfo.cb = sizeof(StartupInfo);
+        // bInheritHandles=TRUE hands the section handles to the child
+        if (!CreateProcessW(ModuleName, ChildCommandLine, NULL, NULL, TRUE, 0, NULL, NULL,
+                            &StartupInfo, &ProcessInformation)) {
+            LOG_ERROR(GENERAL, "Failed to launch fleet child %u - %d", Launched+1, GetLastError());
+            break;
+        }
+        CloseHandle(ProcessInformation.hThread);
+        phChildren[Launched] = ProcessInformation.hProcess;
+        LOG_INFO(GENERAL, "Launched fleet child %u as process %u", Launched+1, ProcessInformation.dwProcessId);
+    }
+    result = (Launched == Configuration.FleetSize);
+
+    // Each child holds its own references on the sections, but the launcher stays
+    // until they are all done so that callers can wait on a single process.
+    for (unsigned __int32 i=0; i<Launched; ++i) {
+        WaitForSingleObject(phChildren[i], INFINITE);
+        CloseHandle(phChildren[i]);
+    }
+
+Exit:
+    delete [] phChildren;
+    delete [] ChildCommandLine;
+    return result;
+}
@@ -0,0 +1,39 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef FLEET_H__
+#define FLEET_H__
+
+// Fleet launcher.  "/s statefile /fleet count" restores the saved state once,
+// then starts count child emulators from it.  Each child maps the launcher's
+// guest RAM and flash copy-on-write instead of restoring them again, and runs
+// with its own VMID, guest MAC addresses and saved-state file.
+
+enum FleetSection {
+    FleetSectionFlash,
+    FleetSectionRAM,
+    FleetSectionRAMExtension,
+    FleetSectionCount
+};
+
+// Launcher side:  starts the children and waits for them to exit
+bool FleetLaunch(__in_z const wchar_t *CommandLine);
+
+// Child side:  "/fleetchild index {vmid} hFlash,hRAM,hExtension" is appended to
+// the launcher's command line by FleetLaunch().
+bool FleetParseChildArguments(__in_z const wchar_t *Index, __in_z wchar_t *VMID, __in_z const wchar_t *Sections);
+bool FleetIsChild(void);
+HANDLE FleetGetSharedSection(FleetSection Section);
+bool FleetChildAssumeIdentity(void); // called once the saved state has been restored
+
+#endif // FLEET_H__
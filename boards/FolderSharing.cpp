@@ -24,6 +24,11 @@
     recognizes the poll and blocks until an interrupt really is
     pending, or until the I/O completes.
 
+    Reads and writes may also be queued:  the driver sets kServerQueued
+    in the function code, and then up to kFolderSharingMaxRequests of
+    them run at once, each with its own ServerPB.  As each one finishes
+    its ServerPB address can be read back from the CompletedPB register.
+
 --*/
 
 #include "emulator.h"
@@ -66,7 +71,10 @@
 #define kServerGetFCBInfo   0x13        //
 #define kServerUseNotify    0x14        // not used
 #define kServerGetMaxIOSize 0x15        // 
-#define kMaxServerFunction  0x15        // Max Valid function number
+#define kServerNegotiateIOSize 0x16     // fSize = largest I/O the driver can issue
+#define kMaxServerFunction  0x16        // Max Valid function number
+
+#define kServerQueued       0x100       // OR'd into kServerRead/kServerWrite to queue the request
 
 //    Error Codes - these values come from Connectix vs\source\vm\common\devices\vpcredir.h
 
@@ -96,6 +104,9 @@ unsigned __int16 kErrorFromLastError(void);
 // From vs\source\vm\common\hgint\vpcfoldersharingdevice.h:
 #define kFolderSharingMaxReadWriteSize        (1024*64)        // 64K, largest single read or write
 
+// The largest single read or write that kServerNegotiateIOSize will agree to
+#define kFolderSharingMaxNegotiatedSize       (1024*1024)
+
 // From vcefsd\file.c
 #define    kOpenAccessReadOnly            0x0000
 #define    kOpenAccessWriteOnly        0x0001
@@ -114,6 +125,18 @@ unsigned __int16 kErrorFromLastError(void);
     The class tracks only 40 files as vcefsd\file.c gFDList[] array is used to
     track open files, and it is limited to 40 open WinCE HANDLEs concurrently.
 
+    It also buffers sequential I/O, as the guest reads and writes in small
+    pieces and waits for each one:
+    -   Once a read-only handle has been read sequentially a few times, the
+        next kReadAheadSize bytes are read on a CompletionPort worker while
+        the guest consumes the previous ones.
+    -   Writes that continue the previous write are gathered into a buffer of
+        kWriteBehindSize bytes and reported as complete immediately.  The
+        buffer is written out when it fills, when the guest writes elsewhere
+        or reads, on close and SetEOF, before any other folder sharing
+        request, and kWriteBehindTimeout ms after the last write.  If that
+        write fails, the next request on the handle returns the error.
+
 */
 class SharedFileHandleManager {
 public:
@@ -125,14 +148,59 @@ public:
     bool GetSharedFileHandleAttributes(unsigned __int16 fHandle, unsigned __int16 *pOpenMode, __deref_out_z wchar_t **pFileName);
     unsigned __int16 CloseSharedFileHandle(unsigned __int16 fHandle);
 
+    unsigned __int16 Read(unsigned __int16 fHandle, unsigned __int32 Offset, __out_bcount(Size) void *Buffer, unsigned __int32 Size, DWORD *pBytesRead);
+    unsigned __int16 Write(unsigned __int16 fHandle, unsigned __int32 Offset, __in_bcount(Size) const void *Buffer, unsigned __int32 Size, DWORD *pBytesWritten);
+    unsigned __int16 Flush(unsigned __int16 fHandle);
+    void FlushAll(void);
+    void DiscardReadAhead(unsigned __int16 fHandle);
+    unsigned __int64 GetPosition(unsigned __int16 fHandle);
+    void SetPosition(unsigned __int16 fHandle, unsigned __int64 Position);
+
 private:
 #define kMaxFD 40   // maximum number of open files (from vcefsd\file.c)
 #define InvalidSharedFileHandle 0xffff
-    struct {
+#define kReadAheadSize          (256*1024)
+#define kWriteBehindSize        (256*1024)
+#define kWriteBehindTimeout     1000    // ms
+#define kSequentialThreshold    2       // sequential reads before reading ahead
+
+    struct SharedFile {
         HANDLE hFile;
         unsigned __int16 OpenMode;
         wchar_t *FileName;
+
+        // Everything below is guarded by Lock
+        CRITICAL_SECTION Lock;
+        unsigned __int64 Position;          // the file pointer, as ServerGetFCBInfo() reports it
+        unsigned __int32 NextSequential;    // the offset that would continue the last read or write
+        unsigned __int32 SequentialCount;
+
+        unsigned __int8 *ReadBuffer;        // data read ahead, or NULL
+        unsigned __int32 ReadBufferOffset;
+        unsigned __int32 ReadBufferLength;  // less than kReadAheadSize if it reached the end of the file
+        bool fReadAheadPending;
+        unsigned __int32 ReadAheadOffset;
+        unsigned __int32 ReadAheadGeneration;   // bumped to discard a pending read-ahead
+        HANDLE hReadAheadDone;              // manual-reset, signalled while no read-ahead is pending
+        COMPLETIONPORT_CALLBACK ReadAheadCallback;
+
+        unsigned __int8 *WriteBuffer;       // allocated on first use
+        unsigned __int32 WriteBufferOffset;
+        unsigned __int32 WriteBufferLength; // 0 if nothing is waiting to be written
+        unsigned __int16 DeferredError;     // from a write-behind that failed
     } SharedFileHandles[kMaxFD];
+
+    HANDLE hFlushTimer;
+
+    static bool IsReadOnly(unsigned __int16 OpenMode) { return (OpenMode & 0xf) == kOpenAccessReadOnly; }
+    void CloseLocked(SharedFile *pFile);
+    void WaitForReadAheadLocked(SharedFile *pFile);
+    void StartReadAheadLocked(SharedFile *pFile, unsigned __int32 Offset);
+    unsigned __int16 FlushLocked(SharedFile *pFile);
+    void FlushOtherHandles(unsigned __int16 fHandle);
+    void DiscardOtherReadAheads(unsigned __int16 fHandle);
+    static void __fastcall ReadAheadStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
+    static DWORD WINAPI FlushThreadStatic(LPVOID lpvThreadParam);
 };
 
 class SharedFileHandleManager SharedFileHandleManager;
@@ -140,20 +208,44 @@ class SharedFileHandleManager SharedFileHandleManager;
 void SharedFileHandleManager::PowerOn(void)
 {
     for (int i=0; i<kMaxFD; ++i) {
-        SharedFileHandles[i].hFile = INVALID_HANDLE_VALUE;
+        SharedFile *pFile = &SharedFileHandles[i];
+
+        pFile->hFile = INVALID_HANDLE_VALUE;
+        InitializeCriticalSection(&pFile->Lock);
+        pFile->ReadBuffer = NULL;
+        pFile->fReadAheadPending = false;
+        pFile->ReadAheadGeneration = 0;
+        pFile->hReadAheadDone = CreateEvent(NULL, TRUE, TRUE, NULL); // Manual-reset, initially signalled
+        pFile->ReadAheadCallback.lpRoutine = ReadAheadStatic;
+        pFile->ReadAheadCallback.lpParameter = pFile;
+        pFile->WriteBuffer = NULL;
+        pFile->WriteBufferLength = 0;
+        pFile->DeferredError = kErrorNoError;
+    }
+
+    // Without the timer or its thread, write-behind data waits for the next
+    // request on the handle instead.
+    hFlushTimer = CreateWaitableTimer(NULL, FALSE, NULL); // create anonymous sync timer
+    if (hFlushTimer) {
+        HANDLE hThread = CreateThread(NULL, 0, FlushThreadStatic, this, 0, NULL);
+        if (hThread) {
+            CloseHandle(hThread);
+        } else {
+            CloseHandle(hFlushTimer);
+            hFlushTimer = NULL;
+        }
     }
 }
 
 void SharedFileHandleManager::Reset(void)
 {
     for (int i=0; i<kMaxFD; ++i) {
+        EnterCriticalSection(&SharedFileHandles[i].Lock);
         if (SharedFileHandles[i].hFile != INVALID_HANDLE_VALUE) {
-            CloseHandle(SharedFileHandles[i].hFile);
-            SharedFileHandles[i].hFile = INVALID_HANDLE_VALUE;
-
-            free(SharedFileHandles[i].FileName);
-            SharedFileHandles[i].FileName = NULL;
+            FlushLocked(&SharedFileHandles[i]);
+            CloseLocked(&SharedFileHandles[i]);
         }
+        LeaveCriticalSection(&SharedFileHandles[i].Lock);
     }
 }
 
@@ -213,9 +305,15 @@ void SharedFileHandleManager::SetSharedFileHandle(unsigned __int16 fHandle, HAND
     ASSERT(SharedFileHandles[fHandle].hFile == INVALID_HANDLE_VALUE);
     ASSERT(FileHandle != INVALID_HANDLE_VALUE);
 
+    EnterCriticalSection(&SharedFileHandles[fHandle].Lock);
     SharedFileHandles[fHandle].hFile = FileHandle;
     SharedFileHandles[fHandle].OpenMode = OpenMode;
     SharedFileHandles[fHandle].FileName = FileName;
+    SharedFileHandles[fHandle].Position = 0;
+    SharedFileHandles[fHandle].NextSequential = 0;
+    SharedFileHandles[fHandle].SequentialCount = 0;
+    SharedFileHandles[fHandle].DeferredError = kErrorNoError;
+    LeaveCriticalSection(&SharedFileHandles[fHandle].Lock);
 }
 
 // Closes a VCEFSD fHandle and its corresponding Win32
@@ -225,22 +323,1005 @@ unsigned __int16 SharedFileHandleManager::CloseSharedFileHandle(unsigned __int16
     if (fHandle >= ARRAY_SIZE(SharedFileHandles)) {
         return kErrorInvalidHandle;
     }
-    if (!CloseHandle(SharedFileHandles[fHandle].hFile)) {
-        return kErrorFromLastError();
+
+    SharedFile *pFile = &SharedFileHandles[fHandle];
+    unsigned __int16 kError;
+
+    EnterCriticalSection(&pFile->Lock);
+    if (pFile->hFile == INVALID_HANDLE_VALUE) {
+        LeaveCriticalSection(&pFile->Lock);
+        return kErrorInvalidHandle;
+    }
+    WaitForReadAheadLocked(pFile);
+    // The handle is closed even if the last write-behind fails, but the
+    // failure is still reported.
+    kError = FlushLocked(pFile);
+    if (!CloseHandle(pFile->hFile) && kError == kErrorNoError) {
+        kError = kErrorFromLastError();
+    }
+    pFile->hFile = INVALID_HANDLE_VALUE;
+    CloseLocked(pFile);
+    LeaveCriticalSection(&pFile->Lock);
+
+    return kError;
+}
+
+// Closes the Win32 HANDLE if it is still open, and releases the buffers.  Called with
+// pFile->Lock held.
+void SharedFileHandleManager::CloseLocked(SharedFile *pFile)
+{
+    WaitForReadAheadLocked(pFile);
+    if (pFile->hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(pFile->hFile);
+        pFile->hFile = INVALID_HANDLE_VALUE;
+    }
+
+    free(pFile->FileName);
+    pFile->FileName = NULL;
+    free(pFile->ReadBuffer);
+    pFile->ReadBuffer = NULL;
+    free(pFile->WriteBuffer);
+    pFile->WriteBuffer = NULL;
+    pFile->WriteBufferLength = 0;
+}
+
+// Waits for a pending read-ahead to finish.  Called with pFile->Lock held, which is
+// released during the wait.
+void SharedFileHandleManager::WaitForReadAheadLocked(SharedFile *pFile)
+{
+    while (pFile->fReadAheadPending) {
+        LeaveCriticalSection(&pFile->Lock);
+        CompletionPort.BlockingWait(pFile->hReadAheadDone);
+        EnterCriticalSection(&pFile->Lock);
+    }
+}
+
+// Begins reading kReadAheadSize bytes at Offset on a worker thread.  Called with
+// pFile->Lock held.
+void SharedFileHandleManager::StartReadAheadLocked(SharedFile *pFile, unsigned __int32 Offset)
+{
+    ASSERT(!pFile->fReadAheadPending);
+
+    pFile->fReadAheadPending = true;
+    pFile->ReadAheadOffset = Offset;
+    ResetEvent(pFile->hReadAheadDone);
+    if (!CompletionPort.QueueWorkitem(&pFile->ReadAheadCallback)) {
+        pFile->fReadAheadPending = false;
+        SetEvent(pFile->hReadAheadDone);
+    }
+}
+
+// Called by the IO Completion port threadpool
+//   lpParameter = the SharedFile to read ahead in
+void __fastcall SharedFileHandleManager::ReadAheadStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
+{
+    SharedFile *pFile = (SharedFile *)lpParameter;
+    unsigned __int8 *Buffer;
+    unsigned __int32 Generation;
+    OVERLAPPED Overlapped;
+    DWORD dwBytesRead = 0;
+
+    // The handle can't be closed until fReadAheadPending is cleared, so it is safe
+    // to read from it without the lock.
+    EnterCriticalSection(&pFile->Lock);
+    Generation = pFile->ReadAheadGeneration;
+    memset(&Overlapped, 0, sizeof(Overlapped));
+    Overlapped.Offset = pFile->ReadAheadOffset;
+    LeaveCriticalSection(&pFile->Lock);
+
+    Buffer = (unsigned __int8 *)malloc(kReadAheadSize);
+    if (Buffer && !ReadFile(pFile->hFile, Buffer, kReadAheadSize, &dwBytesRead, &Overlapped) &&
+        GetLastError() != ERROR_HANDLE_EOF) {
+        free(Buffer);
+        Buffer = NULL;
+    }
+
+    EnterCriticalSection(&pFile->Lock);
+    if (Buffer && Generation == pFile->ReadAheadGeneration) {
+        free(pFile->ReadBuffer);
+        pFile->ReadBuffer = Buffer;
+        pFile->ReadBufferOffset = Overlapped.Offset;
+        pFile->ReadBufferLength = dwBytesRead;
+    } else {
+        free(Buffer); // failed, or the data is stale
     }
-    SharedFileHandles[fHandle].hFile = INVALID_HANDLE_VALUE;
+    pFile->fReadAheadPending = false;
+    SetEvent(pFile->hReadAheadDone);
+    LeaveCriticalSection(&pFile->Lock);
+}
 
-    free(SharedFileHandles[fHandle].FileName);
-    SharedFileHandles[fHandle].FileName = NULL;
+// Writes out any write-behind data.  Called with pFile->Lock held.
+//
+// Returns:
+//  kErrorNoError on success
+//  the error from this write-behind or an earlier one, which is then cleared
+unsigned __int16 SharedFileHandleManager::FlushLocked(SharedFile *pFile)
+{
+    unsigned __int16 kError;
+
+    if (pFile->WriteBufferLength) {
+        OVERLAPPED Overlapped;
+        DWORD dwBytesWritten;
+
+        memset(&Overlapped, 0, sizeof(Overlapped));
+        Overlapped.Offset = pFile->WriteBufferOffset;
+        if (!WriteFile(pFile->hFile, pFile->WriteBuffer, pFile->WriteBufferLength, &dwBytesWritten, &Overlapped)) {
+            pFile->DeferredError = kErrorFromLastError();
+        } else if (dwBytesWritten != pFile->WriteBufferLength) {
+            pFile->DeferredError = kErrorDiskFull;
+        }
+        pFile->WriteBufferLength = 0;
+    }
+    kError = pFile->DeferredError;
+    pFile->DeferredError = kErrorNoError;
+    return kError;
+}
 
+// Writes out any write-behind data for fHandle
+//
+// Returns:
+//  kErrorNoError on success
+//  a kError... if the data, or an earlier write-behind, could not be written
+unsigned __int16 SharedFileHandleManager::Flush(unsigned __int16 fHandle)
+{
+    unsigned __int16 kError;
+
+    if (fHandle >= ARRAY_SIZE(SharedFileHandles)) {
+        return kErrorInvalidHandle;
+    }
+    EnterCriticalSection(&SharedFileHandles[fHandle].Lock);
+    kError = FlushLocked(&SharedFileHandles[fHandle]);
+    LeaveCriticalSection(&SharedFileHandles[fHandle].Lock);
+    return kError;
+}
+
+// Writes out the write-behind data for every handle.  Any failure is kept
+// for the next request on that handle.
+void SharedFileHandleManager::FlushAll(void)
+{
+    for (int i=0; i<kMaxFD; ++i) {
+        SharedFile *pFile = &SharedFileHandles[i];
+
+        if (pFile->WriteBufferLength == 0) {
+            continue; // cheap check without the lock
+        }
+        EnterCriticalSection(&pFile->Lock);
+        if (pFile->hFile != INVALID_HANDLE_VALUE) {
+            pFile->DeferredError = FlushLocked(pFile);
+        }
+        LeaveCriticalSection(&pFile->Lock);
+    }
+}
+
+DWORD WINAPI SharedFileHandleManager::FlushThreadStatic(LPVOID lpvThreadParam)
+{
+    class SharedFileHandleManager *pThis = (class SharedFileHandleManager *)lpvThreadParam;
+
+    while (WaitForSingleObject(pThis->hFlushTimer, INFINITE) == WAIT_OBJECT_0) {
+        pThis->FlushAll();
+    }
     return 0;
 }
 
+// Writes out write-behind data held by other handles to the same file as fHandle,
+// so a read through fHandle sees it.
+void SharedFileHandleManager::FlushOtherHandles(unsigned __int16 fHandle)
+{
+    for (int i=0; i<kMaxFD; ++i) {
+        SharedFile *pFile = &SharedFileHandles[i];
+
+        if (i == fHandle || pFile->WriteBufferLength == 0) {
+            continue;
+        }
+        EnterCriticalSection(&pFile->Lock);
+        if (pFile->hFile != INVALID_HANDLE_VALUE &&
+            _wcsicmp(pFile->FileName, SharedFileHandles[fHandle].FileName) == 0) {
+            pFile->DeferredError = FlushLocked(pFile);
+        }
+        LeaveCriticalSection(&pFile->Lock);
+    }
+}
+
+// Throws away the read-ahead data for fHandle, after the file changes underneath it
+void SharedFileHandleManager::DiscardReadAhead(unsigned __int16 fHandle)
+{
+    if (fHandle >= ARRAY_SIZE(SharedFileHandles)) {
+        return;
+    }
+
+    SharedFile *pFile = &SharedFileHandles[fHandle];
+
+    EnterCriticalSection(&pFile->Lock);
+    pFile->ReadAheadGeneration++;
+    free(pFile->ReadBuffer);
+    pFile->ReadBuffer = NULL;
+    pFile->SequentialCount = 0;
+    LeaveCriticalSection(&pFile->Lock);
+}
+
+// Throws away the read-ahead data of other handles to the same file as fHandle,
+// after a write through fHandle.
+void SharedFileHandleManager::DiscardOtherReadAheads(unsigned __int16 fHandle)
+{
+    for (unsigned __int16 i=0; i<kMaxFD; ++i) {
+        if (i == fHandle || SharedFileHandles[i].hFile == INVALID_HANDLE_VALUE ||
+            !IsReadOnly(SharedFileHandles[i].OpenMode) ||
+            _wcsicmp(SharedFileHandles[i].FileName, SharedFileHandles[fHandle].FileName) != 0) {
+            continue;
+        }
+        DiscardReadAhead(i);
+    }
+}
+
+// Reads Size bytes at Offset, from the read-ahead buffer if possible.
+//
+// Returns:
+//  kErrorNoError and *pBytesRead set on success.  Reading at or past the end of
+//      the file is not an error.
+//  other values are a kError... value
+unsigned __int16 SharedFileHandleManager::Read(unsigned __int16 fHandle, unsigned __int32 Offset, __out_bcount(Size) void *Buffer, unsigned __int32 Size, DWORD *pBytesRead)
+{
+    if (fHandle >= ARRAY_SIZE(SharedFileHandles) ||
+        SharedFileHandles[fHandle].hFile == INVALID_HANDLE_VALUE) {
+        return kErrorInvalidHandle;
+    }
+
+    SharedFile *pFile = &SharedFileHandles[fHandle];
+    unsigned __int16 kError;
+    bool fBuffered = false;
+
+    FlushOtherHandles(fHandle);
+
+    EnterCriticalSection(&pFile->Lock);
+    kError = FlushLocked(pFile);
+    if (kError != kErrorNoError) {
+        LeaveCriticalSection(&pFile->Lock);
+        return kError;
+    }
+
+    if (Offset == pFile->NextSequential) {
+        pFile->SequentialCount++;
+    } else {
+        pFile->SequentialCount = 0;
+    }
+
+    // If a read-ahead is fetching this data, wait for it rather than reading it twice
+    if (pFile->fReadAheadPending && Offset >= pFile->ReadAheadOffset &&
+        Offset-pFile->ReadAheadOffset < kReadAheadSize) {
+        WaitForReadAheadLocked(pFile);
+    }
+
+    if (pFile->ReadBuffer && Offset >= pFile->ReadBufferOffset &&
+        Offset-pFile->ReadBufferOffset <= pFile->ReadBufferLength) {
+        unsigned __int32 Available = pFile->ReadBufferLength-(Offset-pFile->ReadBufferOffset);
+
+        if (Available >= Size) {
+            *pBytesRead = Size;
+            fBuffered = true;
+        } else if (pFile->ReadBufferLength < kReadAheadSize) {
+            // The read-ahead stopped at the end of the file
+            *pBytesRead = Available;
+            fBuffered = true;
+        }
+        if (fBuffered) {
+            memcpy(Buffer, pFile->ReadBuffer+(Offset-pFile->ReadBufferOffset), *pBytesRead);
+        }
+    }
+
+    if (!fBuffered) {
+        OVERLAPPED Overlapped;
+
+        memset(&Overlapped, 0, sizeof(Overlapped));
+        Overlapped.Offset = Offset;
+        if (!ReadFile(pFile->hFile, Buffer, Size, pBytesRead, &Overlapped)) {
+            if (GetLastError() != ERROR_HANDLE_EOF) {
+                kError = kErrorFromLastError();
+                LeaveCriticalSection(&pFile->Lock);
+                return kError;
+            }
+            *pBytesRead = 0; // reading at or past the end of the file is not an error
+        }
+    }
+    pFile->Position = (unsigned __int64)Offset+*pBytesRead;
+    pFile->NextSequential = Offset+*pBytesRead;
+
+    // Keep one buffer ahead of a sequential reader:  start the next read-ahead once
+    // the guest is into the second half of the current one.
+    if (pFile->SequentialCount >= kSequentialThreshold && IsReadOnly(pFile->OpenMode) &&
+        !pFile->fReadAheadPending && *pBytesRead != 0) {
+        if (!fBuffered) {
+            StartReadAheadLocked(pFile, pFile->NextSequential);
+        } else if (pFile->ReadBufferLength == kReadAheadSize &&
+                   pFile->NextSequential-pFile->ReadBufferOffset >= kReadAheadSize/2) {
+            StartReadAheadLocked(pFile, pFile->ReadBufferOffset+kReadAheadSize);
+        }
+    }
+    LeaveCriticalSection(&pFile->Lock);
+    return kErrorNoError;
+}
+
+// Writes Size bytes at Offset, into the write-behind buffer if the write continues
+// the previous one.
+//
+// Returns:
+//  kErrorNoError and *pBytesWritten set on success
+//  other values are a kError... value, possibly from an earlier write-behind
+unsigned __int16 SharedFileHandleManager::Write(unsigned __int16 fHandle, unsigned __int32 Offset, __in_bcount(Size) const void *Buffer, unsigned __int32 Size, DWORD *pBytesWritten)
+{
+    if (fHandle >= ARRAY_SIZE(SharedFileHandles) ||
+        SharedFileHandles[fHandle].hFile == INVALID_HANDLE_VALUE) {
+        return kErrorInvalidHandle;
+    }
+
+    SharedFile *pFile = &SharedFileHandles[fHandle];
+    unsigned __int16 kError;
+
+    DiscardOtherReadAheads(fHandle);
+
+    EnterCriticalSection(&pFile->Lock);
+    if (pFile->WriteBufferLength &&
+        Offset == pFile->WriteBufferOffset+pFile->WriteBufferLength &&
+        Size <= kWriteBehindSize-pFile->WriteBufferLength) {
+        // Append to the write-behind data
+        memcpy(pFile->WriteBuffer+pFile->WriteBufferLength, Buffer, Size);
+        pFile->WriteBufferLength += Size;
+        *pBytesWritten = Size;
+    } else {
+        kError = FlushLocked(pFile);
+        if (kError != kErrorNoError) {
+            LeaveCriticalSection(&pFile->Lock);
+            return kError;
+        }
+        if (pFile->WriteBuffer == NULL && Offset == pFile->NextSequential) {
+            pFile->WriteBuffer = (unsigned __int8 *)malloc(kWriteBehindSize);
+        }
+        if (pFile->WriteBuffer && Offset == pFile->NextSequential && Size < kWriteBehindSize) {
+            // Begin gathering a sequential run of writes
+            memcpy(pFile->WriteBuffer, Buffer, Size);
+            pFile->WriteBufferOffset = Offset;
+            pFile->WriteBufferLength = Size;
+            *pBytesWritten = Size;
+        } else {
+            OVERLAPPED Overlapped;
+
+            memset(&Overlapped, 0, sizeof(Overlapped));
+            Overlapped.Offset = Offset;
+            if (!WriteFile(pFile->hFile, Buffer, Size, pBytesWritten, &Overlapped)) {
+                kError = kErrorFromLastError();
+                LeaveCriticalSection(&pFile->Lock);
+                return kError;
+            }
+        }
+    }
+    pFile->Position = (unsigned __int64)Offset+*pBytesWritten;
+    pFile->NextSequential = Offset+*pBytesWritten;
+
+    if (pFile->WriteBufferLength && hFlushTimer) {
+        LARGE_INTEGER DueTime;
+
+        DueTime.QuadPart = -(__int64)kWriteBehindTimeout*10000; // relative, in 100ns units
+        SetWaitableTimer(hFlushTimer, &DueTime, 0, NULL, NULL, FALSE);
+    }
+    LeaveCriticalSection(&pFile->Lock);
+    return kErrorNoError;
+}
+
+// The file position that the guest last read or wrote up to
+unsigned __int64 SharedFileHandleManager::GetPosition(unsigned __int16 fHandle)
+{
+    unsigned __int64 Position;
+
+    ASSERT(fHandle < ARRAY_SIZE(SharedFileHandles));
+    EnterCriticalSection(&SharedFileHandles[fHandle].Lock);
+    Position = SharedFileHandles[fHandle].Position;
+    LeaveCriticalSection(&SharedFileHandles[fHandle].Lock);
+    return Position;
+}
+
+void SharedFileHandleManager::SetPosition(unsigned __int16 fHandle, unsigned __int64 Position)
+{
+    ASSERT(fHandle < ARRAY_SIZE(SharedFileHandles));
+    EnterCriticalSection(&SharedFileHandles[fHandle].Lock);
+    SharedFileHandles[fHandle].Position = Position;
+    LeaveCriticalSection(&SharedFileHandles[fHandle].Lock);
+}
+
+
+/*
+    The FolderCache keeps recent GetInfo() results so that guest directory
+    listings don't turn into a host syscall per query:  the attributes of
+    single files and directories (the fIndex == -1 existence checks), and
+    complete directory listings for FindFirst/FindNext enumerations.  Both
+    are keyed by the translated Win32 path.
+
+    Entries are dropped when the guest changes the file or directory
+    through folder sharing, and when the host changes anything under the
+    share, which a watcher thread learns of from ReadDirectoryChangesW().
+    If the share can't be watched (some network redirectors don't support
+    change notifications), nothing is cached.
+
+    Listings are reference-counted:  an enumeration in progress keeps
+    the listing it started with even if the cache drops it meanwhile.
+*/
+struct FolderCacheEntry {
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastWriteTime;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+    unsigned __int32 NameOffset;    // into FolderCacheListing::Names
+};
+
+struct FolderCacheListing {
+    volatile LONG RefCount;         // one for the cache, plus one per user
+    wchar_t Pattern[MAX_PATH];      // the FindFirstFile() pattern
+    size_t DirectoryLength;         // characters in Pattern before its final '\\'
+    unsigned __int16 EmptyError;    // returned by FindFirst if Count is 0
+    unsigned __int32 Count;
+    DWORD LastUse;
+    FolderCacheEntry *Entries;      // both point into the same allocation as the listing
+    wchar_t *Names;
+};
+
+class FolderCache {
+public:
+    void PowerOn(void);
+    void Start(__in_z const wchar_t *Root);
+    void Stop(void);
+    void Flush(void);
+
+    unsigned __int16 GetAttributes(__in_z const wchar_t *Path, WIN32_FILE_ATTRIBUTE_DATA *pData);
+    unsigned __int16 GetListing(__in_z const wchar_t *Pattern, FolderCacheListing **ppListing);
+    void GetListingEntry(FolderCacheListing *pListing, unsigned __int32 Index, LPWIN32_FIND_DATA lpFindData);
+    void ReleaseListing(FolderCacheListing *pListing);
+    void Invalidate(__in_z const wchar_t *Path);
+    void InvalidateRelative(__in_z const wchar_t *RelativePath);
+
+private:
+    #define kFolderCacheAttributes      512     // must be a power of two
+    #define kFolderCacheListings        16
+    #define kFolderCacheMaxEntries      4096    // larger directories are enumerated directly
+
+    struct AttributeEntry {
+        size_t PathLength;          // 0 if the entry is unused
+        wchar_t Path[MAX_PATH];
+        unsigned __int16 kError;    // a cached kErrorFileNotFound or kErrorPathNotFound
+        WIN32_FILE_ATTRIBUTE_DATA Data;
+    };
+
+    // Guards everything below except the watcher's own fields
+    CRITICAL_SECTION Lock;
+    AttributeEntry Attributes[kFolderCacheAttributes];
+    FolderCacheListing *Listings[kFolderCacheListings];
+    unsigned __int32 Generation;    // bumped by every invalidation
+    volatile bool fEnabled;         // true while the share is being watched
+    wchar_t Root[MAX_PATH];
+    size_t RootLength;
+
+    unsigned __int32 AttributeHits;
+    unsigned __int32 AttributeMisses;
+    unsigned __int32 ListingHits;
+    unsigned __int32 ListingMisses;
+
+    HANDLE hDirectory;
+    HANDLE hWatchThread;
+    HANDLE hStopEvent;
+    DWORD NotifyBuffer[16*1024];    // FILE_NOTIFY_INFORMATION records must be DWORD-aligned
+
+    static unsigned __int32 HashPath(__in_ecount(Length) const wchar_t *Path, size_t Length);
+    static bool IsPathWithin(__in_ecount(Length) const wchar_t *Path, size_t Length, __in_ecount(PrefixLength) const wchar_t *Prefix, size_t PrefixLength);
+    void FlushLocked(void);
+    FolderCacheListing *ReadListing(__in_z const wchar_t *Pattern, unsigned __int16 *pkError);
+    void LogStatistics(void);
+    static DWORD WINAPI WatchThreadStatic(LPVOID lpvThreadParam);
+    DWORD WatchThread(void);
+};
+
+FolderCache FolderCache;
+
+void FolderCache::PowerOn(void)
+{
+    InitializeCriticalSection(&Lock);
+    for (int i=0; i<ARRAY_SIZE(Attributes); ++i) {
+        Attributes[i].PathLength = 0;
+    }
+    for (int i=0; i<ARRAY_SIZE(Listings); ++i) {
+        Listings[i] = NULL;
+    }
+    Generation = 0;
+    fEnabled = false;
+    AttributeHits = AttributeMisses = ListingHits = ListingMisses = 0;
+    hDirectory = INVALID_HANDLE_VALUE;
+    hWatchThread = NULL;
+    hStopEvent = NULL;
+}
+
+// Begin caching for the share at Root.  If the directory can't be watched,
+// caching stays off and every lookup goes to the host.
+void FolderCache::Start(__in_z const wchar_t *ShareRoot)
+{
+    Stop();
+
+    if (FAILED(StringCchCopyW(Root, ARRAY_SIZE(Root), ShareRoot))) {
+        return;
+    }
+    RootLength = wcslen(Root);
+
+    hDirectory = CreateFileW(Root,
+                             FILE_LIST_DIRECTORY,
+                             FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_FLAG_BACKUP_SEMANTICS|FILE_FLAG_OVERLAPPED,
+                             NULL);
+    if (hDirectory == INVALID_HANDLE_VALUE) {
+        LOG_WARN(FOLDERSHARING, "Not caching:  failed to open %S for change notifications - %d", ShareRoot, GetLastError());
+        return;
+    }
+    hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL); // Manual-reset, initially unsignalled
+    if (hStopEvent == NULL) {
+        goto Error;
+    }
+
+    // The watcher turns caching on once its first ReadDirectoryChangesW() is
+    // pending, so no change can be missed.
+    hWatchThread = CreateThread(NULL, 0, WatchThreadStatic, this, 0, NULL);
+    if (hWatchThread == NULL) {
+        goto Error;
+    }
+    return;
+
+Error:
+    if (hStopEvent) {
+        CloseHandle(hStopEvent);
+        hStopEvent = NULL;
+    }
+    CloseHandle(hDirectory);
+    hDirectory = INVALID_HANDLE_VALUE;
+}
+
+// Stop caching, and wait for the watcher thread to exit
+void FolderCache::Stop(void)
+{
+    if (hWatchThread) {
+        SetEvent(hStopEvent);
+        WaitForSingleObject(hWatchThread, INFINITE);
+        CloseHandle(hWatchThread);
+        hWatchThread = NULL;
+        CloseHandle(hStopEvent);
+        hStopEvent = NULL;
+        LogStatistics();
+    }
+    if (hDirectory != INVALID_HANDLE_VALUE) {
+        CloseHandle(hDirectory);
+        hDirectory = INVALID_HANDLE_VALUE;
+    }
+    fEnabled = false;
+    Flush();
+}
+
+void FolderCache::Flush(void)
+{
+    EnterCriticalSection(&Lock);
+    FlushLocked();
+    LeaveCriticalSection(&Lock);
+}
+
+void FolderCache::FlushLocked(void)
+{
+    for (int i=0; i<ARRAY_SIZE(Attributes); ++i) {
+        Attributes[i].PathLength = 0;
+    }
+    for (int i=0; i<ARRAY_SIZE(Listings); ++i) {
+        if (Listings[i]) {
+            ReleaseListing(Listings[i]);
+            Listings[i] = NULL;
+        }
+    }
+    Generation++;
+}
+
+void FolderCache::LogStatistics(void)
+{
+    LOG_INFO(FOLDERSHARING, "Cache:  attributes %d hits, %d misses; listings %d hits, %d misses",
+             AttributeHits, AttributeMisses, ListingHits, ListingMisses);
+}
+
+// A case-insensitive hash, as Win32 paths are case-insensitive
+unsigned __int32 FolderCache::HashPath(__in_ecount(Length) const wchar_t *Path, size_t Length)
+{
+    unsigned __int32 Hash = 0x811c9dc5;
+
+    for (size_t i=0; i<Length; ++i) {
+        Hash = (Hash ^ towlower(Path[i])) * 0x01000193;
+    }
+    return Hash;
+}
+
+// Returns true if Path is Prefix itself, or is something inside the directory Prefix
+bool FolderCache::IsPathWithin(__in_ecount(Length) const wchar_t *Path, size_t Length, __in_ecount(PrefixLength) const wchar_t *Prefix, size_t PrefixLength)
+{
+    if (Length < PrefixLength || _wcsnicmp(Path, Prefix, PrefixLength) != 0) {
+        return false;
+    }
+    return (Length == PrefixLength || Path[PrefixLength] == L'\\');
+}
+
+// Looks up the attributes of Path, a fully-qualified Win32 path.
+//
+// Returns:
+//  kErrorNoError and *pData filled in on success
+//  other values are a kError... from the host
+unsigned __int16 FolderCache::GetAttributes(__in_z const wchar_t *Path, WIN32_FILE_ATTRIBUTE_DATA *pData)
+{
+    size_t PathLength = wcslen(Path);
+    AttributeEntry *pEntry = &Attributes[HashPath(Path, PathLength) & (kFolderCacheAttributes-1)];
+    unsigned __int32 StartGeneration;
+    unsigned __int16 kError;
+
+    EnterCriticalSection(&Lock);
+    if (fEnabled && pEntry->PathLength == PathLength && _wcsicmp(pEntry->Path, Path) == 0) {
+        AttributeHits++;
+        kError = pEntry->kError;
+        *pData = pEntry->Data;
+        LeaveCriticalSection(&Lock);
+        return kError;
+    }
+    AttributeMisses++;
+    StartGeneration = Generation;
+    LeaveCriticalSection(&Lock);
+
+    if (GetFileAttributesEx(Path, GetFileExInfoStandard, pData) == 0) {
+        kError = kErrorFromLastError();
+        if (kError != kErrorFileNotFound && kError != kErrorPathNotFound) {
+            return kError; // don't cache transient failures such as sharing violations
+        }
+    } else {
+        kError = kErrorNoError;
+    }
+
+    // Only cache the result if nothing was invalidated while it was being fetched
+    EnterCriticalSection(&Lock);
+    if (fEnabled && Generation == StartGeneration && PathLength < ARRAY_SIZE(pEntry->Path)) {
+        memcpy(pEntry->Path, Path, (PathLength+1)*sizeof(wchar_t));
+        pEntry->PathLength = PathLength;
+        pEntry->kError = kError;
+        pEntry->Data = *pData;
+    }
+    LeaveCriticalSection(&Lock);
+    return kError;
+}
+
+// Enumerates the files matching Pattern, skipping "." and "..".
+//
+// Returns:
+//  NULL with *pkError set to the error if the enumeration failed, or to
+//      kErrorNoError if there are too many files to cache
+//  the new listing, with a single reference, on success
+FolderCacheListing *FolderCache::ReadListing(__in_z const wchar_t *Pattern, unsigned __int16 *pkError)
+{
+    WIN32_FIND_DATA FindFileData;
+    FolderCacheEntry *Entries = NULL;
+    wchar_t *Names = NULL;
+    unsigned __int32 Count = 0;
+    unsigned __int32 EntryCapacity = 0;
+    size_t NamesLength = 0;
+    size_t NamesCapacity = 0;
+    FolderCacheListing *pListing = NULL;
+    unsigned __int16 EmptyError = kErrorNoMoreFiles;
+    const wchar_t *LastSlash;
+    HANDLE hFindFile;
+
+    *pkError = kErrorNoError;
+    hFindFile = FindFirstFile(Pattern, &FindFileData);
+    if (hFindFile == INVALID_HANDLE_VALUE) {
+        *pkError = kErrorFromLastError();
+        if (*pkError != kErrorFileNotFound) {
+            return NULL;
+        }
+        // Nothing matches:  that can be cached, as an empty listing
+        *pkError = kErrorNoError;
+        EmptyError = kErrorFileNotFound;
+    } else {
+        do {
+            if (wcscmp(FindFileData.cFileName, L".") == 0 || wcscmp(FindFileData.cFileName, L"..") == 0) {
+                continue;
+            }
+            size_t NameLength = wcslen(FindFileData.cFileName)+1;
+            if (Count == kFolderCacheMaxEntries) {
+                goto Done; // too large:  *pkError is kErrorNoError
+            }
+            if (Count == EntryCapacity) {
+                EntryCapacity = (EntryCapacity) ? EntryCapacity*2 : 64;
+                FolderCacheEntry *NewEntries = (FolderCacheEntry *)realloc(Entries, EntryCapacity*sizeof(FolderCacheEntry));
+                if (NewEntries == NULL) {
+                    goto Done;
+                }
+                Entries = NewEntries;
+            }
+            if (NamesLength+NameLength > NamesCapacity) {
+                NamesCapacity = max(NamesCapacity*2, NamesLength+NameLength);
+                wchar_t *NewNames = (wchar_t *)realloc(Names, NamesCapacity*sizeof(wchar_t));
+                if (NewNames == NULL) {
+                    goto Done;
+                }
+                Names = NewNames;
+            }
+            Entries[Count].dwFileAttributes = FindFileData.dwFileAttributes;
+            Entries[Count].ftCreationTime = FindFileData.ftCreationTime;
+            Entries[Count].ftLastWriteTime = FindFileData.ftLastWriteTime;
+            Entries[Count].nFileSizeHigh = FindFileData.nFileSizeHigh;
+            Entries[Count].nFileSizeLow = FindFileData.nFileSizeLow;
+            Entries[Count].NameOffset = (unsigned __int32)NamesLength;
+            memcpy(&Names[NamesLength], FindFileData.cFileName, NameLength*sizeof(wchar_t));
+            NamesLength += NameLength;
+            Count++;
+        } while (FindNextFile(hFindFile, &FindFileData));
+
+        if (GetLastError() != ERROR_NO_MORE_FILES) {
+            *pkError = kErrorFromLastError();
+            goto Done;
+        }
+    }
+
+    // Pack the listing, its entries and their names into one allocation
+    pListing = (FolderCacheListing *)malloc(sizeof(FolderCacheListing)+Count*sizeof(FolderCacheEntry)+NamesLength*sizeof(wchar_t));
+    if (pListing == NULL) {
+        goto Done;
+    }
+    if (FAILED(StringCchCopyW(pListing->Pattern, ARRAY_SIZE(pListing->Pattern), Pattern))) {
+        free(pListing);
+        pListing = NULL;
+        goto Done;
+    }
+    LastSlash = wcsrchr(pListing->Pattern, L'\\');
+    pListing->DirectoryLength = (LastSlash) ? LastSlash-pListing->Pattern : 0;
+    pListing->RefCount = 1;
+    pListing->EmptyError = EmptyError;
+    pListing->Count = Count;
+    pListing->LastUse = GetTickCount();
+    pListing->Entries = (FolderCacheEntry *)(pListing+1);
+    pListing->Names = (wchar_t *)(pListing->Entries+Count);
+    if (Count) {
+        memcpy(pListing->Entries, Entries, Count*sizeof(FolderCacheEntry));
+        memcpy(pListing->Names, Names, NamesLength*sizeof(wchar_t));
+    }
+
+Done:
+    if (hFindFile != INVALID_HANDLE_VALUE) {
+        FindClose(hFindFile);
+    }
+    free(Entries);
+    free(Names);
+    return pListing;
+}
+
+// Looks up the listing for a FindFirstFile() pattern, which is a fully-qualified
+// Win32 path that may contain wildcards.
+//
+// Returns:
+//  kErrorNoError and *ppListing set to a listing that the caller must release with
+//      ReleaseListing(), or to NULL if the directory is too large to cache and the
+//      caller should enumerate it directly
+//  other values are a kError... from the host
+unsigned __int16 FolderCache::GetListing(__in_z const wchar_t *Pattern, FolderCacheListing **ppListing)
+{
+    FolderCacheListing *pListing;
+    unsigned __int32 StartGeneration;
+    unsigned __int16 kError;
+    int Slot;
+
+    *ppListing = NULL;
+
+    EnterCriticalSection(&Lock);
+    if (!fEnabled) {
+        LeaveCriticalSection(&Lock);
+        return kErrorNoError;
+    }
+    for (int i=0; i<ARRAY_SIZE(Listings); ++i) {
+        if (Listings[i] && _wcsicmp(Listings[i]->Pattern, Pattern) == 0) {
+            ListingHits++;
+            Listings[i]->LastUse = GetTickCount();
+            InterlockedIncrement(&Listings[i]->RefCount);
+            *ppListing = Listings[i];
+            LeaveCriticalSection(&Lock);
+            return kErrorNoError;
+        }
+    }
+    ListingMisses++;
+    StartGeneration = Generation;
+    LeaveCriticalSection(&Lock);
+
+    pListing = ReadListing(Pattern, &kError);
+    if (pListing == NULL) {
+        return kError;
+    }
+
+    EnterCriticalSection(&Lock);
+    if (fEnabled && Generation == StartGeneration) {
+        // Replace an empty slot, or else the least recently used listing
+        Slot = 0;
+        for (int i=0; i<ARRAY_SIZE(Listings); ++i) {
+            if (Listings[i] == NULL) {
+                Slot = i;
+                break;
+            }
+            if (GetTickCount()-Listings[i]->LastUse > GetTickCount()-Listings[Slot]->LastUse) {
+                Slot = i;
+            }
+        }
+        if (Listings[Slot]) {
+            ReleaseListing(Listings[Slot]);
+        }
+        Listings[Slot] = pListing;
+        InterlockedIncrement(&pListing->RefCount); // the caller's reference
+    }
+    LeaveCriticalSection(&Lock);
+
+    // If the listing wasn't cached, the caller's reference is the only one
+    *ppListing = pListing;
+    return kErrorNoError;
+}
+
+// Fills in the WIN32_FIND_DATA fields that UpdateResultsFromFind() uses
+void FolderCache::GetListingEntry(FolderCacheListing *pListing, unsigned __int32 Index, LPWIN32_FIND_DATA lpFindData)
+{
+    const FolderCacheEntry *pEntry = &pListing->Entries[Index];
+
+    ASSERT(Index < pListing->Count);
+    lpFindData->dwFileAttributes = pEntry->dwFileAttributes;
+    lpFindData->ftCreationTime = pEntry->ftCreationTime;
+    lpFindData->ftLastWriteTime = pEntry->ftLastWriteTime;
+    lpFindData->nFileSizeHigh = pEntry->nFileSizeHigh;
+    lpFindData->nFileSizeLow = pEntry->nFileSizeLow;
+    if (FAILED(StringCchCopyW(lpFindData->cFileName, ARRAY_SIZE(lpFindData->cFileName), &pListing->Names[pEntry->NameOffset]))) {
+        ASSERT(FALSE); // the name came from a WIN32_FIND_DATA, so it must fit
+    }
+}
+
+void FolderCache::ReleaseListing(FolderCacheListing *pListing)
+{
+    if (InterlockedDecrement(&pListing->RefCount) == 0) {
+        free(pListing);
+    }
+}
+
+// Drops everything cached about Path, a fully-qualified Win32 path:  its own
+// attributes, the listings of the directory containing it, and if it is a
+// directory, everything cached beneath it.
+void FolderCache::Invalidate(__in_z const wchar_t *Path)
+{
+    size_t PathLength = wcslen(Path);
+    const wchar_t *LastSlash = wcsrchr(Path, L'\\');
+    size_t ParentLength = (LastSlash) ? LastSlash-Path : 0;
+
+    EnterCriticalSection(&Lock);
+    Generation++;
+    for (int i=0; i<ARRAY_SIZE(Attributes); ++i) {
+        if (Attributes[i].PathLength &&
+            IsPathWithin(Attributes[i].Path, Attributes[i].PathLength, Path, PathLength)) {
+            Attributes[i].PathLength = 0;
+        }
+    }
+    for (int i=0; i<ARRAY_SIZE(Listings); ++i) {
+        FolderCacheListing *pListing = Listings[i];
+
+        if (pListing == NULL) {
+            continue;
+        }
+        if ((pListing->DirectoryLength == ParentLength && _wcsnicmp(pListing->Pattern, Path, ParentLength) == 0) ||
+            IsPathWithin(pListing->Pattern, pListing->DirectoryLength, Path, PathLength)) {
+            ReleaseListing(pListing);
+            Listings[i] = NULL;
+        }
+    }
+    LeaveCriticalSection(&Lock);
+}
+
+// As Invalidate(), for a path relative to the share root
+void FolderCache::InvalidateRelative(__in_z const wchar_t *RelativePath)
+{
+    wchar_t Path[MAX_PATH];
+
+    if (FAILED(StringCchCopyW(Path, ARRAY_SIZE(Path), Root)) ||
+        FAILED(StringCchCatW(Path, ARRAY_SIZE(Path), RelativePath))) {
+        Flush();
+        return;
+    }
+    Invalidate(Path);
+}
+
+DWORD WINAPI FolderCache::WatchThreadStatic(LPVOID lpvThreadParam)
+{
+    FolderCache *pThis = (FolderCache *)lpvThreadParam;
+
+    return pThis->WatchThread();
+}
+
+DWORD FolderCache::WatchThread(void)
+{
+    OVERLAPPED Overlapped;
+    HANDLE Handles[2];
+
+    memset(&Overlapped, 0, sizeof(Overlapped));
+    Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL); // Manual-reset, initially unsignalled
+    if (Overlapped.hEvent == NULL) {
+        return 0;
+    }
+    Handles[0] = Overlapped.hEvent;
+    Handles[1] = hStopEvent;
+
+    while (1) {
+        DWORD dwBytesReturned;
+        DWORD dw;
+
+        if (!ReadDirectoryChangesW(hDirectory, NotifyBuffer, sizeof(NotifyBuffer), TRUE,
+                                   FILE_NOTIFY_CHANGE_FILE_NAME|FILE_NOTIFY_CHANGE_DIR_NAME|
+                                   FILE_NOTIFY_CHANGE_ATTRIBUTES|FILE_NOTIFY_CHANGE_SIZE|
+                                   FILE_NOTIFY_CHANGE_LAST_WRITE|FILE_NOTIFY_CHANGE_CREATION,
+                                   NULL, &Overlapped, NULL)) {
+            LOG_WARN(FOLDERSHARING, "Not caching:  ReadDirectoryChangesW failed - %d", GetLastError());
+            break;
+        }
+        if (!fEnabled) {
+            LOG_INFO(FOLDERSHARING, "Caching enabled for %S", Root);
+            fEnabled = true;
+        }
+
+        dw = WaitForMultipleObjects(2, Handles, FALSE, INFINITE);
+        if (dw != WAIT_OBJECT_0) {
+            // Stopping
+            CancelIo(hDirectory);
+            GetOverlappedResult(hDirectory, &Overlapped, &dwBytesReturned, TRUE);
+            break;
+        }
+        if (!GetOverlappedResult(hDirectory, &Overlapped, &dwBytesReturned, FALSE)) {
+            LOG_WARN(FOLDERSHARING, "Not caching:  change notification failed - %d", GetLastError());
+            break;
+        }
+        ResetEvent(Overlapped.hEvent);
+
+        if (dwBytesReturned == 0) {
+            // Too many changes to fit in NotifyBuffer:  assume anything changed
+            Flush();
+            continue;
+        }
+
+        const unsigned __int8 *pRecord = (const unsigned __int8 *)NotifyBuffer;
+        while (1) {
+            const FILE_NOTIFY_INFORMATION *pInfo = (const FILE_NOTIFY_INFORMATION *)pRecord;
+            wchar_t Path[MAX_PATH];
+
+            // The name is relative to the share root and not null-terminated
+            if (FAILED(StringCchCopyW(Path, ARRAY_SIZE(Path), Root)) ||
+                FAILED(StringCchCatW(Path, ARRAY_SIZE(Path), L"\\")) ||
+                FAILED(StringCchCatNW(Path, ARRAY_SIZE(Path), pInfo->FileName, pInfo->FileNameLength/sizeof(wchar_t)))) {
+                Flush();
+            } else {
+                LOG_VERBOSE(FOLDERSHARING, "Cache:  host changed %S", Path);
+                Invalidate(Path);
+            }
+            if (pInfo->NextEntryOffset == 0) {
+                break;
+            }
+            pRecord += pInfo->NextEntryOffset;
+        }
+    }
+
+    // Whatever the reason for stopping, nothing can be cached any more
+    EnterCriticalSection(&Lock);
+    fEnabled = false;
+    FlushLocked();
+    LeaveCriticalSection(&Lock);
+    CloseHandle(Overlapped.hEvent);
+    return 0;
+}
 
 /*
     The FindManager tracks in-progress FindFirst/FindNext enumerations.
     The TransactionID is used to identify a specific FindFirst/FindNext
-    enumeration, and its associated Win32 FindHandle.
+    enumeration, and either its associated Win32 FindHandle, or the
+    FolderCache listing it is walking and the index of the next entry.
 
     There are a maximum of 40 in-progress enumerations, matching the
     size of vcefsd\find.c's gFCList[] which is used to track
@@ -255,13 +1336,19 @@ public:
     bool IsValidTransactionID(unsigned __int32 FindTransactionID);
     HANDLE GetFindHandle(unsigned __int32 FindTransactionID);
     void SetFindHandle(unsigned __int32 FindTransactionID, HANDLE hFindFile);
+    FolderCacheListing *GetFindListing(unsigned __int32 FindTransactionID, unsigned __int32 *pNextEntry);
+    void SetFindListing(unsigned __int32 FindTransactionID, FolderCacheListing *pListing, unsigned __int32 NextEntry);
 
 private:
     #define    kMaxFC        40 // from vcefsd\find.c
 
     struct {
         HANDLE hFindFile;
+        FolderCacheListing *pListing;   // the FindManager owns a reference
+        unsigned __int32 NextEntry;
     } FindContext[kMaxFC];
+
+    void CloseContext(unsigned __int32 FindTransactionID);
 };
 
 FindManager FindManager;
@@ -270,16 +1357,27 @@ void FindManager::PowerOn(void)
 {
     for (int i=0; i<ARRAY_SIZE(FindContext); ++i) {
         FindContext[i].hFindFile = INVALID_HANDLE_VALUE;
+        FindContext[i].pListing = NULL;
     }
 }
 
 void FindManager::Reset(void)
 {
     for (int i=0; i<ARRAY_SIZE(FindContext); ++i) {
-        if (FindContext[i].hFindFile != INVALID_HANDLE_VALUE) {
-            FindClose(FindContext[i].hFindFile);
-            FindContext[i].hFindFile = INVALID_HANDLE_VALUE;
-        }
+        CloseContext(i);
+    }
+}
+
+// Ends whichever kind of enumeration the TransactionID has in progress
+void FindManager::CloseContext(unsigned __int32 FindTransactionID)
+{
+    if (FindContext[FindTransactionID].hFindFile != INVALID_HANDLE_VALUE) {
+        FindClose(FindContext[FindTransactionID].hFindFile);
+        FindContext[FindTransactionID].hFindFile = INVALID_HANDLE_VALUE;
+    }
+    if (FindContext[FindTransactionID].pListing) {
+        FolderCache.ReleaseListing(FindContext[FindTransactionID].pListing);
+        FindContext[FindTransactionID].pListing = NULL;
     }
 }
 
@@ -315,12 +1413,37 @@ HANDLE FindManager::GetFindHandle(unsigned __int32 FindTransactionID)
 void FindManager::SetFindHandle(unsigned __int32 FindTransactionID, HANDLE hFindFile)
 {
     ASSERT(IsValidTransactionID(FindTransactionID));
-    if (FindContext[FindTransactionID].hFindFile != INVALID_HANDLE_VALUE) {
-        FindClose(FindContext[FindTransactionID].hFindFile);
-    }
+    CloseContext(FindTransactionID);
     FindContext[FindTransactionID].hFindFile = hFindFile;
 }
 
+// Retrieves the FolderCache listing that the TransactionID is walking
+//
+// Returns:
+//  NULL if the TransactionID is not valid, or isn't walking a listing
+//  the listing, and *pNextEntry set to the index of its next entry
+FolderCacheListing *FindManager::GetFindListing(unsigned __int32 FindTransactionID, unsigned __int32 *pNextEntry)
+{
+    if (FindTransactionID >= ARRAY_SIZE(FindContext)) {
+        return NULL;
+    }
+    *pNextEntry = FindContext[FindTransactionID].NextEntry;
+    return FindContext[FindTransactionID].pListing;
+}
+
+// Associates a TransactionID with a listing, whose reference passes to the
+// FindManager, or moves an existing association on to NextEntry.  Any other
+// enumeration in progress for the TransactionID is closed.
+void FindManager::SetFindListing(unsigned __int32 FindTransactionID, FolderCacheListing *pListing, unsigned __int32 NextEntry)
+{
+    ASSERT(IsValidTransactionID(FindTransactionID));
+    if (FindContext[FindTransactionID].pListing != pListing) {
+        CloseContext(FindTransactionID);
+        FindContext[FindTransactionID].pListing = pListing;
+    }
+    FindContext[FindTransactionID].NextEntry = NextEntry;
+}
+
 
 
 // Calls GetLastError() and maps the Win32 error to a VCEFSD kError... value.
@@ -375,8 +1498,24 @@ bool __fastcall IOFolderSharing::PowerOn(void)
     Callback.lpRoutine = CompletionRoutineStatic;
     Callback.lpParameter = this;
 
+    for (int i=0; i<kFolderSharingMaxRequests; ++i) {
+        Requests[i].Callback.lpRoutine = RequestRoutineStatic;
+        Requests[i].Callback.lpParameter = &Requests[i];
+        Requests[i].pThis = this;
+        Requests[i].fInUse = false;
+    }
+    RequestsInFlight = 0;
+    CompletedHead = 0;
+    CompletedCount = 0;
+    MaxIOSize = kFolderSharingMaxReadWriteSize;
+    hRequestsIdle = CreateEvent(NULL, TRUE, TRUE, NULL); // Manual-reset, initially signalled
+    if (hRequestsIdle == NULL) {
+        return false;
+    }
+
     SharedFileHandleManager.PowerOn();
     FindManager.PowerOn();
+    FolderCache.PowerOn();
 
     if ( Configuration.getFolderShareName() != NULL &&
          !Configuration.NoSecurityPrompt && 
@@ -530,9 +1669,15 @@ void __fastcall IOFolderSharing::AsyncReconfigure(void)
     // reconfiguration data.
     fNeedsReconfiguration = false;
 
-    // Reset the two managers:  they cache information about the FolderShareRoot
+    // Reset the managers:  they cache information about the FolderShareRoot
     SharedFileHandleManager.Reset();
     FindManager.Reset();
+    FolderCache.Flush();
+
+    // No queued request is running (see CompletionRoutine()), so forget any that
+    // finished but were never collected, along with the negotiated I/O size.
+    CompletedCount = 0;
+    MaxIOSize = kFolderSharingMaxReadWriteSize;
 
     if (NewRoot) {
         // Reconfiguration is enabling folder sharing at the directory NewRoot
@@ -569,6 +1714,7 @@ void __fastcall IOFolderSharing::AsyncReconfigure(void)
             }
         }
         
+        FolderCache.Start(FolderShareRoot);
         LOG_INFO(FOLDERSHARING, "Enabled for directory %S", FolderShareRoot);
     } else {
         // Reconfiguration is disabling folder sharing
@@ -585,6 +1731,7 @@ void __fastcall IOFolderSharing::AsyncReconfigure(void)
             // disable folder sharing
             CloseHandle(hIOComplete);
             hIOComplete = INVALID_HANDLE_VALUE;
+            FolderCache.Stop();
 
             LOG_INFO(FOLDERSHARING, "Disabled");
         }
@@ -641,6 +1788,8 @@ unsigned __int32 __fastcall IOFolderSharing::ReadWord(unsigned __int32 IOAddress
         return (IOPending > 0 ? 1 : 0);
     case 12:
         return Result;
+    case 16:
+        return PopCompletedRequest();
     default:
         TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
     }
@@ -669,6 +1818,10 @@ void __fastcall IOFolderSharing::WriteWord(unsigned __int32 IOAddress, unsigned
             }
             PreviousValue = Value;
         }
+        if (Code & kServerQueued) {
+            QueueRequest(Code & ~kServerQueued);
+            break;
+        }
         if (Code != kServerPollCompletion) {
             if (IOPending) {
                 // An async I/O (or async reconfigure) is already in progress
@@ -729,6 +1882,9 @@ void __fastcall IOFolderSharing::WriteWord(unsigned __int32 IOAddress, unsigned
         case kServerGetMaxIOSize:
             ServerGetMaxIOSize();
             break;
+        case kServerNegotiateIOSize:
+            ServerNegotiateIOSize();
+            break;
         default:
             TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE); 
             break;
@@ -740,6 +1896,9 @@ void __fastcall IOFolderSharing::WriteWord(unsigned __int32 IOAddress, unsigned
     case 12:
         Result = Value;
         break;
+    case 16:
+        // Ignore writes to CompletedPB
+        break;
     default:
         TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE); 
         break;
@@ -752,6 +1911,11 @@ void __fastcall IOFolderSharing::WriteWord(unsigned __int32 IOAddress, unsigned
 //  Pointer to the ServerPB structure.  If the WinCE address doens't
 //  point into guest RAM, then the emulator exits via TerminateWithMessage()
 IOFolderSharing::PServerPB IOFolderSharing::GetServerPB(void)
+{
+    return GetServerPB(ServerPBAddr);
+}
+
+IOFolderSharing::PServerPB IOFolderSharing::GetServerPB(unsigned __int32 Address)
 {
     size_t HostEffectiveAddress;
     PServerPB pServerPB;
@@ -759,7 +1923,7 @@ IOFolderSharing::PServerPB IOFolderSharing::GetServerPB(void)
     // Although vcefsd\main.cpp indicates that gpServerPB is a physical address, it really
     // isn't.  It is a kernel-mode address 0x0c200000.  That value|0x80000000 is what
     // is passed to VirtualCopy() as the 
-    HostEffectiveAddress = BoardMapGuestPhysicalToHostRAM(ServerPBAddr);
+    HostEffectiveAddress = BoardMapGuestPhysicalToHostRAM(Address);
     if (!HostEffectiveAddress) {
         TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
     }
@@ -792,7 +1956,9 @@ void __fastcall IOFolderSharing::ServerPollCompletion(void)
     DWORD dw;
     HANDLE Handles[2];
 
-    if (!IOPending) { // No IO is currently pending - return without the overhead of calling WFMO
+    if (!IOPending && (RequestsInFlight == 0 || CompletedCount != 0)) {
+        // No IO is currently pending, or a queued request has already completed - return
+        // without the overhead of calling WFMO
         LOG_VERBOSE(FOLDERSHARING, "ServerPollCompletion() - IOPending was zero.  Operation completed quickly.");
         Result = kErrorNoError;
         return;
@@ -930,6 +2096,7 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerCreate(class IOFolderSha
     }
     // else success
     CloseHandle(hFile);
+    FolderCache.Invalidate(FileName);
 
     LOG_VERBOSE(FOLDERSHARING, "ServerCreate() - success");
     return kErrorNoError; // indicate success
@@ -1040,6 +2207,13 @@ unsigned __int32 IOFolderSharing::AsyncServerSetEOF(class IOFolderSharing *pThis
         return kErrorInvalidHandle;
     }
 
+    // Write out any write-behind data first, so it can't land beyond the new EOF
+    UInt16 kError = SharedFileHandleManager.Flush(pServerPB->fHandle);
+    if (kError != kErrorNoError) {
+        return kError;
+    }
+    SharedFileHandleManager.DiscardReadAhead(pServerPB->fHandle);
+
     LARGE_INTEGER Pos;
     Pos.QuadPart = pServerPB->fPosition;
     if (!SetFilePointerEx(hFile, Pos, NULL, FILE_BEGIN)) {
@@ -1049,6 +2223,8 @@ unsigned __int32 IOFolderSharing::AsyncServerSetEOF(class IOFolderSharing *pThis
     if (!SetEndOfFile(hFile)) {
         return kErrorFromLastError();
     }
+    SharedFileHandleManager.SetPosition(pServerPB->fHandle, pServerPB->fPosition);
+    pThis->InvalidateSharedFile(pServerPB->fHandle);
 
     LOG_VERBOSE(FOLDERSHARING, "ServerSetEOF() - success");
     return kErrorNoError;
@@ -1231,8 +2407,9 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerGetInfo(IOFolderSharing
             return kError;
         }
 
-        if (GetFileAttributesEx(FileName, GetFileExInfoStandard, &FileAttributes) == 0) {
-            return kErrorFromLastError();
+        kError = FolderCache.GetAttributes(FileName, &FileAttributes);
+        if (kError != kErrorNoError) {
+            return kError;
         }
 
         pServerPB->fFileCreateTimeDate = FiletimeToLong(&FileAttributes.ftCreationTime);
@@ -1264,28 +2441,49 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerGetInfo(IOFolderSharing
             return kError;
         }
 
-        // Begin the enumeration
-        hFindFile = FindFirstFile(FileName, &FindFileData);
-        if (hFindFile == INVALID_HANDLE_VALUE) {
-            return kErrorFromLastError();
+        // Walk a cached listing of the directory, unless it is too large to cache
+        FolderCacheListing *pListing;
+        kError = FolderCache.GetListing(FileName, &pListing);
+        if (kError != kErrorNoError) {
+            return kError;
         }
-
-        // If this is really a WinCE FindFirst/FindNext enumeration, and the returned 
-        // name is "." or "..", ignore it and find the next entry.
-        while (wcscmp(FindFileData.cFileName, L".") == 0 || wcscmp(FindFileData.cFileName, L"..") == 0) {
-            if (!FindNextFile(hFindFile, &FindFileData)) {
-                // Close the hFindFile, as the enumeration has ended.
-                kError = kErrorFromLastError();
-                FindClose(hFindFile);
+        if (pListing) {
+            if (pListing->Count == 0) {
+                kError = pListing->EmptyError;
+                FolderCache.ReleaseListing(pListing);
                 return kError;
             }
-        }
-
-        if (fFindTransactionID == 0xffffffff) {
-            FindClose(hFindFile);
+            FolderCache.GetListingEntry(pListing, 0, &FindFileData);
+            if (fFindTransactionID == 0xffffffff) {
+                FolderCache.ReleaseListing(pListing);
+            } else {
+                // Preserve the listing for the FindNext call
+                FindManager.SetFindListing(fFindTransactionID, pListing, 1);
+            }
         } else {
-            // Preserve the enumeration handle for the FindNext call
-            FindManager.SetFindHandle(fFindTransactionID, hFindFile);
+            // Begin the enumeration
+            hFindFile = FindFirstFile(FileName, &FindFileData);
+            if (hFindFile == INVALID_HANDLE_VALUE) {
+                return kErrorFromLastError();
+            }
+
+            // If this is really a WinCE FindFirst/FindNext enumeration, and the returned 
+            // name is "." or "..", ignore it and find the next entry.
+            while (wcscmp(FindFileData.cFileName, L".") == 0 || wcscmp(FindFileData.cFileName, L"..") == 0) {
+                if (!FindNextFile(hFindFile, &FindFileData)) {
+                    // Close the hFindFile, as the enumeration has ended.
+                    kError = kErrorFromLastError();
+                    FindClose(hFindFile);
+                    return kError;
+                }
+            }
+
+            if (fFindTransactionID == 0xffffffff) {
+                FindClose(hFindFile);
+            } else {
+                // Preserve the enumeration handle for the FindNext call
+                FindManager.SetFindHandle(fFindTransactionID, hFindFile);
+            }
         }
 
         // Fill in the results of the enumeration
@@ -1296,22 +2494,36 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerGetInfo(IOFolderSharing
         WIN32_FIND_DATA FindFileData;
         unsigned __int32 fFindTransactionID;
         
-        // Get the enumeration handle
         fFindTransactionID = pServerPB->fFindTransactionID;
-        hFindFile = FindManager.GetFindHandle(fFindTransactionID);
-        if (hFindFile == INVALID_HANDLE_VALUE) {
-            return kErrorGeneralFailure;
-        }
 
-        // Find the next file, ignoring "." and ".."
-        do {
-            if (!FindNextFile(hFindFile, &FindFileData)) {
-                // Close the hFindFile, as the enumeration has ended.
-                kError = kErrorFromLastError();
+        // Take the next entry from the cached listing, if the enumeration has one
+        unsigned __int32 NextEntry;
+        FolderCacheListing *pListing = FindManager.GetFindListing(fFindTransactionID, &NextEntry);
+        if (pListing) {
+            if (NextEntry >= pListing->Count) {
+                // Release the listing, as the enumeration has ended.
                 FindManager.SetFindHandle(fFindTransactionID, INVALID_HANDLE_VALUE);
-                return kError;
+                return kErrorNoMoreFiles;
+            }
+            FolderCache.GetListingEntry(pListing, NextEntry, &FindFileData);
+            FindManager.SetFindListing(fFindTransactionID, pListing, NextEntry+1);
+        } else {
+            // Get the enumeration handle
+            hFindFile = FindManager.GetFindHandle(fFindTransactionID);
+            if (hFindFile == INVALID_HANDLE_VALUE) {
+                return kErrorGeneralFailure;
             }
-        } while (wcscmp(FindFileData.cFileName, L".") == 0 || wcscmp(FindFileData.cFileName, L"..") == 0);
+
+            // Find the next file, ignoring "." and ".."
+            do {
+                if (!FindNextFile(hFindFile, &FindFileData)) {
+                    // Close the hFindFile, as the enumeration has ended.
+                    kError = kErrorFromLastError();
+                    FindManager.SetFindHandle(fFindTransactionID, INVALID_HANDLE_VALUE);
+                    return kError;
+                }
+            } while (wcscmp(FindFileData.cFileName, L".") == 0 || wcscmp(FindFileData.cFileName, L"..") == 0);
+        }
 
         pThis->UpdateResultsFromFind(pServerPB, &FindFileData, true);
     }
@@ -1339,10 +2551,45 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerClose(class IOFolderShar
     // call is in progress.  The risk is that the Win32 HANDLE might be re-used after this
     // CloseHandle() and accidentally allow an AsyncServerRead() to read from a HANDLE not
     // shared with the guest OS.
-    
+
+    // Closing a file that was written updates its last-write time
+    pThis->InvalidateSharedFile(pServerPB->fHandle);
+
     return SharedFileHandleManager.CloseSharedFileHandle(pServerPB->fHandle);
 }
 
+// Maps a guest buffer used for a read or write.  Now that a negotiated transfer
+// can be much larger than a page, check that the whole buffer lies within guest RAM.
+//
+// Returns:
+//  NULL if any part of the buffer is outside of guest RAM
+//  the host address of the buffer on success
+LPVOID IOFolderSharing::MapGuestBuffer(UInt8 MYFAR *DTAPtr, UInt32 Size)
+{
+    size_t HostAddress = BoardMapGuestPhysicalToHostRAM(PtrToLong(DTAPtr));
+
+    if (HostAddress == 0) {
+        return NULL;
+    }
+    if (Size > 1 &&
+        BoardMapGuestPhysicalToHostRAM(PtrToLong(DTAPtr)+Size-1) != HostAddress+Size-1) {
+        return NULL;
+    }
+    return (LPVOID)HostAddress;
+}
+
+// Drops whatever the FolderCache holds about an open file, after the guest
+// changes it through its fHandle.
+void IOFolderSharing::InvalidateSharedFile(UInt16 fHandle)
+{
+    wchar_t *FileName;
+    UInt16 OpenMode;
+
+    if (SharedFileHandleManager.GetSharedFileHandleAttributes(fHandle, &OpenMode, &FileName)) {
+        FolderCache.InvalidateRelative(FileName);
+    }
+}
+
 // ServerRead - implements ReadFile()
 //
 //Parameters:
@@ -1364,20 +2611,20 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerRead(IOFolderSharing *pT
         return kErrorInvalidHandle;
     }
 
-    LPVOID lpvBuffer = (LPVOID)BoardMapGuestPhysicalToHostRAM(PtrToLong(pServerPB->fDTAPtr));
+    LPVOID lpvBuffer = MapGuestBuffer(pServerPB->fDTAPtr, pServerPB->fSize);
     if (lpvBuffer == NULL) {
         return kErrorReadFault;
     }
+    BoardMakeGuestRAMResident((size_t)lpvBuffer, pServerPB->fSize);
 
-    LARGE_INTEGER Pos;
-    Pos.QuadPart = pServerPB->fPosition;
-    if (!SetFilePointerEx(hFile, Pos, NULL, FILE_BEGIN)) {
-        return kErrorFromLastError();
-    }
-
+    // Read at fPosition without a separate seek, so queued reads and writes to the
+    // same file can't move each other's position.  The SharedFileHandleManager
+    // serves sequential reads from its read-ahead buffer.
     DWORD dwBytesRead;
-    if (!ReadFile(hFile, lpvBuffer, pServerPB->fSize, &dwBytesRead, NULL)) {
-        return kErrorFromLastError();
+    UInt16 kError = SharedFileHandleManager.Read(pServerPB->fHandle, pServerPB->fPosition,
+                                                 lpvBuffer, pServerPB->fSize, &dwBytesRead);
+    if (kError != kErrorNoError) {
+        return kError;
     }
 
     // Success
@@ -1408,21 +2655,21 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerWrite(IOFolderSharing *p
         return kErrorInvalidHandle;
     }
 
-    LPVOID lpvBuffer = (LPVOID)BoardMapGuestPhysicalToHostRAM(PtrToLong(pServerPB->fDTAPtr));
+    LPVOID lpvBuffer = MapGuestBuffer(pServerPB->fDTAPtr, pServerPB->fSize);
     if (lpvBuffer == NULL) {
         return kErrorWriteFault;
     }
+    BoardMakeGuestRAMResident((size_t)lpvBuffer, pServerPB->fSize);
 
-    LARGE_INTEGER Pos;
-    Pos.QuadPart = pServerPB->fPosition;
-    if (!SetFilePointerEx(hFile, Pos, NULL, FILE_BEGIN)) {
-        return kErrorFromLastError();
-    }
-
+    // Write at fPosition without a separate seek - see AsyncServerRead().  Sequential
+    // writes may be held in the SharedFileHandleManager's write-behind buffer.
     DWORD dwBytesWritten;
-    if (!WriteFile(hFile, lpvBuffer, pServerPB->fSize, &dwBytesWritten, NULL)) {
-        return kErrorFromLastError();
+    UInt16 kError = SharedFileHandleManager.Write(pServerPB->fHandle, pServerPB->fPosition,
+                                                  lpvBuffer, pServerPB->fSize, &dwBytesWritten);
+    if (kError != kErrorNoError) {
+        return kError;
     }
+    pThis->InvalidateSharedFile(pServerPB->fHandle);
 
     // Success
     pServerPB->fSize = dwBytesWritten;
@@ -1452,15 +2699,18 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerGetFCBInfo(IOFolderShari
         return kErrorInvalidHandle;
     }
 
-    LARGE_INTEGER CurrentPos;
-    LARGE_INTEGER Zero;
-
-    // Get the current file position
-    Zero.QuadPart=0;
-    if (!SetFilePointerEx(hFile, Zero, &CurrentPos, FILE_CURRENT)) {
-        return kErrorFromLastError();
+    // Write out any write-behind data, so the size is up to date
+    UInt16 kError = SharedFileHandleManager.Flush(fHandle);
+    if (kError != kErrorNoError) {
+        return kError;
     }
 
+    // Get the current file position.  Reads and writes are positional and may be
+    // served from buffers, so this is tracked by the SharedFileHandleManager
+    // rather than taken from the Win32 file pointer.
+    LARGE_INTEGER CurrentPos;
+    CurrentPos.QuadPart = SharedFileHandleManager.GetPosition(fHandle);
+
     // Get the file size and attributes
     BY_HANDLE_FILE_INFORMATION FileInfo;
     if (!GetFileInformationByHandle(hFile, &FileInfo)) {
@@ -1560,6 +2810,7 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerMkDir(class IOFolderShar
     if (!CreateDirectoryW(FileName, NULL)) {
         return kErrorFromLastError();
     }
+    FolderCache.Invalidate(FileName);
 
     LOG_VERBOSE(FOLDERSHARING, "ServerMkDir() - success");
     return kErrorNoError;
@@ -1593,6 +2844,7 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerRmDir(class IOFolderShar
     if (!RemoveDirectoryW(FileName)) {
         return kErrorFromLastError();
     }
+    FolderCache.Invalidate(FileName);
 
     LOG_VERBOSE(FOLDERSHARING, "ServerRmDir() - success");
     return kErrorNoError;
@@ -1632,6 +2884,7 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerSetAttributes(class IOFo
     if (!SetFileAttributes(FileName, pServerPB->fFileAttributes)) {
         return kErrorFromLastError();
     }
+    FolderCache.Invalidate(FileName); // before the date and time, which may fail
 
     // Set the new file date and time, if present
     unsigned __int32 fFileDateTime = pServerPB->fFileTimeDate;
@@ -1705,6 +2958,8 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerRename(class IOFolderSha
     if (!MoveFileEx(OldName, NewName, MOVEFILE_COPY_ALLOWED)) {
         return kErrorFromLastError();
     }
+    FolderCache.Invalidate(OldName);
+    FolderCache.Invalidate(NewName);
 
     LOG_VERBOSE(FOLDERSHARING, "ServerRename() - success");
     return kErrorNoError;
@@ -1737,6 +2992,7 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerDelete(class IOFolderSha
     if (!DeleteFile(FileName)) {
         return kErrorFromLastError();
     }
+    FolderCache.Invalidate(FileName);
 
     LOG_VERBOSE(FOLDERSHARING, "ServerDelete() - success");
     return kErrorNoError;
@@ -1745,8 +3001,33 @@ unsigned __int32 __fastcall IOFolderSharing::AsyncServerDelete(class IOFolderSha
 // Return the maximum support file I/O size
 void __fastcall IOFolderSharing::ServerGetMaxIOSize(void)
 {
-    LOG_VERBOSE(FOLDERSHARING, "ServerGetMaxIOSize - returning 0x%x", kFolderSharingMaxReadWriteSize);
-    SignalIOComplete(kFolderSharingMaxReadWriteSize);
+    LOG_VERBOSE(FOLDERSHARING, "ServerGetMaxIOSize - returning 0x%x", MaxIOSize);
+    SignalIOComplete(MaxIOSize);
+}
+
+// Agree on the largest read or write with the guest.  Drivers that don't send
+// this keep using kFolderSharingMaxReadWriteSize.
+//
+//Parameters:
+//    In:     inPB            - Ptr to a Server Parameter block
+//            ->fSize         - largest I/O the driver can issue
+//    Out:    Result          - the negotiated maximum I/O size
+//            inPB->fPosition - the number of queued requests that may be in flight
+void __fastcall IOFolderSharing::ServerNegotiateIOSize(void)
+{
+    PServerPB pServerPB = GetServerPB();
+    UInt32 Size = pServerPB->fSize;
+
+    // Keep to whole pages, and never go below what every driver already handles
+    Size = min(Size, (UInt32)kFolderSharingMaxNegotiatedSize) & ~(UInt32)4095;
+    if (Size < (UInt32)kFolderSharingMaxReadWriteSize) {
+        Size = kFolderSharingMaxReadWriteSize;
+    }
+    MaxIOSize = Size;
+    pServerPB->fPosition = kFolderSharingMaxRequests;
+
+    LOG_VERBOSE(FOLDERSHARING, "ServerNegotiateIOSize - guest asked for 0x%x, returning 0x%x", pServerPB->fSize, MaxIOSize);
+    SignalIOComplete(MaxIOSize);
 }
 
 // Queue up an async call to run on the worker thread.  The queue
@@ -1758,6 +3039,117 @@ void IOFolderSharing::AsyncCall(pfnAsyncRequest_t pfn)
     CompletionPort.QueueWorkitem(&Callback);
 }
 
+// Queue a read or write that runs alongside any others already queued.  It uses
+// the ServerPB at ServerPBAddr, which must not be reused until the request shows up
+// in the CompletedPB register, and its result is returned in that ServerPB's fResult.
+//
+// Called with the IOLock held.  Result is set to kErrorNoError if the request was
+// queued, otherwise kErrorInvalidFunction and the driver may retry after polling.
+void IOFolderSharing::QueueRequest(unsigned __int32 RequestCode)
+{
+    pfnAsyncRequest_t pfn;
+    int i;
+
+    switch (RequestCode) {
+    case kServerRead:
+        pfn = AsyncServerRead;
+        break;
+    case kServerWrite:
+        pfn = AsyncServerWrite;
+        break;
+    default:
+        // Only reads and writes are safe to run concurrently
+        Result = kErrorInvalidFunction;
+        return;
+    }
+
+    // Requests in the Code register (opens, closes, etc.) and reconfiguration
+    // wait for the queued requests to drain, so don't start any more meanwhile.
+    EnterCriticalSection(&FolderShareLock);
+    bool fBusy = (IOPending != 0 || fNeedsReconfiguration);
+    LeaveCriticalSection(&FolderShareLock);
+    if (fBusy) {
+        Result = kErrorInvalidFunction;
+        return;
+    }
+
+    // Validate the ServerPB now, rather than on the worker thread
+    GetServerPB(ServerPBAddr);
+
+    // A request's slot is reused as soon as it completes, but its CompletedPB entry
+    // stays until the driver collects it, so count both against the limit.
+    for (i=0; i<kFolderSharingMaxRequests; ++i) {
+        if (!Requests[i].fInUse) {
+            break;
+        }
+    }
+    if (i == kFolderSharingMaxRequests || RequestsInFlight+CompletedCount >= kFolderSharingMaxRequests) {
+        Result = kErrorInvalidFunction;
+        return;
+    }
+
+    Requests[i].fInUse = true;
+    Requests[i].pfn = pfn;
+    Requests[i].ServerPBAddr = ServerPBAddr;
+    if (RequestsInFlight++ == 0) {
+        ResetEvent(hRequestsIdle);
+    }
+    if (!CompletionPort.QueueWorkitem(&Requests[i].Callback)) {
+        Requests[i].fInUse = false;
+        if (--RequestsInFlight == 0) {
+            SetEvent(hRequestsIdle);
+        }
+        Result = kErrorInvalidFunction;
+        return;
+    }
+    Result = kErrorNoError;
+}
+
+// Called by the IO Completion port threadpool for a queued request
+//   lpParameter = the QueuedRequest
+//   dwBytesTransferred = 0
+//   lpOverlapped = 0
+void IOFolderSharing::RequestRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
+{
+    QueuedRequest *pRequest = (QueuedRequest *)lpParameter;
+
+    pRequest->pThis->RequestRoutine(pRequest);
+}
+
+void IOFolderSharing::RequestRoutine(QueuedRequest *pRequest)
+{
+    PServerPB pServerPB = GetServerPB(pRequest->ServerPBAddr);
+
+    pServerPB->fResult = (UInt16)pRequest->pfn(this, pServerPB);
+    if (pServerPB->fResult != kErrorNoError) {
+        LOG_VERBOSE(FOLDERSHARING, "Queued server call failed:  0x%x", pServerPB->fResult);
+    }
+
+    EnterCriticalSection(&IOLock);
+    ASSERT(CompletedCount < kFolderSharingMaxRequests);
+    CompletedPBs[(CompletedHead+CompletedCount) % kFolderSharingMaxRequests] = pRequest->ServerPBAddr;
+    CompletedCount++;
+    pRequest->fInUse = false;
+    if (--RequestsInFlight == 0) {
+        SetEvent(hRequestsIdle);
+    }
+    SetEvent(hIOComplete);
+    LeaveCriticalSection(&IOLock);
+}
+
+// Returns the ServerPB address of the oldest completed queued request, or 0 if
+// none has completed since the last call.  Called with the IOLock held.
+unsigned __int32 IOFolderSharing::PopCompletedRequest(void)
+{
+    if (CompletedCount == 0) {
+        return 0;
+    }
+    unsigned __int32 Address = CompletedPBs[CompletedHead];
+    CompletedHead = (CompletedHead+1) % kFolderSharingMaxRequests;
+    CompletedCount--;
+    return Address;
+}
+
 // Called by the IO Completion port threadpool
 //   lpParameter = this pointer
 //   dwBytesTransferred = 0
@@ -1772,10 +3164,20 @@ void IOFolderSharing::CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesT
 // Called by the IO Completion port threadpool
 void IOFolderSharing::CompletionRoutine()
 {
+    // Let the queued requests finish first:  they may be using file handles that
+    // this request closes, or that reconfiguration throws away.
+    CompletionPort.BlockingWait(hRequestsIdle);
+
     // Copy pfnAsyncRequest into a local and zero it out before making the call
     pfnAsyncRequest_t pfn = pfnAsyncRequest;
     pfnAsyncRequest = NULL;
 
+    // Requests other than reads and writes may look at files by name, so write
+    // out any write-behind data before they do.
+    if (pfn != AsyncServerRead && pfn != AsyncServerWrite) {
+        SharedFileHandleManager.FlushAll();
+    }
+
     EnterCriticalSection(&FolderShareLock);
     if (fNeedsReconfiguration) {
         fNeedsReconfiguration = false;
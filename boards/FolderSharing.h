@@ -79,11 +79,15 @@ private:
     void SignalIOComplete(unsigned __int32 ResultValue);
     __inline bool IsFolderSharingEnabled(void) { return (hIOComplete != INVALID_HANDLE_VALUE); }
     PServerPB GetServerPB(void); // this either succeeds or calls TerminateWithMessage() to exit the process
+    PServerPB GetServerPB(unsigned __int32 Address);
     void AsyncCall(pfnAsyncRequest_t pfn);
+    void QueueRequest(unsigned __int32 RequestCode);
 
     static unsigned __int32 FiletimeToLong(const FILETIME *ft);
     static bool LongToFiletime(unsigned __int32 fFileTimeDate, FILETIME *ft);
     UInt16 GetWin32Path(__out_bcount(cbWinCEPath) wchar_t *WinCEPath, size_t cbWinCEPath, __inout_ecount(cchWin32Path) wchar_t *Win32Path, size_t cchWin32Path);
+    static LPVOID MapGuestBuffer(UInt8 MYFAR *DTAPtr, UInt32 Size);
+    void InvalidateSharedFile(UInt16 fHandle);
     static bool DesiredAccessFromOpenMode(UInt16 OpenMode, DWORD *pdwDesiredAccess);
     static bool ShareModeFromOpenMode(UInt16 OpenMode, DWORD *pdwShareMode);
     static UInt16 GetCEFileAttributes(DWORD dwWin32FileAttributes);
@@ -106,6 +110,7 @@ private:
     static unsigned __int32 __fastcall AsyncServerRename(class IOFolderSharing *pThis, PServerPB pServerPB);
     static unsigned __int32 __fastcall AsyncServerDelete(class IOFolderSharing *pThis, PServerPB pServerPB);
     void __fastcall ServerGetMaxIOSize(void);
+    void __fastcall ServerNegotiateIOSize(void);
 
     // Guards FolderShareRoot, NewRoot, and fNeedsReconfiguration, fGuestReset,
     // fDontTriggerInterrupt 
@@ -122,6 +127,29 @@ private:
     unsigned __int32 IOResult;
     pfnAsyncRequest_t pfnAsyncRequest;
 
+    // Queued requests:  reads and writes that the guest issues with kServerQueued
+    // set in the Code register.  Several of these run at once on the CompletionPort
+    // workers, each with its own ServerPB, while the request in the Code/Result
+    // registers above is run only once all of them have finished.  All of these
+    // fields are guarded by the IOLock.
+    #define kFolderSharingMaxRequests 8
+    struct QueuedRequest {
+        COMPLETIONPORT_CALLBACK Callback;
+        class IOFolderSharing *pThis;
+        pfnAsyncRequest_t pfn;
+        unsigned __int32 ServerPBAddr;
+        bool fInUse;
+    } Requests[kFolderSharingMaxRequests];
+    unsigned __int32 RequestsInFlight;
+    HANDLE hRequestsIdle;           // manual-reset, signalled while RequestsInFlight is 0
+    unsigned __int32 CompletedPBs[kFolderSharingMaxRequests];   // ServerPBAddr of each finished request
+    unsigned __int32 CompletedHead;
+    unsigned __int32 CompletedCount;
+    unsigned __int32 MaxIOSize;     // largest read or write, as negotiated with the guest
+    static void RequestRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
+    void RequestRoutine(QueuedRequest *pRequest);
+    unsigned __int32 PopCompletedRequest(void);
+
     // Fields and methods used only to manage reconfiguration, which is run on the worker thread, async from the 
     // Reconfigure() method itself
     wchar_t *NewRoot; // New FolderShareRoot value to use
@@ -136,6 +164,7 @@ private:
     unsigned __int32 Code;
     unsigned __int32 IOPending;
     unsigned __int32 Result;
+    // CompletedPB (offset 16) is read-only, and is computed by PopCompletedRequest()
 };
 
 #endif // FOLDERSHARING__H_
@@ -0,0 +1,576 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "resource.h"
+#include "GuestMemory.h"
+#include "..\..\features\zlib\ZLib.h"
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "guestmemory.tmh"
+#include "vsd_logging_inc.h"
+
+// Regions currently being lazily populated.  The board has at most three (flash,
+// RAM and extension RAM), all registered from the main thread during restore.
+static GuestMemoryRegion *LazyRegions[4];
+static PVOID hLazyExceptionHandler;
+static CRITICAL_SECTION LazyLock;
+static bool LazyLockInitialized;
+
+MappedStateFile * __fastcall MappedStateFile::Open(HANDLE hFile)
+{
+    LARGE_INTEGER FileSize;
+
+    if (!GetFileSizeEx(hFile, &FileSize) || FileSize.HighPart != 0) {
+        return NULL;
+    }
+
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL) {
+        return NULL;
+    }
+    const unsigned __int8 *View = (const unsigned __int8 *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping); // the view holds its own reference on the section
+    if (View == NULL) {
+        return NULL;
+    }
+
+    MappedStateFile *pFile = new MappedStateFile;
+    if (pFile == NULL) {
+        UnmapViewOfFile(View);
+        return NULL;
+    }
+    pFile->View = View;
+    pFile->Size = FileSize.QuadPart;
+    return pFile;
+}
+
+void MappedStateFile::Release(void)
+{
+    if (InterlockedDecrement(&RefCount) == 0) {
+        delete this;
+    }
+}
+
+MappedStateFile::~MappedStateFile()
+{
+    if (View) {
+        UnmapViewOfFile(View);
+    }
+}
+
+// Large pages are locked in memory, so the process must hold SeLockMemoryPrivilege
+// (the "Lock pages in memory" user right) and enable it before allocating them.
+size_t __fastcall GetLargePageSize(void)
+{
+    static bool Initialized;
+    static size_t LargePageSize;
+    HANDLE hToken;
+    TOKEN_PRIVILEGES Privileges;
+    DWORD Error;
+
+    if (Initialized) {
+        return LargePageSize;
+    }
+    Initialized = true;
+
+    size_t Minimum = GetLargePageMinimum();
+    if (Minimum == 0) {
+        LOG_WARN(GENERAL, "The host does not support large pages");
+        return 0;
+    }
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &hToken)) {
+        return 0;
+    }
+    Privileges.PrivilegeCount = 1;
+    Privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // AdjustTokenPrivileges() succeeds, but sets ERROR_NOT_ALL_ASSIGNED, if the
+    // token lacks the privilege
+    if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &Privileges.Privileges[0].Luid)) {
+        AdjustTokenPrivileges(hToken, FALSE, &Privileges, 0, NULL, NULL);
+    }
+    Error = GetLastError();
+    CloseHandle(hToken);
+    if (Error != ERROR_SUCCESS) {
+        LOG_WARN(GENERAL, "Large pages are not available without SeLockMemoryPrivilege (%d)", Error);
+        return 0;
+    }
+
+    LOG_INFO(GENERAL, "Using %d byte large pages", Minimum);
+    LargePageSize = Minimum;
+    return LargePageSize;
+}
+
+bool __fastcall GuestMemoryRegion::Allocate(size_t RegionSize)
+{
+    if (Base) {
+        ASSERT(Size == RegionSize);
+        return true;
+    }
+
+    // The fleet's children map the section copy-on-write, which large pages don't
+    // support
+    size_t LargePageSize = (Configuration.LargePages && Configuration.FleetSize == 0) ? GetLargePageSize() : 0;
+    if (LargePageSize) {
+        size_t SectionSize = (RegionSize + LargePageSize - 1) & ~(LargePageSize - 1);
+
+        hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, 0, (DWORD)SectionSize, NULL);
+        if (hSection != NULL) {
+            Base = (unsigned __int8 *)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, SectionSize);
+            if (Base == NULL) {
+                CloseHandle(hSection);
+                hSection = NULL;
+            }
+        }
+        if (Base != NULL) {
+            Size = RegionSize;
+            LargePages = true;
+            return true;
+        }
+        LOG_WARN(GENERAL, "Failed to allocate %d bytes of large pages (%d), using small pages", SectionSize, GetLastError());
+    }
+
+    hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)RegionSize, NULL);
+    if (hSection == NULL) {
+        return false;
+    }
+    Base = (unsigned __int8 *)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, RegionSize);
+    if (Base == NULL) {
+        CloseHandle(hSection);
+        hSection = NULL;
+        return false;
+    }
+    Size = RegionSize;
+    return true;
+}
+
+bool __fastcall GuestMemoryRegion::Share(HANDLE *phShared)
+{
+    if (Base == NULL) {
+        *phShared = NULL;
+        return true;
+    }
+
+    // The children map the section itself, which must therefore hold every block
+    CompleteLazyPopulate();
+    return DuplicateHandle(GetCurrentProcess(), hSection, GetCurrentProcess(), phShared,
+                           FILE_MAP_READ, TRUE, 0) != FALSE;
+}
+
+bool __fastcall GuestMemoryRegion::AttachCopyOnWrite(HANDLE hShared, size_t RegionSize)
+{
+    if (Base) {
+        ASSERT(Size == RegionSize);
+        return true;
+    }
+
+    Base = (unsigned __int8 *)MapViewOfFile(hShared, FILE_MAP_COPY, 0, 0, RegionSize);
+    if (Base == NULL) {
+        return false;
+    }
+    hSection = hShared;
+    Size = RegionSize;
+    CopyOnWrite = true;
+    return true;
+}
+
+bool __fastcall GuestMemoryRegion::BeginLazyPopulate(MappedStateFile *pFile, const unsigned __int8 *pSource, unsigned __int32 *BlockTable)
+{
+    size_t BlockCount = (Size + GUEST_MEMORY_BLOCK_SIZE - 1) / GUEST_MEMORY_BLOCK_SIZE;
+
+    ASSERT(Base && (Size % GUEST_MEMORY_BLOCK_SIZE) == 0);
+
+    if (CopyOnWrite || LargePages) {
+        // Blocks are filled through a writable alias of the section, which would
+        // modify the pages shared with the other processes.  Large pages can be
+        // neither protected nor aliased one block at a time.
+        return false;
+    }
+
+    // Any earlier lazy restore into this region is abandoned:  its contents are about
+    // to be replaced.
+    EndLazyPopulate();
+
+    // Validate the source before trusting it:  every block must lie within the
+    // mapped file and decompress to no more than one block.
+    const unsigned __int8 *FileEnd = pFile->getView() + pFile->getSize();
+    if (BlockTable) {
+        for (size_t i=0; i<BlockCount; ++i) {
+            if (BlockTable[i] > BlockTable[i+1] || BlockTable[i+1]-BlockTable[i] > GUEST_MEMORY_BLOCK_SIZE) {
+                return false;
+            }
+        }
+        if (pSource + BlockTable[BlockCount] > FileEnd) {
+            return false;
+        }
+    } else if (pSource + Size > FileEnd) {
+        return false;
+    }
+
+    bool *Present = new bool[BlockCount];
+    if (Present == NULL) {
+        return false;
+    }
+    memset(Present, 0, BlockCount*sizeof(bool));
+
+    Source = pSource;
+    BlockOffsets = BlockTable;
+    if (!RegisterLazy(pFile, Present)) {
+        Source = NULL;
+        BlockOffsets = NULL;
+        return false;
+    }
+    return true;
+}
+
+static int __cdecl CompareExtents(const void *p1, const void *p2)
+{
+    const GuestMemoryExtent *pExtent1 = (const GuestMemoryExtent *)p1;
+    const GuestMemoryExtent *pExtent2 = (const GuestMemoryExtent *)p2;
+
+    if (pExtent1->HostAddress < pExtent2->HostAddress) {
+        return -1;
+    }
+    return (pExtent1->HostAddress > pExtent2->HostAddress) ? 1 : 0;
+}
+
+bool __fastcall GuestMemoryRegion::BeginLazyLoad(MappedStateFile *pFile, const GuestMemoryExtent *pExtents, size_t Count)
+{
+    size_t BlockCount = (Size + GUEST_MEMORY_BLOCK_SIZE - 1) / GUEST_MEMORY_BLOCK_SIZE;
+    const unsigned __int8 *FileEnd = pFile->getView() + pFile->getSize();
+    size_t RegionCount = 0;
+    size_t i;
+
+    ASSERT((Size % GUEST_MEMORY_BLOCK_SIZE) == 0);
+
+    // Anything still pending from a saved state is older than the image
+    EndLazyPopulate();
+
+    // An unallocated region contains no extents
+    for (i=0; i<Count; ++i) {
+        if (Contains(pExtents[i].HostAddress)) {
+            if (pExtents[i].Length > (size_t)Base+Size-pExtents[i].HostAddress ||
+                pExtents[i].pSource < pFile->getView() || pExtents[i].Length > (size_t)(FileEnd-pExtents[i].pSource)) {
+                return false;
+            }
+            RegionCount++;
+        }
+    }
+    if (RegionCount == 0) {
+        return true;
+    }
+    if (CopyOnWrite || LargePages) {
+        return false;
+    }
+
+    GuestMemoryExtent *RegionExtents = new GuestMemoryExtent[RegionCount];
+    bool *Present = new bool[BlockCount];
+    if (RegionExtents == NULL || Present == NULL) {
+        delete [] RegionExtents;
+        delete [] Present;
+        return false;
+    }
+    RegionCount = 0;
+    for (i=0; i<Count; ++i) {
+        if (Contains(pExtents[i].HostAddress)) {
+            RegionExtents[RegionCount++] = pExtents[i];
+        }
+    }
+
+    // The image is copied in file order, so overlapping sections would depend on
+    // that order.  Sort them for PopulateBlock's binary search, and refuse overlaps.
+    qsort(RegionExtents, RegionCount, sizeof(GuestMemoryExtent), CompareExtents);
+    for (i=1; i<RegionCount; ++i) {
+        if (RegionExtents[i-1].HostAddress+RegionExtents[i-1].Length > RegionExtents[i].HostAddress) {
+            delete [] RegionExtents;
+            delete [] Present;
+            return false;
+        }
+    }
+
+    // Only the blocks holding part of the image need to wait for it
+    for (i=0; i<BlockCount; ++i) {
+        Present[i] = true;
+    }
+    for (i=0; i<RegionCount; ++i) {
+        if (RegionExtents[i].Length) {
+            size_t First = (RegionExtents[i].HostAddress-(size_t)Base) / GUEST_MEMORY_BLOCK_SIZE;
+            size_t Last = (RegionExtents[i].HostAddress+RegionExtents[i].Length-1-(size_t)Base) / GUEST_MEMORY_BLOCK_SIZE;
+            for (size_t Block=First; Block<=Last; ++Block) {
+                Present[Block] = false;
+            }
+        }
+    }
+
+    Extents = RegionExtents;
+    ExtentCount = RegionCount;
+    if (!RegisterLazy(pFile, Present)) {
+        Extents = NULL;
+        ExtentCount = 0;
+        delete [] RegionExtents;
+        return false;
+    }
+    return true;
+}
+
+// Makes the blocks that are not yet Present inaccessible and registers the region
+// for lazy population from pFile.  The region takes ownership of Present.  If
+// every block is already present, BlockOffsets and Extents are released too, as
+// EndLazyPopulate() would have done.
+bool __fastcall GuestMemoryRegion::RegisterLazy(MappedStateFile *pFile, bool *Present)
+{
+    size_t BlockCount = Size / GUEST_MEMORY_BLOCK_SIZE;
+    size_t Remaining = 0;
+    DWORD OldProtect;
+    size_t i;
+
+    if (!LazyLockInitialized) {
+        InitializeCriticalSection(&LazyLock);
+        LazyLockInitialized = true;
+    }
+    if (!hLazyExceptionHandler) {
+        // Register as the first handler, so that accesses are resolved before any
+        // frame-based handler gets a chance to see the access violation.
+        hLazyExceptionHandler = AddVectoredExceptionHandler(1, LazyExceptionHandler);
+        if (!hLazyExceptionHandler) {
+            delete [] Present;
+            return false;
+        }
+    }
+
+    int Slot;
+    for (Slot=0; Slot<ARRAY_SIZE(LazyRegions); ++Slot) {
+        if (LazyRegions[Slot] == NULL) {
+            break;
+        }
+    }
+    if (Slot == ARRAY_SIZE(LazyRegions)) {
+        ASSERT(FALSE);
+        delete [] Present;
+        return false;
+    }
+
+    // Protect each run of missing blocks with one call
+    for (i=0; i<BlockCount; ) {
+        if (Present[i]) {
+            ++i;
+            continue;
+        }
+        size_t RunEnd = i+1;
+        while (RunEnd < BlockCount && !Present[RunEnd]) {
+            ++RunEnd;
+        }
+        if (!VirtualProtect(Base+i*GUEST_MEMORY_BLOCK_SIZE, (RunEnd-i)*GUEST_MEMORY_BLOCK_SIZE, PAGE_NOACCESS, &OldProtect)) {
+            VirtualProtect(Base, Size, PAGE_READWRITE, &OldProtect);
+            delete [] Present;
+            return false;
+        }
+        Remaining += RunEnd-i;
+        i = RunEnd;
+    }
+    if (Remaining == 0) {
+        delete [] Present;
+        delete [] BlockOffsets;
+        BlockOffsets = NULL;
+        delete [] Extents;
+        Extents = NULL;
+        ExtentCount = 0;
+        Source = NULL;
+        return true;
+    }
+
+    pFile->AddRef();
+    pStateFile = pFile;
+    BlockPresent = Present;
+    BlocksPopulated = 0;
+    BlocksRemaining = Remaining;
+    LazyRegions[Slot] = this;
+    return true;
+}
+
+// Copies or decompresses one block from the save-state file, or assembles it from
+// the ROM image's extents, into the region.  Must be called with LazyLock held.
+bool __fastcall GuestMemoryRegion::PopulateBlock(size_t BlockIndex)
+{
+    if (BlockPresent[BlockIndex]) {
+        return true;
+    }
+
+    size_t Offset = BlockIndex*GUEST_MEMORY_BLOCK_SIZE;
+
+    // Fill the block through a private alias view:  the guest's view stays
+    // PAGE_NOACCESS until the data is complete, so no other thread can observe a
+    // partially-restored block.
+    unsigned __int8 *Alias = (unsigned __int8 *)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, (DWORD)Offset, GUEST_MEMORY_BLOCK_SIZE);
+    if (Alias == NULL) {
+        return false;
+    }
+
+    bool Result = true;
+    __try {
+        if (Extents) {
+            // Binary search for the first extent that ends past the block's start,
+            // then copy the part of each extent that falls in the block.  The rest
+            // of the block keeps whatever the section already held.
+            size_t BlockStart = (size_t)Base+Offset;
+            size_t BlockEnd = BlockStart+GUEST_MEMORY_BLOCK_SIZE;
+            size_t Low = 0;
+            size_t High = ExtentCount;
+
+            while (Low < High) {
+                size_t Middle = (Low+High)/2;
+                if (Extents[Middle].HostAddress+Extents[Middle].Length <= BlockStart) {
+                    Low = Middle+1;
+                } else {
+                    High = Middle;
+                }
+            }
+            for (size_t i=Low; i<ExtentCount && Extents[i].HostAddress < BlockEnd; ++i) {
+                size_t CopyStart = max(Extents[i].HostAddress, BlockStart);
+                size_t CopyEnd = min(Extents[i].HostAddress+Extents[i].Length, BlockEnd);
+
+                memcpy(Alias+(CopyStart-BlockStart), Extents[i].pSource+(CopyStart-Extents[i].HostAddress), CopyEnd-CopyStart);
+            }
+        } else if (BlockOffsets == NULL) {
+            memcpy(Alias, Source+Offset, GUEST_MEMORY_BLOCK_SIZE);
+        } else {
+            unsigned long CompressedLength = BlockOffsets[BlockIndex+1]-BlockOffsets[BlockIndex];
+            const unsigned __int8 *Compressed = Source + BlockOffsets[BlockIndex];
+
+            if (CompressedLength == GUEST_MEMORY_BLOCK_SIZE) {
+                // Stored without compression
+                memcpy(Alias, Compressed, GUEST_MEMORY_BLOCK_SIZE);
+            } else {
+                unsigned long DataLength = GUEST_MEMORY_BLOCK_SIZE;
+                if (uncompress(Alias, &DataLength, Compressed, CompressedLength) != Z_OK ||
+                    DataLength != GUEST_MEMORY_BLOCK_SIZE) {
+                    Result = false;
+                }
+            }
+        }
+    }
+    __except(GetExceptionCode()==EXCEPTION_IN_PAGE_ERROR ?
+        EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+    {
+        // Failed to read from the view.  This is most likely caused by a network problem
+        Result = false;
+    }
+    UnmapViewOfFile(Alias);
+    if (!Result) {
+        return false;
+    }
+
+    DWORD OldProtect;
+    if (!VirtualProtect(Base+Offset, GUEST_MEMORY_BLOCK_SIZE, PAGE_READWRITE, &OldProtect)) {
+        return false;
+    }
+    BlockPresent[BlockIndex] = true;
+    BlocksPopulated++;
+    if (--BlocksRemaining == 0) {
+        LOG_INFO(GENERAL, "Lazy population of region at %p complete", Base);
+        EndLazyPopulate();
+    }
+    return true;
+}
+
+// Unregisters the region from lazy population and releases the save-state file.
+// Must be called with LazyLock held, or before any other thread is running.
+void __fastcall GuestMemoryRegion::EndLazyPopulate(void)
+{
+    if (pStateFile == NULL) {
+        return;
+    }
+
+    if (BlocksRemaining) {
+        // Abandoned partway:  leave the unpopulated blocks zero-filled but accessible
+        DWORD OldProtect;
+        VirtualProtect(Base, Size, PAGE_READWRITE, &OldProtect);
+        BlocksRemaining = 0;
+    }
+    for (int i=0; i<ARRAY_SIZE(LazyRegions); ++i) {
+        if (LazyRegions[i] == this) {
+            LazyRegions[i] = NULL;
+        }
+    }
+    delete [] BlockPresent;
+    BlockPresent = NULL;
+    delete [] BlockOffsets;
+    BlockOffsets = NULL;
+    delete [] Extents;
+    Extents = NULL;
+    ExtentCount = 0;
+    Source = NULL;
+    pStateFile->Release();
+    pStateFile = NULL;
+}
+
+// Host I/O into guest memory (ReadFile/WriteFile on a guest buffer) is performed
+// by the kernel and does not raise a user-mode access violation, so callers must
+// make the buffer resident before passing it to the host.
+void __fastcall GuestMemoryRegion::MakeResident(size_t HostAddress, size_t Length)
+{
+    if (!isLazy() || Length == 0) {
+        return;
+    }
+
+    size_t First = (HostAddress - (size_t)Base) / GUEST_MEMORY_BLOCK_SIZE;
+    size_t Last = (min(HostAddress + Length, (size_t)Base + Size) - 1 - (size_t)Base) / GUEST_MEMORY_BLOCK_SIZE;
+
+    EnterCriticalSection(&LazyLock);
+    for (size_t i=First; i<=Last && isLazy(); ++i) {
+        if (!PopulateBlock(i)) {
+            LeaveCriticalSection(&LazyLock);
+            TerminateWithMessage(ID_MESSAGE_FAILED_SAVED_FILE_READ);
+        }
+    }
+    LeaveCriticalSection(&LazyLock);
+}
+
+// Populates every remaining block.  Called before the region is written to a new
+// save-state file, since the old file cannot be replaced while it is still mapped.
+void __fastcall GuestMemoryRegion::CompleteLazyPopulate(void)
+{
+    if (isLazy()) {
+        MakeResident((size_t)Base, Size);
+    }
+}
+
+LONG CALLBACK GuestMemoryRegion::LazyExceptionHandler(PEXCEPTION_POINTERS pExceptionInfo)
+{
+    if (pExceptionInfo->ExceptionRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION ||
+        pExceptionInfo->ExceptionRecord->NumberParameters < 2) {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    size_t FaultAddress = (size_t)pExceptionInfo->ExceptionRecord->ExceptionInformation[1];
+
+    EnterCriticalSection(&LazyLock);
+    for (int i=0; i<ARRAY_SIZE(LazyRegions); ++i) {
+        GuestMemoryRegion *pRegion = LazyRegions[i];
+
+        if (pRegion && pRegion->Contains(FaultAddress)) {
+            if (!pRegion->PopulateBlock((FaultAddress - (size_t)pRegion->Base) / GUEST_MEMORY_BLOCK_SIZE)) {
+                LeaveCriticalSection(&LazyLock);
+                TerminateWithMessage(ID_MESSAGE_FAILED_SAVED_FILE_READ);
+            }
+            LeaveCriticalSection(&LazyLock);
+            // Retry the faulting instruction
+            return EXCEPTION_CONTINUE_EXECUTION;
+        }
+    }
+    LeaveCriticalSection(&LazyLock);
+    return EXCEPTION_CONTINUE_SEARCH;
+}
@@ -0,0 +1,114 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef GUESTMEMORY_H__
+#define GUESTMEMORY_H__
+
+// Block size used by the 'BMEM' save-state format and by lazy restore.  It must be
+// a multiple of the host allocation granularity (64k on all Win32 hosts) so that
+// a single block can be mapped through an alias view.
+#define GUEST_MEMORY_BLOCK_SIZE (64*1024)
+
+// A read-only view of an entire save-state file or ROM image, shared by every
+// GuestMemoryRegion that is still being lazily populated from it.  The view is
+// unmapped once the last region has been fully populated.
+class MappedStateFile {
+public:
+    static MappedStateFile * __fastcall Open(HANDLE hFile);
+
+    void AddRef(void) { InterlockedIncrement(&RefCount); }
+    void Release(void);
+
+    const unsigned __int8 *getView(void) const { return View; }
+    unsigned __int64 getSize(void) const { return Size; }
+
+private:
+    MappedStateFile() { View = NULL; Size = 0; RefCount = 1; }
+    ~MappedStateFile();
+
+    const unsigned __int8 *View;
+    unsigned __int64 Size;
+    LONG RefCount;
+};
+
+// One section of a ROM image, to be copied to HostAddress by BeginLazyLoad()
+struct GuestMemoryExtent {
+    size_t HostAddress;
+    const unsigned __int8 *pSource;     // within the MappedStateFile's view
+    size_t Length;
+};
+
+// A range of guest memory (RAM or flash), backed by a pagefile section.  Using a
+// section instead of a plain allocation allows the emulator to map a second,
+// private view of any block so the block can be filled in before it becomes
+// accessible to the guest and to the peripheral threads.
+class GuestMemoryRegion {
+public:
+    GuestMemoryRegion() { hSection = NULL; Base = NULL; Size = 0; CopyOnWrite = false; LargePages = false;
+                          pStateFile = NULL; Source = NULL; BlockOffsets = NULL; BlockPresent = NULL;
+                          Extents = NULL; ExtentCount = 0;
+                          BlocksRemaining = 0; BlocksPopulated = 0; }
+
+    bool __fastcall Allocate(size_t RegionSize);
+
+    // Sharing between emulator processes (see Fleet.h).  Share() returns an
+    // inheritable, read-only handle to the section; AttachCopyOnWrite() maps such a
+    // handle in place of Allocate(), so pages are only copied once they are written.
+    bool __fastcall Share(HANDLE *phShared);
+    bool __fastcall AttachCopyOnWrite(HANDLE hShared, size_t RegionSize);
+
+    inline unsigned __int8 *getBase(void) const { return Base; }
+    inline size_t getSize(void) const { return Size; }
+    inline bool Contains(size_t HostAddress) const
+        { return HostAddress >= (size_t)Base && HostAddress < (size_t)Base+Size; }
+
+    // Lazy restore.  The region is made inaccessible and each GUEST_MEMORY_BLOCK_SIZE
+    // block is copied or decompressed from the save-state file on first access.
+    // BlockTable is NULL for an uncompressed ('UMEM') image, or points to the
+    // BlockCount+1 entry offset table of a block-compressed ('BMEM') image.  The
+    // region takes ownership of BlockTable.
+    bool __fastcall BeginLazyPopulate(MappedStateFile *pFile, const unsigned __int8 *pSource, unsigned __int32 *BlockTable);
+    // Lazy ROM load.  Only the blocks that the extents within this region touch are
+    // made inaccessible, and each is assembled from those extents on first access.
+    // Extents outside the region are ignored.  Returns false, leaving the region
+    // as it was, if an extent straddles the region's end or two extents overlap;
+    // the caller then copies the image itself.
+    bool __fastcall BeginLazyLoad(MappedStateFile *pFile, const GuestMemoryExtent *Extents, size_t ExtentCount);
+    void __fastcall MakeResident(size_t HostAddress, size_t Length);
+    void __fastcall CompleteLazyPopulate(void);
+    inline bool isLazy(void) const { return BlocksRemaining != 0; }
+
+private:
+    bool __fastcall PopulateBlock(size_t BlockIndex);
+    bool __fastcall RegisterLazy(MappedStateFile *pFile, bool *Present);
+    void __fastcall EndLazyPopulate(void);
+    static LONG CALLBACK LazyExceptionHandler(PEXCEPTION_POINTERS pExceptionInfo);
+
+    HANDLE hSection;
+    unsigned __int8 *Base;
+    size_t Size;
+    bool CopyOnWrite;   // mapped from another process's section
+    bool LargePages;    // committed in large pages, so lazy population is not possible
+
+    // Lazy restore state
+    MappedStateFile *pStateFile;
+    const unsigned __int8 *Source;
+    unsigned __int32 *BlockOffsets;
+    GuestMemoryExtent *Extents;     // lazy ROM load:  sorted by HostAddress
+    size_t ExtentCount;
+    bool *BlockPresent;
+    size_t BlocksRemaining;
+    size_t BlocksPopulated;
+};
+
+#endif // GUESTMEMORY_H__
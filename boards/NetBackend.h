@@ -0,0 +1,137 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef NETBACKEND_H__
+#define NETBACKEND_H__
+
+// The host side of an emulated network adapter.  VPCNetDriver owns the packet rings
+// and talks to the device models; a NetBackend only moves ethernet frames between
+// those rings and the host.  The backend is chosen by Configuration.NetBackend.
+class NetBackend {
+public:
+    virtual ~NetBackend() { }
+
+    // Settles the guest MAC address and opens the host side of the adapter.  See
+    // VPCNetDriver::PowerOn() for the meaning of the arguments.  Every send and
+    // receive started later completes by posting lpOverlapped to pCallback through
+    // CompletionPort, with the packet length as dwBytesTransferred.
+    virtual bool __fastcall Open(USHORT* GuestMACAddress,
+                                 const wchar_t* DeviceName,
+                                 unsigned __int8 * HostMACAddress,
+                                 COMPLETIONPORT_CALLBACK *pCallback) = 0;
+    virtual void __fastcall Close(void) = 0;
+
+    // Both return false only if the request could not be started.  The buffer must
+    // remain valid until the completion is posted.
+    virtual bool __fastcall BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped) = 0;
+    virtual bool __fastcall BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped) = 0;
+
+    // FilterValue is a combination of VPCNetDriver::PACKET_TYPE_* values
+    virtual bool __fastcall ConfigurePacketFilter(int FilterValue) = 0;
+};
+
+// Creates the backend selected on the command line
+NetBackend * __fastcall CreateNetBackend(void);
+
+// Shared by backends that have no host driver to negotiate the guest MAC address
+// with:  keeps a suggested address, otherwise reuses the one cached for this VMID,
+// otherwise generates and caches a new one.
+bool __fastcall ChooseGuestMACAddress(USHORT* GuestMACAddress, const wchar_t* DeviceName);
+bool __fastcall GenerateGuestMACAddress(unsigned __int8 *MACAddress);
+
+// The Virtual PC network services driver (VPCNetS2).  This is the default.
+class VPCNetBackend : public NetBackend {
+public:
+    virtual bool __fastcall Open(USHORT* GuestMACAddress,
+                                 const wchar_t* DeviceName,
+                                 unsigned __int8 * HostMACAddress,
+                                 COMPLETIONPORT_CALLBACK *pCallback);
+    virtual void __fastcall Close(void);
+    virtual bool __fastcall BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall ConfigurePacketFilter(int FilterValue);
+
+private:
+    HANDLE hAdapter;
+    HANDLE hVirtualAdapter;
+
+    wchar_t * NetworkAdapterOracle(__in CHAR * AdaptersBuffer, ULONG Size, unsigned __int8 * HostMACAddress);
+};
+
+// A TAP-Windows virtual adapter (the tap0901 driver), selected with /nettap.  The
+// host sees the guest as a directly attached ethernet segment and can bridge or
+// route it like any other adapter.
+class TapNetBackend : public NetBackend {
+public:
+    virtual bool __fastcall Open(USHORT* GuestMACAddress,
+                                 const wchar_t* DeviceName,
+                                 unsigned __int8 * HostMACAddress,
+                                 COMPLETIONPORT_CALLBACK *pCallback);
+    virtual void __fastcall Close(void);
+    virtual bool __fastcall BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall ConfigurePacketFilter(int FilterValue);
+
+private:
+    HANDLE hTap;
+
+    bool __fastcall FindAdapter(const wchar_t* Name, __out_ecount(GuidLength) wchar_t *Guid, size_t GuidLength);
+};
+
+// An ethernet switch in shared memory, selected with /netswitch name.  Every
+// adapter in every emulator on this host that names the same switch gets a port
+// on it, and frames are copied straight into the receive ring of the destination
+// port.  No host driver is involved, so nothing leaves the switch.
+#define NETSWITCH_PORT_COUNT    8
+#define NETSWITCH_RING_SIZE     64      // frames queued per port
+
+class SwitchNetBackend : public NetBackend {
+public:
+    virtual bool __fastcall Open(USHORT* GuestMACAddress,
+                                 const wchar_t* DeviceName,
+                                 unsigned __int8 * HostMACAddress,
+                                 COMPLETIONPORT_CALLBACK *pCallback);
+    virtual void __fastcall Close(void);
+    virtual bool __fastcall BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall ConfigurePacketFilter(int FilterValue);
+
+private:
+    struct SwitchMemory *pSwitch;   // the shared view
+    HANDLE hSection;
+    HANDLE hLock;                   // named mutex serializing every port's senders
+    HANDLE hPortEvents[NETSWITCH_PORT_COUNT];  // signalled when a frame is queued to the port
+    unsigned __int32 Port;          // the port owned by this adapter
+    COMPLETIONPORT_CALLBACK *pCallback;
+
+    // Receives posted by VPCNetDriver, completed in order by the receive thread
+    struct PendingReceive {
+        unsigned __int8* Buffer;
+        unsigned __int32 BufferLength;
+        LPOVERLAPPED lpOverlapped;
+    };
+    CRITICAL_SECTION ReceiveLock;
+    PendingReceive PendingReceives[VPCNET_RECEIVE_RING_SIZE];
+    unsigned __int32 PendingHead;
+    unsigned __int32 PendingCount;
+    HANDLE hReceiveThread;
+    HANDLE hWakeEvent;
+    volatile bool Stopping;
+
+    bool __fastcall ClaimPort(const unsigned __int8 *MACAddress);
+    void __fastcall DeliverPackets(void);
+    static DWORD WINAPI ReceiveThreadStatic(LPVOID lpvThreadParam);
+    DWORD ReceiveThread(void);
+};
+
+#endif // NETBACKEND_H__
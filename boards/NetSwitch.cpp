@@ -0,0 +1,361 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "resource.h"
+#include "CompletionPort.h"
+#include "VPCNet.h"
+#include "NetBackend.h"
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "netswitch.tmh"
+#include "vsd_logging_inc.h"
+
+// The switch lives in a pagefile section named after the switch, so every emulator
+// that opens the same name sees the same ports.  Each port owns a ring of frames:
+// senders append at Tail while holding the switch mutex, and only the port's owner
+// advances Head, so the owner can drain its ring without taking the mutex.
+
+#define NETSWITCH_SIGNATURE     0x48435753  // 'SWCH'
+#define NETSWITCH_VERSION       1
+
+struct SwitchFrame {
+    unsigned __int32 Length;
+    unsigned __int8 Data[VPCNET_PACKET_BUFFER_SIZE];
+};
+
+struct SwitchPort {
+    volatile LONG OwnerProcessId;   // 0 if the port is free
+    unsigned __int8 MACAddress[6];
+    volatile LONG PacketFilter;     // VPCNetDriver::PACKET_TYPE_* values
+    volatile LONG Head;             // next frame for the owner to receive
+    volatile LONG Tail;             // next free frame
+    volatile LONG FramesDropped;    // the ring was full
+    SwitchFrame Ring[NETSWITCH_RING_SIZE];
+};
+
+struct SwitchMemory {
+    unsigned __int32 Signature;
+    unsigned __int32 Version;
+    SwitchPort Ports[NETSWITCH_PORT_COUNT];
+};
+
+static bool AcquireSwitchLock(HANDLE hLock)
+{
+    // An abandoned mutex means another emulator exited while sending.  The frame it
+    // was copying is lost, but the ring indices are only updated once a frame is
+    // complete, so the switch is still consistent.
+    DWORD dw = WaitForSingleObject(hLock, INFINITE);
+    return (dw == WAIT_OBJECT_0 || dw == WAIT_ABANDONED);
+}
+
+static bool IsProcessRunning(DWORD ProcessId)
+{
+    HANDLE hProcess;
+    bool Running;
+
+    hProcess = OpenProcess(SYNCHRONIZE, FALSE, ProcessId);
+    if (hProcess == NULL) {
+        return false;
+    }
+    Running = (WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT);
+    CloseHandle(hProcess);
+    return Running;
+}
+
+static bool PortAcceptsFrame(const SwitchPort *pPort, const unsigned __int8 *Frame)
+{
+    const VPCENetMACAddress Destination(Frame);
+    LONG Filter = pPort->PacketFilter;
+
+    if (Filter & VPCNetDriver::PACKET_TYPE_PROMISCUOUS) {
+        return true;
+    }
+    if (Destination.IsBroadcast()) {
+        return (Filter & VPCNetDriver::PACKET_TYPE_BROADCAST) != 0;
+    }
+    if (Destination.IsMulticast()) {
+        // The device models apply the guest's multicast hash themselves
+        return (Filter & (VPCNetDriver::PACKET_TYPE_MULTICAST|VPCNetDriver::PACKET_TYPE_ALL_MULTICAST)) != 0;
+    }
+    return (Filter & VPCNetDriver::PACKET_TYPE_DIRECTED) != 0 &&
+           memcmp(Frame, pPort->MACAddress, sizeof(pPort->MACAddress)) == 0;
+}
+
+// Takes the first port that is free or whose owner has exited.  The caller must not
+// hold the switch lock.
+bool __fastcall SwitchNetBackend::ClaimPort(const unsigned __int8 *MACAddress)
+{
+    if (!AcquireSwitchLock(hLock)) {
+        return false;
+    }
+
+    if (pSwitch->Signature == 0) {
+        // This emulator created the switch
+        pSwitch->Signature = NETSWITCH_SIGNATURE;
+        pSwitch->Version = NETSWITCH_VERSION;
+    } else if (pSwitch->Signature != NETSWITCH_SIGNATURE || pSwitch->Version != NETSWITCH_VERSION) {
+        LOG_ERROR(NETWORK, "The virtual switch was created by an incompatible emulator");
+        ReleaseMutex(hLock);
+        return false;
+    }
+
+    for (unsigned __int32 i=0; i<NETSWITCH_PORT_COUNT; ++i) {
+        SwitchPort *pPort = &pSwitch->Ports[i];
+
+        if (pPort->OwnerProcessId != 0 && IsProcessRunning(pPort->OwnerProcessId)) {
+            continue;
+        }
+        pPort->Head = pPort->Tail = 0;
+        pPort->FramesDropped = 0;
+        memcpy(pPort->MACAddress, MACAddress, sizeof(pPort->MACAddress));
+        pPort->PacketFilter = VPCNetDriver::PACKET_TYPE_DIRECTED|VPCNetDriver::PACKET_TYPE_MULTICAST|VPCNetDriver::PACKET_TYPE_BROADCAST;
+        pPort->OwnerProcessId = GetCurrentProcessId();
+        Port = i;
+        break;
+    }
+
+    ReleaseMutex(hLock);
+    return (Port < NETSWITCH_PORT_COUNT);
+}
+
+// HostMACAddress selects a host adapter for the VPC driver to bind to.  The switch
+// never reaches a host adapter, so it is ignored here.
+bool __fastcall SwitchNetBackend::Open(
+                                       USHORT* GuestMACAddress,
+                                       const wchar_t* DeviceName,
+                                       unsigned __int8 * HostMACAddress,
+                                       COMPLETIONPORT_CALLBACK *pCallersCallback)
+{
+    const wchar_t *SwitchName = Configuration.NetBackendName;
+    wchar_t ObjectName[_MAX_PATH];
+
+    pSwitch = NULL;
+    hSection = NULL;
+    hLock = NULL;
+    memset(hPortEvents, 0, sizeof(hPortEvents));
+    Port = NETSWITCH_PORT_COUNT;
+    pCallback = pCallersCallback;
+    InitializeCriticalSection(&ReceiveLock);
+    PendingHead = PendingCount = 0;
+    hReceiveThread = NULL;
+    hWakeEvent = NULL;
+    Stopping = false;
+
+    if (SwitchName[0] == L'\0' || wcschr(SwitchName, L'\\') != NULL) {
+        LOG_ERROR(NETWORK, "Invalid virtual switch name '%S'", SwitchName);
+        goto Error;
+    }
+
+    if (!ChooseGuestMACAddress(GuestMACAddress, DeviceName)) {
+        LOG_ERROR(NETWORK, "Failed to choose a guest MAC address");
+        goto Error;
+    }
+
+    if (FAILED(StringCchPrintfW(ObjectName, ARRAY_SIZE(ObjectName), L"Local\\DeviceEmulatorSwitch_%s", SwitchName))) {
+        goto Error;
+    }
+    hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SwitchMemory), ObjectName);
+    if (hSection == NULL) {
+        LOG_ERROR(NETWORK, "CreateFileMapping on %S failed with %d", ObjectName, GetLastError());
+        goto Error;
+    }
+    pSwitch = (SwitchMemory *)MapViewOfFile(hSection, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SwitchMemory));
+    if (pSwitch == NULL) {
+        LOG_ERROR(NETWORK, "MapViewOfFile failed with %d", GetLastError());
+        goto Error;
+    }
+
+    if (FAILED(StringCchPrintfW(ObjectName, ARRAY_SIZE(ObjectName), L"Local\\DeviceEmulatorSwitch_%s_Lock", SwitchName))) {
+        goto Error;
+    }
+    hLock = CreateMutex(NULL, FALSE, ObjectName);
+    if (hLock == NULL) {
+        LOG_ERROR(NETWORK, "CreateMutex on %S failed with %d", ObjectName, GetLastError());
+        goto Error;
+    }
+
+    for (unsigned __int32 i=0; i<NETSWITCH_PORT_COUNT; ++i) {
+        if (FAILED(StringCchPrintfW(ObjectName, ARRAY_SIZE(ObjectName), L"Local\\DeviceEmulatorSwitch_%s_Port%d", SwitchName, i))) {
+            goto Error;
+        }
+        hPortEvents[i] = CreateEvent(NULL, FALSE, FALSE, ObjectName); // Auto-reset, initially unsignalled
+        if (hPortEvents[i] == NULL) {
+            LOG_ERROR(NETWORK, "CreateEvent on %S failed with %d", ObjectName, GetLastError());
+            goto Error;
+        }
+    }
+
+    hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL); // Auto-reset, initially unsignalled
+    if (hWakeEvent == NULL) {
+        goto Error;
+    }
+
+    if (!ClaimPort((const unsigned __int8 *)GuestMACAddress)) {
+        LOG_ERROR(NETWORK, "No free port on virtual switch %S", SwitchName);
+        ShowDialog(ID_MESSAGE_FAILED_NETWORK_SWITCH_OPEN, SwitchName);
+        goto Error;
+    }
+
+    hReceiveThread = CreateThread(NULL, 0, ReceiveThreadStatic, this, 0, NULL);
+    if (hReceiveThread == NULL) {
+        goto Error;
+    }
+
+    LOG_INFO(NETWORK, "Connected to port %d of virtual switch %S", Port, SwitchName);
+    return true;
+
+Error:
+    Close();
+    return false;
+}
+
+void __fastcall SwitchNetBackend::Close(void)
+{
+    if (hReceiveThread) {
+        Stopping = true;
+        SetEvent(hWakeEvent);
+        WaitForSingleObject(hReceiveThread, INFINITE);
+        CloseHandle(hReceiveThread);
+        hReceiveThread = NULL;
+    }
+    if (Port < NETSWITCH_PORT_COUNT) {
+        if (AcquireSwitchLock(hLock)) {
+            pSwitch->Ports[Port].OwnerProcessId = 0;
+            ReleaseMutex(hLock);
+        }
+        Port = NETSWITCH_PORT_COUNT;
+    }
+    if (hWakeEvent) {
+        CloseHandle(hWakeEvent);
+        hWakeEvent = NULL;
+    }
+    for (unsigned __int32 i=0; i<NETSWITCH_PORT_COUNT; ++i) {
+        if (hPortEvents[i]) {
+            CloseHandle(hPortEvents[i]);
+            hPortEvents[i] = NULL;
+        }
+    }
+    if (hLock) {
+        CloseHandle(hLock);
+        hLock = NULL;
+    }
+    if (pSwitch) {
+        UnmapViewOfFile(pSwitch);
+        pSwitch = NULL;
+    }
+    if (hSection) {
+        CloseHandle(hSection);
+        hSection = NULL;
+    }
+    DeleteCriticalSection(&ReceiveLock);
+}
+
+// Copies the frame into every other port that accepts it.  Like a real switch,
+// frames for a port whose ring is full are dropped.
+bool __fastcall SwitchNetBackend::BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped)
+{
+    if (PacketLength >= sizeof(EthernetHeader) && AcquireSwitchLock(hLock)) {
+        for (unsigned __int32 i=0; i<NETSWITCH_PORT_COUNT; ++i) {
+            SwitchPort *pPort = &pSwitch->Ports[i];
+
+            if (i == Port || pPort->OwnerProcessId == 0 || !PortAcceptsFrame(pPort, PacketData)) {
+                continue;
+            }
+            if ((unsigned __int32)(pPort->Tail - pPort->Head) >= NETSWITCH_RING_SIZE) {
+                pPort->FramesDropped++;
+                LOG_VVERBOSE(NETWORK, "Virtual switch port %d is full, dropping frame", i);
+                continue;
+            }
+
+            SwitchFrame *pFrame = &pPort->Ring[(unsigned __int32)pPort->Tail % NETSWITCH_RING_SIZE];
+            pFrame->Length = PacketLength;
+            memcpy(pFrame->Data, PacketData, PacketLength);
+            // Publish the frame only once it has been copied
+            InterlockedIncrement(&pPort->Tail);
+            SetEvent(hPortEvents[i]);
+        }
+        ReleaseMutex(hLock);
+    }
+
+    return CompletionPort.PostCompletion(pCallback, PacketLength, lpOverlapped);
+}
+
+bool __fastcall SwitchNetBackend::BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped)
+{
+    EnterCriticalSection(&ReceiveLock);
+    if (PendingCount == VPCNET_RECEIVE_RING_SIZE) {
+        // VPCNetDriver never posts more than its ring holds
+        ASSERT(FALSE);
+        LeaveCriticalSection(&ReceiveLock);
+        return false;
+    }
+    PendingReceive *pReceive = &PendingReceives[(PendingHead+PendingCount) % VPCNET_RECEIVE_RING_SIZE];
+    pReceive->Buffer = Buffer;
+    pReceive->BufferLength = BufferLength;
+    pReceive->lpOverlapped = lpOverlapped;
+    PendingCount++;
+    LeaveCriticalSection(&ReceiveLock);
+
+    // Frames may already be waiting for a receive
+    SetEvent(hWakeEvent);
+    return true;
+}
+
+bool __fastcall SwitchNetBackend::ConfigurePacketFilter(int FilterValue)
+{
+    InterlockedExchange(&pSwitch->Ports[Port].PacketFilter, FilterValue);
+    return true;
+}
+
+// Completes posted receives, in order, from the frames queued to this port
+void __fastcall SwitchNetBackend::DeliverPackets(void)
+{
+    SwitchPort *pPort = &pSwitch->Ports[Port];
+
+    EnterCriticalSection(&ReceiveLock);
+    while (PendingCount && pPort->Head != pPort->Tail) {
+        PendingReceive *pReceive = &PendingReceives[PendingHead];
+        SwitchFrame *pFrame = &pPort->Ring[(unsigned __int32)pPort->Head % NETSWITCH_RING_SIZE];
+        unsigned __int32 Length = min(pFrame->Length, pReceive->BufferLength);
+
+        memcpy(pReceive->Buffer, pFrame->Data, Length);
+        // The slot may be reused by a sender as soon as Head moves past it
+        InterlockedIncrement(&pPort->Head);
+        PendingHead = (PendingHead+1) % VPCNET_RECEIVE_RING_SIZE;
+        PendingCount--;
+        CompletionPort.PostCompletion(pCallback, Length, pReceive->lpOverlapped);
+    }
+    LeaveCriticalSection(&ReceiveLock);
+}
+
+DWORD WINAPI SwitchNetBackend::ReceiveThreadStatic(LPVOID lpvThreadParam)
+{
+    return ((SwitchNetBackend*)lpvThreadParam)->ReceiveThread();
+}
+
+DWORD SwitchNetBackend::ReceiveThread(void)
+{
+    HANDLE Events[2];
+
+    Events[0] = hPortEvents[Port];  // a frame was queued to the port
+    Events[1] = hWakeEvent;         // a receive was posted, or Close() was called
+
+    while (!Stopping) {
+        DeliverPackets();
+        WaitForMultipleObjects(ARRAY_SIZE(Events), Events, FALSE, INFINITE);
+    }
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+#include "cpu.h"
+#include "resource.h"
+#include "loadbin_nb0.h"
+#include "profiler.h"
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "profiler.tmh"
+#include "vsd_logging_inc.h"
+
+// Milliseconds between samples.  The PWM timer raises the host timer resolution
+// to 1ms, so Sleep() is accurate enough.
+#define PROFILE_INTERVAL_MS 1
+
+// Distinct (address, mode) pairs kept.  Must be a power of 2.  Samples at new
+// addresses are dropped once PROFILE_MAX_PROBES entries have been tried.
+#define PROFILE_TABLE_SIZE 65536
+#define PROFILE_MAX_PROBES 32
+
+// Addresses listed in the flat profile
+#define PROFILE_REPORT_ADDRESSES 500
+
+// ROM modules read back for symbolization
+#define PROFILE_MAX_MODULES 1024
+
+// Code outside any ROM module is named by the 32mb process slot it is in
+#define PROFILE_SLOT_COUNT 128
+
+typedef struct {
+    unsigned __int32 Address;   // modified virtual address of the PC
+    unsigned __int32 Mode;      // CPSR mode bits, or 0 if the entry is unused
+    unsigned __int32 Count;
+} ProfileEntry;
+
+static FILE *ProfileFile;
+static FILE *ProfileFoldedFile;
+static HANDLE hProfileThread;
+static volatile bool ProfileStopping;
+
+// Written only by the CPU thread
+static ProfileEntry ProfileTable[PROFILE_TABLE_SIZE];
+static unsigned __int32 ProfileSamples;
+static unsigned __int32 ProfileDropped;
+
+// Written only by the sampling thread
+static unsigned __int32 ProfileNotRunning;
+
+static void __cdecl ProfilerStop(void);
+
+static DWORD WINAPI ProfilerThreadProc(LPVOID lpParameter)
+{
+    UNREFERENCED_PARAMETER(lpParameter);
+
+    TraceNameThread("Profiler");
+    while (!ProfileStopping) {
+        Sleep(PROFILE_INTERVAL_MS);
+        if (!CpuRequestProfileSample()) {
+            // The CPU has not polled since the last request:  it is idle, or
+            // blocked in a device or in the debugger.
+            ProfileNotRunning++;
+        }
+    }
+    return 0;
+}
+
+bool __fastcall ProfilerStart(__in_z const wchar_t *FileName)
+{
+    wchar_t FoldedFileName[MAX_PATH];
+
+    if (_wfopen_s(&ProfileFile, FileName, L"w")) {
+        ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN, FileName);
+        return false;
+    }
+    if (FAILED(StringCchPrintfW(FoldedFileName, ARRAY_SIZE(FoldedFileName), L"%s.folded", FileName)) ||
+        _wfopen_s(&ProfileFoldedFile, FoldedFileName, L"w")) {
+        ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN, FoldedFileName);
+        return false;
+    }
+    hProfileThread = CreateThread(NULL, 0, ProfilerThreadProc, NULL, 0, NULL);
+    if (hProfileThread == NULL) {
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+    SetThreadPriority(hProfileThread, THREAD_PRIORITY_ABOVE_NORMAL);
+    atexit(ProfilerStop);
+    return true;
+}
+
+void __fastcall ProfilerRecordSample(unsigned __int32 Address, unsigned __int32 Mode)
+{
+    unsigned __int32 Hash = ((Address >> 2) ^ (Mode << 27)) * 2654435761u;
+
+    ProfileSamples++;
+    for (unsigned __int32 i=0; i<PROFILE_MAX_PROBES; ++i) {
+        ProfileEntry *pEntry = &ProfileTable[(Hash+i) & (PROFILE_TABLE_SIZE-1)];
+
+        if (pEntry->Mode == 0) {
+            pEntry->Address = Address;
+            pEntry->Mode = Mode;
+            pEntry->Count = 1;
+            return;
+        }
+        if (pEntry->Address == Address && pEntry->Mode == Mode) {
+            pEntry->Count++;
+            return;
+        }
+    }
+    ProfileDropped++;
+}
+
+static const char * __fastcall ProfilerModeName(unsigned __int32 Mode)
+{
+    switch (Mode) {
+    case 16: return "usr";
+    case 17: return "fiq";
+    case 18: return "irq";
+    case 19: return "svc";
+    case 23: return "abt";
+    case 27: return "und";
+    case 31: return "sys";
+    default: return "?";
+    }
+}
+
+// Returns the index of the location containing Address:  a ROM module, then a
+// process slot, then "unknown" last.  *pOffset is set to the offset into it.
+static size_t __fastcall ProfilerSymbolize(unsigned __int32 Address, const RomModule *Modules, size_t ModuleCount, unsigned __int32 *pOffset)
+{
+    size_t Match = ModuleCount;
+    size_t i;
+
+    for (i=0; i<ModuleCount; ++i) {
+        if (Address - Modules[i].Base < Modules[i].Size) {
+            *pOffset = Address - Modules[i].Base;
+            return i;
+        }
+    }
+
+    if (Address < 0x80000000 && (Address >> 25) >= 2) {
+        // Code in a process slot.  Every EXE is linked at the same low address,
+        // so it can only be named if exactly one EXE in the ROM contains it.
+        unsigned __int32 SlotOffset = Address & 0x01ffffff;
+
+        for (i=0; i<ModuleCount; ++i) {
+            if (Modules[i].Base < 0x02000000 && SlotOffset - Modules[i].Base < Modules[i].Size) {
+                if (Match != ModuleCount) {
+                    Match = ModuleCount;
+                    break;
+                }
+                Match = i;
+            }
+        }
+        if (Match != ModuleCount) {
+            *pOffset = SlotOffset - Modules[Match].Base;
+            return Match;
+        }
+        *pOffset = SlotOffset;
+        return ModuleCount + (Address >> 25);
+    }
+    *pOffset = Address;
+    return ModuleCount + PROFILE_SLOT_COUNT;
+}
+
+static void __fastcall ProfilerLocationName(size_t Location, const RomModule *Modules, size_t ModuleCount, __out_ecount(Length) char *Name, size_t Length)
+{
+    if (Location < ModuleCount) {
+        StringCchCopyA(Name, Length, Modules[Location].Name);
+    } else if (Location < ModuleCount + PROFILE_SLOT_COUNT) {
+        StringCchPrintfA(Name, Length, "slot%u", (unsigned __int32)(Location - ModuleCount));
+    } else {
+        StringCchCopyA(Name, Length, "unknown");
+    }
+}
+
+static int __cdecl ProfilerCompareEntries(const void *p1, const void *p2)
+{
+    const ProfileEntry *pEntry1 = (const ProfileEntry *)p1;
+    const ProfileEntry *pEntry2 = (const ProfileEntry *)p2;
+
+    if (pEntry1->Count != pEntry2->Count) {
+        return (pEntry1->Count > pEntry2->Count) ? -1 : 1;
+    }
+    return (pEntry1->Address < pEntry2->Address) ? -1 : (pEntry1->Address > pEntry2->Address);
+}
+
+// Writes the profile.  Called at exit.
+static void __cdecl ProfilerStop(void)
+{
+    RomModule *Modules;
+    size_t ModuleCount;
+    ProfileEntry *Entries;
+    size_t EntryCount;
+    size_t LocationCount;
+    unsigned __int32 *LocationSamples;
+    size_t *EntryLocations;
+    unsigned __int32 *EntryOffsets;
+    FILE *fp = ProfileFile;
+    FILE *fpFolded = ProfileFoldedFile;
+    double Total;
+    char Name[64];
+    size_t i;
+
+    // Give up on the sampling thread if the thread calling exit() holds the
+    // InterruptLock.
+    ProfileStopping = true;
+    WaitForSingleObject(hProfileThread, 1000);
+    CloseHandle(hProfileThread);
+
+    Modules = new RomModule[PROFILE_MAX_MODULES];
+    Entries = new ProfileEntry[PROFILE_TABLE_SIZE];
+    LocationCount = PROFILE_MAX_MODULES + PROFILE_SLOT_COUNT + 1;
+    LocationSamples = new unsigned __int32[LocationCount];
+    EntryLocations = new size_t[PROFILE_TABLE_SIZE];
+    EntryOffsets = new unsigned __int32[PROFILE_TABLE_SIZE];
+    if (!Modules || !Entries || !LocationSamples || !EntryLocations || !EntryOffsets) {
+        LOG_ERROR(GENERAL, "Out of memory writing the profile");
+        fclose(fpFolded);
+        fclose(fp);
+        return;
+    }
+
+    // The CPU thread may still be recording, if it is the one calling exit() or
+    // has yet to be stopped.  A sample more or less does not matter.
+    EntryCount = 0;
+    for (i=0; i<PROFILE_TABLE_SIZE; ++i) {
+        if (ProfileTable[i].Mode) {
+            Entries[EntryCount++] = ProfileTable[i];
+        }
+    }
+    qsort(Entries, EntryCount, sizeof(ProfileEntry), ProfilerCompareEntries);
+
+    ModuleCount = GetRomModules(Modules, PROFILE_MAX_MODULES);
+    memset(LocationSamples, 0, LocationCount*sizeof(unsigned __int32));
+    for (i=0; i<EntryCount; ++i) {
+        EntryLocations[i] = ProfilerSymbolize(Entries[i].Address, Modules, ModuleCount, &EntryOffsets[i]);
+        LocationSamples[EntryLocations[i]] += Entries[i].Count;
+    }
+
+    Total = (ProfileSamples) ? (double)ProfileSamples : 1.0;
+    fprintf(fp, "Samples\t%u\n", ProfileSamples);
+    fprintf(fp, "Not running\t%u\n", ProfileNotRunning);
+    fprintf(fp, "Dropped\t%u\n", ProfileDropped);
+    fprintf(fp, "ROM modules\t%u\n", (unsigned __int32)ModuleCount);
+
+    fprintf(fp, "\nModule\tSamples\tPercent\n");
+    for (;;) {
+        size_t Largest = 0;
+
+        for (i=1; i<ModuleCount + PROFILE_SLOT_COUNT + 1; ++i) {
+            if (LocationSamples[i] > LocationSamples[Largest]) {
+                Largest = i;
+            }
+        }
+        if (LocationSamples[Largest] == 0) {
+            break;
+        }
+        ProfilerLocationName(Largest, Modules, ModuleCount, Name, ARRAY_SIZE(Name));
+        fprintf(fp, "%s\t%u\t%.2f\n", Name, LocationSamples[Largest], 100.0 * (double)LocationSamples[Largest] / Total);
+        LocationSamples[Largest] = 0;
+    }
+
+    fprintf(fp, "\nAddress\tMode\tLocation\tSamples\tPercent\n");
+    for (i=0; i<EntryCount; ++i) {
+        ProfilerLocationName(EntryLocations[i], Modules, ModuleCount, Name, ARRAY_SIZE(Name));
+        if (i < PROFILE_REPORT_ADDRESSES) {
+            fprintf(fp, "%8.8x\t%s\t%s+0x%x\t%u\t%.2f\n", Entries[i].Address, ProfilerModeName(Entries[i].Mode),
+                    Name, EntryOffsets[i], Entries[i].Count, 100.0 * (double)Entries[i].Count / Total);
+        }
+        fprintf(fpFolded, "%s;%s;%s+0x%x %u\n", ProfilerModeName(Entries[i].Mode), Name, Name, EntryOffsets[i], Entries[i].Count);
+    }
+
+    fclose(fpFolded);
+    fclose(fp);
+    delete [] EntryOffsets;
+    delete [] EntryLocations;
+    delete [] LocationSamples;
+    delete [] Entries;
+    delete [] Modules;
+}
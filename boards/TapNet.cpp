@@ -0,0 +1,229 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "resource.h"
+#include "CompletionPort.h"
+#include "VPCNet.h"
+#include "NetBackend.h"
+#include <winioctl.h>
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "tapnet.tmh"
+#include "vsd_logging_inc.h"
+
+// The following are from the TAP-Windows driver's tap-windows.h
+
+#define TAP_WIN_COMPONENT_ID        L"tap0901"
+#define TAP_WIN_IOCTL_SET_MEDIA_STATUS  CTL_CODE(FILE_DEVICE_UNKNOWN, 6, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define USERMODEDEVICEDIR           L"\\\\.\\Global\\"
+#define TAP_WIN_SUFFIX              L".tap"
+
+// Network adapters, and the connection names the user sees in the shell
+#define ADAPTER_KEY                 L"SYSTEM\\CurrentControlSet\\Control\\Class\\{4D36E972-E325-11CE-BFC1-08002BE10318}"
+#define NETWORK_CONNECTIONS_KEY     L"SYSTEM\\CurrentControlSet\\Control\\Network\\{4D36E972-E325-11CE-BFC1-08002BE10318}"
+
+// Finds a TAP adapter by its connection name (such as "Local Area Connection 2") or
+// its instance GUID.  An empty Name matches the first TAP adapter.
+bool __fastcall TapNetBackend::FindAdapter(const wchar_t* Name, __out_ecount(GuidLength) wchar_t *Guid, size_t GuidLength)
+{
+    HKEY hAdapters;
+    bool Found = false;
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, ADAPTER_KEY, 0, KEY_READ, &hAdapters) != ERROR_SUCCESS) {
+        LOG_ERROR(NETWORK, "Failed to open the network adapter registry key");
+        return false;
+    }
+
+    for (DWORD Index = 0; !Found; ++Index) {
+        wchar_t SubkeyName[256];
+        DWORD SubkeyLength = ARRAY_SIZE(SubkeyName);
+        wchar_t ComponentId[256];
+        wchar_t ConnectionKey[_MAX_PATH];
+        wchar_t ConnectionName[256];
+        DWORD cbData;
+        DWORD Type;
+        HKEY hAdapter;
+        HKEY hConnection;
+        LONG l;
+
+        l = RegEnumKeyEx(hAdapters, Index, SubkeyName, &SubkeyLength, NULL, NULL, NULL, NULL);
+        if (l == ERROR_NO_MORE_ITEMS) {
+            break;
+        } else if (l != ERROR_SUCCESS) {
+            continue;
+        }
+        if (RegOpenKeyEx(hAdapters, SubkeyName, 0, KEY_READ, &hAdapter) != ERROR_SUCCESS) {
+            continue;
+        }
+
+        cbData = sizeof(ComponentId)-sizeof(wchar_t);
+        l = RegQueryValueEx(hAdapter, L"ComponentId", NULL, &Type, (LPBYTE)ComponentId, &cbData);
+        if (l != ERROR_SUCCESS || Type != REG_SZ) {
+            RegCloseKey(hAdapter);
+            continue;
+        }
+        ComponentId[cbData/sizeof(wchar_t)] = L'\0';
+        if ((_wcsicmp(ComponentId, TAP_WIN_COMPONENT_ID) != 0 && _wcsicmp(ComponentId, L"root\\" TAP_WIN_COMPONENT_ID) != 0)) {
+            RegCloseKey(hAdapter);
+            continue;
+        }
+
+        cbData = (DWORD)((GuidLength-1)*sizeof(wchar_t));
+        l = RegQueryValueEx(hAdapter, L"NetCfgInstanceId", NULL, &Type, (LPBYTE)Guid, &cbData);
+        RegCloseKey(hAdapter);
+        if (l != ERROR_SUCCESS || Type != REG_SZ) {
+            continue;
+        }
+        Guid[cbData/sizeof(wchar_t)] = L'\0';
+
+        if (Name[0] == L'\0' || _wcsicmp(Name, Guid) == 0) {
+            Found = true;
+            break;
+        }
+
+        // Compare against the connection name
+        if (FAILED(StringCchPrintfW(ConnectionKey, ARRAY_SIZE(ConnectionKey), L"%s\\%s\\Connection", NETWORK_CONNECTIONS_KEY, Guid))) {
+            continue;
+        }
+        if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, ConnectionKey, 0, KEY_READ, &hConnection) != ERROR_SUCCESS) {
+            continue;
+        }
+        cbData = sizeof(ConnectionName)-sizeof(wchar_t);
+        l = RegQueryValueEx(hConnection, L"Name", NULL, &Type, (LPBYTE)ConnectionName, &cbData);
+        RegCloseKey(hConnection);
+        if (l == ERROR_SUCCESS && Type == REG_SZ) {
+            ConnectionName[cbData/sizeof(wchar_t)] = L'\0';
+            Found = (_wcsicmp(Name, ConnectionName) == 0);
+        }
+    }
+
+    RegCloseKey(hAdapters);
+    return Found;
+}
+
+// HostMACAddress selects a host adapter for the VPC driver to bind to.  A TAP
+// adapter is its own host adapter, so it is ignored here.
+bool __fastcall TapNetBackend::Open(
+                                    USHORT* GuestMACAddress,
+                                    const wchar_t* DeviceName,
+                                    unsigned __int8 * HostMACAddress,
+                                    COMPLETIONPORT_CALLBACK *pCallback)
+{
+    wchar_t Guid[64];
+    wchar_t DevicePath[_MAX_PATH];
+    OVERLAPPED Overlapped;
+    ULONG MediaStatus;
+    DWORD BytesReturned;
+    BOOL b;
+
+    if (!FindAdapter(Configuration.NetBackendName, Guid, ARRAY_SIZE(Guid))) {
+        LOG_ERROR(NETWORK, "No TAP-Windows adapter matches '%S'", Configuration.NetBackendName);
+        ShowDialog(ID_MESSAGE_FAILED_TAP_NETWORK_OPEN);
+        return false;
+    }
+    if (FAILED(StringCchPrintfW(DevicePath, ARRAY_SIZE(DevicePath), L"%s%s%s", USERMODEDEVICEDIR, Guid, TAP_WIN_SUFFIX))) {
+        LOG_ERROR(NETWORK, "Failed to create the TAP device name");
+        return false;
+    }
+
+    hTap = CreateFile(DevicePath,
+                      GENERIC_READ | GENERIC_WRITE,
+                      0, NULL,
+                      OPEN_EXISTING,
+                      FILE_ATTRIBUTE_SYSTEM | FILE_FLAG_OVERLAPPED, NULL);
+    if (hTap == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(NETWORK, "CreateFile on %S failed with %d", DevicePath, GetLastError());
+        ShowDialog(ID_MESSAGE_FAILED_TAP_NETWORK_OPEN);
+        return false;
+    }
+
+    if (!ChooseGuestMACAddress(GuestMACAddress, DeviceName)) {
+        LOG_ERROR(NETWORK, "Failed to choose a guest MAC address");
+        CloseHandle(hTap);
+        return false;
+    }
+
+    // Bring the adapter's link up.  This is done before the handle is associated
+    // with the completion port, so it can wait for the result here.
+    memset(&Overlapped, 0, sizeof(Overlapped));
+    Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (Overlapped.hEvent == NULL) {
+        CloseHandle(hTap);
+        return false;
+    }
+    MediaStatus = TRUE;
+    b = DeviceIoControl(hTap,
+                        TAP_WIN_IOCTL_SET_MEDIA_STATUS,
+                        &MediaStatus, sizeof(MediaStatus),
+                        &MediaStatus, sizeof(MediaStatus),
+                        &BytesReturned,
+                        &Overlapped);
+    if (b == FALSE && GetLastError() == ERROR_IO_PENDING) {
+        b = GetOverlappedResult(hTap, &Overlapped, &BytesReturned, TRUE);
+    }
+    CloseHandle(Overlapped.hEvent);
+    if (b == FALSE) {
+        LOG_ERROR(NETWORK, "TAP_WIN_IOCTL_SET_MEDIA_STATUS failed with %d", GetLastError());
+        CloseHandle(hTap);
+        return false;
+    }
+
+    if (!CompletionPort.AssociateHandleWithCompletionPort(hTap, pCallback)) {
+        LOG_ERROR(NETWORK, "Failed to associate the TAP handle with the IO completion port");
+        CloseHandle(hTap);
+        return false;
+    }
+
+    LOG_INFO(NETWORK, "Opened TAP adapter %S", Guid);
+    return true;
+}
+
+void __fastcall TapNetBackend::Close(void)
+{
+    CloseHandle(hTap);
+}
+
+bool __fastcall TapNetBackend::BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped)
+{
+    if (WriteFile(hTap, PacketData, PacketLength, NULL, lpOverlapped) == FALSE) {
+        DWORD ErrorStatus = GetLastError();
+        if (ErrorStatus != ERROR_IO_PENDING) {
+            LOG_ERROR(NETWORK, "WriteFile failed during transmit with %d", ErrorStatus);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool __fastcall TapNetBackend::BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped)
+{
+    if (ReadFile(hTap, Buffer, BufferLength, NULL, lpOverlapped) == FALSE) {
+        DWORD ErrorCode = GetLastError();
+        if (ErrorCode != ERROR_IO_PENDING) {
+            LOG_ERROR(NETWORK, "ReadFile failed while recv %d", ErrorCode);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The TAP driver has no receive filter:  it hands over every frame the host sends
+// to the adapter.  The NE2000 and CS8900 models already drop multicast frames that
+// the guest did not ask for, so the filter is accepted and ignored.
+bool __fastcall TapNetBackend::ConfigurePacketFilter(int FilterValue)
+{
+    return true;
+}
@@ -0,0 +1,258 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "traceevents.tmh"
+#include "vsd_logging_inc.h"
+
+// Records kept per thread.  Must be a power of 2.  At 32 bytes each, this is
+// 1mb per thread that records an event.
+#define TRACE_BUFFER_RECORDS 32768
+// Boot and save-state events kept for the whole process.  Events past this
+// many are dropped.
+#define TRACE_MILESTONE_RECORDS 1024
+
+// Device I/O events shorter than this many microseconds are not recorded:  the
+// CPU thread makes millions of fast accesses, and they would push everything
+// else out of its buffer.  Slow ones are the ones that explain a stall.
+#define TRACE_IO_THRESHOLD_US 10
+
+typedef struct {
+    const char *Name;
+    unsigned __int32 Arg;
+    DWORD ThreadId;
+    unsigned __int8 Category;
+    volatile char Phase;        // 'X' for a complete event, 'i' for an instant, 0 until written
+    unsigned __int64 Timestamp;
+    unsigned __int64 Duration;
+} TraceRecord;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *Next;
+    DWORD ThreadId;
+    const char *ThreadName;
+    // Count of records ever written, modulo 2^32.  The buffer holds the most
+    // recent TRACE_BUFFER_RECORDS of them.  Only the owning thread writes these.
+    volatile unsigned __int32 Head;
+    volatile bool Wrapped;
+    TraceRecord Records[TRACE_BUFFER_RECORDS];
+} TraceBuffer;
+
+static const char * const TraceCategoryNames[] = {
+    "boot",
+    "state",
+    "jit",
+    "cache",
+    "mmu",
+    "io",
+    "interrupt",
+};
+
+volatile bool TraceEnabled;
+
+static FILE *TraceFile;
+static unsigned __int64 TraceStartTime;
+static unsigned __int64 TraceFrequency;
+static unsigned __int64 TraceIOThreshold;   // TRACE_IO_THRESHOLD_US in QueryPerformanceCounter ticks
+
+static TraceBuffer * volatile TraceBuffers; // every thread's buffer, pushed lock-free
+static __declspec(thread) TraceBuffer *CurrentTraceBuffer;
+
+static TraceRecord TraceMilestones[TRACE_MILESTONE_RECORDS];
+static volatile LONG TraceMilestoneCount;
+
+static void __cdecl TraceStop(void);
+
+bool __fastcall TraceStart(__in_z const wchar_t *FileName)
+{
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Now;
+
+    ASSERT(!TraceEnabled);
+
+    if (_wfopen_s(&TraceFile, FileName, L"w")) {
+        LOG_ERROR(GENERAL, "Failed to open trace file %S", FileName);
+        return false;
+    }
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Now);
+    TraceFrequency = Frequency.QuadPart;
+    TraceStartTime = Now.QuadPart;
+    TraceIOThreshold = TraceFrequency * TRACE_IO_THRESHOLD_US / 1000000;
+
+    atexit(TraceStop);
+    TraceEnabled = true;
+    return true;
+}
+
+// Returns the calling thread's buffer, allocating it on the first event
+static TraceBuffer * __fastcall TraceGetThreadBuffer(void)
+{
+    TraceBuffer *pBuffer = CurrentTraceBuffer;
+
+    if (pBuffer == NULL) {
+        TraceBuffer *pHead;
+
+        pBuffer = (TraceBuffer *)VirtualAlloc(NULL, sizeof(TraceBuffer), MEM_COMMIT, PAGE_READWRITE);
+        if (pBuffer == NULL) {
+            return NULL;
+        }
+        pBuffer->ThreadId = GetCurrentThreadId();
+        do {
+            pHead = TraceBuffers;
+            pBuffer->Next = pHead;
+        } while (InterlockedCompareExchangePointer((PVOID volatile *)&TraceBuffers, pBuffer, pHead) != pHead);
+        CurrentTraceBuffer = pBuffer;
+    }
+    return pBuffer;
+}
+
+void __fastcall TraceNameThread(const char *Name)
+{
+    if (TraceEnabled) {
+        TraceBuffer *pBuffer = TraceGetThreadBuffer();
+
+        if (pBuffer) {
+            pBuffer->ThreadName = Name;
+        }
+    }
+}
+
+static void __fastcall TraceRecordEvent(const char *Name, TraceCategory Category, unsigned __int32 Arg,
+                                        char Phase, unsigned __int64 Timestamp, unsigned __int64 Duration)
+{
+    TraceRecord *pRecord;
+    TraceBuffer *pBuffer = NULL;
+
+    if (Category == TraceBoot || Category == TraceState) {
+        LONG Index = InterlockedIncrement(&TraceMilestoneCount)-1;
+
+        if (Index >= TRACE_MILESTONE_RECORDS) {
+            return;
+        }
+        pRecord = &TraceMilestones[Index];
+    } else {
+        pBuffer = TraceGetThreadBuffer();
+        if (pBuffer == NULL) {
+            return;
+        }
+        pRecord = &pBuffer->Records[pBuffer->Head & (TRACE_BUFFER_RECORDS-1)];
+    }
+
+    pRecord->Name = Name;
+    pRecord->Arg = Arg;
+    pRecord->ThreadId = GetCurrentThreadId();
+    pRecord->Category = (unsigned __int8)Category;
+    pRecord->Timestamp = Timestamp;
+    pRecord->Duration = Duration;
+    // Publish the record only once it is complete.  x86 does not reorder stores,
+    // so this needs only to stop the compiler from doing so.
+    _WriteBarrier();
+    pRecord->Phase = Phase;
+    if (pBuffer) {
+        _WriteBarrier();
+        pBuffer->Head++;
+        if (pBuffer->Head == TRACE_BUFFER_RECORDS) {
+            pBuffer->Wrapped = true;
+        }
+    }
+}
+
+void __fastcall TraceRecordInstant(const char *Name, TraceCategory Category, unsigned __int32 Arg)
+{
+    LARGE_INTEGER Now;
+
+    QueryPerformanceCounter(&Now);
+    TraceRecordEvent(Name, Category, Arg, 'i', Now.QuadPart, 0);
+}
+
+void __fastcall TraceRecordComplete(const char *Name, TraceCategory Category, unsigned __int32 Arg, unsigned __int64 StartTime)
+{
+    LARGE_INTEGER Now;
+    unsigned __int64 Duration;
+
+    QueryPerformanceCounter(&Now);
+    Duration = Now.QuadPart - StartTime;
+    if (Category == TraceIO && Duration < TraceIOThreshold) {
+        return;
+    }
+    TraceRecordEvent(Name, Category, Arg, 'X', StartTime, Duration);
+}
+
+static double __fastcall TraceTicksToMicroseconds(unsigned __int64 Ticks)
+{
+    return (double)Ticks * 1000000.0 / (double)TraceFrequency;
+}
+
+static void __fastcall TraceWriteRecord(const TraceRecord *pRecord, DWORD ProcessId)
+{
+    // Events recorded by a thread that was already running when TraceStart()
+    // was called may predate it.
+    unsigned __int64 Timestamp = (pRecord->Timestamp > TraceStartTime) ? pRecord->Timestamp - TraceStartTime : 0;
+
+    fprintf(TraceFile, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,",
+            pRecord->Name, TraceCategoryNames[pRecord->Category], pRecord->Phase,
+            ProcessId, pRecord->ThreadId, TraceTicksToMicroseconds(Timestamp));
+    if (pRecord->Phase == 'X') {
+        fprintf(TraceFile, "\"dur\":%.3f,", TraceTicksToMicroseconds(pRecord->Duration));
+    } else {
+        fputs("\"s\":\"t\",", TraceFile);
+    }
+    fprintf(TraceFile, "\"args\":{\"arg\":\"0x%x\"}}", pRecord->Arg);
+}
+
+// Writes the trace file.  Called at exit, possibly while other threads are still
+// recording.
+static void __cdecl TraceStop(void)
+{
+    DWORD ProcessId = GetCurrentProcessId();
+    LONG MilestoneCount;
+
+    TraceEnabled = false;
+
+    fprintf(TraceFile, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(TraceFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s\"}}",
+            ProcessId, EMULATOR_NAME_A);
+
+    MilestoneCount = min(TraceMilestoneCount, TRACE_MILESTONE_RECORDS);
+    for (LONG i=0; i<MilestoneCount; ++i) {
+        if (TraceMilestones[i].Phase) {
+            TraceWriteRecord(&TraceMilestones[i], ProcessId);
+        }
+    }
+
+    for (TraceBuffer *pBuffer = TraceBuffers; pBuffer; pBuffer = pBuffer->Next) {
+        unsigned __int32 Head = pBuffer->Head;
+        unsigned __int32 Count = Head;
+
+        if (pBuffer->ThreadName) {
+            fprintf(TraceFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    ProcessId, pBuffer->ThreadId, pBuffer->ThreadName);
+        }
+        if (pBuffer->Wrapped) {
+            // Skip the oldest record as well:  a thread that tested TraceEnabled
+            // before it was cleared may be overwriting it.
+            Count = TRACE_BUFFER_RECORDS-1;
+        }
+        for (unsigned __int32 i=Head-Count; i!=Head; ++i) {
+            TraceWriteRecord(&pBuffer->Records[i & (TRACE_BUFFER_RECORDS-1)], ProcessId);
+        }
+    }
+
+    fprintf(TraceFile, "\n]}\n");
+    fclose(TraceFile);
+    TraceFile = NULL;
+}
@@ -0,0 +1,542 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "resource.h"
+#include "CompletionPort.h"
+#include "UARTBackend.h"
+
+// Include the logging infrastructure
+#include "dev_emulator_log.h"
+#define TMH_FILENAME "uartbackend.tmh"
+#include "vsd_logging_inc.h"
+
+#define UART_PIPE_PREFIX        L"\\\\.\\pipe\\"
+#define UART_SOCKET_PREFIX      L"tcp:"
+#define UART_PIPE_BUFFER_SIZE   65536
+
+static void ReportOpenFailure(__in_z const wchar_t *Name, DWORD Error)
+{
+    wchar_t lastErrorBuffer[1000];
+
+    DecodeLastError(Error, ARRAY_SIZE(lastErrorBuffer), lastErrorBuffer);
+    ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN_SERIAL, Name, lastErrorBuffer);
+}
+
+UARTBackend * __fastcall CreateUARTBackend(__in_z const wchar_t *Name)
+{
+    if (_wcsnicmp(Name, UART_PIPE_PREFIX, ARRAY_SIZE(UART_PIPE_PREFIX)-1) == 0) {
+        return new PipeUARTBackend;
+    } else if (_wcsnicmp(Name, UART_SOCKET_PREFIX, ARRAY_SIZE(UART_SOCKET_PREFIX)-1) == 0) {
+        return new SocketUARTBackend;
+    }
+    return new ComPortUARTBackend;
+}
+
+bool __fastcall ComPortUARTBackend::Open(__in_z const wchar_t *Name, COMPLETIONPORT_CALLBACK *pCallback)
+{
+    //
+    // Open the serial port.  It must be opened with FILE_FLAG_OVERLAPPED, or else
+    // one of the serial I/O APIs will block when called.  I can't recall which one,
+    // and the MSDN docs are spotty about documenting this blocking behavior.
+    //
+    hCom = CreateFileW(Name,
+        GENERIC_READ|GENERIC_WRITE,
+        0,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_OVERLAPPED,
+        NULL);
+    if (hCom == INVALID_HANDLE_VALUE) {
+        ReportOpenFailure(Name, GetLastError());
+        return false;
+    }
+
+    // Flush any characters currently stored in the Win32 serial driver
+    PurgeComm(hCom, PURGE_TXCLEAR|PURGE_RXCLEAR);
+
+    COMMTIMEOUTS ct;
+    memset(&ct, 0, sizeof(ct));
+    ct.ReadIntervalTimeout = 1; // ReadFile() returns after 1ms of inactivity after characters begin to arrive
+    if (SetCommTimeouts(hCom, &ct) == 0) {
+        ASSERT(FALSE);
+    }
+
+    if (!CompletionPort.AssociateHandleWithCompletionPort(hCom, pCallback)) {
+        CloseHandle(hCom);
+        hCom = INVALID_HANDLE_VALUE;
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+    return true;
+}
+
+void __fastcall ComPortUARTBackend::Close(void)
+{
+    CancelIo(hCom);
+    CloseHandle(hCom);
+    hCom = INVALID_HANDLE_VALUE;
+}
+
+bool __fastcall ComPortUARTBackend::BeginWrite(const unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped)
+{
+    if (WriteFile(hCom, Buffer, Length, NULL, lpOverlapped) == FALSE) {
+        DWORD ErrorStatus = GetLastError();
+        if (ErrorStatus != ERROR_IO_PENDING) {
+            LOG_ERROR(GENERAL, "WriteFile failed on the serial port with %d", ErrorStatus);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool __fastcall ComPortUARTBackend::BeginRead(unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped)
+{
+    if (ReadFile(hCom, Buffer, Length, NULL, lpOverlapped) == FALSE) {
+        DWORD ErrorStatus = GetLastError();
+        if (ErrorStatus != ERROR_IO_PENDING) {
+            LOG_ERROR(GENERAL, "ReadFile failed on the serial port with %d", ErrorStatus);
+            return false;
+        }
+    }
+    return true;
+}
+
+StreamUARTBackend::StreamUARTBackend()
+{
+    hWakeEvent = NULL;
+    Stopping = false;
+    pCallback = NULL;
+    PendingRead.lpOverlapped = NULL;
+    PendingWrite.lpOverlapped = NULL;
+    Connected = false;
+    hServiceThread = NULL;
+}
+
+bool __fastcall StreamUARTBackend::Open(__in_z const wchar_t *Name, COMPLETIONPORT_CALLBACK *pCallback)
+{
+    this->pCallback = pCallback;
+    InitializeCriticalSection(&Lock);
+
+    hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (hWakeEvent == NULL) {
+        DeleteCriticalSection(&Lock);
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+    if (!Listen(Name)) {
+        CloseHandle(hWakeEvent);
+        hWakeEvent = NULL;
+        DeleteCriticalSection(&Lock);
+        return false;
+    }
+    hServiceThread = CreateThread(NULL, 0, ServiceThreadStatic, this, 0, NULL);
+    if (hServiceThread == NULL) {
+        StopListening();
+        CloseHandle(hWakeEvent);
+        hWakeEvent = NULL;
+        DeleteCriticalSection(&Lock);
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+
+    LOG_INFO(GENERAL, "Serial port is waiting for a client on %S", Name);
+    return true;
+}
+
+void __fastcall StreamUARTBackend::Close(void)
+{
+    Stopping = true;
+    SetEvent(hWakeEvent);
+    WaitForSingleObject(hServiceThread, INFINITE);
+    CloseHandle(hServiceThread);
+    hServiceThread = NULL;
+
+    StopListening();
+    CloseHandle(hWakeEvent);
+    hWakeEvent = NULL;
+    DeleteCriticalSection(&Lock);
+}
+
+bool __fastcall StreamUARTBackend::BeginWrite(const unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped)
+{
+    EnterCriticalSection(&Lock);
+    if (!Connected) {
+        LeaveCriticalSection(&Lock);
+        return CompletionPort.PostCompletion(pCallback, Length, lpOverlapped);
+    }
+    ASSERT(PendingWrite.lpOverlapped == NULL);
+    PendingWrite.Buffer = const_cast<unsigned __int8 *>(Buffer);
+    PendingWrite.Length = Length;
+    PendingWrite.lpOverlapped = lpOverlapped;
+    LeaveCriticalSection(&Lock);
+
+    SetEvent(hWakeEvent);
+    return true;
+}
+
+bool __fastcall StreamUARTBackend::BeginRead(unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped)
+{
+    EnterCriticalSection(&Lock);
+    ASSERT(PendingRead.lpOverlapped == NULL);
+    PendingRead.Buffer = Buffer;
+    PendingRead.Length = Length;
+    PendingRead.lpOverlapped = lpOverlapped;
+    LeaveCriticalSection(&Lock);
+
+    SetEvent(hWakeEvent);
+    return true;
+}
+
+DWORD WINAPI StreamUARTBackend::ServiceThreadStatic(LPVOID lpvThreadParam)
+{
+    StreamUARTBackend *pThis = (StreamUARTBackend *)lpvThreadParam;
+
+    return pThis->ServiceThread();
+}
+
+DWORD StreamUARTBackend::ServiceThread(void)
+{
+    while (!Stopping) {
+        HANDLE hStream = WaitForClient();
+        if (hStream == INVALID_HANDLE_VALUE) {
+            if (!Stopping) {
+                // Don't spin if the listener itself is failing
+                WaitForSingleObject(hWakeEvent, 1000);
+            }
+            continue;
+        }
+
+        EnterCriticalSection(&Lock);
+        Connected = true;
+        LeaveCriticalSection(&Lock);
+        LOG_INFO(GENERAL, "Serial port client connected");
+
+        Serve(hStream);
+
+        // A write the client did not take is discarded.  A read stays pending for
+        // the next client.
+        EnterCriticalSection(&Lock);
+        Connected = false;
+        PendingIo Write = PendingWrite;
+        PendingWrite.lpOverlapped = NULL;
+        LeaveCriticalSection(&Lock);
+        if (Write.lpOverlapped) {
+            CompletionPort.PostCompletion(pCallback, Write.Length, Write.lpOverlapped);
+        }
+
+        Disconnect(hStream);
+        LOG_INFO(GENERAL, "Serial port client disconnected");
+    }
+    return 0;
+}
+
+// Runs the posted reads and writes against the client until it goes away or the
+// backend is closed
+void __fastcall StreamUARTBackend::Serve(HANDLE hStream)
+{
+    OVERLAPPED ReadOverlapped;
+    OVERLAPPED WriteOverlapped;
+    bool ReadActive = false;
+    bool WriteActive = false;
+    DWORD BytesTransferred;
+
+    memset(&ReadOverlapped, 0, sizeof(ReadOverlapped));
+    memset(&WriteOverlapped, 0, sizeof(WriteOverlapped));
+    ReadOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    WriteOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (ReadOverlapped.hEvent == NULL || WriteOverlapped.hEvent == NULL) {
+        goto Done;
+    }
+
+    while (!Stopping) {
+        HANDLE Handles[3] = { hWakeEvent, ReadOverlapped.hEvent, WriteOverlapped.hEvent };
+        PendingIo Read;
+        PendingIo Write;
+
+        EnterCriticalSection(&Lock);
+        Read = PendingRead;
+        Write = PendingWrite;
+        LeaveCriticalSection(&Lock);
+
+        if (!ReadActive && Read.lpOverlapped) {
+            if (ReadFile(hStream, Read.Buffer, Read.Length, NULL, &ReadOverlapped) == FALSE &&
+                GetLastError() != ERROR_IO_PENDING) {
+                break;
+            }
+            ReadActive = true;
+        }
+        if (!WriteActive && Write.lpOverlapped) {
+            if (WriteFile(hStream, Write.Buffer, Write.Length, NULL, &WriteOverlapped) == FALSE &&
+                GetLastError() != ERROR_IO_PENDING) {
+                break;
+            }
+            WriteActive = true;
+        }
+
+        if (WaitForMultipleObjects(ARRAY_SIZE(Handles), Handles, FALSE, INFINITE) == WAIT_FAILED) {
+            break;
+        }
+
+        if (ReadActive && WaitForSingleObject(ReadOverlapped.hEvent, 0) == WAIT_OBJECT_0) {
+            ReadActive = false;
+            if (!GetOverlappedResult(hStream, &ReadOverlapped, &BytesTransferred, FALSE) || BytesTransferred == 0) {
+                break; // the client closed its end
+            }
+            ResetEvent(ReadOverlapped.hEvent);
+
+            EnterCriticalSection(&Lock);
+            LPOVERLAPPED lpOverlapped = PendingRead.lpOverlapped;
+            PendingRead.lpOverlapped = NULL;
+            LeaveCriticalSection(&Lock);
+            CompletionPort.PostCompletion(pCallback, BytesTransferred, lpOverlapped);
+        }
+        if (WriteActive && WaitForSingleObject(WriteOverlapped.hEvent, 0) == WAIT_OBJECT_0) {
+            WriteActive = false;
+            if (!GetOverlappedResult(hStream, &WriteOverlapped, &BytesTransferred, FALSE)) {
+                break;
+            }
+            ResetEvent(WriteOverlapped.hEvent);
+
+            EnterCriticalSection(&Lock);
+            LPOVERLAPPED lpOverlapped = PendingWrite.lpOverlapped;
+            PendingWrite.lpOverlapped = NULL;
+            LeaveCriticalSection(&Lock);
+            CompletionPort.PostCompletion(pCallback, BytesTransferred, lpOverlapped);
+        }
+    }
+
+    // Nothing may touch the request buffers once this returns
+    if (ReadActive || WriteActive) {
+        CancelIo(hStream);
+        if (ReadActive) {
+            GetOverlappedResult(hStream, &ReadOverlapped, &BytesTransferred, TRUE);
+        }
+        if (WriteActive) {
+            GetOverlappedResult(hStream, &WriteOverlapped, &BytesTransferred, TRUE);
+        }
+    }
+
+Done:
+    if (ReadOverlapped.hEvent) {
+        CloseHandle(ReadOverlapped.hEvent);
+    }
+    if (WriteOverlapped.hEvent) {
+        CloseHandle(WriteOverlapped.hEvent);
+    }
+}
+
+bool __fastcall PipeUARTBackend::Listen(__in_z const wchar_t *Name)
+{
+    // FILE_FLAG_FIRST_PIPE_INSTANCE keeps another process from creating the pipe
+    // first and receiving the guest's output.
+    hPipe = CreateNamedPipeW(Name,
+                             PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                             PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                             1,
+                             UART_PIPE_BUFFER_SIZE,
+                             UART_PIPE_BUFFER_SIZE,
+                             0,
+                             NULL);
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        ReportOpenFailure(Name, GetLastError());
+        return false;
+    }
+    return true;
+}
+
+void __fastcall PipeUARTBackend::StopListening(void)
+{
+    CloseHandle(hPipe);
+    hPipe = INVALID_HANDLE_VALUE;
+}
+
+HANDLE __fastcall PipeUARTBackend::WaitForClient(void)
+{
+    OVERLAPPED Overlapped;
+    HANDLE hStream = INVALID_HANDLE_VALUE;
+    DWORD BytesTransferred;
+
+    memset(&Overlapped, 0, sizeof(Overlapped));
+    Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (Overlapped.hEvent == NULL) {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (ConnectNamedPipe(hPipe, &Overlapped)) {
+        hStream = hPipe;
+    } else {
+        switch (GetLastError()) {
+        case ERROR_PIPE_CONNECTED:  // the client connected before ConnectNamedPipe() was called
+            hStream = hPipe;
+            break;
+
+        case ERROR_NO_DATA:         // the client connected and has already closed its end
+            DisconnectNamedPipe(hPipe);
+            break;
+
+        case ERROR_IO_PENDING:
+            {
+                HANDLE Handles[2] = { hWakeEvent, Overlapped.hEvent };
+                DWORD dw;
+
+                // hWakeEvent is also signalled for every read and write posted while
+                // no client is connected; only Close() ends the wait.
+                do {
+                    dw = WaitForMultipleObjects(ARRAY_SIZE(Handles), Handles, FALSE, INFINITE);
+                } while (dw == WAIT_OBJECT_0 && !Stopping);
+
+                if (dw == WAIT_OBJECT_0+1 && GetOverlappedResult(hPipe, &Overlapped, &BytesTransferred, FALSE)) {
+                    hStream = hPipe;
+                } else {
+                    CancelIo(hPipe);
+                    GetOverlappedResult(hPipe, &Overlapped, &BytesTransferred, TRUE);
+                }
+            }
+            break;
+
+        default:
+            LOG_ERROR(GENERAL, "ConnectNamedPipe failed with %d", GetLastError());
+            break;
+        }
+    }
+
+    CloseHandle(Overlapped.hEvent);
+    return hStream;
+}
+
+void __fastcall PipeUARTBackend::Disconnect(HANDLE hStream)
+{
+    DisconnectNamedPipe(hStream);
+}
+
+bool __fastcall SocketUARTBackend::Listen(__in_z const wchar_t *Name)
+{
+    WSADATA wsaData;
+    wchar_t Address[64];
+    const wchar_t *Endpoint = Name + ARRAY_SIZE(UART_SOCKET_PREFIX)-1;
+    sockaddr_in sin;
+    int AddressLength = sizeof(sin);
+    BOOL Exclusive = TRUE;
+    int Error;
+
+    // A bare port number listens on the loopback address only
+    if (wcschr(Endpoint, L':') == NULL) {
+        if (FAILED(StringCchPrintfW(Address, ARRAY_SIZE(Address), L"127.0.0.1:%s", Endpoint))) {
+            ReportOpenFailure(Name, ERROR_INVALID_NAME);
+            return false;
+        }
+    } else if (FAILED(StringCchCopyW(Address, ARRAY_SIZE(Address), Endpoint))) {
+        ReportOpenFailure(Name, ERROR_INVALID_NAME);
+        return false;
+    }
+
+    Error = WSAStartup(MAKEWORD(2,2), &wsaData);
+    if (Error != 0) {
+        ReportOpenFailure(Name, Error);
+        return false;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    if (WSAStringToAddressW(Address, AF_INET, NULL, (LPSOCKADDR)&sin, &AddressLength) != 0) {
+        Error = WSAGetLastError();
+        goto Fail;
+    }
+    if (sin.sin_port == 0) {
+        Error = WSAEINVAL;
+        goto Fail;
+    }
+
+    ListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (ListenSocket == INVALID_SOCKET) {
+        Error = WSAGetLastError();
+        goto Fail;
+    }
+    if (setsockopt(ListenSocket, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char *)&Exclusive, sizeof(Exclusive)) != 0 ||
+        bind(ListenSocket, (const sockaddr *)&sin, sizeof(sin)) != 0 ||
+        listen(ListenSocket, 1) != 0) {
+        Error = WSAGetLastError();
+        goto Fail;
+    }
+
+    hAcceptEvent = WSACreateEvent();
+    if (hAcceptEvent == WSA_INVALID_EVENT) {
+        hAcceptEvent = NULL;
+        Error = WSAGetLastError();
+        goto Fail;
+    }
+    if (WSAEventSelect(ListenSocket, hAcceptEvent, FD_ACCEPT) != 0) {
+        Error = WSAGetLastError();
+        goto Fail;
+    }
+    return true;
+
+Fail:
+    ReportOpenFailure(Name, Error);
+    StopListening();
+    return false;
+}
+
+void __fastcall SocketUARTBackend::StopListening(void)
+{
+    if (ListenSocket != INVALID_SOCKET) {
+        closesocket(ListenSocket);
+        ListenSocket = INVALID_SOCKET;
+    }
+    if (hAcceptEvent) {
+        WSACloseEvent(hAcceptEvent);
+        hAcceptEvent = NULL;
+    }
+    WSACleanup();
+}
+
+HANDLE __fastcall SocketUARTBackend::WaitForClient(void)
+{
+    for (;;) {
+        HANDLE Handles[2] = { hWakeEvent, hAcceptEvent };
+        DWORD dw;
+        SOCKET s;
+        u_long NonBlocking = 0;
+        BOOL NoDelay = TRUE;
+
+        dw = WaitForMultipleObjects(ARRAY_SIZE(Handles), Handles, FALSE, INFINITE);
+        if (Stopping || dw == WAIT_FAILED) {
+            return INVALID_HANDLE_VALUE;
+        }
+        if (dw != WAIT_OBJECT_0+1) {
+            continue;
+        }
+        WSAResetEvent(hAcceptEvent);
+
+        s = accept(ListenSocket, NULL, NULL);
+        if (s == INVALID_SOCKET) {
+            continue;
+        }
+
+        // The socket inherits the listener's event selection, which also makes it
+        // non-blocking.  Undo both so it can be used for overlapped ReadFile() and
+        // WriteFile() like a pipe.  Guest output is interactive, so don't let
+        // Nagle hold back short writes.
+        WSAEventSelect(s, NULL, 0);
+        ioctlsocket(s, FIONBIO, &NonBlocking);
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&NoDelay, sizeof(NoDelay));
+        return (HANDLE)s;
+    }
+}
+
+void __fastcall SocketUARTBackend::Disconnect(HANDLE hStream)
+{
+    shutdown((SOCKET)hStream, SD_BOTH);
+    closesocket((SOCKET)hStream);
+}
@@ -0,0 +1,139 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef UARTBACKEND_H__
+#define UARTBACKEND_H__
+
+// The host side of an emulated serial port.  IOHardwareUART owns the transmit and
+// receive queues; a UARTBackend only moves runs of bytes between those queues and
+// the host.  The backend is chosen by the name given to /u0, /u1 or /u2.
+class UARTBackend {
+public:
+    virtual ~UARTBackend() { }
+
+    // Opens the host side of the port and reports any failure to the user.  Every
+    // read and write started later completes by posting lpOverlapped to pCallback
+    // through CompletionPort, with the number of bytes moved as dwBytesTransferred.
+    virtual bool __fastcall Open(__in_z const wchar_t *Name, COMPLETIONPORT_CALLBACK *pCallback) = 0;
+    // Cancels outstanding I/O.  Nothing is written to a buffer once Close() returns,
+    // but completions already posted may still arrive.
+    virtual void __fastcall Close(void) = 0;
+
+    // Both return false only if the request could not be started.  Only one of each
+    // may be outstanding, and the buffer must remain valid until the completion is
+    // posted.  A write may complete with fewer bytes than were asked for.
+    virtual bool __fastcall BeginWrite(const unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped) = 0;
+    virtual bool __fastcall BeginRead(unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped) = 0;
+
+    // The Win32 COM port behind the backend, for line settings and modem control,
+    // or INVALID_HANDLE_VALUE if there is none
+    virtual HANDLE __fastcall GetCommHandle(void) { return INVALID_HANDLE_VALUE; }
+};
+
+// Creates the backend for a /u0-/u2 name:  \\.\pipe\name is a named pipe, tcp:port
+// or tcp:address:port is a TCP listener, and anything else is a Win32 COM port.
+UARTBackend * __fastcall CreateUARTBackend(__in_z const wchar_t *Name);
+
+// A Win32 serial port such as COM1.  This is the default.
+class ComPortUARTBackend : public UARTBackend {
+public:
+    ComPortUARTBackend() { hCom = INVALID_HANDLE_VALUE; }
+
+    virtual bool __fastcall Open(__in_z const wchar_t *Name, COMPLETIONPORT_CALLBACK *pCallback);
+    virtual void __fastcall Close(void);
+    virtual bool __fastcall BeginWrite(const unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall BeginRead(unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped);
+    virtual HANDLE __fastcall GetCommHandle(void) { return hCom; }
+
+private:
+    HANDLE hCom;
+};
+
+// A byte stream that a host program connects to, such as a terminal or a test
+// harness.  A service thread waits for the client, runs the reads and writes, and
+// waits for the next client when it goes away.  Bytes written while no client is
+// connected are discarded, as they would be on an unplugged serial cable.
+class StreamUARTBackend : public UARTBackend {
+public:
+    StreamUARTBackend();
+
+    virtual bool __fastcall Open(__in_z const wchar_t *Name, COMPLETIONPORT_CALLBACK *pCallback);
+    virtual void __fastcall Close(void);
+    virtual bool __fastcall BeginWrite(const unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped);
+    virtual bool __fastcall BeginRead(unsigned __int8 *Buffer, unsigned __int32 Length, LPOVERLAPPED lpOverlapped);
+
+protected:
+    // Creates the listening end of the stream
+    virtual bool __fastcall Listen(__in_z const wchar_t *Name) = 0;
+    virtual void __fastcall StopListening(void) = 0;
+    // Waits for a client and returns the handle to read and write it through, or
+    // INVALID_HANDLE_VALUE if hWakeEvent was signalled or the wait failed
+    virtual HANDLE __fastcall WaitForClient(void) = 0;
+    virtual void __fastcall Disconnect(HANDLE hStream) = 0;
+
+    HANDLE hWakeEvent;              // signalled when a request is posted or on Close()
+    volatile bool Stopping;
+
+private:
+    struct PendingIo {
+        unsigned __int8 *Buffer;
+        unsigned __int32 Length;
+        LPOVERLAPPED lpOverlapped;  // NULL if nothing is pending
+    };
+
+    COMPLETIONPORT_CALLBACK *pCallback;
+    CRITICAL_SECTION Lock;          // protects the pending requests and Connected
+    PendingIo PendingRead;
+    PendingIo PendingWrite;
+    bool Connected;
+    HANDLE hServiceThread;
+
+    void __fastcall Serve(HANDLE hStream);
+    static DWORD WINAPI ServiceThreadStatic(LPVOID lpvThreadParam);
+    DWORD ServiceThread(void);
+};
+
+// A named pipe server, such as \\.\pipe\ce-serial.  This fills the role of a
+// pseudo-terminal:  terminal programs and scripts attach to it by name.
+class PipeUARTBackend : public StreamUARTBackend {
+public:
+    PipeUARTBackend() { hPipe = INVALID_HANDLE_VALUE; }
+
+protected:
+    virtual bool __fastcall Listen(__in_z const wchar_t *Name);
+    virtual void __fastcall StopListening(void);
+    virtual HANDLE __fastcall WaitForClient(void);
+    virtual void __fastcall Disconnect(HANDLE hStream);
+
+private:
+    HANDLE hPipe;
+};
+
+// A TCP listener, tcp:port on the loopback address or tcp:address:port, taking one
+// client at a time.
+class SocketUARTBackend : public StreamUARTBackend {
+public:
+    SocketUARTBackend() { ListenSocket = INVALID_SOCKET; hAcceptEvent = NULL; }
+
+protected:
+    virtual bool __fastcall Listen(__in_z const wchar_t *Name);
+    virtual void __fastcall StopListening(void);
+    virtual HANDLE __fastcall WaitForClient(void);
+    virtual void __fastcall Disconnect(HANDLE hStream);
+
+private:
+    SOCKET ListenSocket;
+    HANDLE hAcceptEvent;
+};
+
+#endif // UARTBACKEND_H__
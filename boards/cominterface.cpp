@@ -636,12 +636,24 @@ HRESULT STDMETHODCALLTYPE CEmulatorDMAChannel::Receive(
 
 bool __fastcall IODMATransport::PowerOn(void)
 {
+    for (unsigned __int32 i=0; i<NumberOfChannels; ++i) {
+        InitializeCriticalSection(&Rings[i].Lock);
+        Rings[i].pHeader = NULL;
+        // A restored state may already have rings registered
+        if (DMAChannels[i].RingRegister && !RegisterRing(i, DMAChannels[i].RingRegister)) {
+            DMAChannels[i].RingRegister = 0;
+        }
+    }
     return true;
 }
 
 bool __fastcall IODMATransport::Reset(void)
 {
     ChannelRecordSet.disconnectAll(DEVICE_CONNECTED);
+    for (unsigned __int32 i=0; i<NumberOfChannels; ++i) {
+        DMAChannels[i].RingRegister = 0;
+        RegisterRing(i, 0);
+    }
     return true;
 }
 
@@ -664,6 +676,7 @@ void __fastcall IODMATransport::SaveState(StateFiler& filer) const
         filer.Write(DMAChannels[i].IOOutputRegister);
         filer.Write(DMAChannels[i].IRQRegister);
         filer.Write(DMAChannels[i].IRQAcknowledgeRegister);
+        filer.Write(DMAChannels[i].RingRegister);
     }
     ChannelRecordSet.SaveState(filer);
     AddressService.SaveState(filer);
@@ -688,6 +701,11 @@ void __fastcall IODMATransport::RestoreState(StateFiler& filer)
         filer.Read(DMAChannels[i].IOOutputRegister);
         filer.Read(DMAChannels[i].IRQRegister);
         filer.Read(DMAChannels[i].IRQAcknowledgeRegister);
+        if (filer.getVersion() >= MinimumStateFileVersionForDMARings) {
+            filer.Read(DMAChannels[i].RingRegister);
+        } else {
+            DMAChannels[i].RingRegister = 0;
+        }
     }
     ChannelRecordSet.RestoreState(filer);
     AddressService.RestoreState(filer);
@@ -760,6 +778,12 @@ unsigned __int32 __fastcall IODMATransport::ReadWord(unsigned __int32 IOAddress)
             return DMAChannels[ChannelNumber].IRQRegister;
         case 0x14:
             return DMAChannels[ChannelNumber].IRQAcknowledgeRegister;
+        case 0x18:
+            // Zero if the ring was rejected, so the guest can fall back to the
+            // InputBuffer/OutputBuffer window
+            return DMAChannels[ChannelNumber].RingRegister;
+        case 0x1c:
+            return DMAChannels[ChannelNumber].RingDoorbellRegister;
         default:
             TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
             return 0;
@@ -964,6 +988,16 @@ void __fastcall IODMATransport::WriteWord(unsigned __int32 IOAddress, unsigned _
             DMAChannels[ChannelNumber].IRQAcknowledgeRegister = Value;
             ClearInterrupt();
             break;
+        case 0x18:
+            DMAChannels[ChannelNumber].RingRegister = Value;
+            if (!RegisterRing(ChannelNumber, Value)) {
+                DMAChannels[ChannelNumber].RingRegister = 0;
+            }
+            break;
+        case 0x1c:
+            DMAChannels[ChannelNumber].RingDoorbellRegister = Value;
+            RingDoorbell(ChannelNumber);
+            break;
         default:
             TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
             break;
@@ -1075,13 +1109,33 @@ HRESULT __fastcall IODMATransport::Send(DMAChannelRecord * channel, const BYTE *
     if ( channel->isVirtual() && (!channel->isDeviceConnected() || !channel->isDesktopConnected() ) )
         return HRESULT_FROM_WIN32(ERROR_NOT_READY);
 
+    // Copy the packet straight into the guest's ring, if it registered one and
+    // has a buffer free
+    if (SendToRing(channel, dataBuffer, byteCount)) {
+        return S_OK;
+    }
+
     // Notify WinCE that it needs to pick up the packet.  The Send() returns
     // without blocking for WinCE to actually pick it up.
     EnterCriticalSection(&IOLock);
     if (channel->getSendQueue()->Enqueue(dataBuffer, byteCount, channel->isVirtual()))
     {
-        channel->setFlags(1);
-        RaiseInterrupt(channel->getChannelIndex());
+        if (!channel->isVirtual() && Rings[channel->getChannelIndex()].pHeader) {
+            // The ring was full.  The packet moves into the ring once the guest
+            // makes room, and packets sent after it queue behind it.
+            DMARing *pRing = &Rings[channel->getChannelIndex()];
+            EnterCriticalSection(&pRing->Lock);
+            pRing->RxBacklog = true;
+            if (pRing->pHeader) {
+                pRing->pHeader->RingFlags |= DMARING_RX_WAITING;
+            }
+            LeaveCriticalSection(&pRing->Lock);
+            // The guest may have made room since SendToRing() looked
+            RingDoorbell(channel->getChannelIndex());
+        } else {
+            channel->setFlags(1);
+            RaiseInterrupt(channel->getChannelIndex());
+        }
         hr = S_OK;
     }
     else
@@ -1109,14 +1163,21 @@ HRESULT __fastcall IODMATransport::Receive(DMAChannelRecord * channel, BYTE *dat
     // Wait for a packet to arrive, or the timeout to expire
     dw = WaitForSingleObject(channel->getReceiveEvent(), Timeout);
     if (dw == WAIT_OBJECT_0) {
-        // A packet has arrived - dequeue and return it
+        // Packets the guest sent through the OutputBuffer window go first, then
+        // those in its ring
         EnterCriticalSection(&IOLock);
+        if (channel->getReceiveQueue()->IsEmpty() && ReceiveFromRing(channel, dataBuffer, byteCount)) {
+            LeaveCriticalSection(&IOLock);
+            return S_OK;
+        }
+
+        // A packet has arrived - dequeue and return it
         unsigned __int32 Count = *byteCount;
         Ret = channel->getReceiveQueue()->Dequeue(dataBuffer, &Count);
         if (Ret) {
             *byteCount = (USHORT)Count;
         }
-        if (channel->getReceiveQueue()->IsEmpty()) {
+        if (channel->getReceiveQueue()->IsEmpty() && !RingHasTxPackets(channel)) {
             ResetEvent(channel->getReceiveEvent());
         }
         LeaveCriticalSection(&IOLock);
@@ -1145,6 +1206,255 @@ void IODMATransport::ClearInterrupt(void)
     GPIO.ClearInterrupt(10); // EINT10 is reserved as SYSINTR_DMATRANS
 }
 
+unsigned __int8 * IODMATransport::MapRingBuffer(unsigned __int32 GuestAddress, unsigned __int32 Length)
+{
+    size_t HostAddress = BoardMapGuestPhysicalToHostRAM(GuestAddress);
+
+    if (HostAddress == 0) {
+        return NULL;
+    }
+    if (Length > 1 &&
+        BoardMapGuestPhysicalToHostRAM(GuestAddress+Length-1) != HostAddress+Length-1) {
+        return NULL;
+    }
+    return (unsigned __int8 *)HostAddress;
+}
+
+// Registers, replaces or (if GuestAddress is 0) removes the channel's ring.  Returns
+// false if the ring was rejected.  The IOLock must be held.
+bool IODMATransport::RegisterRing(unsigned __int32 ChannelNumber, unsigned __int32 GuestAddress)
+{
+    DMARing *pRing = &Rings[ChannelNumber];
+    DMARingHeader *pHeader = NULL;
+    bool Backlog = false;
+
+    if (GuestAddress) {
+        pHeader = (DMARingHeader *)MapRingBuffer(GuestAddress, sizeof(DMARingHeader));
+        if (pHeader == NULL ||
+            pHeader->Signature != DMARING_SIGNATURE ||
+            pHeader->EntryCount == 0 ||
+            pHeader->EntryCount > DMARING_MAX_ENTRIES ||
+            (pHeader->EntryCount & (pHeader->EntryCount-1)) != 0 ||
+            MapRingBuffer(GuestAddress, sizeof(DMARingHeader)+2*pHeader->EntryCount*sizeof(DMARingDescriptor)) != (unsigned __int8 *)pHeader) {
+            LOG_ERROR(DMA, "IODMATransport::RegisterRing rejected the ring at %x for channel %d", GuestAddress, ChannelNumber);
+            pHeader = NULL;
+        }
+    }
+
+    // Packets queued before the ring was registered go into it first
+    DMAChannelRecord * Channel = ChannelRecordSet.getChannel(ChannelNumber);
+    if (Channel && Channel->getSendQueue() && !Channel->getSendQueue()->IsEmpty()) {
+        Backlog = true;
+    }
+
+    EnterCriticalSection(&pRing->Lock);
+    pRing->pHeader = pHeader;
+    if (pHeader) {
+        pRing->RxDescriptors = (DMARingDescriptor *)(pHeader+1);
+        pRing->TxDescriptors = pRing->RxDescriptors + pHeader->EntryCount;
+        pRing->Mask = pHeader->EntryCount-1;
+        pRing->RxSinceInterrupt = 0;
+        pRing->RxBacklog = Backlog;
+        pHeader->RingFlags = (Backlog) ? DMARING_RX_WAITING : 0;
+        LOG_INFO(DMA, "IODMATransport::RegisterRing registered a %d-entry ring at %x for channel %d", pHeader->EntryCount, GuestAddress, ChannelNumber);
+    }
+    LeaveCriticalSection(&pRing->Lock);
+
+    if (pHeader && Backlog) {
+        RingDoorbell(ChannelNumber);
+    }
+    return (pHeader != NULL || GuestAddress == 0);
+}
+
+// Copies a packet from the desktop into the guest's next free Rx buffer.  Returns
+// false if the channel has no ring, the ring is full, or packets are already
+// queued ahead of this one; the caller then queues the packet.
+bool IODMATransport::SendToRing(DMAChannelRecord * channel, const BYTE *dataBuffer, USHORT byteCount)
+{
+    if (channel->isVirtual()) {
+        return false;
+    }
+
+    const unsigned __int32 ChannelNumber = channel->getChannelIndex();
+    DMARing *pRing = &Rings[ChannelNumber];
+    bool Interrupt = false;
+
+    if (pRing->pHeader == NULL) {
+        return false;
+    }
+
+    EnterCriticalSection(&pRing->Lock);
+    DMARingHeader *pHeader = pRing->pHeader;
+    if (pHeader == NULL || pRing->RxBacklog) {
+        LeaveCriticalSection(&pRing->Lock);
+        return false;
+    }
+
+    const unsigned __int32 Produced = pHeader->RxProduced;
+    if (Produced - pHeader->RxConsumed > pRing->Mask) {
+        // The ring is full
+        LeaveCriticalSection(&pRing->Lock);
+        return false;
+    }
+
+    DMARingDescriptor *pDescriptor = &pRing->RxDescriptors[Produced & pRing->Mask];
+    unsigned __int8 *pBuffer = MapRingBuffer(pDescriptor->BufferAddress, BufferSizeDMA);
+    if (pBuffer == NULL) {
+        LOG_ERROR(DMA, "IODMATransport::SendToRing found an invalid Rx buffer address %x on channel %d", pDescriptor->BufferAddress, ChannelNumber);
+        LeaveCriticalSection(&pRing->Lock);
+        return false;
+    }
+    memcpy(pBuffer, dataBuffer, byteCount);
+    pDescriptor->Length = byteCount;
+
+    // Publish the packet, then look at how far the guest has got.  If it had taken
+    // every earlier packet, it may be idle and needs the interrupt.
+    MemoryBarrier();
+    pHeader->RxProduced = Produced+1;
+    MemoryBarrier();
+    pRing->RxSinceInterrupt++;
+    if (pHeader->RxConsumed == Produced ||
+        (pHeader->InterruptBatch && pRing->RxSinceInterrupt >= pHeader->InterruptBatch)) {
+        pRing->RxSinceInterrupt = 0;
+        Interrupt = true;
+    }
+    LeaveCriticalSection(&pRing->Lock);
+
+    LOG_VVERBOSE(DMA, "IODMATransport::SendToRing produced a packet on channel %d", ChannelNumber);
+    if (Interrupt) {
+        EnterCriticalSection(&IOLock);
+        RaiseInterrupt(ChannelNumber);
+        LeaveCriticalSection(&IOLock);
+    }
+    return true;
+}
+
+// Copies the guest's next Tx packet to the desktop.  Returns false if the channel
+// has no ring or the ring is empty.  The IOLock must be held.
+bool IODMATransport::ReceiveFromRing(DMAChannelRecord * channel, BYTE *dataBuffer, USHORT *byteCount)
+{
+    if (channel->isVirtual()) {
+        return false;
+    }
+
+    DMARing *pRing = &Rings[channel->getChannelIndex()];
+
+    if (pRing->pHeader == NULL) {
+        return false;
+    }
+
+    EnterCriticalSection(&pRing->Lock);
+    DMARingHeader *pHeader = pRing->pHeader;
+    if (pHeader == NULL || pHeader->TxConsumed == pHeader->TxProduced) {
+        LeaveCriticalSection(&pRing->Lock);
+        return false;
+    }
+
+    const unsigned __int32 Consumed = pHeader->TxConsumed;
+    MemoryBarrier();
+    DMARingDescriptor *pDescriptor = &pRing->TxDescriptors[Consumed & pRing->Mask];
+    unsigned __int32 Length = min(min(pDescriptor->Length, (unsigned __int32)*byteCount), BufferSizeDMA);
+    unsigned __int8 *pBuffer = MapRingBuffer(pDescriptor->BufferAddress, Length);
+    if (pBuffer) {
+        memcpy(dataBuffer, pBuffer, Length);
+        *byteCount = (USHORT)Length;
+    } else {
+        // Drop the packet rather than wedge the ring behind it
+        LOG_ERROR(DMA, "IODMATransport::ReceiveFromRing found an invalid Tx buffer address %x", pDescriptor->BufferAddress);
+        *byteCount = 0;
+    }
+
+    // Retire the packet, then look again:  the guest rings the doorbell only if it
+    // saw the ring empty, so the event stays set while anything remains.
+    pHeader->TxConsumed = Consumed+1;
+    MemoryBarrier();
+    if (pHeader->TxProduced == Consumed+1 && channel->getReceiveQueue()->IsEmpty()) {
+        ResetEvent(channel->getReceiveEvent());
+    }
+    LeaveCriticalSection(&pRing->Lock);
+    return true;
+}
+
+bool IODMATransport::RingHasTxPackets(DMAChannelRecord * channel)
+{
+    if (channel->isVirtual()) {
+        return false;
+    }
+
+    DMARing *pRing = &Rings[channel->getChannelIndex()];
+    bool HasPackets = false;
+
+    EnterCriticalSection(&pRing->Lock);
+    if (pRing->pHeader) {
+        HasPackets = (pRing->pHeader->TxConsumed != pRing->pHeader->TxProduced);
+    }
+    LeaveCriticalSection(&pRing->Lock);
+    return HasPackets;
+}
+
+// The guest wrote RingDoorbellRegister:  it has queued Tx packets, or made room for
+// Rx packets that were waiting.  The IOLock must be held.
+void IODMATransport::RingDoorbell(unsigned __int32 ChannelNumber)
+{
+    DMARing *pRing = &Rings[ChannelNumber];
+    DMAChannelRecord * Channel = ChannelRecordSet.getChannel(ChannelNumber);
+    bool Interrupt = false;
+
+    EnterCriticalSection(&pRing->Lock);
+    DMARingHeader *pHeader = pRing->pHeader;
+    if (pHeader == NULL) {
+        LeaveCriticalSection(&pRing->Lock);
+        return;
+    }
+
+    // Move packets the desktop sent while the ring was full
+    while (pRing->RxBacklog) {
+        const unsigned __int32 Produced = pHeader->RxProduced;
+        unsigned __int32 Length;
+
+        if (Channel == NULL || Channel->getSendQueue() == NULL || Channel->getSendQueue()->IsEmpty()) {
+            pRing->RxBacklog = false;
+            pHeader->RingFlags &= ~DMARING_RX_WAITING;
+            break;
+        }
+        if (Produced - pHeader->RxConsumed > pRing->Mask) {
+            break;
+        }
+        DMARingDescriptor *pDescriptor = &pRing->RxDescriptors[Produced & pRing->Mask];
+        unsigned __int8 *pBuffer = MapRingBuffer(pDescriptor->BufferAddress, BufferSizeDMA);
+        if (pBuffer == NULL) {
+            LOG_ERROR(DMA, "IODMATransport::RingDoorbell found an invalid Rx buffer address %x on channel %d", pDescriptor->BufferAddress, ChannelNumber);
+            break;
+        }
+        Channel->getSendQueue()->Dequeue(pBuffer, &Length);
+        pDescriptor->Length = Length;
+        MemoryBarrier();
+        pHeader->RxProduced = Produced+1;
+        Interrupt = true;
+    }
+    if (Interrupt) {
+        pRing->RxSinceInterrupt = 0;
+    }
+
+    // Wake the desktop receiver for the guest's Tx packets
+    if (pHeader->TxConsumed != pHeader->TxProduced) {
+        if (Channel == NULL) {
+            // As with the OutputBuffer window, hold the packets until the desktop
+            // opens the channel
+            Channel = ChannelRecordSet.createChannel(ChannelNumber, DEVICE_CONNECTED);
+            if (Channel == NULL) {
+                TerminateWithMessage(ID_MESSAGE_RESOURCE_EXHAUSTED);
+            }
+        }
+        SetEvent(Channel->getReceiveEvent());
+    }
+    LeaveCriticalSection(&pRing->Lock);
+
+    if (Interrupt) {
+        RaiseInterrupt(ChannelNumber);
+    }
+}
+
 
 DMATransportQueue::DMATransportQueue()
 {
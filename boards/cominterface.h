@@ -143,6 +143,49 @@ private:
 #define BufferSizeDMA 0x1000
 #define FirstChannel 4
 #define NumberOfChannels 4
+
+// A descriptor ring in guest RAM, registered per physical channel by writing its
+// guest physical address to the channel's RingRegister.  Once registered, packets
+// move directly between the desktop caller's buffer and guest buffers, without
+// passing through the 0x1000-byte InputBuffer/OutputBuffer window or IOLock.
+//
+// The counters are free-running; entry N lives at index N & (EntryCount-1).
+//  - Rx (desktop to guest):  the guest fills in every RxDescriptors[].BufferAddress
+//    with a BufferSizeDMA-byte buffer before registering the ring.  The emulator
+//    copies each packet into the next buffer, sets its Length and advances
+//    RxProduced.  The guest advances RxConsumed as it takes packets.
+//  - Tx (guest to desktop):  the guest fills in the next TxDescriptors[] entry and
+//    advances TxProduced.  The emulator advances TxConsumed once the desktop has
+//    received the packet.
+//
+// Interrupts are moderated.  The emulator raises the channel's interrupt only when
+// the Rx ring goes from empty to non-empty, or once InterruptBatch packets have been
+// produced since the last interrupt.  The guest writes RingDoorbellRegister only
+// when the Tx ring goes from empty to non-empty, or after consuming Rx packets while
+// the desktop had packets waiting (RingFlags has DMARING_RX_WAITING set).  Each side
+// must re-read the other side's counter after publishing its own, so that one of
+// them always sees the transition.
+#define DMARING_SIGNATURE       0x474e5244  // 'DRNG'
+#define DMARING_MAX_ENTRIES     256
+#define DMARING_RX_WAITING      0x1         // packets are queued in the emulator for a full Rx ring
+
+typedef struct {
+    unsigned __int32 BufferAddress; // guest physical address
+    unsigned __int32 Length;        // bytes in the packet
+} DMARingDescriptor;
+
+typedef struct {
+    unsigned __int32 Signature;     // DMARING_SIGNATURE
+    unsigned __int32 EntryCount;    // a power of two, up to DMARING_MAX_ENTRIES
+    volatile unsigned __int32 RxProduced;   // written by the emulator
+    volatile unsigned __int32 RxConsumed;   // written by the guest
+    volatile unsigned __int32 TxProduced;   // written by the guest
+    volatile unsigned __int32 TxConsumed;   // written by the emulator
+    volatile unsigned __int32 InterruptBatch; // written by the guest; 0 means only on empty to non-empty
+    volatile unsigned __int32 RingFlags;    // DMARING_* flags, written by the emulator
+    // Followed by DMARingDescriptor RxDescriptors[EntryCount], TxDescriptors[EntryCount]
+} DMARingHeader;
+
 // Connectix uses a 64-element queue to hold these packets until
 // the Win32 caller can retreive them.  Once the queue fills,
 // Connectix drops the oldest packet and overwrites it with the
@@ -226,6 +269,7 @@ private:
 #define CHANNEL_LOOKUP_TABLE_SIZE   512
 
 #define MinimumStateFileVersionForDMATransport 12
+#define MinimumStateFileVersionForDMARings 14
 
 typedef class DMAChannelRecordSet {
 public:
@@ -367,24 +411,24 @@ private:
     // 0x208c: __int32 IOOutputRegister0
     // 0x2090: __int32 IRQRegister0
     // 0x2094: __int32 IRQAcknowledgeRegister0
-    // 0x2098: // Reserved0
-    // 0x209c: // Reserved0
+    // 0x2098: __int32 RingRegister0 - guest physical address of a DMARingHeader, or 0
+    // 0x209c: __int32 RingDoorbellRegister0
     // 0x20a0: __int32 GlobalRegister0
     // 0x20a4: __int32 FlagsRegister0 - holds a guest physical address of a UINT32... the address of Flags0
     // 0x20a8: __int32 IOInputRegister0
     // 0x20ac: __int32 IOOutputRegister0
     // 0x20b0: __int32 IRQRegister0
     // 0x20b4: __int32 IRQAcknowledgeRegister0
-    // 0x20b8: // Reserved0
-    // 0x20bc: // Reserved0
+    // 0x20b8: __int32 RingRegister1
+    // 0x20bc: __int32 RingDoorbellRegister1
     // 0x20c0: __int32 GlobalRegister0
     // 0x20c4: __int32 FlagsRegister0 - holds a guest physical address of a UINT32... the address of Flags0
     // 0x20c8: __int32 IOInputRegister0
     // 0x20cc: __int32 IOOutputRegister0
     // 0x20c0: __int32 IRQRegister0
     // 0x20c4: __int32 IRQAcknowledgeRegister0
-    // 0x20c8: // Reserved0
-    // 0x20cc: // Reserved0
+    // 0x20c8: __int32 RingRegister2
+    // 0x20cc: __int32 RingDoorbellRegister2
     // 0x20cc: // CurrentVirtualChannel
     // 0x20cc: // VirtualOperation
     // 0x20cc: // VirtualStatus
@@ -408,8 +452,8 @@ private:
         unsigned __int32 IOOutputRegister;
         unsigned __int32 IRQRegister;
         unsigned __int32 IRQAcknowledgeRegister;
-        unsigned __int32 Reserved0;
-        unsigned __int32 Reserved1;
+        unsigned __int32 RingRegister;
+        unsigned __int32 RingDoorbellRegister;
     } DMAChannel;
 
     DMAChannel DMAChannels[NumberOfChannels];
@@ -425,6 +469,26 @@ private:
     unsigned __int32 VirtualChannelIndexR;
     unsigned __int32 VirtualChannelIndexW;
     // end of variables that correspond to the WinCE DMA Transport device
+
+    // The rings registered through RingRegister.  Each lock is held while the
+    // emulator reads or advances that ring's counters, and nests inside IOLock.
+    struct DMARing {
+        DMARingHeader *pHeader;     // NULL if no ring is registered
+        DMARingDescriptor *RxDescriptors;
+        DMARingDescriptor *TxDescriptors;
+        unsigned __int32 Mask;      // EntryCount-1
+        unsigned __int32 RxSinceInterrupt;
+        bool RxBacklog;             // desktop packets are queued in the SendQueue for a full ring
+        CRITICAL_SECTION Lock;
+    };
+    DMARing Rings[NumberOfChannels];
+
+    bool RegisterRing(unsigned __int32 ChannelNumber, unsigned __int32 GuestAddress);
+    bool SendToRing(DMAChannelRecord * channel, const BYTE *dataBuffer, USHORT byteCount);
+    bool ReceiveFromRing(DMAChannelRecord * channel, BYTE *dataBuffer, USHORT *byteCount);
+    bool RingHasTxPackets(DMAChannelRecord * channel);
+    void RingDoorbell(unsigned __int32 ChannelNumber);
+    unsigned __int8 * MapRingBuffer(unsigned __int32 GuestAddress, unsigned __int32 Length);
 };
 
 HRESULT BindToVMID(const GUID* pVMID, IDeviceEmulatorItem** ppItem);
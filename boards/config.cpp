@@ -75,6 +75,16 @@ bool EmulatorConfig::init()
     NoSecurityPrompt = false;
     Board64RamRegion = false;
     DialogOnly = false;
+    LazyRestore = false;
+    LazyROM = false;
+    LargePages = false;
+    FleetSize = 0;
+    NetBackend = NetBackendVPC;
+    NetBackendName[0] = L'\0';
+    TraceFileName[0] = L'\0';
+    BenchmarkFileName[0] = L'\0';
+    JitVerifyFileName[0] = L'\0';
+    ProfileFileName[0] = L'\0';
     FuncKeyCode = 0;
     return true;
 }
@@ -126,6 +136,15 @@ void __fastcall EmulatorConfig::SaveState(StateFiler& filer) const
     // filer.Write(UseUpdatedSettings) // not included in save-state
     // filer.Write(PassiveKITL) // only makes sense on cold boot
     // filer.Write(DialogOnly) // only makes sense on start
+    // filer.Write(LazyRestore) // only makes sense on start
+    // filer.Write(LazyROM) // only makes sense on start
+    // filer.Write(LargePages) // only makes sense on start
+    // filer.Write(FleetSize) // only makes sense on start
+    // filer.Write(NetBackend) // only makes sense on start
+    // filer.Write(TraceFileName) // only makes sense on start
+    // filer.Write(BenchmarkFileName) // only makes sense on start
+    // filer.Write(JitVerifyFileName) // only makes sense on start
+    // filer.Write(ProfileFileName) // only makes sense on start
     filer.Write(SpecifiedNE2000Mac);
     filer.Write(SpecifiedCS8900Mac);
     filer.Write(UseDefaultSaveState);
@@ -208,6 +227,15 @@ void __fastcall EmulatorConfig::RestoreState(StateFiler& filer)
     // filer.Read(UseUpdatedSettings)  // not included in save-state
     // filer.Read(PassiveKITL) // only makes sense on cold boot
     // filer.Read(DialogOnly) // only makes sense on start
+    // filer.Read(LazyRestore) // only makes sense on start
+    // filer.Read(LazyROM) // only makes sense on start
+    // filer.Read(LargePages) // only makes sense on start
+    // filer.Read(FleetSize) // only makes sense on start
+    // filer.Read(NetBackend) // only makes sense on start
+    // filer.Read(TraceFileName) // only makes sense on start
+    // filer.Read(BenchmarkFileName) // only makes sense on start
+    // filer.Read(JitVerifyFileName) // only makes sense on start
+    // filer.Read(ProfileFileName) // only makes sense on start
     (UseUpdatedSettings ? filer.Read(BufferBOOL) : filer.Read(SpecifiedNE2000Mac));
     filer.Read(SpecifiedCS8900Mac);
 
@@ -500,6 +528,15 @@ bool EmulatorConfig::equal(EmulatorConfig * other, bool update, bool runtime_com
      // NOT_EQUAL_VAL(Board64RamRegion)     // is not calculatable without loading the image
     )// NOT_EQUAL_VAL(VSSetup )             // not included in save-state 
      // NOT_EQUAL_VAL(DialogOnly)           // not included in save-state
+     // NOT_EQUAL_VAL(LazyRestore)          // not included in save-state
+     // NOT_EQUAL_VAL(LazyROM)              // not included in save-state
+     // NOT_EQUAL_VAL(LargePages)           // not included in save-state
+     // NOT_EQUAL_VAL(FleetSize)            // not included in save-state
+     // NOT_EQUAL_VAL(NetBackend)           // not included in save-state
+     // NOT_EQUAL_VAL(TraceFileName)        // not included in save-state
+     // NOT_EQUAL_VAL(BenchmarkFileName)    // not included in save-state
+     // NOT_EQUAL_VAL(JitVerifyFileName)    // not included in save-state
+     // NOT_EQUAL_VAL(ProfileFileName)      // not included in save-state
      // NOT_EQUAL_VAL(LoadImage)............// not included in save-state
         return false; // Some value was different
 
@@ -17,10 +17,24 @@
 #include "resource.h"
 #include "loadbin_nb0.h"
 #include "Board.h"
+#include "GuestMemory.h"
 
 unsigned __int32 ROMHDRAddress;
 ROMHDR *pROMHDR;
 
+// pROMHDR points into the image, which is unmapped once it is loaded.  This copy
+// is kept for GetRomModules().
+static ROMHDR RomHeader;
+static bool fRomHeaderValid;
+
+// With /lazyrom, the image stays mapped and the sections are recorded here rather
+// than copied.  The board then copies each block of guest memory from them on
+// first access.
+static MappedStateFile *pLazyRomFile;
+static GuestMemoryExtent *LazyExtents;
+static size_t LazyExtentCount;
+static size_t LazyExtentCapacity;
+
 
 struct CESectionHeader
 {
@@ -33,6 +47,30 @@ struct CESectionHeader
 	unsigned __int32			fSectionCheckSum;			// Checksum of bytes in section
 };
 
+// This structure is copied from WinCE's public\common\oak\inc\romldr.h.  The
+// TOCentry array immediately follows the ROMHDR in guest memory.
+typedef struct TOCentry {
+	DWORD   dwFileAttributes;
+	FILETIME ftTime;
+	DWORD   nFileSize;
+	ULONG   lpszFileName;           // address of the module name
+	ULONG   ulE32Offset;            // address of the module's e32_rom
+	ULONG   ulO32Offset;            // address of the module's o32_rom array
+	ULONG   ulLoadOffset;           // MODULE load buffer offset
+} TOCentry;
+
+// The start of WinCE's e32_rom structure, from public\common\oak\inc\pehdr.h
+typedef struct E32ROMPrefix {
+	unsigned short  e32_objcnt;     // Number of memory objects
+	unsigned short  e32_imageflags; // Image flags
+	unsigned long   e32_entryrva;   // Relative virt. addr. of entry point
+	unsigned long   e32_vbase;      // Virtual base address of module
+	unsigned short  e32_subsysmajor;// The subsystem major version number
+	unsigned short  e32_subsysminor;// The subsystem minor version number
+	unsigned long   e32_stackmax;   // Maximum stack size
+	unsigned long   e32_vsize;      // Virtual size of the entire image
+} E32ROMPrefix;
+
 bool safe_copy( void * dest, void * src, unsigned __int32 size)
 {
 	bool result = true;
@@ -50,6 +88,60 @@ bool safe_copy( void * dest, void * src, unsigned __int32 size)
 	return result;
 }
 
+bool AddLazyExtent(size_t HostAddress, const unsigned __int8 *pSource, size_t Length)
+{
+	if (LazyExtentCount == LazyExtentCapacity) {
+		size_t NewCapacity = LazyExtentCapacity ? LazyExtentCapacity*2 : 64;
+		GuestMemoryExtent *NewExtents = new GuestMemoryExtent[NewCapacity];
+		if (NewExtents == NULL) {
+			return false;
+		}
+		if (LazyExtentCount) {
+			memcpy(NewExtents, LazyExtents, LazyExtentCount*sizeof(GuestMemoryExtent));
+		}
+		delete [] LazyExtents;
+		LazyExtents = NewExtents;
+		LazyExtentCapacity = NewCapacity;
+	}
+	LazyExtents[LazyExtentCount].HostAddress = HostAddress;
+	LazyExtents[LazyExtentCount].pSource = pSource;
+	LazyExtents[LazyExtentCount].Length = Length;
+	LazyExtentCount++;
+	return true;
+}
+
+// Hands the recorded sections to the board, or copies them now if it cannot
+// load them lazily.
+bool CompleteLazyLoad(void)
+{
+	if (BoardBeginLazyImageLoad(pLazyRomFile, LazyExtents, LazyExtentCount)) {
+		return true;
+	}
+	for (size_t i=0; i<LazyExtentCount; ++i) {
+		if ( !safe_copy((void*)LazyExtents[i].HostAddress, (void*)LazyExtents[i].pSource, (unsigned __int32)LazyExtents[i].Length))
+		{
+			// Failed to read from the view. This is most likely caused by a network problem
+			return false;
+		}
+	}
+	return true;
+}
+
+void ReleaseRomImage(unsigned __int8 *RomImage)
+{
+	if (pLazyRomFile) {
+		// Guest memory that still has sections to copy holds its own reference
+		pLazyRomFile->Release();
+		pLazyRomFile = NULL;
+		delete [] LazyExtents;
+		LazyExtents = NULL;
+		LazyExtentCount = 0;
+		LazyExtentCapacity = 0;
+	} else {
+		UnmapViewOfFile(RomImage);
+	}
+}
+
 // An NB0 file is a contiguous sequence of instructions.
 bool LoadNB0File(unsigned __int8 *RomImage, DWORD FileSize) {
 	size_t HostEffectiveAddress, HostEffectiveAddressEnd;
@@ -75,7 +167,11 @@ bool LoadNB0File(unsigned __int8 *RomImage, DWORD FileSize) {
 		return false; 
 	}
 
-	if ( !safe_copy((void*)HostEffectiveAddress, RomImage, FileSize))
+	if (pLazyRomFile) {
+		if (!AddLazyExtent(HostEffectiveAddress, RomImage, FileSize) || !CompleteLazyLoad()) {
+			return false;
+		}
+	} else if ( !safe_copy((void*)HostEffectiveAddress, RomImage, FileSize))
 	{
 		// Failed to read from the view. This is most likely caused by a network problem
 		return false;
@@ -230,6 +326,14 @@ HeaderCallbackCode LoadSection(unsigned __int8 *RomImage, DWORD FileSize, const
 		return Error_StopEnumerating;
 	}
 
+	if (pLazyRomFile) {
+		// Only the section header has been read from the image so far
+		if (!AddLazyExtent(HostEffectiveAddress, (const unsigned __int8 *)&pSection[1], sectionLocal.fSectionSize)) {
+			return Error_StopEnumerating;
+		}
+		return ContinueEnumerating;
+	}
+
 	if ( !safe_copy((void*)HostEffectiveAddress, (void*)&pSection[1], sectionLocal.fSectionSize))
 	{
 		// Failed to read from the view. This is most likely caused by a network problem
@@ -245,18 +349,22 @@ bool LoadBINFile(unsigned __int8 *RomImage, DWORD FileSize)
 	// Find the ROMHDR structure in the image
 	if (!ForEachSectionHeader(RomImage, FileSize, FindROMHDR)) {
 		ShowDialog(ID_MESSAGE_INVALID_ROM_IMAGE);
-		UnmapViewOfFile(RomImage);
+		ReleaseRomImage(RomImage);
 		return false;
 	}
 
 	// Now load the image into emulator RAM
-	if (!ForEachSectionHeader(RomImage, FileSize, LoadSection)) {
+	if (!ForEachSectionHeader(RomImage, FileSize, LoadSection) ||
+		(pLazyRomFile && !CompleteLazyLoad())) {
 		ShowDialog(ID_MESSAGE_INVALID_ROM_IMAGE);
-		UnmapViewOfFile(RomImage);
+		ReleaseRomImage(RomImage);
 		return false;
 	}
 
-	UnmapViewOfFile(RomImage);
+	if (safe_copy((void*)&RomHeader, (void *)pROMHDR, sizeof(ROMHDR))) {
+		fRomHeaderValid = true;
+	}
+	ReleaseRomImage(RomImage);
 	return true;
 }
 
@@ -287,18 +395,28 @@ bool Load_BIN_NB0_File(const wchar_t *RomImageFile)
 		return false;
 	}
 
-	hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
-	CloseHandle(hFile);
-	if (hMapping == INVALID_HANDLE_VALUE) {
-		ShowDialog(ID_MESSAGE_INTERNAL_ERROR);
-		return false;
+	if (Configuration.LazyROM) {
+		// Keep the image mapped until every section has been copied.  If it can't
+		// be, load the image the usual way.
+		pLazyRomFile = MappedStateFile::Open(hFile);
 	}
+	if (pLazyRomFile) {
+		CloseHandle(hFile);
+		RomImage = (unsigned __int8*)pLazyRomFile->getView();
+	} else {
+		hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(hFile);
+		if (hMapping == INVALID_HANDLE_VALUE) {
+			ShowDialog(ID_MESSAGE_INTERNAL_ERROR);
+			return false;
+		}
 
-	RomImage = (unsigned __int8*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
-	CloseHandle(hMapping);
-	if (!RomImage) {
-		ShowDialog(ID_MESSAGE_INTERNAL_ERROR);
-		return false;
+		RomImage = (unsigned __int8*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(hMapping);
+		if (!RomImage) {
+			ShowDialog(ID_MESSAGE_INTERNAL_ERROR);
+			return false;
+		}
 	}
 
 	unsigned __int8 SigLocal[8];
@@ -306,6 +424,7 @@ bool Load_BIN_NB0_File(const wchar_t *RomImageFile)
 		  sizeof(SigLocal) < sizeof(Signature) ||
 		  FileSize < sizeof(SigLocal))
 	{
+		ReleaseRomImage(RomImage);
 		return false;
 	}
 
@@ -316,9 +435,61 @@ bool Load_BIN_NB0_File(const wchar_t *RomImageFile)
 	} else if((*((int *)&SigLocal[0]) & 0xea000000) == 0xea000000){
 		// NB0 file
 		// assumption: always starts with a branch instruction 0xeaXXXXXX
-		return LoadNB0File(RomImage, FileSize);
+		bool result = LoadNB0File(RomImage, FileSize);
+		ReleaseRomImage(RomImage);
+		return result;
 	}
 
 	ShowDialog(ID_MESSAGE_INVALID_ROM_IMAGE_TYPE);
+	ReleaseRomImage(RomImage);
 	return false; 
 }
+
+// Copies Length bytes from the image's virtual address VA in guest memory
+static bool ReadImageMemory(void *pDest, unsigned __int32 VA, unsigned __int32 Length)
+{
+	unsigned __int32 PA = BoardMapVAToPA(&RomHeader, VA);
+	size_t HostAdjust;
+	size_t HostAddress;
+
+	HostAddress = BoardMapGuestPhysicalToHost(PA, &HostAdjust);
+	if (HostAddress == 0 || PA+Length < PA ||
+		BoardMapGuestPhysicalToHost(PA+Length-1, &HostAdjust) != HostAddress+Length-1) {
+		return false;
+	}
+	return safe_copy(pDest, (void*)HostAddress, Length);
+}
+
+size_t GetRomModules(__out_ecount(MaxModules) RomModule *Modules, size_t MaxModules)
+{
+	size_t Count = 0;
+
+	if (!fRomHeaderValid) {
+		return 0;
+	}
+	for (ULONG i=0; i<RomHeader.nummods && Count < MaxModules; ++i) {
+		TOCentry Entry;
+		E32ROMPrefix E32;
+
+		if (!ReadImageMemory(&Entry, ROMHDRAddress+sizeof(ROMHDR)+i*sizeof(TOCentry), sizeof(Entry)) ||
+			!ReadImageMemory(&E32, Entry.ulE32Offset, sizeof(E32))) {
+			break;
+		}
+
+		RomModule *pModule = &Modules[Count];
+		unsigned __int32 NameLength;
+
+		// The name is NUL-terminated, but may end close to the end of guest memory
+		for (NameLength=0; NameLength<sizeof(pModule->Name)-1; ++NameLength) {
+			if (!ReadImageMemory(&pModule->Name[NameLength], Entry.lpszFileName+NameLength, 1) ||
+				pModule->Name[NameLength] == '\0') {
+				break;
+			}
+		}
+		pModule->Name[NameLength] = '\0';
+		pModule->Base = E32.e32_vbase;
+		pModule->Size = E32.e32_vsize;
+		Count++;
+	}
+	return Count;
+}
@@ -46,8 +46,21 @@ typedef struct ROMHDR {
     ULONG   ulTrackingLen;          // tracking memory ending address
 } ROMHDR;
 
+// A module listed in the table of contents of the loaded .bin image
+typedef struct RomModule {
+    char Name[64];
+    unsigned __int32 Base;          // e32_vbase:  the virtual address the module runs at
+    unsigned __int32 Size;          // e32_vsize
+} RomModule;
+
 
 bool Load_BIN_NB0_File(const wchar_t *RomImageFile);
 
+// Reads the table of contents of the loaded .bin image back out of guest memory
+// and returns the number of modules copied to Modules.  Returns 0 if an .nb0
+// image was loaded, if a saved state was restored instead, or if the table can
+// no longer be read.
+size_t GetRomModules(__out_ecount(MaxModules) RomModule *Modules, size_t MaxModules);
+
 
 #endif // LoadBIN_NB0__H_
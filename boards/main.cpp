@@ -15,6 +15,8 @@
 #include "cpu.h"
 #include "state.h"
 #include "board.h"
+#include "Fleet.h"
+#include "profiler.h"
 #include <io.h>
 #include <fcntl.h>
 #include <ShellAPI.h> // for CommandLineToArgvW()
@@ -134,6 +136,12 @@ bool CreateConsoleWindow(void)
 
 bool LoadImageOrRestoreState(void)
 {
+    if (Configuration.BenchmarkFileName[0] != L'\0') {
+        return BoardLoadBenchmark();
+    }
+    if (Configuration.JitVerifyFileName[0] != L'\0') {
+        return BoardLoadJitVerify();
+    }
     if (Configuration.UseDefaultSaveState) {
         bIsRestoringState = true;
         if ( BoardLoadSavedState(true) )
@@ -236,6 +244,11 @@ int __stdcall wWinMain(
         goto ErrorExit;
     }
 
+    if (Configuration.TraceFileName[0] != L'\0' && !TraceStart(Configuration.TraceFileName)) {
+        ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN, Configuration.TraceFileName);
+        goto ErrorExit;
+    }
+
 #if FEATURE_COM_INTERFACE
     HRESULT hr = StartCOM();
     if (FAILED(hr)) {
@@ -254,10 +267,35 @@ int __stdcall wWinMain(
     }
 #endif //!FEATURE_COM_INTERFACE
 
-    if (!LoadImageOrRestoreState()) {
-        BoardPrintUsage();
+#if FEATURE_SAVESTATE
+    if (Configuration.FleetSize && !FleetIsChild() &&
+        (Configuration.getLoadImage() || Configuration.UseDefaultSaveState || !Configuration.isSaveStateEnabled())) {
+        // The fleet is launched from a saved state named with /s
+        ShowDialog(ID_MESSAGE_MUST_SPECIFY_BIN_SAVESTATE);
         goto ErrorExit;
     }
+#endif
+
+    {
+        TraceScope Trace("LoadImageOrRestoreState", TraceBoot, 0);
+
+        if (!LoadImageOrRestoreState()) {
+            BoardPrintUsage();
+            goto ErrorExit;
+        }
+    }
+
+#if FEATURE_SAVESTATE
+    if (FleetIsChild()) {
+        if (!FleetChildAssumeIdentity()) {
+            goto ErrorExit;
+        }
+    } else if (Configuration.FleetSize) {
+        // The launcher never powers on:  its restored memory is shared, unmodified,
+        // with the children.
+        exit(FleetLaunch(lpCmdLine) ? 0 : 1);
+    }
+#endif
 
 
     // At this point, the emulator can begin making decisions based on
@@ -295,9 +333,13 @@ int __stdcall wWinMain(
 
     CodeMarker(perfEmulatorBootBegin);
 
-    if(!BoardPowerOn()){
-        ShowDialog(ID_MESSAGE_POWERON_ERROR);
-        goto ErrorExit;
+    {
+        TraceScope Trace("BoardPowerOn", TraceBoot, 0);
+
+        if(!BoardPowerOn()){
+            ShowDialog(ID_MESSAGE_POWERON_ERROR);
+            goto ErrorExit;
+        }
     }
 
 #if FEATURE_COM_INTERFACE
@@ -305,6 +347,13 @@ int __stdcall wWinMain(
         goto ErrorExit;
 #endif
     fIsRunning = true;
+    TraceNameThread("CPU");
+    if (Configuration.JitVerifyFileName[0] != L'\0') {
+        CpuVerifyJit(Configuration.JitVerifyFileName);
+    }
+    if (Configuration.ProfileFileName[0] != L'\0' && !ProfilerStart(Configuration.ProfileFileName)) {
+        goto ErrorExit;
+    }
     CpuSimulate();
 
 ErrorExit:
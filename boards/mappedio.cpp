@@ -33,6 +33,10 @@ typedef struct {
 #define MAPPEDIODEVICE(baseclass, devicename, iobase, iolength) \
 	{devicename##_IOBase, devicename##_IOEnd, &devicename, #baseclass},
 
+// Set when the CPU reads a register that MappedIODevice::IsTimeVarying() reports.
+// Only the CPU thread reads or writes it.
+bool BoardTimeVaryingRead;
+
 const MappedIORange IORanges[] = {
 	#include "mappediodevices.h"
 };
@@ -96,7 +100,7 @@ void __fastcall RestoreDeviceStates(StateFiler& filer)
 class IODefaultDevice DefaultDevice;
 class IOPCMCIADefaultDevice PCMCIADefaultDevice;
 
-const MappedIORange UnmappedIO = { 0x00000000, 0x00000000, &DefaultDevice};
+const MappedIORange UnmappedIO = { 0x00000000, 0x00000000, &DefaultDevice, "UnmappedIO"};
 
 int __cdecl CompareIORange ( const void *element, const void *entry)
 {
@@ -150,8 +154,13 @@ unsigned __int8 __fastcall IOReadByte(__int8 *pIOIndexHint)
 		*pIOIndexHint = IODeviceIndex;
 	}
 	
+	// The trace event includes the wait for IOLock
+	TraceScope Trace(pIORange->name, TraceIO, IOAddress);
 	EnterCriticalSection(&IOLock);
 	Ret = pIORange->Device->ReadByte(IOAddress-pIORange->StartAddress);
+	if (pIORange->Device->IsTimeVarying(IOAddress-pIORange->StartAddress)) {
+		BoardTimeVaryingRead = true;
+	}
 	LeaveCriticalSection(&IOLock);
 #if defined(LOGGING_ENABLED) || defined(_DEBUG)
 	LOG_VVERBOSE(PERIPHERAL_CALLS,"Read BYTE from %s address %x - value %x", pIORange->name, 
@@ -178,8 +187,12 @@ unsigned __int16 __fastcall IOReadHalf(__int8 *pIOIndexHint)
 	}
 	
 
+	TraceScope Trace(pIORange->name, TraceIO, IOAddress);
 	EnterCriticalSection(&IOLock);
 	Ret = pIORange->Device->ReadHalf(IOAddress-pIORange->StartAddress);
+	if (pIORange->Device->IsTimeVarying(IOAddress-pIORange->StartAddress)) {
+		BoardTimeVaryingRead = true;
+	}
 	LeaveCriticalSection(&IOLock);
 
 #if defined(LOGGING_ENABLED) || defined(_DEBUG)
@@ -207,8 +220,12 @@ unsigned __int32 __fastcall IOReadWord(__int8 *pIOIndexHint)
 		*pIOIndexHint = IODeviceIndex;
 	}
 	
+	TraceScope Trace(pIORange->name, TraceIO, IOAddress);
 	EnterCriticalSection(&IOLock);
 	Ret= pIORange->Device->ReadWord(IOAddress-pIORange->StartAddress);
+	if (pIORange->Device->IsTimeVarying(IOAddress-pIORange->StartAddress)) {
+		BoardTimeVaryingRead = true;
+	}
 	LeaveCriticalSection(&IOLock);
 
 #if defined(LOGGING_ENABLED) || defined(_DEBUG)
@@ -235,6 +252,7 @@ void __fastcall IOWriteByte(unsigned __int8  Value, __int8 *pIOIndexHint)
 		*pIOIndexHint = IODeviceIndex;
 	}
 	
+	TraceScope Trace(pIORange->name, TraceIO, IOAddress);
 	EnterCriticalSection(&IOLock);
 	pIORange->Device->WriteByte(IOAddress-pIORange->StartAddress, Value);
 	LeaveCriticalSection(&IOLock);
@@ -261,6 +279,7 @@ void __fastcall IOWriteHalf(unsigned __int16 Value, __int8 *pIOIndexHint)
 		IODeviceIndex = (__int8 )((PtrToLong(pIORange) - PtrToLong(IORanges)) / sizeof(IORanges[0]));
 		*pIOIndexHint = IODeviceIndex;
 	}
+	TraceScope Trace(pIORange->name, TraceIO, IOAddress);
 	EnterCriticalSection(&IOLock);
 	pIORange->Device->WriteHalf(IOAddress-pIORange->StartAddress, Value);
 	LeaveCriticalSection(&IOLock);
@@ -287,6 +306,7 @@ void __fastcall IOWriteWord(unsigned __int32 Value, __int8 *pIOIndexHint)
 		*pIOIndexHint = IODeviceIndex;
 	}
 
+	TraceScope Trace(pIORange->name, TraceIO, IOAddress);
 	EnterCriticalSection(&IOLock);
 	pIORange->Device->WriteWord(IOAddress-pIORange->StartAddress, Value);
 	LeaveCriticalSection(&IOLock);
@@ -351,6 +371,10 @@ void __fastcall MappedIODevice::WriteWord(unsigned __int32 IOAddress, unsigned _
 	return;
 }
 
+bool __fastcall MappedIODevice::IsTimeVarying(unsigned __int32 IOAddress) {
+	return false;
+}
+
 unsigned __int8  __fastcall IODefaultDevice::ReadByte(unsigned __int32 IOAddress) {
 	return 0;
 }
@@ -39,6 +39,11 @@ public:
 	virtual void __fastcall WriteByte(unsigned __int32 IOAddress, unsigned __int8  Value);
 	virtual void __fastcall WriteHalf(unsigned __int32 IOAddress, unsigned __int16 Value);
 	virtual void __fastcall WriteWord(unsigned __int32 IOAddress, unsigned __int32 Value);
+
+	// Returns true if the register can change without the device raising an
+	// interrupt, such as a free-running count or a ready/busy status.  Reading
+	// one sets BoardTimeVaryingRead.
+	virtual bool __fastcall IsTimeVarying(unsigned __int32 IOAddress);
 } MappedIODevice;
 
 typedef class PCMCIADevice : public MappedIODevice {
@@ -899,13 +899,8 @@ void IONE2000::BeginAsyncReceive(void)
 {
     ASSERT_CRITSEC_OWNED(IOLock);
 
-    if (AsyncReceiveCount == 0) {
-        AsyncReceiveCount=1;
-        if (VPCNet.BeginAsyncReceivePacket(ReceiveBuffer, sizeof(ReceiveBuffer)) == false) {
-            ASSERT(FALSE);
-        }
-    } else {
-        ASSERT(AsyncReceiveCount == 1);
+    if (VPCNet.BeginAsyncReceive() == false) {
+        ASSERT(FALSE);
     }
 }
 
@@ -913,134 +908,147 @@ void IONE2000::ReceiveCompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesT
 {
     IONE2000 *pThis = (IONE2000*)lpParameter;
 
-    pThis->ReceiveCompletionRoutine(dwBytesTransferred);
+    pThis->ReceivePackets();
 }
 
-void IONE2000::ReceiveCompletionRoutine(DWORD dwBytesTransferred)
+// Called by VPCNet whenever packets may be waiting in its receive ring.  Copies as
+// many of them into the CardRAM ring as have arrived, then raises a single receive
+// interrupt for the whole batch.
+void IONE2000::ReceivePackets(void)
 {
-    EnterCriticalSection(&IOLock);
-    ASSERT(AsyncReceiveCount == 1);
-    AsyncReceiveCount=0;
+    unsigned __int8 *ReceiveBuffer;
+    unsigned __int32 dwBytesTransferred;
+    bool PacketsReceived = false;
 
-    if (NIC_COMMAND.Bits.CR_STOP) {
-        // The main thread wishes to stop the NE2000
-        LeaveCriticalSection(&IOLock);
-        return;
-    }
+    EnterCriticalSection(&IOLock);
 
-    if (!NIC_DATA_CONFIG.Bits.DCR_NORMAL) {
-        // loopback mode is enabled - silently drop the packet
-        goto Done;
-    }
-    if (NIC_RCV_CONFIG.Bits.RCR_MONITOR) {
-        // Monitor mode is enabled - silently drop the packet
-        goto Done;
-    }
+    while (VPCNet.GetReceivedPacket(&ReceiveBuffer, &dwBytesTransferred)) {
+        unsigned __int8 NextPage;
+        unsigned __int8 PSTART;
+        unsigned __int8 PSTOP;
+        unsigned __int8 PCUR;
+        unsigned __int8 BRNY;
+
+        if (NIC_COMMAND.Bits.CR_STOP) {
+            // The main thread wishes to stop the NE2000.  Drop the packet and leave
+            // the ring entry idle until the guest starts the NIC again.
+            VPCNet.ReleaseReceivedPacket(false);
+            continue;
+        }
 
-    // Filter multicast packets so that only the packets that match the address hash
-    // are delivered to the guest 
-    if (NIC_RCV_CONFIG.Bits.RCR_MULTICAST) {
-        // Note:  Technically, we should read the recipient MAC address
-        //        and check if it is a multicast address.  If it is, we 
-        //        should set CardRAM[(PCUR<<8)+0-RamBase] to RSR_MULTICAST
-        //        in addition to RSR_PACKET_OK.  However, the WinCE driver
-        //        never examines this bit, so there is no need to compute
-        //        it here.
-
-        EthernetHeader & enetDatagram = *reinterpret_cast<EthernetHeader *>(ReceiveBuffer);
-        if (enetDatagram.fDestinationAddress.IsMulticast() && !ShouldIndicatePacketToGuest(enetDatagram)) {
+        if (!NIC_DATA_CONFIG.Bits.DCR_NORMAL) {
+            // loopback mode is enabled - silently drop the packet
+            goto Done;
+        }
+        if (NIC_RCV_CONFIG.Bits.RCR_MONITOR) {
+            // Monitor mode is enabled - silently drop the packet
             goto Done;
         }
-    }
 
-    // Copy the packet into CardRAM
-    // NIC_CURRENT<<8 is the byte offset to begin the copy at.  Once 
-    // NIC_CURRENT==NIC_PAGE_STOP, it wraps around to NIC_PAGE_START.
-    // The NIC writes a 4-byte header, followed by the ethernet packet
-    // itself.
-    //
-    // The IOLock isn't held during the copy - on the NE2000, the
-    // transfer is done via DMA concurrently with the CPU running.
-    // However, NIC_CURRENT, NIC_PAGE_START, and NIC_PAGE_STOP are all
-    // writable registers so the values could change underneath us.
-    // Cache local copies and range-check them carefully before
-    // using them.
-    unsigned __int8 NextPage;
-    unsigned __int8 PSTART = NIC_PAGE_START;
-    unsigned __int8 PSTOP = NIC_PAGE_STOP;
-    unsigned __int8 PCUR = NIC_CURRENT;
-    unsigned __int8 BRNY = NIC_BOUNDARY;
-
-    if (PSTART < (RamBase>>8) || PSTART >= ((RamBase+RamSize)>>8) ||
-        PSTOP  < (RamBase>>8) || PSTOP  > ((RamBase+RamSize)>>8) &&
-        PCUR   < (RamBase>>8) || PCUR   >= ((RamBase+RamSize)>>8)) {
-        // One or more of the start/stop/current values do not point
-        // into CardRAM.  Ignore the packet.
-        goto Done;
-    }
+        // Filter multicast packets so that only the packets that match the address hash
+        // are delivered to the guest 
+        if (NIC_RCV_CONFIG.Bits.RCR_MULTICAST) {
+            // Note:  Technically, we should read the recipient MAC address
+            //        and check if it is a multicast address.  If it is, we 
+            //        should set CardRAM[(PCUR<<8)+0-RamBase] to RSR_MULTICAST
+            //        in addition to RSR_PACKET_OK.  However, the WinCE driver
+            //        never examines this bit, so there is no need to compute
+            //        it here.
+
+            EthernetHeader & enetDatagram = *reinterpret_cast<EthernetHeader *>(ReceiveBuffer);
+            if (enetDatagram.fDestinationAddress.IsMulticast() && !ShouldIndicatePacketToGuest(enetDatagram)) {
+                goto Done;
+            }
+        }
 
-    LeaveCriticalSection(&IOLock);
-    // Make the expensive memcpy() calls outside of the IOLock
+        // Copy the packet into CardRAM
+        // NIC_CURRENT<<8 is the byte offset to begin the copy at.  Once 
+        // NIC_CURRENT==NIC_PAGE_STOP, it wraps around to NIC_PAGE_START.
+        // The NIC writes a 4-byte header, followed by the ethernet packet
+        // itself.
+        //
+        // The IOLock isn't held during the copy - on the NE2000, the
+        // transfer is done via DMA concurrently with the CPU running.
+        // However, NIC_CURRENT, NIC_PAGE_START, and NIC_PAGE_STOP are all
+        // writable registers so the values could change underneath us.
+        // Cache local copies and range-check them carefully before
+        // using them.
+        PSTART = NIC_PAGE_START;
+        PSTOP = NIC_PAGE_STOP;
+        PCUR = NIC_CURRENT;
+        BRNY = NIC_BOUNDARY;
+
+        if (PSTART < (RamBase>>8) || PSTART >= ((RamBase+RamSize)>>8) ||
+            PSTOP  < (RamBase>>8) || PSTOP  > ((RamBase+RamSize)>>8) &&
+            PCUR   < (RamBase>>8) || PCUR   >= ((RamBase+RamSize)>>8)) {
+            // One or more of the start/stop/current values do not point
+            // into CardRAM.  Ignore the packet.
+            goto Done;
+        }
 
-    // Compute the next starting page.  The "+4" accounts for the 4-byte
-    // header added by the NE2000, and the total length is rounded up to
-    // the next 256-byte page.
-    NextPage = PCUR + (unsigned __int8)((dwBytesTransferred+4)>>8) + 1;
+        LeaveCriticalSection(&IOLock);
+        // Make the expensive memcpy() calls outside of the IOLock
 
-    if (NextPage > PSTOP) {
-        // The packet wraps around within the circular buffer
-        NextPage = PSTART + (NextPage - PSTOP);
+        // Compute the next starting page.  The "+4" accounts for the 4-byte
+        // header added by the NE2000, and the total length is rounded up to
+        // the next 256-byte page.
+        NextPage = PCUR + (unsigned __int8)((dwBytesTransferred+4)>>8) + 1;
 
-        if (BRNY > PCUR || NextPage > PCUR) {
-            EnterCriticalSection(&IOLock);
-            RaiseInterrupt(ISR_OVERFLOW_BIT);
-            goto Done;
-        }
-        memcpy(&CardRAM[(PCUR<<8)+4-RamBase], 
-                ReceiveBuffer, 
-                ((PSTOP-PCUR)<<8)-4);
-        memcpy(&CardRAM[(PSTART<<8)-RamBase], 
-                &ReceiveBuffer[(PSTOP-PCUR)<<8]-4, 
-                dwBytesTransferred - (((PSTOP-PCUR)<<8)-4));
-    } else {
-        // The packet is contiguous
-        if (PCUR < BRNY && BRNY < NextPage) {
-            EnterCriticalSection(&IOLock);
-            RaiseInterrupt(ISR_OVERFLOW_BIT);
-            RaiseInterrupt(ISR_RESET_BIT); // see the ISR documentation
-            goto Done;
+        if (NextPage > PSTOP) {
+            // The packet wraps around within the circular buffer
+            NextPage = PSTART + (NextPage - PSTOP);
+
+            if (BRNY > PCUR || NextPage > PCUR) {
+                EnterCriticalSection(&IOLock);
+                RaiseInterrupt(ISR_OVERFLOW_BIT);
+                goto Done;
+            }
+            memcpy(&CardRAM[(PCUR<<8)+4-RamBase], 
+                    ReceiveBuffer, 
+                    ((PSTOP-PCUR)<<8)-4);
+            memcpy(&CardRAM[(PSTART<<8)-RamBase], 
+                    &ReceiveBuffer[(PSTOP-PCUR)<<8]-4, 
+                    dwBytesTransferred - (((PSTOP-PCUR)<<8)-4));
+        } else {
+            // The packet is contiguous
+            if (PCUR < BRNY && BRNY < NextPage) {
+                EnterCriticalSection(&IOLock);
+                RaiseInterrupt(ISR_OVERFLOW_BIT);
+                RaiseInterrupt(ISR_RESET_BIT); // see the ISR documentation
+                goto Done;
+            }
+            memcpy(&CardRAM[(PCUR<<8)+4-RamBase], ReceiveBuffer, dwBytesTransferred);
         }
-        memcpy(&CardRAM[(PCUR<<8)+4-RamBase], ReceiveBuffer, dwBytesTransferred);
-    }
-    dwBytesTransferred+=4; // account for the 4-byte NIC header
-    CardRAM[(PCUR<<8)+0-RamBase]=1; // RSR_PACKET_OK
-    CardRAM[(PCUR<<8)+1-RamBase]=NextPage;
-    CardRAM[(PCUR<<8)+2-RamBase]=(unsigned __int8)dwBytesTransferred;
-    CardRAM[(PCUR<<8)+3-RamBase]=(unsigned __int8)(dwBytesTransferred >> 8);
+        dwBytesTransferred+=4; // account for the 4-byte NIC header
+        CardRAM[(PCUR<<8)+0-RamBase]=1; // RSR_PACKET_OK
+        CardRAM[(PCUR<<8)+1-RamBase]=NextPage;
+        CardRAM[(PCUR<<8)+2-RamBase]=(unsigned __int8)dwBytesTransferred;
+        CardRAM[(PCUR<<8)+3-RamBase]=(unsigned __int8)(dwBytesTransferred >> 8);
 
-    EnterCriticalSection(&IOLock);
+        EnterCriticalSection(&IOLock);
 
-    if (NIC_COMMAND.Bits.CR_STOP) {
-        LeaveCriticalSection(&IOLock);
-        return;
-    }
+        if (NIC_COMMAND.Bits.CR_STOP) {
+            goto Done;
+        }
 
-    NIC_CURRENT = NextPage;
-    if (NIC_CURRENT >= NIC_PAGE_STOP) {
-        // NIC_CURRENT needs to wrap around
-        NIC_CURRENT = NIC_PAGE_START + (NIC_CURRENT-NIC_PAGE_STOP);
-    }
+        NIC_CURRENT = NextPage;
+        if (NIC_CURRENT >= NIC_PAGE_STOP) {
+            // NIC_CURRENT needs to wrap around
+            NIC_CURRENT = NIC_PAGE_START + (NIC_CURRENT-NIC_PAGE_STOP);
+        }
 
-    NIC_RCV_STATUS.Bits.RSR_MULTICAST=0;
-    NIC_RCV_STATUS.Bits.RSR_PACKET_OK=1;
-    RaiseInterrupt(ISR_RCV_BIT);
+        NIC_RCV_STATUS.Bits.RSR_MULTICAST=0;
+        NIC_RCV_STATUS.Bits.RSR_PACKET_OK=1;
+        PacketsReceived = true;
 
 Done:
-    if (NIC_COMMAND.Bits.CR_STOP == 0 && NIC_COMMAND.Bits.CR_START == 1) {
-        // Begin another async packet receive
-        BeginAsyncReceive();
+        // Hand the ring entry back for another receive, unless the NIC has been stopped
+        VPCNet.ReleaseReceivedPacket(NIC_COMMAND.Bits.CR_STOP == 0 && NIC_COMMAND.Bits.CR_START == 1);
     }
 
+    if (PacketsReceived && NIC_COMMAND.Bits.CR_STOP == 0) {
+        RaiseInterrupt(ISR_RCV_BIT);
+    }
     LeaveCriticalSection(&IOLock);
 }
 
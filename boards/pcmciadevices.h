@@ -187,12 +187,10 @@ private:
     unsigned __int16 DMACount;
     unsigned __int16 DMAOffset;
 
-    unsigned __int8 ReceiveBuffer[2048];
     void BeginAsyncReceive(void);
     COMPLETIONPORT_CALLBACK ReceiveCallback;
     static void ReceiveCompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
-    void ReceiveCompletionRoutine(DWORD dwBytesTransferred);
-    int AsyncReceiveCount; // used to ensure that only one async receive is pending at any one time.
+    void ReceivePackets(void);
 
     COMPLETIONPORT_CALLBACK TransmitCallback;
     static void TransmitCompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
@@ -25,6 +25,8 @@
 #include "devices.h"
 #include "decfg.h"
 #include "CompletionPort.h"
+#include "GuestMemory.h"
+#include "Fleet.h"
 
 #define SUPPORT_42_BSP 1
 #define SUPPORT_50_BSP 1
@@ -61,10 +63,13 @@ struct {
 
 #define INITIAL_STACK_POINTER              (PHYSICAL_MEMORY_BASE+0x10000)  // an arbitrary address within physical RAM
 
-#pragma bss_seg(push, stack1, ".EmulatedMemory")    // Define a new EXE section, ".EmulatedMemory", so Physical/FlashMemory is at least 4k-aligned
-unsigned __int32 PhysicalMemory[PHYSICAL_MEMORY_SIZE/sizeof(unsigned __int32)];
-unsigned __int32 FlashBank0[FLASH_BANK0_SIZE/sizeof(unsigned __int32)];
-#pragma bss_seg(pop, stack1)
+// Guest RAM and flash are pagefile-backed sections (see GuestMemory.h), allocated by
+// BoardAllocateGuestMemory() before the first image load or state restore.
+GuestMemoryRegion PhysicalMemoryRegion;
+GuestMemoryRegion FlashBank0Region;
+GuestMemoryRegion PhysicalMemoryExtensionRegion;
+unsigned __int32 *PhysicalMemory;
+unsigned __int32 *FlashBank0;
 LPVOID PhysicalMemoryExtension;
 unsigned __int32 PhysicalMemoryExtensionSize; // size in bytes
 
@@ -227,7 +232,7 @@ extern HRESULT SetSaveStateFileNameFromVMID(bool Global);
 
 size_t __fastcall BoardMapGuestPhysicalToHostRAM(unsigned __int32 EffectiveAddress)
 {
-    if (EffectiveAddress >= PHYSICAL_MEMORY_BASE && EffectiveAddress < PHYSICAL_MEMORY_BASE+sizeof(PhysicalMemory)) {
+    if (EffectiveAddress >= PHYSICAL_MEMORY_BASE && EffectiveAddress < PHYSICAL_MEMORY_BASE+PHYSICAL_MEMORY_SIZE) {
         return (size_t)EffectiveAddress+(size_t)PhysicalMemory-PHYSICAL_MEMORY_BASE;
     } else if (PhysicalMemoryExtension && 
                EffectiveAddress >= PHYSICAL_MEMORY_EXTENSION_BASE && EffectiveAddress < PHYSICAL_MEMORY_EXTENSION_BASE+PhysicalMemoryExtensionSize) {
@@ -245,10 +250,10 @@ size_t __fastcall BoardMapGuestPhysicalToHost(unsigned __int32 EffectiveAddress,
 {
     size_t HostAddress;
 
-    if (EffectiveAddress >= PHYSICAL_MEMORY_BASE && EffectiveAddress < PHYSICAL_MEMORY_BASE+sizeof(PhysicalMemory)) {
+    if (EffectiveAddress >= PHYSICAL_MEMORY_BASE && EffectiveAddress < PHYSICAL_MEMORY_BASE+PHYSICAL_MEMORY_SIZE) {
         *pHostAdjust = (size_t)PhysicalMemory-PHYSICAL_MEMORY_BASE;
         HostAddress = (size_t)EffectiveAddress+(size_t)PhysicalMemory-PHYSICAL_MEMORY_BASE;
-    } else if (EffectiveAddress >= FLASH_BANK0_BASE && EffectiveAddress < FLASH_BANK0_BASE+sizeof(FlashBank0)) {
+    } else if (EffectiveAddress >= FLASH_BANK0_BASE && EffectiveAddress < FLASH_BANK0_BASE+FLASH_BANK0_SIZE) {
         // Attempts to read from physical 0...32mb are treated as reads from FlashBank0.
         // Attempts to write to that region are treated as memory-mapped IO.
         *pHostAdjust = 0; // Use 0 instead of (size_t)FlashBank0 otherwise TLB established
@@ -271,7 +276,7 @@ size_t __fastcall BoardMapGuestPhysicalToHostWrite(unsigned __int32 EffectiveAdd
 {
     size_t HostAddress;
 
-    if (EffectiveAddress >= PHYSICAL_MEMORY_BASE && EffectiveAddress < PHYSICAL_MEMORY_BASE+sizeof(PhysicalMemory)) {
+    if (EffectiveAddress >= PHYSICAL_MEMORY_BASE && EffectiveAddress < PHYSICAL_MEMORY_BASE+PHYSICAL_MEMORY_SIZE) {
         *pHostAdjust = (size_t)PhysicalMemory-PHYSICAL_MEMORY_BASE;
         HostAddress = (size_t)EffectiveAddress+(size_t)PhysicalMemory-PHYSICAL_MEMORY_BASE;
     } else if (PhysicalMemoryExtension && 
@@ -290,7 +295,7 @@ size_t __fastcall BoardMapGuestPhysicalToHostWrite(unsigned __int32 EffectiveAdd
 
 bool __fastcall BoardIsHostAddressInRAM(size_t HostAddress)
 {
-    if (HostAddress >= (size_t)PhysicalMemory && HostAddress < (size_t)PhysicalMemory+sizeof(PhysicalMemory)) {
+    if (HostAddress >= (size_t)PhysicalMemory && HostAddress < (size_t)PhysicalMemory+PHYSICAL_MEMORY_SIZE) {
         return true;
     } else if (PhysicalMemoryExtension && HostAddress >= (size_t)PhysicalMemoryExtension && HostAddress < (size_t)PhysicalMemoryExtension+PhysicalMemoryExtensionSize) {
         return true;
@@ -300,19 +305,72 @@ bool __fastcall BoardIsHostAddressInRAM(size_t HostAddress)
 
 size_t __fastcall BoardMapGuestPhysicalToFlash(unsigned __int32 EffectiveAddress)
 {
-    if (EffectiveAddress >= FLASH_BANK0_BASE && EffectiveAddress < FLASH_BANK0_BASE+sizeof(FlashBank0)) {
+    if (EffectiveAddress >= FLASH_BANK0_BASE && EffectiveAddress < FLASH_BANK0_BASE+FLASH_BANK0_SIZE) {
         return (size_t)FlashBank0 + EffectiveAddress;
     }
     return 0;
 }
 
+void __fastcall BoardDeliverPostedInterrupts(void)
+{
+    EnterCriticalSection(&IOLock);
+    InterruptController.DeliverPostedInterrupts();
+    LeaveCriticalSection(&IOLock);
+}
+
+
+bool __fastcall BoardAllocateGuestMemory(void)
+{
+    if (FleetIsChild()) {
+        // Map the fleet launcher's memory instead of allocating and restoring our own
+        if (!PhysicalMemoryRegion.AttachCopyOnWrite(FleetGetSharedSection(FleetSectionRAM), PHYSICAL_MEMORY_SIZE) ||
+            !FlashBank0Region.AttachCopyOnWrite(FleetGetSharedSection(FleetSectionFlash), FLASH_BANK0_SIZE)) {
+            return false;
+        }
+    } else if (!PhysicalMemoryRegion.Allocate(PHYSICAL_MEMORY_SIZE) ||
+               !FlashBank0Region.Allocate(FLASH_BANK0_SIZE)) {
+        return false;
+    }
+    PhysicalMemory = (unsigned __int32 *)PhysicalMemoryRegion.getBase();
+    FlashBank0 = (unsigned __int32 *)FlashBank0Region.getBase();
+    return true;
+}
+
+void __fastcall BoardMakeGuestRAMResident(size_t HostAddress, size_t Length)
+{
+    if (PhysicalMemoryRegion.Contains(HostAddress)) {
+        PhysicalMemoryRegion.MakeResident(HostAddress, Length);
+    } else if (PhysicalMemoryExtensionRegion.Contains(HostAddress)) {
+        PhysicalMemoryExtensionRegion.MakeResident(HostAddress, Length);
+    }
+}
+
+bool __fastcall BoardBeginLazyImageLoad(MappedStateFile *pImageFile, const GuestMemoryExtent *Extents, size_t ExtentCount)
+{
+    return FlashBank0Region.BeginLazyLoad(pImageFile, Extents, ExtentCount) &&
+           PhysicalMemoryRegion.BeginLazyLoad(pImageFile, Extents, ExtentCount) &&
+           PhysicalMemoryExtensionRegion.BeginLazyLoad(pImageFile, Extents, ExtentCount);
+}
+
+bool __fastcall BoardShareGuestMemory(HANDLE *phSections)
+{
+    return FlashBank0Region.Share(&phSections[FleetSectionFlash]) &&
+           PhysicalMemoryRegion.Share(&phSections[FleetSectionRAM]) &&
+           PhysicalMemoryExtensionRegion.Share(&phSections[FleetSectionRAMExtension]);
+}
 
 void __fastcall BoardSaveState(StateFiler& filer)
 {
-    filer.LZWrite(reinterpret_cast<unsigned __int8*>(FlashBank0),sizeof(FlashBank0));
-    filer.LZWrite(reinterpret_cast<unsigned __int8*>(PhysicalMemory),sizeof(PhysicalMemory));
+    // A lazily-restored region still reads from the old save-state file, which is
+    // about to be replaced.
+    FlashBank0Region.CompleteLazyPopulate();
+    PhysicalMemoryRegion.CompleteLazyPopulate();
+    PhysicalMemoryExtensionRegion.CompleteLazyPopulate();
+
+    filer.BlockLZWrite(reinterpret_cast<unsigned __int8*>(FlashBank0),FLASH_BANK0_SIZE);
+    filer.BlockLZWrite(reinterpret_cast<unsigned __int8*>(PhysicalMemory),PHYSICAL_MEMORY_SIZE);
     if (Configuration.PhysicalMemoryExtensionSize) {
-        filer.LZWrite(reinterpret_cast<unsigned __int8*>(PhysicalMemoryExtension), PhysicalMemoryExtensionSize);
+        filer.BlockLZWrite(reinterpret_cast<unsigned __int8*>(PhysicalMemoryExtension), PhysicalMemoryExtensionSize);
     }
 }
 
@@ -336,23 +394,41 @@ bool BoardAllocatePhysicalMemoryExtension(void)
     }
 
     // Make the allocation
-    PhysicalMemoryExtension = VirtualAlloc(NULL, PhysicalMemoryExtensionSize, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
-    if (!PhysicalMemoryExtension) {
+    if (FleetIsChild()) {
+        if (!PhysicalMemoryExtensionRegion.AttachCopyOnWrite(FleetGetSharedSection(FleetSectionRAMExtension), PhysicalMemoryExtensionSize)) {
+            return false;
+        }
+    } else if (!PhysicalMemoryExtensionRegion.Allocate(PhysicalMemoryExtensionSize)) {
         return false;
     }
+    PhysicalMemoryExtension = PhysicalMemoryExtensionRegion.getBase();
     return true;
 }
 
 void __fastcall BoardRestoreState(StateFiler& filer)
 {
-    filer.LZRead(reinterpret_cast<unsigned __int8*>(FlashBank0),sizeof(FlashBank0));
-    filer.LZRead(reinterpret_cast<unsigned __int8*>(PhysicalMemory),sizeof(PhysicalMemory));
-    if (Configuration.PhysicalMemoryExtensionSize) {
-        if (!BoardAllocatePhysicalMemoryExtension()) {
-            filer.setStatus(false);
-            return;
+    if (FleetIsChild()) {
+        // Guest memory was already mapped from the fleet launcher, which restored it
+        // from this same file.
+        filer.LZSkip();
+        filer.LZSkip();
+        if (Configuration.PhysicalMemoryExtensionSize) {
+            if (!BoardAllocatePhysicalMemoryExtension()) {
+                filer.setStatus(false);
+                return;
+            }
+            filer.LZSkip();
+        }
+    } else {
+        filer.LZReadLazy(FlashBank0Region);
+        filer.LZReadLazy(PhysicalMemoryRegion);
+        if (Configuration.PhysicalMemoryExtensionSize) {
+            if (!BoardAllocatePhysicalMemoryExtension()) {
+                filer.setStatus(false);
+                return;
+            }
+            filer.LZReadLazy(PhysicalMemoryExtensionRegion);
         }
-        filer.LZRead(reinterpret_cast<unsigned __int8*>(PhysicalMemoryExtension),PhysicalMemoryExtensionSize);
     }
 
     CpuSetInstructionPointer(Configuration.InitialInstructionPointer);
@@ -409,6 +485,10 @@ bool __fastcall BoardPowerOn(void)
 {
     unsigned __int32 *Addr;
 
+    if (!BoardAllocateGuestMemory()) {
+        return false;
+    }
+
     // Initialize the contents of virtual address 0x92001004 with the sequence of
     // instructions used to power down the CPU.
     Addr = &FlashBank0[1+0x1000/4];
@@ -491,6 +571,10 @@ bool __fastcall BoardPowerOn(void)
 
 bool __fastcall BoardLoadImage(const wchar_t *ImageFile)
 {
+    if (!BoardAllocateGuestMemory()) {
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
     if (!Load_BIN_NB0_File(ImageFile)) {
         return false;
     }
@@ -500,6 +584,36 @@ bool __fastcall BoardLoadImage(const wchar_t *ImageFile)
     return true;
 }
 
+bool __fastcall BoardLoadBenchmark(void)
+{
+    if (!BoardAllocateGuestMemory()) {
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+    if (!BenchmarkLoadProgram()) {
+        return false;
+    }
+    CpuSetStackPointer(INITIAL_STACK_POINTER);  // set sp to an arbitrary address within physical RAM
+    // The multiply benchmark includes the ARMv5TE DSP instructions
+    Configuration.ProcessorFeatures |= 2; // Feature_DSP in armcpu.cpp
+    // The NAND benchmarks read sector 0 of the flash
+    Configuration.setFlashEnabled(true);
+
+    return true;
+}
+
+bool __fastcall BoardLoadJitVerify(void)
+{
+    if (!BoardAllocateGuestMemory()) {
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+    // Verify the ARMv5TE instructions too
+    Configuration.ProcessorFeatures |= 3; // Feature_LoadStoreDouble and Feature_DSP in armcpu.cpp
+
+    return true;
+}
+
 bool __fastcall BoardLoadSavedState(bool default_state)
 {
     // The loading rules are as follows:
@@ -513,6 +627,11 @@ bool __fastcall BoardLoadSavedState(bool default_state)
 
     bool result = false;
 
+    if (!BoardAllocateGuestMemory()) {
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        goto Exit;
+    }
+
     if ( Configuration.VSSetup ) {
         SetSaveStateFileNameFromVMID(true);
         goto Exit;
@@ -639,6 +758,24 @@ bool BoardParseCommandLine(int argc, __in_ecount(argc) wchar_t *argv[], class Em
             break;
 #endif // FEATURE_GUI
 
+        case 'b':
+            if (_wcsicmp(&argv[i][1], L"benchmark") == 0) {
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    i++; // skip ahead to the report filename
+                    if (!_wfullpath(pConfiguration->BenchmarkFileName, &argv[i][0], ARRAY_SIZE(pConfiguration->BenchmarkFileName))) {
+                        ParseError->setError( ID_MESSAGE_RESOURCE_EXHAUSTED, NULL );
+                        return false;
+                    }
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
+            } else {
+                ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                return false;
+            }
+            break;
+
         case 'c':
             if (argv[i][2] != '\0') {
                 ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
@@ -670,6 +807,24 @@ bool BoardParseCommandLine(int argc, __in_ecount(argc) wchar_t *argv[], class Em
             break;
 #endif //#if FEATURE_SAVESTATE
 
+        case 'j':
+            if (_wcsicmp(&argv[i][1], L"jitverify") == 0) {
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    i++; // skip ahead to the report filename
+                    if (!_wfullpath(pConfiguration->JitVerifyFileName, &argv[i][0], ARRAY_SIZE(pConfiguration->JitVerifyFileName))) {
+                        ParseError->setError( ID_MESSAGE_RESOURCE_EXHAUSTED, NULL );
+                        return false;
+                    }
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
+            } else {
+                ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                return false;
+            }
+            break;
+
         case 'l':
             if (_wcsicmp(&argv[i][1], L"language") == 0) {
                 if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
@@ -684,6 +839,14 @@ bool BoardParseCommandLine(int argc, __in_ecount(argc) wchar_t *argv[], class Em
                     ParseError->setError( ID_MESSAGE_MISSING_LANGUAGE, NULL);
                     return false;
                 }
+#if FEATURE_SAVESTATE
+            } else if (_wcsicmp(&argv[i][1], L"lazyrestore") == 0) {
+                pConfiguration->LazyRestore = true;
+#endif //FEATURE_SAVESTATE
+            } else if (_wcsicmp(&argv[i][1], L"lazyrom") == 0) {
+                pConfiguration->LazyROM = true;
+            } else if (_wcsicmp(&argv[i][1], L"largepages") == 0) {
+                pConfiguration->LargePages = true;
             } else if (argv[i][2] == '\0') {
 #if LOGGING_ENABLED
                 LogToFile = true;
@@ -737,6 +900,27 @@ bool BoardParseCommandLine(int argc, __in_ecount(argc) wchar_t *argv[], class Em
             if (_wcsicmp(&argv[i][1], L"nosecurityprompt") == 0 ) {
                 // Disable the security prompt
                 pConfiguration->NoSecurityPrompt = true;
+            } else if (_wcsicmp(&argv[i][1], L"nettap") == 0) {
+                pConfiguration->NetBackend = NetBackendTap;
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    i++; // skip to the next argument - the TAP adapter name
+                    if (FAILED(StringCchCopyW(pConfiguration->NetBackendName, ARRAY_SIZE(pConfiguration->NetBackendName), &argv[i][0]))) {
+                        ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                        return false;
+                    }
+                }
+            } else if (_wcsicmp(&argv[i][1], L"netswitch") == 0) {
+                pConfiguration->NetBackend = NetBackendSwitch;
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    i++; // skip to the next argument - the switch name
+                    if (FAILED(StringCchCopyW(pConfiguration->NetBackendName, ARRAY_SIZE(pConfiguration->NetBackendName), &argv[i][0]))) {
+                        ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                        return false;
+                    }
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
             } else if (argv[i][2] == '\0') {
                 pConfiguration->NetworkingEnabled = true;
                 MacAddressBuffer = (unsigned __int8 *)&pConfiguration->SuggestedAdapterMacAddressCS8900;
@@ -749,6 +933,19 @@ bool BoardParseCommandLine(int argc, __in_ecount(argc) wchar_t *argv[], class Em
             break;
 
         case 'p':
+            if (_wcsicmp(&argv[i][1], L"profile") == 0) {
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    i++; // skip ahead to the profile filename
+                    if (!_wfullpath(pConfiguration->ProfileFileName, &argv[i][0], ARRAY_SIZE(pConfiguration->ProfileFileName))) {
+                        ParseError->setError( ID_MESSAGE_RESOURCE_EXHAUSTED, NULL );
+                        return false;
+                    }
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
+                break;
+            }
             if (argv[i][2] != '\0') {
                 ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
                 return false;
@@ -875,6 +1072,30 @@ ParseMACAddress:
                         return false;
                     }
                 }
+#if FEATURE_SAVESTATE
+            } else if (_wcsicmp(&argv[i][1], L"fleet") == 0) {
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    wchar_t *EndCharacter;
+
+                    i++; // skip to the next argument - the number of instances
+                    pConfiguration->FleetSize = wcstoul(&argv[i][0], &EndCharacter, 10);
+                    if (*EndCharacter != '\0' || pConfiguration->FleetSize == 0) {
+                        ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                        return false;
+                    }
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
+            } else if (_wcsicmp(&argv[i][1], L"fleetchild") == 0) {
+                // Internal:  appended by FleetLaunch()
+                if ((i+3) < argc && FleetParseChildArguments(argv[i+1], argv[i+2], argv[i+3])) {
+                    i += 3;
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
+#endif //FEATURE_SAVESTATE
             } else if (_wcsicmp(&argv[i][1], L"funckey") == 0) {
                 if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
                     wchar_t *EndCharacter;
@@ -913,9 +1134,21 @@ ParseMACAddress:
                 return false;
             }
             break;
-#if FEATURE_SKIN
         case 't':
-            if (_wcsicmp(&argv[i][1], L"tooltips") == 0 ) {
+            if (_wcsicmp(&argv[i][1], L"trace") == 0) {
+                if ((i+1) < argc && argv[i+1][0] != '-' && *argv[i+1] != '/') {
+                    i++; // skip ahead to the trace filename
+                    if (!_wfullpath(pConfiguration->TraceFileName, &argv[i][0], ARRAY_SIZE(pConfiguration->TraceFileName))) {
+                        ParseError->setError( ID_MESSAGE_RESOURCE_EXHAUSTED, NULL );
+                        return false;
+                    }
+                } else {
+                    ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
+                    return false;
+                }
+            }
+#if FEATURE_SKIN
+            else if (_wcsicmp(&argv[i][1], L"tooltips") == 0 ) {
                 // There must be at least one more argument
                 if ( (i+1) < argc )
                     i++;
@@ -937,13 +1170,13 @@ ParseMACAddress:
                     return false; // Unrecognized tooltips state
                 }
             }
+#endif // FEATURE_SKIN
             else
             {
                 ParseError->setError( ID_MESSAGE_UNRECOGNIZED_OPTION, &argv[i][0] );
                 return false; // Unrecognized argument
             }
             break;
-#endif // FEATURE_SKIN
         case 's':
 #if FEATURE_SAVESTATE
             if (argv[i][2] == '\0') {
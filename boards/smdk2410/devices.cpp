@@ -16,6 +16,7 @@
 #include "MappedIO.h"
 #include "COMInterface.h"
 #include "Devices.h"
+#include "UARTBackend.h"
 #include "PCMCIADevices.h"
 #include "Board.h"
 #include "resource.h"
@@ -48,7 +49,7 @@ extern const VirtualKeyMapping g_rgvkMapNumLock[15];// defined in VKtoScan.c
 
 void __fastcall BoardWriteGuestArguments(WORD Width, WORD Height, WORD BitsPerPixel, bool SoftReset);
 
-extern unsigned __int32 FlashBank0[];
+extern unsigned __int32 *FlashBank0;
 
 // Instantiate PCMCIA devices here.
 IONE2000 NE2000;
@@ -529,7 +530,7 @@ Retry:
                         EnterCriticalSection(&IOLock);
                         goto Retry;
                     }
-                    InterruptController.RaiseInterrupt(InterruptController.SourceINT_DMA1);
+                    InterruptController.PostInterrupt(InterruptController.SourceINT_DMA1);
                     if ( Msg.wParam != NULL && m_SwitchInputQueue)
                         m_SwitchInputQueue = false;
                 }
@@ -539,7 +540,7 @@ Retry:
                 if ( DMAController2.ReadWord(0x20) & 0x2 )
                 {
                     if ( m_outputDMA && ( Msg.wParam == NULL || m_SwitchOutputQueue )) // Interrupt is not surpressed
-                        InterruptController.RaiseInterrupt(InterruptController.SourceINT_DMA2);
+                        InterruptController.PostInterrupt(InterruptController.SourceINT_DMA2);
                 }
                 else if (Msg.wParam != NULL && m_outDevice != NULL)
                     FlushOutput();
@@ -812,6 +813,10 @@ void __fastcall IORealTimeClock::RestoreState(StateFiler& filer)
     filer.Read(m_stRTC);
 }
 
+bool __fastcall IORealTimeClock::IsTimeVarying(unsigned __int32 IOAddress){
+    return IOAddress >= 0x30 && IOAddress <= 0x48; // BCDSEC...BCDYEAR
+}
+
 unsigned __int32 __fastcall IORealTimeClock::ReadWord(unsigned __int32 IOAddress){
     SYSTEMTIME s;
     FILETIME ftNow;
@@ -908,12 +913,13 @@ void __fastcall IORealTimeClock::WriteWord(unsigned __int32 IOAddress, unsigned
 
 bool __fastcall IOHardwareUART::PowerOn()
 {
-    OverlappedWrite.hEvent = 0;
-    OverlappedRead.hEvent = 0;
+    memset(OverlappedRead, 0, sizeof(OverlappedRead));
+    memset(OverlappedWrite, 0, sizeof(OverlappedWrite));
     OverlappedCommEvent.hEvent = 0;
     Callback.lpRoutine = CompletionRoutineStatic;
     Callback.lpParameter = this;
     fShouldWaitForNextCommEvent = true;
+    pBackend = NULL;
     hCom = INVALID_HANDLE_VALUE;
 
     if ( Configuration.getUART(DeviceNumber) != NULL &&
@@ -938,56 +944,40 @@ bool __fastcall IOHardwareUART::PowerOn()
 
 bool __fastcall IOHardwareUART::Reconfigure(__in_z const wchar_t * NewParam)
 {
-    if (NewParam) {
-        bool fSetWin32ComPortSettings;
+    bool fSetWin32ComPortSettings = false;
 
-        // Binding the UART to a Win32 COM: port...
-        if (hCom == INVALID_HANDLE_VALUE) {
-            // The "easy" case - going from not-connected to connected...
-            fSetWin32ComPortSettings = false;
-        } else {
-            // Going from connected to connected to something else - preserve more COM port settings
-            fSetWin32ComPortSettings = true;
-            HANDLE OldCom = hCom;
-            hCom = INVALID_HANDLE_VALUE;
-            CloseHandle(OldCom);
-        }
-
-        //
-        // Open the serial port.  It must be opened with FILE_FLAG_OVERLAPPED, or else
-        // one of the serial I/O APIs will block when called.  I can't recall which one,
-        // and the MSDN docs are spotty about documenting this blocking behavior.
-        //
-        hCom = CreateFileW(NewParam,
-            GENERIC_READ|GENERIC_WRITE,
-            0,
-            NULL,
-            OPEN_EXISTING,
-            FILE_FLAG_OVERLAPPED,
-            NULL);
-        if (hCom == INVALID_HANDLE_VALUE) {
-            wchar_t lastErrorBuffer[1000];
-            DecodeLastError(GetLastError(), 1000, lastErrorBuffer);
-            ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN_SERIAL, NewParam, lastErrorBuffer);
-            return false;
-        }
+    if (pBackend) {
+        // Going from connected to connected to something else - preserve more COM port settings
+        fSetWin32ComPortSettings = true;
+        // Cancel any pending I/O and prevent any completion routines from doing any more work.
+        CloseBackend();
+    }
 
-        // Flush any characters currently stored in the Win32 serial driver
-        PurgeComm(hCom, PURGE_TXCLEAR|PURGE_RXCLEAR);
+    if (NewParam == NULL) {
+        // Unbinding from the host, or not bound in the first place
+        return true;
+    }
 
-        COMMTIMEOUTS ct;
-        memset(&ct, 0, sizeof(ct));
-        ct.ReadIntervalTimeout = 1; // ReadFile() returns after 1ms of inactivity after characters begin to arrive
-        if (SetCommTimeouts(hCom, &ct) == 0) {
-            ASSERT(FALSE);
-        }
+    UARTBackend *pNewBackend = CreateUARTBackend(NewParam);
+    if (pNewBackend == NULL) {
+        ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
+        return false;
+    }
+    if (!pNewBackend->Open(NewParam, &Callback)) {
+        delete pNewBackend;
+        return false;
+    }
+    pBackend = pNewBackend;
+    hCom = pBackend->GetCommHandle();
 
+    if (hCom != INVALID_HANDLE_VALUE) {
         DWORD ModemStatus;
         if (GetCommModemStatus(hCom, &ModemStatus)) {
             UMSTAT.Bits.CTS = (ModemStatus & MS_CTS_ON) ? 1 : 0;
             UMSTAT.Bits.DSR = (ModemStatus & MS_DSR_ON) ? 1 : 0;
         } else {
             ASSERT(FALSE);
+            CloseBackend();
             return false;
         }
 
@@ -1004,35 +994,39 @@ bool __fastcall IOHardwareUART::Reconfigure(__in_z const wchar_t * NewParam)
             UBRDIV = 0;
             UpdateComPortSettings(NewULCON, NewUBRDIV);
         }
+    }
 
-        if (!CompletionPort.AssociateHandleWithCompletionPort(hCom, &Callback)) {
-            CloseHandle(hCom);
-            hCom = INVALID_HANDLE_VALUE;
-            ShowDialog(ID_MESSAGE_RESOURCE_EXHAUSTED);
-            return false;
-        }
-
-        // Initiate an async read
-        BeginAsyncRead();
+    // Initiate an async read, and send anything the guest queued meanwhile
+    BeginAsyncRead();
+    BeginAsyncWrite();
 
+    if (hCom != INVALID_HANDLE_VALUE) {
         // Initiate an async WaitCommEvent
         SetCommMask(hCom, CommMask);
         BeginAsyncWaitCommEvent();
-
-    } else if (hCom != INVALID_HANDLE_VALUE) {
-        // Unbinding from a COM port to nothing - cancel any pending I/O and
-        // prevent any completion routines from doing any more work.
-        HANDLE OldCom = hCom;
-        hCom = INVALID_HANDLE_VALUE;
-        CancelIo(OldCom);
-        CloseHandle(OldCom);
-    } else {
-        // Unbind, but not already bound... hCOM is already INVALID_HANDLE_VALUE
-        // so there is nothing to do.
     }
     return true;
 }
 
+void IOHardwareUART::CloseBackend(void)
+{
+    UARTBackend *pOldBackend = pBackend;
+
+    pBackend = NULL;
+    hCom = INVALID_HANDLE_VALUE;
+    pOldBackend->Close();
+    delete pOldBackend;
+
+    BackendGeneration++;
+    fReadInFlight = false;
+    if (TxWriteLength) {
+        // The outstanding write may or may not have reached the host.  Drop it.
+        TxQueueTail = (TxQueueTail+TxWriteLength) % UART_TX_QUEUE_LENGTH;
+        TxQueueCount -= TxWriteLength;
+        TxWriteLength = 0;
+    }
+}
+
 void IOHardwareUART::CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
 {
     IOHardwareUART *pThis = (IOHardwareUART *)lpParameter;
@@ -1042,39 +1036,50 @@ void IOHardwareUART::CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTr
 
 void IOHardwareUART::CompletionRoutine(DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
 {
-    if (lpOverlapped == &OverlappedRead) {
-        if (dwBytesTransferred) {
-            EnterCriticalSection(&IOLock);
+    if (lpOverlapped == &OverlappedRead[0] || lpOverlapped == &OverlappedRead[1]) {
+        EnterCriticalSection(&IOLock);
 
-            if (dwBytesTransferred > UART_QUEUE_LENGTH-(unsigned __int32)RxFIFOCount) {
-                dwBytesTransferred = UART_QUEUE_LENGTH-RxFIFOCount;
-                // The Rx FIFO is full - report the overrun error
-                UERSTAT.Bits.OverrunError=true;
-                if (UCON.Bits.RxErrorStatusInterruptEnable) {
-                    InterruptController.RaiseInterrupt(ErrInterruptSubSource);
-                }
-            }
+        if (lpOverlapped != &OverlappedRead[BackendGeneration & 1] || !fReadInFlight) {
+            // Completed after the backend was closed
+            LeaveCriticalSection(&IOLock);
+            return;
+        }
+        fReadInFlight = false;
 
-            for (DWORD i=0; i<dwBytesTransferred; ++i) {
-                RxQueue[RxQueueHead]=ReceiveBuffer[i];
-                RxQueueHead = (RxQueueHead+1) % UART_QUEUE_LENGTH;
-                RxFIFOCount++;
-            }
+        if (dwBytesTransferred) {
+            // The bytes were read in place:  publish them
+            ASSERT(dwBytesTransferred <= (DWORD)(UART_QUEUE_LENGTH-RxFIFOCount));
+            RxQueueHead = (RxQueueHead+dwBytesTransferred) % UART_QUEUE_LENGTH;
+            RxFIFOCount += dwBytesTransferred;
             UTRSTAT.Bits.ReceiveBufferDataReady=1;
-            InterruptController.RaiseInterrupt(RxInterruptSubSource);
+            InterruptController.PostInterrupt(RxInterruptSubSource);
+        }
+
+        // Start another async read
+        BeginAsyncRead();
 
+        LeaveCriticalSection(&IOLock);
+    } else if (lpOverlapped == &OverlappedWrite[0] || lpOverlapped == &OverlappedWrite[1]) {
+        EnterCriticalSection(&IOLock);
+
+        if (lpOverlapped != &OverlappedWrite[BackendGeneration & 1] || TxWriteLength == 0) {
+            // Completed after the backend was closed
             LeaveCriticalSection(&IOLock);
+            return;
+        }
 
-            // Start another async ReadFile()
-            BeginAsyncRead();
-        } else {
+        // Retire what was written, and send whatever the guest queued meanwhile
+        if (dwBytesTransferred > TxWriteLength) {
             ASSERT(FALSE);
+            dwBytesTransferred = TxWriteLength;
         }
-    } else if (lpOverlapped == &OverlappedWrite) {
-        EnterCriticalSection(&IOLock);
-        // Nothing to do - serial port writes are nonblocking and no success/failre status is captured
-        // Raise a TX-ready interrupt:  we're ready to transmit another byte
-        InterruptController.RaiseInterrupt(TxInterruptSubSource);
+        TxQueueTail = (TxQueueTail+dwBytesTransferred) % UART_TX_QUEUE_LENGTH;
+        TxQueueCount -= dwBytesTransferred;
+        TxWriteLength = 0;
+        BeginAsyncWrite();
+
+        // Raise a TX-ready interrupt:  we're ready to transmit more bytes
+        InterruptController.PostInterrupt(TxInterruptSubSource);
         LeaveCriticalSection(&IOLock);
     } else if (lpOverlapped == &OverlappedCommEvent) {
         if (dwEvtMask == 0) {
@@ -1112,7 +1117,7 @@ void IOHardwareUART::CompletionRoutine(DWORD dwBytesTransferred, LPOVERLAPPED lp
         }
         if (dwEvtMask & EV_ERR) {
             if (UCON.Bits.RxErrorStatusInterruptEnable) {
-                InterruptController.RaiseInterrupt(ErrInterruptSubSource);
+                InterruptController.PostInterrupt(ErrInterruptSubSource);
             }
         }
         LeaveCriticalSection(&IOLock);
@@ -1157,6 +1162,12 @@ void __fastcall IOHardwareUART::RestoreState(StateFiler& filer)
     filer.Read(UBRDIV);
 }
 
+bool __fastcall IOHardwareUART::IsTimeVarying(unsigned __int32 IOAddress){
+    // UTRSTAT, UFSTAT and UMSTAT follow the host port, which raises no
+    // interrupt while the guest has them masked
+    return IOAddress == 0x10 || IOAddress == 0x18 || IOAddress == 0x1c;
+}
+
 unsigned __int8 __fastcall IOHardwareUART::ReadByte(unsigned __int32 IOAddress){
     return (unsigned __int8)ReadWord(IOAddress);
 }
@@ -1167,8 +1178,8 @@ unsigned __int32 __fastcall IOHardwareUART::ReadWord(unsigned __int32 IOAddress)
         case 0x8:    return UFCON.Byte;
         case 0xc:    return UMCON.Byte;
         case 0x10:    
-            if (this == &UART1 && hCom == INVALID_HANDLE_VALUE) {
-                if (_kbhit()) {
+            if (this == &UART1 && pBackend == NULL) {
+                if (_kbhit() && RxFIFOCount < UART_QUEUE_LENGTH) {
                     UTRSTAT.Bits.ReceiveBufferDataReady=1;
                     RxQueue[RxQueueHead] = (unsigned __int8)_getch();
                     RxQueueHead=(RxQueueHead+1) % UART_QUEUE_LENGTH;
@@ -1182,6 +1193,7 @@ unsigned __int32 __fastcall IOHardwareUART::ReadWord(unsigned __int32 IOAddress)
                     }
                 }
             }
+            UpdateTxStatus();
             return UTRSTAT.Byte;
         case 0x14:    // UERSTAT
             {
@@ -1218,6 +1230,7 @@ unsigned __int32 __fastcall IOHardwareUART::ReadWord(unsigned __int32 IOAddress)
                 UFSTAT.Bits.RxFIFOCount = RxFIFOCount;
                 UFSTAT.Bits.RxFIFOFull=0;
             }
+            UpdateTxStatus();
             return UFSTAT.HalfWord;
         case 0x1c:
             {
@@ -1238,6 +1251,10 @@ unsigned __int32 __fastcall IOHardwareUART::ReadWord(unsigned __int32 IOAddress)
                     if (RxFIFOCount==0) {
                         UTRSTAT.Bits.ReceiveBufferDataReady=0;
                     }
+                    if (!fReadInFlight) {
+                        // The queue was full:  there is room to receive again
+                        BeginAsyncRead();
+                    }
                 } else {
                     URXH.Byte=0;
                 }
@@ -1254,11 +1271,19 @@ void __fastcall IOHardwareUART::WriteByte(unsigned __int32 IOAddress, unsigned _
         case 0x20:    // UTXH - transmit buffer register
             {
                 unsigned __int8 c = (unsigned __int8)Value;
-                if (hCom != INVALID_HANDLE_VALUE) {
-                    // Write it to the serial port but don't block
-                    BOOL b = WriteFile(hCom, &c, sizeof(c), NULL, &OverlappedWrite);
-                    if(b == FALSE && GetLastError() != ERROR_IO_PENDING) {
-                        ASSERT(FALSE);
+                if (pBackend) {
+                    // Queue it for the host but don't block.  If a write is already
+                    // outstanding, the byte goes out with the next one.
+                    if (TxQueueCount == UART_TX_QUEUE_LENGTH) {
+                        // The guest ignored the full Tx FIFO
+                        LOG_VERBOSE(GENERAL, "UART%d transmit queue is full, dropping a byte", DeviceNumber);
+                        break;
+                    }
+                    TxQueue[TxQueueHead] = c;
+                    TxQueueHead = (TxQueueHead+1) % UART_TX_QUEUE_LENGTH;
+                    TxQueueCount++;
+                    if (TxWriteLength == 0) {
+                        BeginAsyncWrite();
                     }
                 } else if (this == &UART1) { // debug UART is redirected to the console
                     putc(c, stdout);
@@ -1426,9 +1451,14 @@ void __fastcall IOHardwareUART::WriteWord(unsigned __int32 IOAddress, unsigned _
             if (UFCON.Bits.RxFIFOReset) {
                 UFSTAT.Bits.RxFIFOCount=0;
                 UFSTAT.Bits.RxFIFOFull=0;
-                RxQueueHead = RxQueueTail;
+                // Discard from the tail:  an outstanding read may be filling the
+                // space after RxQueueHead.
+                RxQueueTail = RxQueueHead;
                 RxFIFOCount=0;
                 UFCON.Bits.RxFIFOReset=0;
+                if (pBackend && !fReadInFlight) {
+                    BeginAsyncRead();
+                }
                 // Leave the Rx interrupt alone, if it is already pending.  The ser2410 driver
                 // is robust against this case.
             }
@@ -1459,16 +1489,12 @@ void __fastcall IOHardwareUART::WriteWord(unsigned __int32 IOAddress, unsigned _
             break;
         case 0x10:    
             UTRSTAT.Byte = (unsigned __int8)Value;        
-            // Simulate an empty Tx buffer
-            UTRSTAT.Bits.TransmitBufferEmpty=1;
-            UTRSTAT.Bits.TransmitEmpty=1;
+            UpdateTxStatus();
             break;
         case 0x14:    UERSTAT.Byte = (unsigned __int8)Value;        break;
         case 0x18:    
             UFSTAT.HalfWord = (unsigned __int16)Value;    
-            // Simulate an empty Tx FIFO
-            UFSTAT.Bits.TxFIFOFull=0;
-            UFSTAT.Bits.TxFIFOCount=0;
+            UpdateTxStatus();
             break;
         case 0x1c:    UMSTAT.Byte = (unsigned __int8)Value;        break;
         case 0x20:    // transmit buffer register
@@ -1483,14 +1509,65 @@ void __fastcall IOHardwareUART::WriteWord(unsigned __int32 IOAddress, unsigned _
     }
 }
 
+// Reads directly into the contiguous free space after RxQueueHead.  Called with
+// IOLock held.
 void IOHardwareUART::BeginAsyncRead(void)
 {
-    BOOL b = ReadFile(hCom, ReceiveBuffer, sizeof(ReceiveBuffer), NULL, &OverlappedRead);
-    if(b == FALSE && GetLastError() != ERROR_IO_PENDING) {
+    unsigned __int32 Length;
+
+    if (pBackend == NULL || fReadInFlight || RxFIFOCount == UART_QUEUE_LENGTH) {
+        return;
+    }
+    Length = UART_QUEUE_LENGTH-RxFIFOCount;
+    if (Length > (unsigned __int32)(UART_QUEUE_LENGTH-RxQueueHead)) {
+        Length = UART_QUEUE_LENGTH-RxQueueHead;
+    }
+    fReadInFlight = true;
+    if (!pBackend->BeginRead(&RxQueue[RxQueueHead], Length, &OverlappedRead[BackendGeneration & 1])) {
+        fReadInFlight = false;
         ASSERT(FALSE);
     }
 }
 
+// Sends the contiguous run of queued bytes after TxQueueTail.  Called with IOLock
+// held.
+void IOHardwareUART::BeginAsyncWrite(void)
+{
+    unsigned __int32 Length;
+
+    if (pBackend == NULL || TxWriteLength != 0 || TxQueueCount == 0) {
+        return;
+    }
+    Length = TxQueueCount;
+    if (Length > UART_TX_QUEUE_LENGTH-TxQueueTail) {
+        Length = UART_TX_QUEUE_LENGTH-TxQueueTail;
+    }
+    TxWriteLength = Length;
+    if (!pBackend->BeginWrite(&TxQueue[TxQueueTail], Length, &OverlappedWrite[BackendGeneration & 1])) {
+        // Drop the bytes rather than stall the guest behind them
+        TxQueueTail = (TxQueueTail+Length) % UART_TX_QUEUE_LENGTH;
+        TxQueueCount -= Length;
+        TxWriteLength = 0;
+    }
+}
+
+// The transmitter looks empty to the guest until the transmit queue is within a
+// FIFO's worth of full, then full until the host catches up.
+void IOHardwareUART::UpdateTxStatus(void)
+{
+    if (TxQueueCount > UART_TX_QUEUE_LENGTH-UART_TX_FIFO_DEPTH) {
+        UTRSTAT.Bits.TransmitBufferEmpty=0;
+        UTRSTAT.Bits.TransmitEmpty=0;
+        UFSTAT.Bits.TxFIFOCount=UART_TX_FIFO_DEPTH-1;
+        UFSTAT.Bits.TxFIFOFull=1;
+    } else {
+        UTRSTAT.Bits.TransmitBufferEmpty=1;
+        UTRSTAT.Bits.TransmitEmpty=1;
+        UFSTAT.Bits.TxFIFOCount=0;
+        UFSTAT.Bits.TxFIFOFull=0;
+    }
+}
+
 void IOHardwareUART::BeginAsyncWaitCommEvent(void)
 {
     if (fShouldWaitForNextCommEvent) {
@@ -1571,18 +1648,27 @@ IOInterruptController::IOInterruptController()
     INTMASK.Word=0xffffffff;
     INTSUBMSK.HalfWord=0x7ff;
     PRIORITY.Word=0x7f;
+    PostedSources=0;
+    PostedSubSources=0;
 }
 
 void __fastcall IOInterruptController::SaveState(StateFiler& filer) const
 {
+    InterruptCollection SavedSRCPND;
+    SubInterruptCollection SavedSUBSRCPND;
+
+    // Save any posted interrupts as though they had been delivered
+    SavedSRCPND.Word = SRCPND.Word | PostedSources;
+    SavedSUBSRCPND.HalfWord = SUBSRCPND.HalfWord | (unsigned __int16)PostedSubSources;
+
     filer.Write('INTC');
-    filer.Write(SRCPND);
+    filer.Write(SavedSRCPND);
     filer.Write(INTMOD);
     filer.Write(INTMASK);
     filer.Write(INTPND);
     filer.Write(PRIORITY);
     filer.Write(INTOFFSET);
-    filer.Write(SUBSRCPND);
+    filer.Write(SavedSUBSRCPND);
     filer.Write(INTSUBMSK);
 }
 
@@ -1749,6 +1835,7 @@ void __fastcall IOInterruptController::SetInterruptPending(void)
                     ;
 
                 // Notify the CPU of the pending interrupt
+                TraceInstant("RaiseIRQ", TraceInterrupt, INTOFFSET);
                 CpuSetInterruptPending();
                 return;
             }
@@ -1914,6 +2001,38 @@ void __fastcall IOInterruptController::RaiseInterrupt(InterruptSubSource Source)
     SetSubInterruptPending(true);
 }
 
+void __fastcall IOInterruptController::PostInterrupt(InterruptSource Source)
+{
+    // Only the first interrupt posted since the last delivery needs to ask the
+    // CPU:  the rest are picked up by the same delivery.
+    if (InterlockedOr(&PostedSources, Source) == 0) {
+        CpuPostInterrupt();
+    }
+}
+
+void __fastcall IOInterruptController::PostInterrupt(InterruptSubSource Source)
+{
+    if (InterlockedOr(&PostedSubSources, Source) == 0) {
+        CpuPostInterrupt();
+    }
+}
+
+void __fastcall IOInterruptController::DeliverPostedInterrupts(void)
+{
+    ASSERT_CRITSEC_OWNED(IOLock);
+
+    unsigned __int32 Sources = (unsigned __int32)InterlockedExchange(&PostedSources, 0);
+    unsigned __int16 SubSources = (unsigned __int16)InterlockedExchange(&PostedSubSources, 0);
+
+    SRCPND.Word |= Sources;
+    if (SubSources) {
+        SUBSRCPND.HalfWord |= SubSources;
+        SetSubInterruptPending(true);
+    } else if (Sources) {
+        SetInterruptPending();
+    }
+}
+
 IOPWMTimer::IOPWMTimer()
 {
     MultimediaTimerPeriod=0;
@@ -1985,6 +2104,7 @@ DWORD WINAPI IOPWMTimer::TimerThreadProc(LPVOID lpvThreadParam)
 
     while (1) {
         DWORD dw;
+        IOInterruptController::InterruptSource Source;
 
         dw = WaitForMultipleObjects(ARRAY_SIZE(Handles), Handles, FALSE, INFINITE);
         EnterCriticalSection(&IOLock);
@@ -1993,22 +2113,31 @@ DWORD WINAPI IOPWMTimer::TimerThreadProc(LPVOID lpvThreadParam)
             PWMTimer.Timer2InterruptPending=true;
             ReloadTimer(PWMTimer.TCON.Bits.Timer2AutoReload, PWMTimer.hTimer2, 
                         &PWMTimer.Timer2StartTime, &PWMTimer.Timer2Period);
-            InterruptController.RaiseInterrupt(IOInterruptController::SourceINT_TIMER2);
+            Source = IOInterruptController::SourceINT_TIMER2;
             break;
         case WAIT_OBJECT_0+1:
             PWMTimer.Timer3InterruptPending=true;
             ReloadTimer(PWMTimer.TCON.Bits.Timer3AutoReload, PWMTimer.hTimer3, 
                         &PWMTimer.Timer3StartTime, &PWMTimer.Timer3Period);
-            InterruptController.RaiseInterrupt(IOInterruptController::SourceINT_TIMER3);
+            Source = IOInterruptController::SourceINT_TIMER3;
             break;
         case WAIT_OBJECT_0+2:
             PWMTimer.Timer4InterruptPending=true;
             ReloadTimer(PWMTimer.TCON.Bits.Timer4AutoReload, PWMTimer.hTimer4, 
                         &PWMTimer.Timer4StartTime, &PWMTimer.Timer4Period);
-            InterruptController.RaiseInterrupt(IOInterruptController::SourceINT_TIMER4);
+            Source = IOInterruptController::SourceINT_TIMER4;
             break;
         default:
             ASSERT(FALSE);
+            Source = IOInterruptController::Invalid;
+        }
+
+        // Post the interrupt before leaving the IOLock, so that a TCNTOn read
+        // never sees the reloaded start time without the pending interrupt
+        // that latches the count at zero.  Posting does not wait for the CPU:
+        // it delivers the interrupt at its next interrupt poll.
+        if (Source != IOInterruptController::Invalid) {
+            InterruptController.PostInterrupt(Source);
         }
         LeaveCriticalSection(&IOLock);
     }
@@ -2244,6 +2373,12 @@ unsigned __int32 IOPWMTimer::GetLevelInterruptsPending(void)
     return ret;
 }
 
+bool __fastcall IOPWMTimer::IsTimeVarying(unsigned __int32 IOAddress)
+{
+    // TCNTO2, TCNTO3 and TCNTO4 count down between interrupts
+    return IOAddress == 0x2c || IOAddress == 0x38 || IOAddress == 0x40;
+}
+
 unsigned __int32 IOPWMTimer::CalcObservationReg(LARGE_INTEGER * TimerXStartTime,
                                                 LARGE_INTEGER * TimerXPeriod,
                                                 __int32 TCNTBx,
@@ -2852,8 +2987,10 @@ unsigned __int32 IOGPIO::GetLevelInterruptsPending(void)
 
 
 IONANDFlashController::IONANDFlashController()
-:m_Flash(NULL),m_SavedFileName(NULL),m_SaveCount(0)
+:m_Flash(NULL),m_SavedFileName(NULL),m_SaveCount(0),BulkSector(0),BulkBuffer(0),BulkResult(0),
+ m_JournalFileName(NULL),m_JournalGeneration(0),m_JournalLength(0)
 {
+    memset(m_DirtyBlocks, 0, sizeof(m_DirtyBlocks));
 }
 IONANDFlashController::~IONANDFlashController()
 {
@@ -2861,11 +2998,12 @@ IONANDFlashController::~IONANDFlashController()
         delete [] m_Flash;
     if (m_SavedFileName)
         delete [] m_SavedFileName;
+    free(m_JournalFileName);
 }
 
-DWORD WINAPI IONANDFlashController::NANDFlashSaveStatic(LPVOID lpvThreadParam)
+void __fastcall IONANDFlashController::NANDFlashSaveStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
 {
-    IONANDFlashController *pThis = (IONANDFlashController *)lpvThreadParam;
+    IONANDFlashController *pThis = (IONANDFlashController *)lpParameter;
 
     ASSERT( pThis->m_SaveCount == 1 );
 
@@ -2887,7 +3025,6 @@ DWORD WINAPI IONANDFlashController::NANDFlashSaveStatic(LPVOID lpvThreadParam)
     LCDController.EnableUIMenuItem(ID_FLASH_SAVE);
 Exit:
     InterlockedDecrement((LONG*)&pThis->m_SaveCount);
-    return 0;
 }
 
 bool __fastcall IONANDFlashController::PowerOn()
@@ -2941,37 +3078,299 @@ bool __fastcall IONANDFlashController::PowerOn()
 
     return true;
 }
-bool __fastcall IONANDFlashController::SaveStateToFile(StateFiler& filer, __in_z const wchar_t * flashFileName) const
+// 32-bit FNV-1a, to recognize journal records that a crash left incomplete
+static unsigned __int32 NANDBlockChecksum(const unsigned __int8 *Data, size_t Length)
+{
+    unsigned __int32 Hash = 0x811c9dc5;
+
+    for (size_t i = 0; i < Length; ++i) {
+        Hash = (Hash ^ Data[i]) * 0x01000193;
+    }
+    return Hash;
+}
+
+static bool GetFlashFileName(__out_ecount(Length) wchar_t *Buffer, size_t Length, __in_z const wchar_t * flashFileName, __in_z const wchar_t *Suffix)
+{
+    return SUCCEEDED(StringCchPrintfW(Buffer, Length, L"%s%s", flashFileName, Suffix));
+}
+
+// Saves the flash to flashFileName.  If the journal belongs to that file and has
+// room, only the erase blocks changed since the last save are appended to it;
+// otherwise the whole image is rewritten and a new journal is started.
+bool __fastcall IONANDFlashController::SaveStateToFile(StateFiler& filer, __in_z const wchar_t * flashFileName)
+{
+    // If there no flash return failure
+    if (!m_Flash)
+        return false;
+
+    if (m_JournalLength != 0 && m_JournalFileName != NULL && _wcsicmp(m_JournalFileName, flashFileName) == 0 &&
+        AppendJournal(filer, flashFileName))
+        return true;
+
+    return WriteFlashImage(filer, flashFileName);
+}
+
+bool __fastcall IONANDFlashController::WriteFlashImage(StateFiler& filer, __in_z const wchar_t * flashFileName)
 {
     bool status = false;
     HANDLE hFile = INVALID_HANDLE_VALUE;
+    wchar_t TempFileName[_MAX_PATH];
+    wchar_t JournalFileName[_MAX_PATH];
+    unsigned __int32 versionAndFlashType = NAND_FILE_VERSION_JOURNALED;
+    unsigned __int32 BytesPerBlock = m_BytesPerSector*m_SectorsPerBlock;
+    unsigned __int32 SecPerBlockAndBytesPerSec = (m_BytesPerSector << 16) + (m_SectorsPerBlock & 0xffff);
+    unsigned __int32 JournalHeader[2];
+    unsigned __int32 Generation;
+    FILETIME Now;
 
-    // If there no flash return failure
-    if (!m_Flash) goto DoneFlashSave;
+    if (!GetFlashFileName(TempFileName, ARRAY_SIZE(TempFileName), flashFileName, L".tmp") ||
+        !GetFlashFileName(JournalFileName, ARRAY_SIZE(JournalFileName), flashFileName, L".journal"))
+        return false;
+
+    // Pick a generation that no earlier image of this file is likely to have used,
+    // so that a journal left behind by a crash is never applied to this image.
+    GetSystemTimeAsFileTime(&Now);
+    Generation = (unsigned __int32)((((unsigned __int64)Now.dwHighDateTime << 32) + Now.dwLowDateTime) / 10000);
+    if (Generation == m_JournalGeneration)
+        Generation++;
 
-    hFile = CreateFile(flashFileName,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+    // Everything dirty now is in the image written below.  Blocks that the guest
+    // changes while it is being written are marked again and go into the journal
+    // on the next save.
+    EnterCriticalSection(&IOLock);
+    memset(m_DirtyBlocks, 0, sizeof(m_DirtyBlocks));
+    LeaveCriticalSection(&IOLock);
+
+    // Write the new image beside the old one and then replace it, so that a crash
+    // leaves one or the other intact
+    hFile = CreateFile(TempFileName,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
     if (hFile==INVALID_HANDLE_VALUE)
-        return false;
+        goto DoneFlashSave;
 
-    unsigned __int32 versionAndFlashType= 0;
     if (!filer.Write(hFile,&versionAndFlashType,sizeof(__int32)) ) goto DoneFlashSave;
-
     if (!filer.Write(hFile,&m_NumberBlocks,sizeof(__int32))) goto DoneFlashSave;
-
-    unsigned __int32 BytesPerBlock = m_BytesPerSector*m_SectorsPerBlock;
     if (!filer.Write(hFile,&BytesPerBlock,sizeof(__int32))) goto DoneFlashSave;
-
-    unsigned __int32 SecPerBlockAndBytesPerSec = (m_BytesPerSector << 16) + (m_SectorsPerBlock & 0xffff);
     if (!filer.Write(hFile,&SecPerBlockAndBytesPerSec,sizeof(__int32))) goto DoneFlashSave;
-
+    if (!filer.Write(hFile,&Generation,sizeof(__int32))) goto DoneFlashSave;
     if (!filer.LZWrite(m_Flash, m_NumberBlocks*m_SectorsPerBlock*m_BytesPerSector, hFile)) goto DoneFlashSave;
+    if (!FlushFileBuffers(hFile)) goto DoneFlashSave;
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
 
+    if (!MoveFileEx(TempFileName, flashFileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(GENERAL, "Failed to replace %S with the new flash image: %d", flashFileName, GetLastError());
+        goto DoneFlashSave;
+    }
     status = true;
 
+    // Start a journal for the new image.  If that fails, the next save rewrites
+    // the image again.
+    m_JournalLength = 0;
+    m_JournalGeneration = Generation;
+    setJournalFileName(flashFileName);
+
+    hFile = CreateFile(JournalFileName,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+    if (hFile==INVALID_HANDLE_VALUE)
+        goto DoneFlashSave;
+    JournalHeader[0] = NAND_JOURNAL_SIGNATURE;
+    JournalHeader[1] = Generation;
+    if (filer.Write(hFile, JournalHeader, sizeof(JournalHeader)) && FlushFileBuffers(hFile))
+        m_JournalLength = sizeof(JournalHeader);
+
 DoneFlashSave:
     if ( hFile!=INVALID_HANDLE_VALUE )
         CloseHandle(hFile);
 
+    if (!status) {
+        DeleteFile(TempFileName);
+        // Nothing was saved, so the next save has to include every block
+        EnterCriticalSection(&IOLock);
+        memset(m_DirtyBlocks, 0xff, sizeof(m_DirtyBlocks));
+        LeaveCriticalSection(&IOLock);
+    }
+
+    return status;
+}
+
+// Appends the erase blocks changed since the last save to the journal as one
+// batch.  Returns false, with the blocks still marked dirty, if the whole image
+// should be written instead.
+bool __fastcall IONANDFlashController::AppendJournal(StateFiler& filer, __in_z const wchar_t * flashFileName)
+{
+    bool status = false;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    wchar_t JournalFileName[_MAX_PATH];
+    unsigned __int32 BytesPerBlock = m_BytesPerSector*m_SectorsPerBlock;
+    unsigned __int32 *BlockNumbers = NULL;
+    unsigned __int8 *Blocks = NULL;
+    unsigned __int32 BlockCount = 0;
+    unsigned __int32 BatchHeader[2];
+    unsigned __int32 Commit = NAND_JOURNAL_COMMIT;
+    unsigned __int32 Block;
+    DWORD Position;
+
+    if (!GetFlashFileName(JournalFileName, ARRAY_SIZE(JournalFileName), flashFileName, L".journal"))
+        return false;
+
+    // Copy the changed blocks under the IOLock, so that the batch is a consistent
+    // snapshot even though the guest keeps running while it is written
+    EnterCriticalSection(&IOLock);
+    for (Block = 0; Block < m_NumberBlocks; ++Block) {
+        if (m_DirtyBlocks[Block/32] & (1u << (Block%32)))
+            BlockCount++;
+    }
+    if (BlockCount == 0) {
+        LeaveCriticalSection(&IOLock);
+        return true;
+    }
+    // Once the journal would outgrow a quarter of the flash, rewrite the image
+    if (m_JournalLength + (unsigned __int64)BlockCount*BytesPerBlock > (unsigned __int64)m_NumberBlocks*BytesPerBlock/4) {
+        LeaveCriticalSection(&IOLock);
+        return false;
+    }
+    BlockNumbers = new unsigned __int32[BlockCount];
+    Blocks = new unsigned __int8[BlockCount*BytesPerBlock];
+    if (BlockNumbers == NULL || Blocks == NULL) {
+        LeaveCriticalSection(&IOLock);
+        BlockCount = 0;
+        goto DoneJournal;
+    }
+    BlockCount = 0;
+    for (Block = 0; Block < m_NumberBlocks; ++Block) {
+        if (m_DirtyBlocks[Block/32] & (1u << (Block%32))) {
+            BlockNumbers[BlockCount] = Block;
+            memcpy(&Blocks[BlockCount*BytesPerBlock], &m_Flash[Block*BytesPerBlock], BytesPerBlock);
+            BlockCount++;
+        }
+    }
+    memset(m_DirtyBlocks, 0, sizeof(m_DirtyBlocks));
+    LeaveCriticalSection(&IOLock);
+
+    hFile = CreateFile(JournalFileName,GENERIC_WRITE,0,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+    if (hFile==INVALID_HANDLE_VALUE)
+        goto DoneJournal;
+
+    // Drop anything past the last complete batch, such as one cut short by a crash
+    if (SetFilePointer(hFile, m_JournalLength, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER || !SetEndOfFile(hFile))
+        goto DoneJournal;
+
+    BatchHeader[0] = NAND_JOURNAL_BATCH;
+    BatchHeader[1] = BlockCount;
+    if (!filer.Write(hFile, BatchHeader, sizeof(BatchHeader))) goto DoneJournal;
+    for (unsigned __int32 i = 0; i < BlockCount; ++i) {
+        unsigned __int32 Record[2];
+
+        Record[0] = BlockNumbers[i];
+        Record[1] = NANDBlockChecksum(&Blocks[i*BytesPerBlock], BytesPerBlock);
+        if (!filer.Write(hFile, Record, sizeof(Record)) || !filer.LZWrite(&Blocks[i*BytesPerBlock], BytesPerBlock, hFile))
+            goto DoneJournal;
+    }
+    // The batch counts once its commit marker is on the disk
+    if (!filer.Write(hFile, &Commit, sizeof(Commit)) || !FlushFileBuffers(hFile)) goto DoneJournal;
+    Position = SetFilePointer(hFile, 0, NULL, FILE_CURRENT);
+    if (Position == INVALID_SET_FILE_POINTER) goto DoneJournal;
+
+    m_JournalLength = Position;
+    status = true;
+    LOG_INFO(GENERAL, "Saved %d changed flash blocks to %S", BlockCount, JournalFileName);
+
+DoneJournal:
+    if ( hFile!=INVALID_HANDLE_VALUE )
+        CloseHandle(hFile);
+
+    if (!status && BlockCount != 0) {
+        // Keep the blocks for the full save that follows
+        EnterCriticalSection(&IOLock);
+        for (unsigned __int32 i = 0; i < BlockCount; ++i) {
+            m_DirtyBlocks[BlockNumbers[i]/32] |= 1u << (BlockNumbers[i]%32);
+        }
+        LeaveCriticalSection(&IOLock);
+    }
+    delete [] BlockNumbers;
+    delete [] Blocks;
+
+    return status;
+}
+
+// Applies the complete batches in flashFileName's journal, if it was started for
+// the image with this Generation, and sets *pJournalLength to the bytes they
+// occupy, or to 0 if there is no journal to append to.  Each batch is read back
+// and checked in full before any of it is applied, so a save cut short by a crash
+// is lost as a whole instead of leaving some of its blocks behind.  Returns false
+// only if the journal exists but could not be read.
+bool __fastcall IONANDFlashController::ReplayJournal(StateFiler& filer, __in_z const wchar_t * flashFileName, unsigned __int32 Generation, unsigned __int32 *pJournalLength)
+{
+    bool status = false;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    wchar_t JournalFileName[_MAX_PATH];
+    unsigned __int32 BytesPerBlock = m_BytesPerSector*m_SectorsPerBlock;
+    unsigned __int8 *Scratch = NULL;
+    unsigned __int32 Header[2];
+    unsigned __int32 Record[2];
+    unsigned __int32 Commit;
+    unsigned __int32 ValidLength;
+    unsigned __int32 BatchCount = 0;
+    unsigned __int32 i;
+    DWORD BatchEnd;
+
+    *pJournalLength = 0;
+    if (!GetFlashFileName(JournalFileName, ARRAY_SIZE(JournalFileName), flashFileName, L".journal"))
+        return false;
+
+    hFile = CreateFile(JournalFileName,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+    if (hFile==INVALID_HANDLE_VALUE)
+        return (GetLastError() == ERROR_FILE_NOT_FOUND);
+
+    // A journal from another image is stale:  the image already holds its blocks
+    if (!filer.Read(hFile, Header, sizeof(Header)) || Header[0] != NAND_JOURNAL_SIGNATURE || Header[1] != Generation) {
+        status = true;
+        goto DoneReplay;
+    }
+    ValidLength = sizeof(Header);
+
+    Scratch = new unsigned __int8[BytesPerBlock];
+    if (Scratch == NULL)
+        goto DoneReplay;
+
+    for (;;) {
+        if (!filer.Read(hFile, Header, sizeof(Header)) || Header[0] != NAND_JOURNAL_BATCH ||
+            Header[1] == 0 || Header[1] > m_NumberBlocks)
+            break;
+
+        for (i = 0; i < Header[1]; ++i) {
+            if (!filer.Read(hFile, Record, sizeof(Record)) || Record[0] >= m_NumberBlocks ||
+                !filer.LZRead(Scratch, BytesPerBlock, hFile) || NANDBlockChecksum(Scratch, BytesPerBlock) != Record[1])
+                break;
+        }
+        if (i != Header[1] || !filer.Read(hFile, &Commit, sizeof(Commit)) || Commit != NAND_JOURNAL_COMMIT)
+            break;
+        BatchEnd = SetFilePointer(hFile, 0, NULL, FILE_CURRENT);
+        if (BatchEnd == INVALID_SET_FILE_POINTER)
+            goto DoneReplay;
+
+        // The batch is complete:  go back and apply it
+        if (SetFilePointer(hFile, ValidLength+sizeof(Header), NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+            goto DoneReplay;
+        for (i = 0; i < Header[1]; ++i) {
+            if (!filer.Read(hFile, Record, sizeof(Record)) ||
+                !filer.LZRead(&m_Flash[Record[0]*BytesPerBlock], BytesPerBlock, hFile))
+                goto DoneReplay;
+        }
+        if (SetFilePointer(hFile, BatchEnd, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+            goto DoneReplay;
+        ValidLength = BatchEnd;
+        BatchCount++;
+    }
+
+    LOG_INFO(GENERAL, "Applied %d saves from %S", BatchCount, JournalFileName);
+    *pJournalLength = ValidLength;
+    status = true;
+
+DoneReplay:
+    if ( hFile!=INVALID_HANDLE_VALUE )
+        CloseHandle(hFile);
+    delete [] Scratch;
+
     return status;
 }
 
@@ -2979,6 +3378,8 @@ bool __fastcall IONANDFlashController::RestoreStateFromFile(StateFiler& filer, _
 {
     bool status = false;
     HANDLE hFile = INVALID_HANDLE_VALUE;
+    unsigned __int32 Generation = 0;
+    unsigned __int32 JournalLength = 0;
 
     // Delete the current backing store as it may the wrong size
     if ( m_Flash )
@@ -2994,8 +3395,8 @@ bool __fastcall IONANDFlashController::RestoreStateFromFile(StateFiler& filer, _
     unsigned __int32 versionAndFlashType= 0;
     if (!filer.Read(hFile,&versionAndFlashType,sizeof(__int32)) ) goto DoneFlashRestore;
 
-    // Version = 0, FlashType = 0
-    if ( versionAndFlashType != 0 ) goto DoneFlashRestore;
+    // Version = 0 or NAND_FILE_VERSION_JOURNALED, FlashType = 0
+    if ( versionAndFlashType != 0 && versionAndFlashType != NAND_FILE_VERSION_JOURNALED ) goto DoneFlashRestore;
 
     if (!filer.Read(hFile,&m_NumberBlocks,sizeof(__int32))) goto DoneFlashRestore;
     // Version = 0, FlashType = 0
@@ -3011,12 +3412,24 @@ bool __fastcall IONANDFlashController::RestoreStateFromFile(StateFiler& filer, _
 
     if ( m_SectorsPerBlock != NAND_BLOCK_SIZE || m_BytesPerSector != NAND_SECTOR_SIZE ) goto DoneFlashRestore;
 
+    if ( versionAndFlashType == NAND_FILE_VERSION_JOURNALED && !filer.Read(hFile,&Generation,sizeof(__int32)) )
+        goto DoneFlashRestore;
+
     // Create the backing store for the flash
     m_Flash = new unsigned __int8[m_NumberBlocks*m_SectorsPerBlock*m_BytesPerSector];
 
     if (m_Flash == NULL || !filer.LZRead(m_Flash, m_NumberBlocks*m_SectorsPerBlock*m_BytesPerSector, hFile)) 
         goto DoneFlashRestore;
 
+    // Bring the image up to date with the saves made since it was written
+    if ( versionAndFlashType == NAND_FILE_VERSION_JOURNALED &&
+         !ReplayJournal(filer, flashFileName, Generation, &JournalLength) )
+        goto DoneFlashRestore;
+
+    memset(m_DirtyBlocks, 0, sizeof(m_DirtyBlocks));
+    m_JournalGeneration = Generation;
+    m_JournalLength = JournalLength;
+    setJournalFileName(flashFileName);
     status = true;
 
 DoneFlashRestore:
@@ -3137,6 +3550,9 @@ void __fastcall IONANDFlashController::SaveState(StateFiler& filer) const
     filer.Write(NFCMD);
     filer.Write(NFADDR);
     filer.Write(BytesRead);
+    filer.Write(BulkSector);
+    filer.Write(BulkBuffer);
+    filer.Write(BulkResult);
     unsigned __int32 IsFlashDataPresent = (m_Flash != NULL);
     filer.Write(IsFlashDataPresent);
     if (IsFlashDataPresent)
@@ -3157,6 +3573,11 @@ void __fastcall IONANDFlashController::RestoreState(StateFiler& filer)
     filer.Read(NFCMD);
     filer.Read(NFADDR);
     filer.Read(BytesRead);
+    if (filer.getVersion() >= MinimumStateFileVersionForNANDBulk) {
+        filer.Read(BulkSector);
+        filer.Read(BulkBuffer);
+        filer.Read(BulkResult);
+    }
     unsigned __int32 IsFlashDataPresent;
     filer.Read(IsFlashDataPresent);
     if (IsFlashDataPresent)
@@ -3175,6 +3596,8 @@ void __fastcall IONANDFlashController::RestoreState(StateFiler& filer)
         if (m_Flash) {
             // Read the flash data 
             filer.LZRead(m_Flash,m_NumberBlocks*m_SectorsPerBlock*m_BytesPerSector);
+            // It need not match the /flash file any more, so save the whole image next time
+            m_JournalLength = 0;
         } else {
             filer.setStatus(false);
         }
@@ -3188,12 +3611,62 @@ void __fastcall IONANDFlashController::WriteWord(unsigned __int32 IOAddress, uns
         NFCONF = Value;
         break;
 
+    case 0x24: // NFBULKSECTOR
+        BulkSector = Value;
+        break;
+
+    case 0x28: // NFBULKBUFFER
+        BulkBuffer = Value;
+        break;
+
+    case 0x2c: // NFBULKCONTROL
+        BulkTransfer(Value);
+        break;
+
     default:
         TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
         break;
     }
 }
 
+// Copies whole sectors between the flash and guest RAM, for the guest's write to
+// NFBULKCONTROL.  A request that is out of range, or whose buffer is not all in
+// guest RAM, moves nothing and reads back as 0.
+void __fastcall IONANDFlashController::BulkTransfer(unsigned __int32 Control)
+{
+    unsigned __int32 SectorCount = Control & NFBULK_COUNT_MASK;
+    unsigned __int32 SectorTotal = m_NumberBlocks*m_SectorsPerBlock;
+
+    BulkResult = 0;
+    if (m_Flash == NULL || SectorCount == 0) {
+        return;
+    }
+    if (BulkSector >= SectorTotal || SectorCount > SectorTotal-BulkSector) {
+        LOG_WARN(GENERAL, "NAND bulk transfer of %d sectors at sector %d is past the end of the flash", SectorCount, BulkSector);
+        return;
+    }
+
+    unsigned __int32 Length = SectorCount*m_BytesPerSector;
+    size_t HostAddress = BoardMapGuestPhysicalToHostRAM(BulkBuffer);
+    if (HostAddress == 0 || BulkBuffer+Length-1 < BulkBuffer ||
+        BoardMapGuestPhysicalToHostRAM(BulkBuffer+Length-1) != HostAddress+Length-1) {
+        LOG_WARN(GENERAL, "NAND bulk transfer buffer 0x%x length 0x%x is not in guest RAM", BulkBuffer, Length);
+        return;
+    }
+    BoardMakeGuestRAMResident(HostAddress, Length);
+
+    unsigned __int8 *pSector = &m_Flash[BulkSector*m_BytesPerSector];
+    if (Control & NFBULK_WRITE) {
+        memcpy(pSector, (void *)HostAddress, Length);
+        MarkSectorsDirty(BulkSector, SectorCount);
+    } else {
+        memcpy((void *)HostAddress, pSector, Length);
+    }
+    BulkResult = SectorCount;
+    NFSTAT |= 1; // report that the command has completed
+    LOG_VVERBOSE(GENERAL, "NAND bulk %s of %d sectors at sector %d", (Control & NFBULK_WRITE) ? "write" : "read", SectorCount, BulkSector);
+}
+
 void __fastcall IONANDFlashController::WriteByte(unsigned __int32 IOAddress, unsigned __int8 Value)
 {
     unsigned int currentCmd   = NFCMD;
@@ -3229,8 +3702,10 @@ void __fastcall IONANDFlashController::WriteByte(unsigned __int32 IOAddress, uns
             // Erase all sectors in the NADDRR block
             unsigned int address = NFADDR >> 8;
             ASSERT ( address < m_NumberBlocks*m_SectorsPerBlock);
-            if ( address < m_NumberBlocks*m_SectorsPerBlock )
+            if ( address < m_NumberBlocks*m_SectorsPerBlock ) {
                 memset( &m_Flash[address* m_BytesPerSector], 0xFF, m_BytesPerSector );
+                MarkSectorsDirty(address, 1);
+            }
             }
             break;
 
@@ -3258,8 +3733,10 @@ void __fastcall IONANDFlashController::WriteByte(unsigned __int32 IOAddress, uns
         {
             // Write one byte to the NADDRR page
             ASSERT ( (NFADDR >> 8) < m_NumberBlocks*m_SectorsPerBlock && BytesRead < m_BytesPerSector);
-            if ((NFADDR >> 8) < m_NumberBlocks*m_SectorsPerBlock && BytesRead < m_BytesPerSector)    
+            if ((NFADDR >> 8) < m_NumberBlocks*m_SectorsPerBlock && BytesRead < m_BytesPerSector) {
                 m_Flash[ ((NFADDR & 0xff)+(NFADDR >> 8))* m_BytesPerSector + BytesRead ] = Value;
+                MarkSectorsDirty((NFADDR & 0xff)+(NFADDR >> 8), 1);
+            }
             BytesRead++;
         }
         else
@@ -3272,6 +3749,11 @@ void __fastcall IONANDFlashController::WriteByte(unsigned __int32 IOAddress, uns
     }
 }
 
+bool __fastcall IONANDFlashController::IsTimeVarying(unsigned __int32 IOAddress)
+{
+    return IOAddress == 0x10; // NFSTAT ready/busy
+}
+
 unsigned __int32 __fastcall IONANDFlashController::ReadWord(unsigned __int32 IOAddress)
 {
     switch (IOAddress) {
@@ -3281,6 +3763,18 @@ unsigned __int32 __fastcall IONANDFlashController::ReadWord(unsigned __int32 IOA
     case 0x10: // NFSTAT
         return NFSTAT;
 
+    case 0x20: // NFBULKID
+        return NFBULK_SIGNATURE;
+
+    case 0x24: // NFBULKSECTOR
+        return BulkSector;
+
+    case 0x28: // NFBULKBUFFER
+        return BulkBuffer;
+
+    case 0x2c: // NFBULKCONTROL
+        return BulkResult;
+
     default:
         TerminateWithMessage(ID_MESSAGE_UNSUPPORTED_HARDWARE);
         return 0;
@@ -3355,6 +3849,18 @@ void IONANDFlashController::setSavedFileName(__in_z const wchar_t * filename)
     free(old_name);
 }
 
+void __fastcall IONANDFlashController::setJournalFileName(__in_z_opt const wchar_t * filename)
+{
+    wchar_t *temp = filename != NULL ? _wcsdup(filename) : NULL;
+
+    if (temp == NULL && filename != NULL) {
+        TerminateWithMessage(ID_MESSAGE_RESOURCE_EXHAUSTED);
+    }
+
+    free(m_JournalFileName);
+    m_JournalFileName = temp;
+}
+
 IOAM29LV800BB::IOAM29LV800BB()
 {
     CMD = 0xF0F0;
@@ -4181,16 +4687,13 @@ bool IOLCDController::onID_FLASH_SAVE(HWND hWnd, UINT uMsg, WPARAM wParam, LPARA
     // Set the name on the flash controller
     NANDFlashController.setSavedFileName(flashFileName);
 
-    // Startup a thread to save the flash
-    HANDLE hThread = INVALID_HANDLE_VALUE;
-    hThread=CreateThread(NULL, 0, IONANDFlashController::NANDFlashSaveStatic, 
-                        &NANDFlashController, 0, NULL);
-    // If we failed to create the thread save the flash on the current thread
-    if (hThread == INVALID_HANDLE_VALUE) {
-        IONANDFlashController::NANDFlashSaveStatic(&NANDFlashController);
+    // Save the flash on a worker thread
+    NANDFlashController.SaveCallback.lpRoutine = IONANDFlashController::NANDFlashSaveStatic;
+    NANDFlashController.SaveCallback.lpParameter = &NANDFlashController;
+    // If we failed to queue the workitem save the flash on the current thread
+    if (!CompletionPort.QueueWorkitem(&NANDFlashController.SaveCallback)) {
+        IONANDFlashController::NANDFlashSaveStatic(&NANDFlashController, 0, NULL);
     }
-    else
-        CloseHandle(hThread);
 
     return true;
 
@@ -4846,8 +5349,10 @@ unsigned __int16 __fastcall IOCS8900IO::ReadHalf(unsigned __int32 IOAddress)
             }
             if (cbRxBuffer == 0) {
                 IO_ISQ=0; // clear the 'packet ready' flags.
-                BeginAsyncReceive();
                 GPIO.ClearInterrupt(9); // EINT9 is reserved for the CS8900
+                // Move the next packet from the receive ring into RxBuffer, if one
+                // has already arrived.
+                VPCNet.IndicateReceivedPackets();
             }
             return Value;
         }
@@ -4987,10 +5492,7 @@ inline bool __fastcall IOCS8900IO::ShouldIndicatePacketToGuest(const EthernetHea
 
 void IOCS8900IO::BeginAsyncReceive(void)
 {
-    // The first __int16 in the RxBuffer is status, and is unused by WinCE
-    RxBuffer.RxStatus=0;
-
-    if (VPCNet.BeginAsyncReceivePacket(RxBuffer.Buffer, sizeof(RxBuffer.Buffer)) == false) {
+    if (VPCNet.BeginAsyncReceive() == false) {
         ASSERT(FALSE);
     }
 }
@@ -4999,33 +5501,44 @@ void __fastcall IOCS8900IO::ReceiveCompletionRoutineStatic(LPVOID lpParameter, D
 {
     IOCS8900IO *pThis = (IOCS8900IO *)lpParameter;
 
-    return pThis->ReceiveCompletionRoutine(dwBytesTransferred);
+    return pThis->ReceivePackets();
 }
 
-void __fastcall IOCS8900IO::ReceiveCompletionRoutine(DWORD dwBytesTransferred)
+// Called by VPCNet whenever packets may be waiting in its receive ring.  The guest
+// reads one packet at a time out of RxBuffer, so the next packet is moved in as
+// soon as the guest has read the previous one, without a round-trip to the host.
+void __fastcall IOCS8900IO::ReceivePackets(void)
 {
-    RxBuffer.FrameLength = (unsigned __int16)dwBytesTransferred;
-
-    // Filter out multicase traffic according to the filter register
-    EthernetHeader & enetDatagram = *reinterpret_cast<EthernetHeader *>(RxBuffer.Buffer);
-    if (enetDatagram.fDestinationAddress.IsMulticast() && !ShouldIndicatePacketToGuest(enetDatagram)) {
-        // This is a broadcast to ourselves - drop it and initiate another receive
-        BeginAsyncReceive();
-    } else {
-        // Prepare to spool the packet into WinCE
-        pCurrentRx=(unsigned __int16*)&RxBuffer;
+    unsigned __int8 *Packet;
+    unsigned __int32 PacketLength;
 
-        // Report the data as available and prepare to return it back
-        EnterCriticalSection(&IOLock);
-        IO_ISQ = 0x0304; // RX_EVENT_HASHED|RX_EVENT_RX_OK|REG_NUM_RX_EVENT
-        if (BUS_CTL.Bits.EnableIRQ) {
-            GPIO.RaiseInterrupt(9); // EINT9 is reserved for the CS8900
+    EnterCriticalSection(&IOLock);
+    while (cbRxBuffer == 0 && VPCNet.GetReceivedPacket(&Packet, &PacketLength)) {
+        // Filter out multicase traffic according to the filter register
+        EthernetHeader & enetDatagram = *reinterpret_cast<EthernetHeader *>(Packet);
+        if (enetDatagram.fDestinationAddress.IsMulticast() && !ShouldIndicatePacketToGuest(enetDatagram)) {
+            // This is a broadcast to ourselves - drop it
+        } else {
+            // The first __int16 in the RxBuffer is status, and is unused by WinCE
+            RxBuffer.RxStatus=0;
+            RxBuffer.FrameLength = (unsigned __int16)PacketLength;
+            memcpy(RxBuffer.Buffer, Packet, PacketLength);
+
+            // Prepare to spool the packet into WinCE
+            pCurrentRx=(unsigned __int16*)&RxBuffer;
+
+            // Report the data as available and prepare to return it back
+            IO_ISQ = 0x0304; // RX_EVENT_HASHED|RX_EVENT_RX_OK|REG_NUM_RX_EVENT
+            if (BUS_CTL.Bits.EnableIRQ) {
+                GPIO.RaiseInterrupt(9); // EINT9 is reserved for the CS8900
+            }
+            else
+                SetEvent(hCS8900PacketArrived);
+            cbRxBuffer = RxBuffer.FrameLength+2*sizeof(__int16);
         }
-        else
-            SetEvent(hCS8900PacketArrived);
-        cbRxBuffer = RxBuffer.FrameLength+2*sizeof(__int16);
-        LeaveCriticalSection(&IOLock);
+        VPCNet.ReleaseReceivedPacket(true);
     }
+    LeaveCriticalSection(&IOLock);
 }
 
 // A network packet is queued up in TxBuffer/cbTxBuffer.  Send it over the network.
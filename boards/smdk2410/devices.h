@@ -18,6 +18,7 @@
 #include "COMInterface.h"
 #include "FolderSharing.h"
 #include "EmulServ.h"
+#include "Benchmark.h"
 
 class IOInterruptController: public MappedIODevice {
 public:
@@ -81,9 +82,17 @@ public:
     } InterruptSubSource;
     void __fastcall RaiseInterrupt(InterruptSubSource Source);
 
+    // Lock-free alternatives to RaiseInterrupt(), for threads other than the CPU
+    // thread.  They may be called without the IOLock.  The interrupt reaches
+    // SRCPND or SUBSRCPND when the CPU thread calls DeliverPostedInterrupts() at
+    // its next interrupt poll.
+    void __fastcall PostInterrupt(InterruptSource Source);
+    void __fastcall PostInterrupt(InterruptSubSource Source);
+    void __fastcall DeliverPostedInterrupts(void);
+
     void __fastcall SetInterruptPending();
     void __fastcall SetSubInterruptPending(bool fMayClearSRCPND);
-    bool __fastcall IsPending(unsigned __int32 mask) { return (INTPND.Word & mask || SRCPND.Word & mask); }
+    bool __fastcall IsPending(unsigned __int32 mask) { return (INTPND.Word & mask || SRCPND.Word & mask || PostedSources & mask); }
 private:
     typedef union {
         unsigned __int32 Word;
@@ -194,6 +203,11 @@ private:
 
     // Sub Interrupt Mask (INTSUBMSK)
     SubInterruptCollection INTSUBMSK;
+
+    // Interrupts posted by PostInterrupt() and not yet delivered.  They are
+    // updated with interlocked operations, not under the IOLock.
+    volatile LONG PostedSources;
+    volatile LONG PostedSubSources;
 };
 
 
@@ -561,6 +575,7 @@ public:
 
     virtual unsigned __int32 __fastcall ReadWord(unsigned __int32 IOAddress);
     virtual void __fastcall WriteWord(unsigned __int32 IOAddress, unsigned __int32 Value);
+    virtual bool __fastcall IsTimeVarying(unsigned __int32 IOAddress);
 
 private:
     union{
@@ -591,6 +606,7 @@ public:
     virtual unsigned __int32 __fastcall ReadWord(unsigned __int32 IOAddress);
     virtual void __fastcall WriteByte(unsigned __int32 IOAddress, unsigned __int8 Value);
     virtual void __fastcall WriteWord(unsigned __int32 IOAddress, unsigned __int32 Value);
+    virtual bool __fastcall IsTimeVarying(unsigned __int32 IOAddress);
 
     void ChangeDTR(unsigned __int32 DTRValue);
     bool GetDSR(void);
@@ -710,7 +726,8 @@ protected:
 
     unsigned __int16 UBRDIV;
 
-    HANDLE hCom;
+    class UARTBackend *pBackend;    // NULL if the port is not connected to the host
+    HANDLE hCom;                    // the backend's Win32 COM port, if it has one
 
     static const DWORD CommMask = EV_BREAK|EV_CTS|EV_ERR|EV_DSR;
 
@@ -719,20 +736,40 @@ protected:
     IOInterruptController::InterruptSubSource RxInterruptSubSource;
     IOInterruptController::InterruptSubSource ErrInterruptSubSource;
 
-    #define UART_QUEUE_LENGTH 8192
+    // The backend reads straight into the free space after RxQueueHead, so a receive
+    // can take as much as the guest has room for.  No read is outstanding while the
+    // queue is full; draining it through URXH starts the next one.
+    #define UART_QUEUE_LENGTH 65536
     unsigned __int8 RxQueue[UART_QUEUE_LENGTH];
     int RxQueueHead;
     int RxQueueTail;
     int RxFIFOCount;
-
-    OVERLAPPED OverlappedRead;
-    OVERLAPPED OverlappedWrite;
+    bool fReadInFlight;
+
+    // Bytes written to UTXH collect here while a host write is outstanding, and go
+    // out together in the next write.  The guest sees a full Tx FIFO once fewer than
+    // a FIFO's worth of bytes are free.
+    #define UART_TX_QUEUE_LENGTH 8192
+    #define UART_TX_FIFO_DEPTH 16
+    unsigned __int8 TxQueue[UART_TX_QUEUE_LENGTH];
+    unsigned __int32 TxQueueHead;
+    unsigned __int32 TxQueueTail;
+    unsigned __int32 TxQueueCount;
+    unsigned __int32 TxWriteLength; // bytes in the outstanding write, or 0
+
+    // Reads and writes use the OVERLAPPED chosen by the low bit of BackendGeneration,
+    // so late completions from a backend that has since been closed are ignored.
+    OVERLAPPED OverlappedRead[2];
+    OVERLAPPED OverlappedWrite[2];
     OVERLAPPED OverlappedCommEvent;
+    unsigned __int32 BackendGeneration;
     COMPLETIONPORT_CALLBACK Callback;
     static void CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
     void CompletionRoutine(DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
-    char ReceiveBuffer[UART_QUEUE_LENGTH];
+    void CloseBackend(void);
     void BeginAsyncRead(void);
+    void BeginAsyncWrite(void);
+    void UpdateTxStatus(void);
     void BeginAsyncWaitCommEvent(void);
     DWORD dwEvtMask;
     bool fShouldWaitForNextCommEvent;
@@ -765,6 +802,7 @@ public:
 
     virtual unsigned __int32 __fastcall ReadWord(unsigned __int32 IOAddress);
     virtual void __fastcall WriteWord(unsigned __int32 IOAddress, unsigned __int32 Value);
+    virtual bool __fastcall IsTimeVarying(unsigned __int32 IOAddress);
     unsigned __int32 GetLevelInterruptsPending(void);
 
 private:
@@ -1088,6 +1126,26 @@ private:
 #define NAND_BLOCK_SIZE 32        // Sectors per block
 #define NAND_BLOCK_COUNT 4*1024   // Block in the chip
 
+// Paravirtual bulk transfer registers, placed past the S3C2410's NFECC.  A driver
+// that reads NFBULK_SIGNATURE from NFBULKID (0x20) sets NFBULKSECTOR (0x24) and
+// NFBULKBUFFER (0x28, a guest physical address), then writes a sector count to
+// NFBULKCONTROL (0x2c) to copy whole NAND_SECTOR_SIZE sectors, sector info
+// included, in one access instead of one NFDATA access per byte.  Reading
+// NFBULKCONTROL returns the number of sectors the last request moved.
+#define NFBULK_SIGNATURE  'NBLK'
+#define NFBULK_COUNT_MASK 0xffff
+#define NFBULK_WRITE      0x80000000 // copy from guest RAM to the flash
+#define MinimumStateFileVersionForNANDBulk 15
+
+// Saving the flash to a /flash file writes the whole image once, then appends only
+// the erase blocks changed since the previous save to name.journal.  The image is
+// rewritten, and the journal started over, once the journal outgrows a quarter of
+// the flash.  See IONANDFlashController::SaveStateToFile.
+#define NAND_FILE_VERSION_JOURNALED  1 // the image header carries a journal generation
+#define NAND_JOURNAL_SIGNATURE       'NJNL'
+#define NAND_JOURNAL_BATCH           'NJBT'
+#define NAND_JOURNAL_COMMIT          'NJCM'
+
 // This emulates the SMDK2410 NAND flash controller  See smdk2410\nand\fmd\fmd.c.
 class IONANDFlashController: public MappedIODevice {
 public:
@@ -1097,7 +1155,7 @@ public:
     virtual bool __fastcall PowerOn();
     virtual void __fastcall SaveState(StateFiler& filer) const;
     virtual void __fastcall RestoreState(StateFiler& filer);
-    virtual bool __fastcall SaveStateToFile(StateFiler& filer, __in_z const wchar_t * flashFileName) const;
+    virtual bool __fastcall SaveStateToFile(StateFiler& filer, __in_z const wchar_t * flashFileName);
     virtual bool __fastcall RestoreStateFromFile(StateFiler& filer, __in_z const wchar_t * flashFileName);
     virtual bool __fastcall IONANDFlashController::InitializeFlashFromResource();
 
@@ -1105,12 +1163,15 @@ public:
     virtual void __fastcall WriteByte(unsigned __int32 IOAddress, unsigned __int8 Value);
     virtual unsigned __int32 __fastcall ReadWord(unsigned __int32 IOAddress);
     virtual unsigned __int8 __fastcall ReadByte(unsigned __int32 IOAddress);
+    virtual bool __fastcall IsTimeVarying(unsigned __int32 IOAddress);
 
     void setSavedFileName(__in_z const wchar_t * filename);
     inline LONG incrementSavedStateLock() {return InterlockedIncrement((LONG*)&m_SaveCount);}
     inline LONG decrementSavedStateLock() {return InterlockedDecrement((LONG*)&m_SaveCount);}
 
-    static DWORD WINAPI NANDFlashSaveStatic(LPVOID lpvThreadParam);
+    // Saves to m_SavedFileName.  Queued as a CompletionPort workitem by onID_FLASH_SAVE.
+    static void __fastcall NANDFlashSaveStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
+    COMPLETIONPORT_CALLBACK SaveCallback;
 
 private:
     unsigned __int32 NFCONF;
@@ -1126,6 +1187,29 @@ private:
     unsigned int m_SaveCount;
 
     unsigned int BytesRead;
+
+    unsigned __int32 BulkSector;    // NFBULKSECTOR
+    unsigned __int32 BulkBuffer;    // NFBULKBUFFER
+    unsigned __int32 BulkResult;    // NFBULKCONTROL, as read back
+
+    void __fastcall BulkTransfer(unsigned __int32 Control);
+
+    // Incremental saves to a /flash file
+    unsigned __int32 m_DirtyBlocks[(NAND_BLOCK_COUNT+31)/32]; // erase blocks changed since the last save, protected by IOLock
+    wchar_t * m_JournalFileName;        // the flash file whose journal is current, or NULL
+    unsigned __int32 m_JournalGeneration; // matches the image the journal applies to
+    unsigned __int32 m_JournalLength;   // bytes of complete batches, or 0 to rewrite the image on the next save
+
+    inline void MarkSectorsDirty(unsigned __int32 Sector, unsigned __int32 SectorCount)
+    {
+        for (unsigned __int32 Block = Sector/m_SectorsPerBlock; Block <= (Sector+SectorCount-1)/m_SectorsPerBlock; ++Block) {
+            m_DirtyBlocks[Block/32] |= 1 << (Block%32);
+        }
+    }
+    bool __fastcall WriteFlashImage(StateFiler& filer, __in_z const wchar_t * flashFileName);
+    bool __fastcall AppendJournal(StateFiler& filer, __in_z const wchar_t * flashFileName);
+    bool __fastcall ReplayJournal(StateFiler& filer, __in_z const wchar_t * flashFileName, unsigned __int32 Generation, unsigned __int32 *pJournalLength);
+    void __fastcall setJournalFileName(__in_z_opt const wchar_t * filename);
 };
 
 // This emulates the AMD AM29LV800BB flash controller used by eboot's am29lv800.c
@@ -1617,7 +1701,7 @@ private:
     void __fastcall TransmitPacket(void);
     inline bool __fastcall ShouldIndicatePacketToGuest(const EthernetHeader & inEthernetHeader);
     static void __fastcall ReceiveCompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
-    void __fastcall ReceiveCompletionRoutine(DWORD dwBytesTransferred);
+    void __fastcall ReceivePackets(void);
     static void __fastcall TransmitCompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
     void BeginAsyncReceive(void);
 
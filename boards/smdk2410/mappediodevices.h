@@ -32,13 +32,14 @@ MAPPEDIODEVICE(IODMAController1,DMAController1,       0x4b000040, 0x3f) // DMA1
 MAPPEDIODEVICE(IODMAController2,DMAController2,       0x4b000080, 0x3f) // DMA2 is used by audio for output
 MAPPEDIODEVICE(IOClockAndPower,	ClockAndPower,		  0x4c000000, 0x18)
 MAPPEDIODEVICE(IOLCDController, LCDController,        0x4d000000, 0x60)
-MAPPEDIODEVICE(IONANDFlashController, NANDFlashController, 0x4e000000, 0x14)
+MAPPEDIODEVICE(IONANDFlashController, NANDFlashController, 0x4e000000, 0x30) // includes the NFBULK* registers
 MAPPEDIODEVICE(IOUART0,			UART0,				  0x50000000, 0x2c) 
 MAPPEDIODEVICE(IOUART1,			UART1,				  0x50004000, 0x2c) 
 MAPPEDIODEVICE(IOUART2,			UART2,				  0x50008000, 0x2c) 
 MAPPEDIODEVICE(IODMATransport,  DMATransport,         0x500f0000, 0x211c) // the UARTs have 1mb of space reserved (0x50000000-0x50100000) so grab a chunk near the top of the reserve
-MAPPEDIODEVICE(IOFolderSharing, FolderSharing,        0x500f4000, 0x0c)
+MAPPEDIODEVICE(IOFolderSharing, FolderSharing,        0x500f4000, 0x10)
 MAPPEDIODEVICE(IOEmulServ,      EmulServ,             0x500f5000, 0x08)
+MAPPEDIODEVICE(IOBenchmark,     Benchmark,            0x500f6000, 0x10) // only used by the /benchmark program
 MAPPEDIODEVICE(IOPWMTimer,      PWMTimer,             0x51000000, 0x40)
 #ifdef DEBUG
 MAPPEDIODEVICE(IOUSBDevice,     USBDevice,            0x52000140, 0x12c) // USB device register
@@ -40,10 +40,12 @@ void StateFiler::Restore(EmulatorConfig * PrivateConfiguration)
 #include "resource.h"
 #include "Board.h"
 #include "MappedIO.h"
+#include "GuestMemory.h"
+#include "CompletionPort.h"
 #include "..\..\features\zlib\ZLib.h"
 
 static const __int32 StateSig='SSED'; // Device Emulator Saved State
-static const __int32 StateVersion=12;  // Increase this every time the state file changes incompatibly
+static const __int32 StateVersion=15;  // Increase this every time the state file changes incompatibly
 static const __int32 MinimumSupportedStateVersion=11;  // Increase this when we stop supporting older format
 
 void StateFiler::SaveVersion()
@@ -149,6 +151,12 @@ bool StateFiler::LZRead(unsigned __int8* data,size_t length, HANDLE fileHandle)
 	if (!status)
 		return false;
 	
+	if (memsig=='BMEM') {
+		if (clen!=length)
+			return false;
+		return BlockLZRead(data, length, fileHandle);
+	}
+
 	if (memsig!='ZMEM' && memsig!='UMEM')
 		return false;
 
@@ -186,6 +194,234 @@ bool StateFiler::LZRead(unsigned __int8* data,size_t length, HANDLE fileHandle)
 	return Read(fileHandle, data, length);
 }
 
+// Blocks compressed per ParallelFor() call by BlockLZWrite
+#define BLOCKLZ_BATCH_BLOCKS	((size_t)64)
+
+struct BlockLZBatch
+{
+	unsigned __int8* data;
+	size_t length;
+	size_t first;						// index of the batch's first block
+	unsigned __int8* compressed;		// BLOCKLZ_BATCH_BLOCKS*GUEST_MEMORY_BLOCK_SIZE bytes
+	unsigned long clen[BLOCKLZ_BATCH_BLOCKS];	// 0 if the block is stored as-is
+};
+
+static void __fastcall BlockLZCompressStatic(LPVOID lpParameter, unsigned __int32 Index)
+{
+	BlockLZBatch *batch=(BlockLZBatch *)lpParameter;
+	size_t i=batch->first+Index;
+	unsigned long blocklen=static_cast<unsigned long>(min(batch->length-i*GUEST_MEMORY_BLOCK_SIZE, GUEST_MEMORY_BLOCK_SIZE));
+	unsigned long clen=blocklen-1; // anything that doesn't shrink is stored as-is
+
+	int r=compress2(batch->compressed+Index*GUEST_MEMORY_BLOCK_SIZE,&clen,batch->data+i*GUEST_MEMORY_BLOCK_SIZE,blocklen,1);
+	batch->clen[Index]=(r==Z_OK) ? clen : 0;
+}
+
+// The 'BMEM' format stores the data as a sequence of GUEST_MEMORY_BLOCK_SIZE blocks, each
+// compressed independently so that any one block can be restored without the others:
+//     'BMEM', unsigned long length, unsigned long block size,
+//     unsigned __int32 offsets[BlockCount+1], block data...
+// A block whose compressed size equals the block size is stored uncompressed.
+bool StateFiler::BlockLZWrite(unsigned __int8* data,size_t length, HANDLE fileHandle)
+{
+	// Allow override of the succeeded flag if the function is called for a different file
+	if (!succeeded && fileHandle == hFile)
+		return false;
+
+	size_t BlockCount = (length+GUEST_MEMORY_BLOCK_SIZE-1)/GUEST_MEMORY_BLOCK_SIZE;
+	arrayowner offsets((BlockCount+1)*sizeof(unsigned __int32));
+	arrayowner compressed(BLOCKLZ_BATCH_BLOCKS*GUEST_MEMORY_BLOCK_SIZE);
+	if (offsets==0 || compressed==0)
+		return false;
+	unsigned __int32 *BlockOffsets = reinterpret_cast<unsigned __int32*>((unsigned __int8*)offsets);
+
+	__int32 memsig='BMEM';
+	unsigned long datalen=static_cast<unsigned long>(length);
+	unsigned long blocksize=GUEST_MEMORY_BLOCK_SIZE;
+	if (!Write(fileHandle, &memsig, sizeof(memsig)) ||
+		!Write(fileHandle, &datalen, sizeof(datalen)) ||
+		!Write(fileHandle, &blocksize, sizeof(blocksize)))
+		return false;
+
+	// Reserve space for the offset table, then come back and fill it in once the
+	// compressed block sizes are known.
+	DWORD tablepos=SetFilePointer(fileHandle,0,NULL,FILE_CURRENT);
+	if (tablepos==INVALID_SET_FILE_POINTER)
+		return false;
+	memset(BlockOffsets, 0, (BlockCount+1)*sizeof(unsigned __int32));
+	if (!Write(fileHandle, BlockOffsets, (BlockCount+1)*sizeof(unsigned __int32)))
+		return false;
+
+	// Blocks are compressed a batch at a time across the worker pool, then written
+	// out in order by this thread.
+	BlockLZBatch batch;
+	batch.data=data;
+	batch.length=length;
+	batch.compressed=compressed;
+
+	unsigned __int32 offset=0;
+	for (size_t first=0; first<BlockCount; first+=BLOCKLZ_BATCH_BLOCKS) {
+		unsigned __int32 count=static_cast<unsigned __int32>(min(BlockCount-first, BLOCKLZ_BATCH_BLOCKS));
+
+		batch.first=first;
+		CompletionPort.ParallelFor(count, BlockLZCompressStatic, &batch);
+
+		for (unsigned __int32 j=0; j<count; ++j) {
+			size_t i=first+j;
+			unsigned __int8* p=batch.compressed+j*GUEST_MEMORY_BLOCK_SIZE;
+			unsigned long clen=batch.clen[j];
+
+			if (clen==0) {
+				// The block doesn't compress:  store it as-is
+				p=data+i*GUEST_MEMORY_BLOCK_SIZE;
+				clen=static_cast<unsigned long>(min(length-i*GUEST_MEMORY_BLOCK_SIZE, GUEST_MEMORY_BLOCK_SIZE));
+			}
+			BlockOffsets[i]=offset;
+			if (!Write(fileHandle, p, clen))
+				return false;
+			offset+=clen;
+		}
+	}
+	BlockOffsets[BlockCount]=offset;
+
+	if (SetFilePointer(fileHandle,tablepos,NULL,FILE_BEGIN)==INVALID_SET_FILE_POINTER ||
+		!Write(fileHandle, BlockOffsets, (BlockCount+1)*sizeof(unsigned __int32)) ||
+		SetFilePointer(fileHandle,0,NULL,FILE_END)==INVALID_SET_FILE_POINTER)
+		return false;
+
+	return true;
+}
+
+// Reads the remainder of a 'BMEM' record, following its signature and length.
+bool StateFiler::BlockLZRead(unsigned __int8* data,size_t length, HANDLE fileHandle)
+{
+	unsigned long blocksize = 0;
+	if (!Read(fileHandle, &blocksize, sizeof(blocksize)) || blocksize!=GUEST_MEMORY_BLOCK_SIZE)
+		return false;
+
+	size_t BlockCount = (length+GUEST_MEMORY_BLOCK_SIZE-1)/GUEST_MEMORY_BLOCK_SIZE;
+	arrayowner offsets((BlockCount+1)*sizeof(unsigned __int32));
+	arrayowner compressed(GUEST_MEMORY_BLOCK_SIZE);
+	if (offsets==0 || compressed==0)
+		return false;
+	unsigned __int32 *BlockOffsets = reinterpret_cast<unsigned __int32*>((unsigned __int8*)offsets);
+	if (!Read(fileHandle, BlockOffsets, (BlockCount+1)*sizeof(unsigned __int32)))
+		return false;
+
+	for (size_t i=0; i<BlockCount; ++i) {
+		unsigned __int8* block=data+i*GUEST_MEMORY_BLOCK_SIZE;
+		unsigned long blocklen=static_cast<unsigned long>(min(length-i*GUEST_MEMORY_BLOCK_SIZE, GUEST_MEMORY_BLOCK_SIZE));
+		unsigned long clen=BlockOffsets[i+1]-BlockOffsets[i];
+
+		if (BlockOffsets[i+1]<BlockOffsets[i] || clen>blocklen)
+			return false;
+		if (clen==blocklen) {
+			if (!Read(fileHandle, block, clen))
+				return false;
+		} else {
+			unsigned long datalen=blocklen;
+			if (!Read(fileHandle, compressed, clen))
+				return false;
+			int r=uncompress(block,&datalen,compressed,clen);
+			if (r!=Z_OK || datalen!=blocklen)
+				return false;
+		}
+	}
+	return true;
+}
+
+void StateFiler::LZReadLazy(GuestMemoryRegion& Region)
+{
+	if (!succeeded)
+		return;
+
+	__int32 memsig = 0;
+	unsigned long clen = 0;
+	DWORD filepos=SetFilePointer(hFile,0,NULL,FILE_CURRENT);
+	if (filepos==INVALID_SET_FILE_POINTER) {
+		succeeded = false;
+		return;
+	}
+
+	// Lazy restore is only possible when every block can be located without
+	// decompressing the ones before it.
+	if (Configuration.LazyRestore &&
+		Read(hFile, &memsig, sizeof(memsig)) && Read(hFile, &clen, sizeof(clen)) &&
+		clen==Region.getSize() && (memsig=='UMEM' || memsig=='BMEM')) {
+
+		if (pMappedFile == NULL)
+			pMappedFile = MappedStateFile::Open(hFile);
+
+		if (pMappedFile) {
+			size_t BlockCount = (Region.getSize()+GUEST_MEMORY_BLOCK_SIZE-1)/GUEST_MEMORY_BLOCK_SIZE;
+			unsigned __int32 *BlockOffsets = NULL;
+			unsigned long blocksize = 0;
+			size_t datalen = clen;
+
+			if (memsig=='BMEM') {
+				BlockOffsets = new unsigned __int32[BlockCount+1];
+				if (BlockOffsets == NULL ||
+					!Read(hFile, &blocksize, sizeof(blocksize)) || blocksize!=GUEST_MEMORY_BLOCK_SIZE ||
+					!Read(hFile, BlockOffsets, (BlockCount+1)*sizeof(unsigned __int32))) {
+					delete [] BlockOffsets;
+					succeeded = false;
+					return;
+				}
+				datalen = BlockOffsets[BlockCount];
+			}
+
+			DWORD datapos=SetFilePointer(hFile,0,NULL,FILE_CURRENT);
+			if (datapos!=INVALID_SET_FILE_POINTER &&
+				Region.BeginLazyPopulate(pMappedFile, pMappedFile->getView()+datapos, BlockOffsets)) {
+				// Skip over the data:  it will be read on demand
+				if (SetFilePointer(hFile,static_cast<LONG>(datalen),NULL,FILE_CURRENT)==INVALID_SET_FILE_POINTER)
+					succeeded = false;
+				return;
+			}
+			delete [] BlockOffsets;
+		}
+	}
+
+	// Fall back to restoring the whole region now
+	if (SetFilePointer(hFile,filepos,NULL,FILE_BEGIN)==INVALID_SET_FILE_POINTER) {
+		succeeded = false;
+		return;
+	}
+	LZRead(Region.getBase(), Region.getSize());
+}
+
+void StateFiler::LZSkip(void)
+{
+	__int32 memsig = 0;
+	unsigned long clen = 0;
+
+	Read(memsig);
+	Read(clen);
+	if (!succeeded)
+		return;
+
+	if (memsig=='BMEM') {
+		// clen is the uncompressed length; the data length is at the end of the offset table
+		unsigned long blocksize = 0;
+		unsigned __int32 datalen = 0;
+		size_t BlockCount = (clen+GUEST_MEMORY_BLOCK_SIZE-1)/GUEST_MEMORY_BLOCK_SIZE;
+
+		Read(blocksize);
+		if (!succeeded || blocksize!=GUEST_MEMORY_BLOCK_SIZE ||
+			SetFilePointer(hFile,static_cast<LONG>(BlockCount*sizeof(unsigned __int32)),NULL,FILE_CURRENT)==INVALID_SET_FILE_POINTER) {
+			succeeded = false;
+			return;
+		}
+		Read(datalen);
+		clen = datalen;
+	} else if (memsig!='ZMEM' && memsig!='UMEM') {
+		succeeded = false;
+		return;
+	}
+	if (succeeded && SetFilePointer(hFile,static_cast<LONG>(clen),NULL,FILE_CURRENT)==INVALID_SET_FILE_POINTER)
+		succeeded = false;
+}
+
 bool StateFiler::LZRead(unsigned __int8* data,size_t length, unsigned __int8 * input)
 {
 	// Do a sanity check on the arguments
@@ -226,6 +462,8 @@ void StateFiler::Save()
     if (!Configuration.isSaveStateEnabled())
         return;
 
+    TraceScope Trace("SaveState", TraceState, 0);
+
     // Make a name for the temporary file by adding ".tmp" on the end
     SavedStateFileName = Configuration.getSaveStateFileName();
     wchar_t TempFileName[MAX_PATH];
@@ -271,6 +509,8 @@ void StateFiler::Restore(EmulatorConfig * PrivateConfiguration)
         return;
     }
 
+    TraceScope Trace("RestoreState", TraceState, 0);
+
 	hFile = CreateFile(Configuration.getSaveStateFileName(),GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
 	if (hFile==INVALID_HANDLE_VALUE) {
 		ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN, Configuration.getSaveStateFileName());
@@ -300,6 +540,11 @@ void StateFiler::Restore(EmulatorConfig * PrivateConfiguration)
 	}
 
 Exit:
+	if (pMappedFile) {
+		// Regions that are still being lazily populated hold their own references
+		pMappedFile->Release();
+		pMappedFile = NULL;
+	}
 	CloseHandle(hFile);
 	if (delete_saved_state) {
 		DeleteFileW(Configuration.getSaveStateFileName());
@@ -16,6 +16,7 @@
 #include "resource.h"
 #include "CompletionPort.h"
 #include "VPCNet.h"
+#include "NetBackend.h"
 #include <winioctl.h>
 #include <iphlpapi.h>
 #include <setupapi.h>
@@ -473,7 +474,7 @@ Exit:
     return result;
 }
 
-wchar_t * VPCNetDriver::NetworkAdapterOracle(__in CHAR * AdaptersBuffer, ULONG Size, unsigned __int8 * HostMACAddress)
+wchar_t * VPCNetBackend::NetworkAdapterOracle(__in CHAR * AdaptersBuffer, ULONG Size, unsigned __int8 * HostMACAddress)
 {
     // If there is not enough data to read the count return NULL
     if (Size < sizeof(ULONG))
@@ -683,15 +684,13 @@ wchar_t * VPCNetDriver::NetworkAdapterOracle(__in CHAR * AdaptersBuffer, ULONG S
 
 
 #pragma prefast(suppress:262, "We know that this function does not exceed stack threshold")
-bool __fastcall VPCNetDriver::PowerOn(
-                                      USHORT* GuestMACAddress, 
-                                      const wchar_t* DeviceName, 
-                                      unsigned __int8 * HostMACAddress,
-                                      COMPLETIONPORT_CALLBACK *pCallersTransmitCallback,
-                                      COMPLETIONPORT_CALLBACK *pCallersReceiveCallback)
+bool __fastcall VPCNetBackend::Open(
+                                    USHORT* GuestMACAddress, 
+                                    const wchar_t* DeviceName, 
+                                    unsigned __int8 * HostMACAddress,
+                                    COMPLETIONPORT_CALLBACK *pCallback)
 {
     HANDLE hControl;
-    HANDLE hAdapter;
     ULONG BytesReturned;
     ULONG Features;
     wchar_t *AdapterName;
@@ -703,14 +702,6 @@ bool __fastcall VPCNetDriver::PowerOn(
     bool UseSuggestedAddress;
     HRESULT hr;
 
-    FirstPacketSent = false;
-
-    ASSERT(PACKET_TYPE_DIRECTED == NDIS_PACKET_TYPE_DIRECTED);
-    ASSERT(PACKET_TYPE_MULTICAST == NDIS_PACKET_TYPE_MULTICAST);
-    ASSERT(PACKET_TYPE_ALL_MULTICAST == NDIS_PACKET_TYPE_ALL_MULTICAST);
-    ASSERT(PACKET_TYPE_BROADCAST == NDIS_PACKET_TYPE_BROADCAST);
-    ASSERT(PACKET_TYPE_PROMISCUOUS == NDIS_PACKET_TYPE_PROMISCUOUS);
-
     hControl = CreateFile(NETSV_DRIVER_NAME, 
                           GENERIC_READ | GENERIC_WRITE, 
                           0, NULL, 
@@ -865,24 +856,7 @@ RetryRegisterGuest:
             UseSuggestedAddress = true;
             guestInfo.fFlags = kVPCNetSvRegisterGuestFlag_AddressIsSuggested;
             // Generated a our own address
-            HCRYPTPROV   hCryptProv = NULL;
-            // Acquire a cryptographic provider context handle.
-            if(::CryptAcquireContext( &hCryptProv, NULL, NULL, PROV_RSA_FULL, 0))
-            {
-                *((int *)guestInfo.fMACAddress) = 0xFFFF0300; // initialize the first 3 bytes of the MAC
-                // Fill in the last three bytes with random data
-                if (::CryptGenRandom( hCryptProv, 3, &(guestInfo.fMACAddress[ 3 ]) ) )
-                    manuallyGenMAC = true;
-            }
-            else
-            {
-                DWORD error = GetLastError();
-                LOG_ERROR(NETWORK, "Failed to acquire crypto context while generating MAC - %x", error);
-                ASSERT(false && "Failed to obtain a cryptographic provider");
-            }
-
-            if(hCryptProv)
-                CryptReleaseContext(hCryptProv, 0);
+            manuallyGenMAC = GenerateGuestMACAddress(guestInfo.fMACAddress);
             if(manuallyGenMAC)
             {
                 LOG_WARN(NETWORK, "Manually generated a MAC address: %x-%x-%x-%x-%x-%x",
@@ -911,34 +885,24 @@ RetryRegisterGuest:
         return false;
     }
 
-    Callback.lpRoutine = (COMPLETIONPORT_ROUTINE)CompletionRoutineStatic;
-    Callback.lpParameter = this;
-    if (!CompletionPort.AssociateHandleWithCompletionPort(hVirtualAdapter, &Callback)) {
+    if (!CompletionPort.AssociateHandleWithCompletionPort(hVirtualAdapter, pCallback)) {
         LOG_ERROR(NETWORK, "Failed to associate the VPCNET handle with the IO completion port");
         CloseHandle(hVirtualAdapter);
         CloseHandle(hAdapter);
         CloseHandle(hControl);
         return false;
     }
-    pTransmitCallback = pCallersTransmitCallback;
-    pReceiveCallback = pCallersReceiveCallback;
-
-    LOG_INFO(NETWORK, "Successfully powered on the NIC");
     CloseHandle(hControl);
     return true;
 }
 
-bool __fastcall VPCNetDriver::PowerOff(void)
+void __fastcall VPCNetBackend::Close(void)
 {
-    LOG_VERBOSE(NETWORK, "Powering off the NIC");
     CloseHandle(hVirtualAdapter);
     CloseHandle(hAdapter);
-    return true;
 }
 
-// This transmits a network packet asynchronously.  Call WaitForTransmissionToComplete() to block
-// until the transmission completes.
-bool __fastcall VPCNetDriver::BeginAsyncTransmitPacket(unsigned __int32 PacketLength, unsigned __int8* PacketData)
+bool __fastcall VPCNetBackend::BeginSend(unsigned __int8* PacketData, unsigned __int32 PacketLength, LPOVERLAPPED lpOverlapped)
 {
     BOOL                                        writeCompleted;
     DWORD                                        ignore;
@@ -946,7 +910,7 @@ bool __fastcall VPCNetDriver::BeginAsyncTransmitPacket(unsigned __int32 PacketLe
     if ( !Configuration.getHostOnlyRouting() )
     {
         LOG_VVERBOSE(NETWORK, "Transmitting packet length %d", PacketLength);
-        writeCompleted = WriteFile(hVirtualAdapter, PacketData, PacketLength, NULL, &OverlappedTransmission);
+        writeCompleted = WriteFile(hVirtualAdapter, PacketData, PacketLength, NULL, lpOverlapped);
     }
     else
     {
@@ -963,7 +927,7 @@ bool __fastcall VPCNetDriver::BeginAsyncTransmitPacket(unsigned __int32 PacketLe
                                         PacketData,
                                         PacketLength,
                                         &ignore,
-                                        &OverlappedTransmission);
+                                        lpOverlapped);
     }
 
     if ( !writeCompleted )
@@ -974,48 +938,22 @@ bool __fastcall VPCNetDriver::BeginAsyncTransmitPacket(unsigned __int32 PacketLe
             return false;
         }
     }
-
-    if ( !FirstPacketSent )
-    {
-        FirstPacketSent = true;
-        CodeMarker(perfEmulatorBootEnd);
-    }
-
     return true;
 }
 
-bool __fastcall VPCNetDriver::BeginAsyncReceivePacket(unsigned __int8* PacketData, unsigned __int16 PacketSize)
+bool __fastcall VPCNetBackend::BeginReceive(unsigned __int8* Buffer, unsigned __int32 BufferLength, LPOVERLAPPED lpOverlapped)
 {
-    ASSERT(InterlockedIncrement(&AsyncReceivesOutstanding) == 1);
-
-    if (ReadFile(hVirtualAdapter, PacketData, PacketSize, NULL, &OverlappedReceipt) == FALSE) {
+    if (ReadFile(hVirtualAdapter, Buffer, BufferLength, NULL, lpOverlapped) == FALSE) {
         DWORD ErrorCode =  GetLastError();
         if (ErrorCode != ERROR_IO_PENDING) {
             LOG_ERROR(NETWORK, "ReadFile failed while recv %d", ErrorCode);
-            ASSERT(InterlockedDecrement(&AsyncReceivesOutstanding) == 0);
             return false;
         }
     }
-
     return true;
 }
 
-void VPCNetDriver::CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
-{
-    VPCNetDriver *pThis = (VPCNetDriver*)lpParameter;
-
-    if (lpOverlapped == &pThis->OverlappedTransmission) {
-        pThis->pTransmitCallback->lpRoutine(pThis->pTransmitCallback->lpParameter, dwBytesTransferred, lpOverlapped);
-    } else if (lpOverlapped == &pThis->OverlappedReceipt) {
-        ASSERT(InterlockedDecrement(&pThis->AsyncReceivesOutstanding) == 0);
-
-        pThis->pReceiveCallback->lpRoutine(pThis->pReceiveCallback->lpParameter, dwBytesTransferred, lpOverlapped);
-    } else {
-        ASSERT(FALSE);
-    }
-}
-
-bool __fastcall VPCNetDriver::ConfigurePacketFilter(int FilterValue)
+bool __fastcall VPCNetBackend::ConfigurePacketFilter(int FilterValue)
 {
     DWORD BytesReturned;
     UCHAR oidBuf[PACKET_OID_DATA_HEADER_LENGTH + sizeof(ULONG)];
@@ -1038,3 +976,344 @@ bool __fastcall VPCNetDriver::ConfigurePacketFilter(int FilterValue)
     }
     return true;
 }
+
+// Generates a guest MAC address in the 00-03-FF range used by Virtual PC, with
+// the last three bytes random.
+bool __fastcall GenerateGuestMACAddress(unsigned __int8 *MACAddress)
+{
+    HCRYPTPROV   hCryptProv = NULL;
+    bool Generated = false;
+
+    // Acquire a cryptographic provider context handle.
+    if(::CryptAcquireContext( &hCryptProv, NULL, NULL, PROV_RSA_FULL, 0))
+    {
+        *((int *)MACAddress) = 0xFFFF0300; // initialize the first 3 bytes of the MAC
+        // Fill in the last three bytes with random data
+        if (::CryptGenRandom( hCryptProv, 3, &MACAddress[ 3 ] ) )
+            Generated = true;
+    }
+    else
+    {
+        DWORD error = GetLastError();
+        LOG_ERROR(NETWORK, "Failed to acquire crypto context while generating MAC - %x", error);
+        ASSERT(false && "Failed to obtain a cryptographic provider");
+    }
+
+    if(hCryptProv)
+        CryptReleaseContext(hCryptProv, 0);
+    return Generated;
+}
+
+bool __fastcall ChooseGuestMACAddress(USHORT* GuestMACAddress, const wchar_t* DeviceName)
+{
+    if (GuestMACAddress[0] != 0 || GuestMACAddress[1] != 0 || GuestMACAddress[2] != 0) {
+        // Restored from saved state
+        return true;
+    }
+    if (GetCachedMACAddress(GuestMACAddress, DeviceName)) {
+        return true;
+    }
+    if (!GenerateGuestMACAddress((unsigned __int8 *)GuestMACAddress)) {
+        return false;
+    }
+    LOG_INFO(NETWORK, "Generated a MAC address: %x-%x-%x-%x-%x-%x",
+                       ((LPBYTE)GuestMACAddress)[0], ((LPBYTE)GuestMACAddress)[1], 
+                       ((LPBYTE)GuestMACAddress)[2], ((LPBYTE)GuestMACAddress)[3], 
+                       ((LPBYTE)GuestMACAddress)[4], ((LPBYTE)GuestMACAddress)[5]);
+    SetCachedMACAddress(GuestMACAddress, DeviceName);
+    return true;
+}
+
+NetBackend * __fastcall CreateNetBackend(void)
+{
+    switch (Configuration.NetBackend) {
+    case NetBackendTap:
+        return new TapNetBackend;
+    case NetBackendSwitch:
+        return new SwitchNetBackend;
+    default:
+        return new VPCNetBackend;
+    }
+}
+
+bool __fastcall VPCNetDriver::PowerOn(
+                                      USHORT* GuestMACAddress, 
+                                      const wchar_t* DeviceName, 
+                                      unsigned __int8 * HostMACAddress,
+                                      COMPLETIONPORT_CALLBACK *pCallersTransmitCallback,
+                                      COMPLETIONPORT_CALLBACK *pCallersReceiveCallback)
+{
+    FirstPacketSent = false;
+    memset(ReceiveRing, 0, sizeof(ReceiveRing));
+    memset(TransmitRing, 0, sizeof(TransmitRing));
+    ReceiveHead = ReceiveTail = ReceivesBusy = 0;
+    TransmitNext = TransmitsBusy = 0;
+    DeferredTransmitData = NULL;
+    ReceiveIndications = 0;
+    memset(&Statistics, 0, sizeof(Statistics));
+    StatisticsSampleTime = GetTickCount();
+    SamplePacketsReceived = SampleBytesReceived = 0;
+    SamplePacketsTransmitted = SampleBytesTransmitted = 0;
+
+    ASSERT(PACKET_TYPE_DIRECTED == NDIS_PACKET_TYPE_DIRECTED);
+    ASSERT(PACKET_TYPE_MULTICAST == NDIS_PACKET_TYPE_MULTICAST);
+    ASSERT(PACKET_TYPE_ALL_MULTICAST == NDIS_PACKET_TYPE_ALL_MULTICAST);
+    ASSERT(PACKET_TYPE_BROADCAST == NDIS_PACKET_TYPE_BROADCAST);
+    ASSERT(PACKET_TYPE_PROMISCUOUS == NDIS_PACKET_TYPE_PROMISCUOUS);
+
+    pBackend = CreateNetBackend();
+    if (pBackend == NULL) {
+        return false;
+    }
+
+    Callback.lpRoutine = (COMPLETIONPORT_ROUTINE)CompletionRoutineStatic;
+    Callback.lpParameter = this;
+    if (!pBackend->Open(GuestMACAddress, DeviceName, HostMACAddress, &Callback)) {
+        delete pBackend;
+        pBackend = NULL;
+        return false;
+    }
+    pTransmitCallback = pCallersTransmitCallback;
+    pReceiveCallback = pCallersReceiveCallback;
+
+    LOG_INFO(NETWORK, "Successfully powered on the NIC");
+    return true;
+}
+
+bool __fastcall VPCNetDriver::PowerOff(void)
+{
+    LOG_VERBOSE(NETWORK, "Powering off the NIC");
+    if (pBackend) {
+        pBackend->Close();
+        delete pBackend;
+        pBackend = NULL;
+    }
+    return true;
+}
+
+// Copies a packet into an idle transmit entry and sends it to the host.  Must
+// be called with RingLock held and an entry idle.  Transmits may complete out of
+// order, so the idle entry is searched for rather than assumed to be next.
+bool __fastcall VPCNetDriver::IssueTransmit(unsigned __int32 PacketLength, const unsigned __int8* PacketData)
+{
+    unsigned __int32 Index = TransmitNext;
+
+    ASSERT(TransmitsBusy < VPCNET_TRANSMIT_RING_SIZE);
+    while (TransmitRing[Index].Busy) {
+        Index = (Index+1) % VPCNET_TRANSMIT_RING_SIZE;
+    }
+
+    PacketBuffer *pBuffer = &TransmitRing[Index];
+
+    memcpy(pBuffer->Data, PacketData, PacketLength);
+    pBuffer->PacketLength = PacketLength;
+    memset(&pBuffer->Overlapped, 0, sizeof(pBuffer->Overlapped));
+    pBuffer->Busy = true;
+    TransmitsBusy++;
+
+    if (!pBackend->BeginSend(pBuffer->Data, pBuffer->PacketLength, &pBuffer->Overlapped)) {
+        pBuffer->Busy = false;
+        TransmitsBusy--;
+        return false;
+    }
+
+    TransmitNext = (Index+1) % VPCNET_TRANSMIT_RING_SIZE;
+    Statistics.PacketsTransmitted++;
+    Statistics.BytesTransmitted += pBuffer->PacketLength;
+    return true;
+}
+
+// This transmits a network packet asynchronously.  The transmit callback is
+// called once the packet no longer needs PacketData.
+bool __fastcall VPCNetDriver::BeginAsyncTransmitPacket(unsigned __int32 PacketLength, unsigned __int8* PacketData)
+{
+    if (PacketLength > VPCNET_PACKET_BUFFER_SIZE) {
+        // Larger than any ethernet frame:  the host driver would reject it anyway
+        LOG_WARN(NETWORK, "Dropping oversized packet of length %d", PacketLength);
+        return CompletionPort.QueueWorkitem(pTransmitCallback);
+    }
+
+    EnterCriticalSection(&RingLock);
+    if (TransmitsBusy == VPCNET_TRANSMIT_RING_SIZE) {
+        // Every entry is in flight.  Hold on to the caller's buffer and send it
+        // when the first one completes.
+        ASSERT(DeferredTransmitData == NULL);
+        DeferredTransmitData = PacketData;
+        DeferredTransmitLength = PacketLength;
+        LeaveCriticalSection(&RingLock);
+        return true;
+    }
+
+    // Packets are handed to the host under RingLock, so in the order the guest
+    // sent them, whichever entries hold them.
+    bool result = IssueTransmit(PacketLength, PacketData);
+    LeaveCriticalSection(&RingLock);
+
+    if (!result) {
+        return false;
+    }
+
+    if ( !FirstPacketSent )
+    {
+        FirstPacketSent = true;
+        CodeMarker(perfEmulatorBootEnd);
+    }
+
+    // The guest's buffer is free again
+    return CompletionPort.QueueWorkitem(pTransmitCallback);
+}
+
+// Posts every idle receive entry to the host.  Must be called with RingLock held.
+bool __fastcall VPCNetDriver::PostReceives(void)
+{
+    // Entries are posted in ring order, starting after the most recently posted
+    // one, so the host fills them in the same order that the device drains them.
+    while (ReceivesBusy < VPCNET_RECEIVE_RING_SIZE) {
+        PacketBuffer *pBuffer = &ReceiveRing[ReceiveTail];
+
+        ASSERT(!pBuffer->Busy);
+        memset(&pBuffer->Overlapped, 0, sizeof(pBuffer->Overlapped));
+        pBuffer->Busy = true;
+        pBuffer->Complete = false;
+
+        if (!pBackend->BeginReceive(pBuffer->Data, sizeof(pBuffer->Data), &pBuffer->Overlapped)) {
+            pBuffer->Busy = false;
+            return false;
+        }
+        ReceiveTail = (ReceiveTail+1) % VPCNET_RECEIVE_RING_SIZE;
+        ReceivesBusy++;
+    }
+    return true;
+}
+
+bool __fastcall VPCNetDriver::BeginAsyncReceive(void)
+{
+    EnterCriticalSection(&RingLock);
+    bool result = PostReceives();
+    LeaveCriticalSection(&RingLock);
+    return result;
+}
+
+bool __fastcall VPCNetDriver::GetReceivedPacket(unsigned __int8** ppPacketData, unsigned __int32* pPacketLength)
+{
+    bool result = false;
+
+    EnterCriticalSection(&RingLock);
+    if (ReceivesBusy && ReceiveRing[ReceiveHead].Complete) {
+        *ppPacketData = ReceiveRing[ReceiveHead].Data;
+        *pPacketLength = ReceiveRing[ReceiveHead].PacketLength;
+        result = true;
+    }
+    LeaveCriticalSection(&RingLock);
+    return result;
+}
+
+void __fastcall VPCNetDriver::ReleaseReceivedPacket(bool Repost)
+{
+    EnterCriticalSection(&RingLock);
+    ASSERT(ReceivesBusy && ReceiveRing[ReceiveHead].Complete);
+    ReceiveRing[ReceiveHead].Busy = false;
+    ReceiveRing[ReceiveHead].Complete = false;
+    ReceiveHead = (ReceiveHead+1) % VPCNET_RECEIVE_RING_SIZE;
+    ReceivesBusy--;
+    if (Repost) {
+        PostReceives();
+    }
+    LeaveCriticalSection(&RingLock);
+}
+
+// Runs the receive callback so the device can drain the ring.  Only one thread runs
+// it at a time:  a thread that finds another one already draining just asks it to
+// make one more pass, and returns.
+void __fastcall VPCNetDriver::IndicateReceivedPackets(void)
+{
+    if (pReceiveCallback == NULL) {
+        // Not powered on
+        return;
+    }
+    if (InterlockedIncrement(&ReceiveIndications) != 1) {
+        return;
+    }
+    do {
+        pReceiveCallback->lpRoutine(pReceiveCallback->lpParameter, 0, NULL);
+    } while (InterlockedDecrement(&ReceiveIndications) != 0);
+}
+
+// Recomputes the per-second rates.  Must be called with RingLock held.
+void __fastcall VPCNetDriver::UpdateStatistics(void)
+{
+    DWORD Now = GetTickCount();
+    DWORD Elapsed = Now - StatisticsSampleTime;
+
+    if (Elapsed < 1000) {
+        return;
+    }
+    Statistics.ReceivePacketsPerSecond = (unsigned __int32)((Statistics.PacketsReceived - SamplePacketsReceived)*1000/Elapsed);
+    Statistics.ReceiveBytesPerSecond = (unsigned __int32)((Statistics.BytesReceived - SampleBytesReceived)*1000/Elapsed);
+    Statistics.TransmitPacketsPerSecond = (unsigned __int32)((Statistics.PacketsTransmitted - SamplePacketsTransmitted)*1000/Elapsed);
+    Statistics.TransmitBytesPerSecond = (unsigned __int32)((Statistics.BytesTransmitted - SampleBytesTransmitted)*1000/Elapsed);
+    SamplePacketsReceived = Statistics.PacketsReceived;
+    SampleBytesReceived = Statistics.BytesReceived;
+    SamplePacketsTransmitted = Statistics.PacketsTransmitted;
+    SampleBytesTransmitted = Statistics.BytesTransmitted;
+    StatisticsSampleTime = Now;
+
+    LOG_VERBOSE(NETWORK, "rx %d packets/s %d bytes/s, tx %d packets/s %d bytes/s",
+                Statistics.ReceivePacketsPerSecond, Statistics.ReceiveBytesPerSecond,
+                Statistics.TransmitPacketsPerSecond, Statistics.TransmitBytesPerSecond);
+}
+
+void __fastcall VPCNetDriver::GetStatistics(VPCNetStatistics* pStatistics)
+{
+    EnterCriticalSection(&RingLock);
+    UpdateStatistics();
+    *pStatistics = Statistics;
+    LeaveCriticalSection(&RingLock);
+}
+
+void VPCNetDriver::CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped)
+{
+    VPCNetDriver *pThis = (VPCNetDriver*)lpParameter;
+    PacketBuffer *pBuffer = CONTAINING_RECORD(lpOverlapped, PacketBuffer, Overlapped);
+
+    if (pBuffer >= pThis->TransmitRing && pBuffer < &pThis->TransmitRing[VPCNET_TRANSMIT_RING_SIZE]) {
+        bool DeferredSent = false;
+
+        EnterCriticalSection(&pThis->RingLock);
+        ASSERT(pBuffer->Busy);
+        pBuffer->Busy = false;
+        pThis->TransmitsBusy--;
+        if (pThis->DeferredTransmitData) {
+            pThis->IssueTransmit(pThis->DeferredTransmitLength, pThis->DeferredTransmitData);
+            pThis->DeferredTransmitData = NULL;
+            DeferredSent = true;
+        }
+        pThis->UpdateStatistics();
+        LeaveCriticalSection(&pThis->RingLock);
+
+        if (DeferredSent) {
+            pThis->pTransmitCallback->lpRoutine(pThis->pTransmitCallback->lpParameter, 0, NULL);
+        }
+    } else if (pBuffer >= pThis->ReceiveRing && pBuffer < &pThis->ReceiveRing[VPCNET_RECEIVE_RING_SIZE]) {
+        EnterCriticalSection(&pThis->RingLock);
+        ASSERT(pBuffer->Busy && !pBuffer->Complete);
+        pBuffer->PacketLength = dwBytesTransferred;
+        pBuffer->Complete = true;
+        pThis->Statistics.PacketsReceived++;
+        pThis->Statistics.BytesReceived += dwBytesTransferred;
+        pThis->UpdateStatistics();
+        LeaveCriticalSection(&pThis->RingLock);
+
+        pThis->IndicateReceivedPackets();
+    } else {
+        ASSERT(FALSE);
+    }
+}
+
+bool __fastcall VPCNetDriver::ConfigurePacketFilter(int FilterValue)
+{
+    if (pBackend == NULL) {
+        return false;
+    }
+    return pBackend->ConfigurePacketFilter(FilterValue);
+}
@@ -88,16 +88,52 @@ struct EthernetHeader
 
 #define kCRC32_Poly    0xEDB88320
 
+// Number of receives kept posted to the host driver, and of transmits that may be
+// in flight at once.  Each ring entry holds one ethernet frame.
+#define VPCNET_RECEIVE_RING_SIZE    16
+#define VPCNET_TRANSMIT_RING_SIZE   8
+#define VPCNET_PACKET_BUFFER_SIZE   2048
+
+struct VPCNetStatistics {
+    unsigned __int64 PacketsReceived;
+    unsigned __int64 BytesReceived;
+    unsigned __int64 PacketsTransmitted;
+    unsigned __int64 BytesTransmitted;
+    // Rates over the most recent sampling interval (about one second)
+    unsigned __int32 ReceivePacketsPerSecond;
+    unsigned __int32 ReceiveBytesPerSecond;
+    unsigned __int32 TransmitPacketsPerSecond;
+    unsigned __int32 TransmitBytesPerSecond;
+};
+
 class VPCNetDriver {
 public:
+    VPCNetDriver() { pBackend = NULL; pReceiveCallback = NULL; InitializeCriticalSection(&RingLock); }
+
     bool __fastcall PowerOn(USHORT* GuestMACAddress, 
                             const wchar_t* DeviceName, 
                             unsigned __int8 * HostMACAddress,
                             COMPLETIONPORT_CALLBACK *pCallersTransmitCallback,
                             COMPLETIONPORT_CALLBACK *pCallersReceiveCallback);
     bool __fastcall PowerOff(void);
+
+    // The packet is copied, and the transmit callback is queued as soon as it is on
+    // its way to the host, so the guest can hand over the next packet while earlier
+    // ones are still in flight.  Once VPCNET_TRANSMIT_RING_SIZE packets are in flight,
+    // the callback is deferred until one of them completes and PacketData must stay
+    // valid until then.
     bool __fastcall BeginAsyncTransmitPacket(unsigned __int32 PacketLength, unsigned __int8* PacketData);
-    bool __fastcall BeginAsyncReceivePacket(unsigned __int8* PacketData, unsigned __int16 PacketSize);
+
+    // Receives are posted to the host in a ring.  The receive callback is called, on
+    // one thread at a time, whenever packets may be available; the device then drains
+    // them in arrival order with GetReceivedPacket()/ReleaseReceivedPacket().
+    // Repost=false leaves the entry idle until the next BeginAsyncReceive().
+    bool __fastcall BeginAsyncReceive(void);
+    bool __fastcall GetReceivedPacket(unsigned __int8** ppPacketData, unsigned __int32* pPacketLength);
+    void __fastcall ReleaseReceivedPacket(bool Repost);
+    void __fastcall IndicateReceivedPackets(void);
+
+    void __fastcall GetStatistics(VPCNetStatistics* pStatistics);
 
     static const int PACKET_TYPE_DIRECTED        =0x00000001;
     static const int PACKET_TYPE_MULTICAST        =0x00000002;
@@ -108,20 +144,44 @@ public:
     bool __fastcall ConfigurePacketFilter(int FilterValue);
 
 private:
-    HANDLE hAdapter;
-    HANDLE hVirtualAdapter;
-    OVERLAPPED OverlappedTransmission;
-    OVERLAPPED OverlappedReceipt;
+    class NetBackend *pBackend;     // moves packets to and from the host
     bool FirstPacketSent;
     COMPLETIONPORT_CALLBACK Callback;
 
-    wchar_t * NetworkAdapterOracle(__in CHAR * AdaptersBuffer, ULONG Size, unsigned __int8 * HostMACAddress);
     static void CompletionRoutineStatic(LPVOID lpParameter, DWORD dwBytesTransferred, LPOVERLAPPED lpOverlapped);
+    bool __fastcall IssueTransmit(unsigned __int32 PacketLength, const unsigned __int8* PacketData);
+    bool __fastcall PostReceives(void);
+    void __fastcall UpdateStatistics(void);
     COMPLETIONPORT_CALLBACK *pReceiveCallback;
     COMPLETIONPORT_CALLBACK *pTransmitCallback;
-#ifdef DEBUG
-    LONG AsyncReceivesOutstanding;
-#endif
+
+    struct PacketBuffer {
+        OVERLAPPED Overlapped;
+        unsigned __int32 PacketLength;
+        bool Busy;      // posted to the host, or holding a received packet
+        bool Complete;  // receive only:  holds a packet not yet released by the device
+        unsigned __int8 Data[VPCNET_PACKET_BUFFER_SIZE];
+    };
+
+    CRITICAL_SECTION RingLock;  // protects everything below
+    PacketBuffer ReceiveRing[VPCNET_RECEIVE_RING_SIZE];
+    unsigned __int32 ReceiveHead;   // oldest busy entry
+    unsigned __int32 ReceiveTail;   // next entry to post
+    unsigned __int32 ReceivesBusy;
+    PacketBuffer TransmitRing[VPCNET_TRANSMIT_RING_SIZE];
+    unsigned __int32 TransmitNext;  // where the search for an idle entry starts
+    unsigned __int32 TransmitsBusy;
+    unsigned __int8* DeferredTransmitData;     // waiting for a free transmit entry
+    unsigned __int32 DeferredTransmitLength;
+
+    LONG ReceiveIndications;    // >0 while a thread is running pReceiveCallback
+
+    VPCNetStatistics Statistics;
+    DWORD StatisticsSampleTime;
+    unsigned __int64 SamplePacketsReceived;
+    unsigned __int64 SampleBytesReceived;
+    unsigned __int64 SamplePacketsTransmitted;
+    unsigned __int64 SampleBytesTransmitted;
 };
 
 #define BUFFER_SIZE_AS_NIC 50
@@ -60,6 +60,9 @@ CRITICAL_SECTION InterruptLock; // See UpdateInterruptOnPoll() for documentation
 
 HANDLE g_hDebuggerEvent; // Debugger interface support
 bool g_fOptimizeCode = true;
+bool g_fPredicateConditionals = true; // generate lone conditional ALU instructions with CMOV instead of a branch
+unsigned __int32 JitConditionalCount;  // conditional instructions translated
+unsigned __int32 JitPredicatedCount;   // ... of which were generated without a branch
 
 static const __int32 Feature_LoadStoreDouble=1;
 static const __int32 Feature_DSP=2;
@@ -1180,6 +1183,7 @@ PVOID CpuRaiseIRQException(unsigned __int32 InstructionPointer)
     PSR_FULL OldPSR;
 
     LogPrint((output,"Raising IRQ Exception\n"));
+    TraceInstant("DeliverIRQ", TraceInterrupt, InstructionPointer);
 
     ASSERT(Cpu.CPSR.Bits.IRQDisable == 0);
 
@@ -3474,6 +3478,31 @@ unsigned __int8* PlaceIdleLoop(unsigned __int8* CodeLocation, Decoded *d)
     return PlaceBranch(CodeLocation, d);
 }
 
+// Milliseconds a polling loop waits for an interrupt before it polls again.  The
+// PWM timer raises the host timer resolution to 1ms, and its ticks arrive as
+// interrupts, so this only bounds how late a loop sees state that changes
+// without one, such as memory written by a host thread.
+#define IDLE_POLL_TIMEOUT 1
+
+// Called at the bottom of each pass through a polling loop.  The loop head
+// clears BoardTimeVaryingRead, so it is set only if this pass read a register
+// that changes without an interrupt, such as a timer count or a ready/busy
+// status.  Such a loop is waiting for a delay far shorter than
+// IDLE_POLL_TIMEOUT, so it keeps running at full speed.  Any other loop waits
+// for an interrupt before it polls again.
+void PollingLoopHelper(void)
+{
+    if (!BoardTimeVaryingRead) {
+        WaitForSingleObject(hIdleEvent, IDLE_POLL_TIMEOUT);
+    }
+}
+
+unsigned __int8* PlacePollingLoop(unsigned __int8* CodeLocation, Decoded *d)
+{
+    Emit_CALL(PollingLoopHelper);            // CALL PollingLoopHelper
+    return PlaceBranch(CodeLocation, d);
+}
+
 unsigned __int8* __fastcall PlaceIllegalCoproc(unsigned __int8* CodeLocation, Decoded *d)
 {
     Emit_MOV_Reg_Imm32(ECX_Reg, d->GuestAddress);            // MOV ECX, GuestAddress
@@ -4838,7 +4867,255 @@ void DisplayRegisterBanner(unsigned __int32 CodeLocation, unsigned __int32 Instr
 #endif // LOGGING_ENABLED
 }
 
+// The instruction classes of DecodeARMInstruction(), as selected by bits 27-20
+// and 7-4 of the opcode.  Everything else about the class, including checks
+// that depend on the processor features, is decoded by the case for it.
+enum ArmDecodeClass {
+    ArmDecodeDataProcessing,
+    ArmDecodeMRSorMSR,
+    ArmDecodeBx,
+    ArmDecodeQADD,
+    ArmDecodeBKPT,
+    ArmDecodeDSPMul,
+    ArmDecodeMultiply,
+    ArmDecodeLoadStoreExtension,
+    ArmDecodeDoubleLoadStoreExtension,
+    ArmDecodeMSRImmediate,
+    ArmDecodeSingleDataTransfer,
+    ArmDecodeBlockDataTransfer,
+    ArmDecodeBranch,
+    ArmDecodeCoprocessorExtension,
+    ArmDecodeCoprocDataTransfer,
+    ArmDecodeSoftwareInterrupt,
+    ArmDecodeCoprocDataOperation,
+    ArmDecodeCoprocRegisterTransfer,
+    ArmDecodeUndefined
+};
+
+#define ARM_DECODE_INDEX(Word) ((((Word) >> 16) & 0xff0) | (((Word) >> 4) & 0xf))
+
+// Classifies an ARM_DECODE_INDEX() value.  The tests are those of the OPCODE
+// structures, written against the raw bits so that they can run at compile time.
+static constexpr unsigned __int8 ArmDecodeClassOf(unsigned __int32 Index)
+{
+    const unsigned __int32 High = Index >> 4;       // bits 27-20
+    const unsigned __int32 Low = Index & 0xf;       // bits 7-4
+    const unsigned __int32 Op1 = (High >> 1) & 3;   // bits 22-21
+
+    switch (High >> 5) {                            // bits 27-25
+    case 0: // DataProcessing or Multiply or SingleDataSwap or Bx or BKPT
+        if ((High >> 3) == 2 && (High & 1) == 0 && ((Low & 1) == 0 || (Low & 9) == 1)) {
+            // ControlExtension
+            switch (Low) {
+            case 0:
+                return ArmDecodeMRSorMSR;
+            case 1:
+                return (Op1 == 1) ? ArmDecodeBx : ArmDecodeUndefined;
+            case 5:
+                return ArmDecodeQADD;
+            case 7:
+                return (Op1 == 1) ? ArmDecodeBKPT : ArmDecodeUndefined;
+            case 8:
+            case 0xa:
+            case 0xc:
+            case 0xe:
+                return ArmDecodeDSPMul;
+            default:
+                return ArmDecodeUndefined;
+            }
+        } else if ((High >> 4) == 0 && Low == 9) {
+            return ArmDecodeMultiply;
+        } else if ((Low & 9) == 9 && !((High & 0x10) == 0 && (Low & 6) == 0)) {
+            // LoadStoreExtension, excluding its post-indexed SWP encodings
+            if ((High & 1) == 0 && (Low & 0xc) == 0xc) {
+                return ArmDecodeDoubleLoadStoreExtension;
+            }
+            return ArmDecodeLoadStoreExtension;
+        }
+        return ArmDecodeDataProcessing;
+
+    case 1: // DataProcessing or MSR (immediate form)
+        if ((High >> 3) == 6 && (High & 1) == 0) {
+            return (Op1 & 1) ? ArmDecodeMSRImmediate : ArmDecodeUndefined;
+        }
+        return ArmDecodeDataProcessing;
+
+    case 2: // SingleDataTransfer
+        return ArmDecodeSingleDataTransfer;
+
+    case 3: // SingleDataTransfer or Undefined
+        return (Low & 1) ? ArmDecodeUndefined : ArmDecodeSingleDataTransfer;
+
+    case 4:
+        return ArmDecodeBlockDataTransfer;
+
+    case 5:
+        return ArmDecodeBranch;
+
+    case 6: // CoprocessorExtension or CoprocDataTransfer
+        if ((High >> 3) == 24 && (High & 2) == 0) {
+            return ArmDecodeCoprocessorExtension;
+        }
+        return ArmDecodeCoprocDataTransfer;
+
+    default: // CoprocDataOperation or CoprocRegisterTransfer or SoftwareInterrupt
+        if ((High >> 4) == 15) {
+            return ArmDecodeSoftwareInterrupt;
+        }
+        return (Low & 1) ? ArmDecodeCoprocRegisterTransfer : ArmDecodeCoprocDataOperation;
+    }
+}
+
+// ArmDecodeClass for every ARM_DECODE_INDEX() value, built by the compiler
+struct ArmDecodeTableType {
+    unsigned __int8 Class[4096];
+
+    constexpr ArmDecodeTableType() : Class() {
+        for (unsigned __int32 i=0; i<ARRAY_SIZE(Class); ++i) {
+            Class[i] = ArmDecodeClassOf(i);
+        }
+    }
+};
+
+static constexpr ArmDecodeTableType ArmDecodeTable;
+
+// Spot checks against hand-decoded opcodes
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe0821001)] == ArmDecodeDataProcessing);  // add r1, r2, r1
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe12fff1e)] == ArmDecodeBx);              // bx lr
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe0010392)] == ArmDecodeMultiply);        // mul r1, r2, r3
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe1020091)] == ArmDecodeLoadStoreExtension); // swp r0, r1, [r2]
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe1c020d8)] == ArmDecodeDoubleLoadStoreExtension); // ldrd r2, [r0, #8]
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe321f013)] == ArmDecodeMSRImmediate);    // msr cpsr_c, #0x13
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xe7f000f0)] == ArmDecodeUndefined);
+C_ASSERT(ArmDecodeTable.Class[ARM_DECODE_INDEX(0xee012f10)] == ArmDecodeCoprocRegisterTransfer); // mcr p15, 0, r2, c1, c0, 0
+
+// Fills in a DataProcessing instruction.  Shared by the ARM and Thumb decoders.
+static __forceinline void DecodeDataProcessingFields(Decoded *d, unsigned __int32 DPOpcode, unsigned __int32 S,
+                                                     unsigned __int32 I, unsigned __int32 Rn, unsigned __int32 Rd,
+                                                     unsigned __int32 Operand2)
+{
+    d->fp = PlaceDataProcessing;
+    d->Operand2 = Operand2;
+    d->S = S;
+    d->Opcode = DPOpcode;
+    d->I = I;
+    if (d->I) {
+        d->Reserved3 = _rotr((unsigned __int8)d->Operand2, (d->Operand2 >> 8) << 1);
+    }
+    switch (d->Opcode) {
+        case 0: // 0000 = AND - Rd = Rn AND Immediate
+        case 1: // 0001 = EOR - Rd = Rn EOR Immediate
+        case 2: // 0010 = SUB - Rd = Rn - Immediate
+        case 3: // 0011 = RSB - Rd = Immediate - Rn
+        case 4: // 0100 = ADD - Rd = Rn + Immediate
+        case 5: // 0101 = ADC - Rd = Rn + Immediate + C
+        case 6: // 0110 = SBC - Rd = Rn - Immediate + C - 1
+        case 7: // 0111 = RSC - Rd = Immediate - Rn + C - 1
+        case 12: // 1100 = ORR - Rd = Rn OR Immediate
+        case 14: // 1110 = BIC = Rd = Rn AND NOT Immediate
+            d->Rn = Rn;
+            d->Rd = Rd;
+            if (d->Rd == R15) {
+                d->R15Modified=true;
+            }
+            break;
+
+        case 8: // 1000 = TST - set condition codes on Rn AND Immediate
+        case 9: // 1001 = TEQ - set condition codes on Rn EOR Immediate
+        case 10: // 1010 = CMP - set condition codes on Rn - Immediate
+        case 11: // 1011 = CMN - set condition codes on Rn + Immediate
+            d->Rn = Rn;
+            d->Rd = 0; // The UPDATE_FLAGS_ARITHMETIC_SUB macro consumes Rd.  We just have to
+                        // ensure that it is not R15 here.
+            break;
+
+        case 13: // 1101 = MOV = Rd = Immediate
+        case 15: // 1111 = MVN = Rd = NOT Immediate
+            d->Rd = Rd;
+            if (d->Rd == R15) {
+                d->R15Modified=true;
+            }
+            d->Rm = d->Operand2 & 0xf;
+            break;
+
+        default:
+            ASSERT(FALSE);
+            break;
+    }
+}
+
+// Fills in a SingleDataTransfer instruction.  Shared by the ARM and Thumb
+// decoders.  Returns false if the instruction is undefined.
+static __forceinline bool DecodeSingleDataTransferFields(Decoded *d, unsigned __int32 I, unsigned __int32 P,
+                                                         unsigned __int32 U, unsigned __int32 B, unsigned __int32 W,
+                                                         unsigned __int32 L, unsigned __int32 Rn, unsigned __int32 Rd,
+                                                         __int32 Offset)
+{
+    d->Offset = Offset;
+    d->I = I;
+    d->Rn = Rn;
+    d->W = W;
+    d->P = P;
+    d->U = U;
+    d->fp = PlaceSingleDataTransfer;
+    d->Rd = Rd;
+    d->L = L;
+    d->B = B;
+    d->Operand2 = Offset & 0xfff;
+    if(d->P==0){
+        // Post-index always writes back.  The assembler convention is to
+        // leave W set to 0 in the opcode.  To simplify logic below,
+        // set W when post-indexing is enabled.
+        d->W=1;
+    }
+    if (d->W && d->Rn == R15){
+        // ARM ARM 5.5.4: Specifying Rn==R15 has UNPREDICTABLE results with writeback enabled
+        return false;
+    }
+    if (d->Rd == R15 && d->L) { // load into R15
+        d->R15Modified=true;
+    }
+    if (d->Rn == R15 && d->I == 0) {
+        // Pre-compute R15+/-Offset and cache it in Reserved3.
+        if (d->U) {
+            d->Reserved3 = d->GuestAddress + d->Offset + ((Cpu.CPSR.Bits.ThumbMode) ? 4 : 8);
+        } else {
+            d->Reserved3 = d->GuestAddress - d->Offset + ((Cpu.CPSR.Bits.ThumbMode) ? 4 : 8);
+        }
+    }
+    if (d->I && (d->Offset & 0xf) == R15) {  // Rm cannot be R15
+        return false;
+    }
+    return true;
+}
+
+// Fills in a BlockDataTransfer instruction.  Shared by the ARM and Thumb
+// decoders.  Returns false if the instruction is undefined.
+static __forceinline bool DecodeBlockDataTransferFields(Decoded *d, unsigned __int32 P, unsigned __int32 U,
+                                                        unsigned __int32 S, unsigned __int32 W, unsigned __int32 L,
+                                                        unsigned __int32 Rn, unsigned __int32 RegisterList)
+{
+    d->Rn = Rn;
+    if(d->Rn == R15){
+        // ARM ARM 5.5.4: Specifying Rn==R15 has UNPREDICTABLE results with writeback enabled
+        return false;
+    }
+    d->fp = PlaceBlockDataTransfer;
+    d->RegisterList = (unsigned __int16)RegisterList;
+    d->L = L;
+    d->W = W;
+    d->S = S;
+    d->U = U;
+    d->P = P;
+    if ((d->RegisterList & (1 << R15)) && d->L) { // LDM including R15
+        d->R15Modified = true;
+    }
+    return true;
+}
+
 bool DecodeARMInstruction(Decoded *d, OPCODE Opcode){
+    unsigned __int32 Class;
+
     d->R15Modified=0; // assume the instruction doesn't modify R15
     d->Cond = Opcode.Generic.Cond;
 
@@ -4857,407 +5134,293 @@ bool DecodeARMInstruction(Decoded *d, OPCODE Opcode){
         }
     }
 
-
-    // Instruction is to be executed.  Decode it and copy fields into the Decoded struct
+    // Instruction is to be executed.  Decode it and copy fields into the Decoded struct.
+    // Bits 27-25 alone identify the most common classes, so those do not wait on
+    // the table load.
     switch (Opcode.Generic.InstructionClass) {
-    case 0:  // 000 - DataProcessing or Multiply or SingleDataSwap or Bx or BKPT
-        if (Opcode.ControlExtension.Reserved3 == 2 && Opcode.ControlExtension.Reserved2 == 0 &&
-            ((Opcode.ControlExtension.Operand2 & 0x10) == 0 || (Opcode.ControlExtension.Operand2 & 0x90) == 0x10)) {
-            // ControlExtension
-            switch ((Opcode.ControlExtension.Operand2 >> 4) & 0xf) {
-            case 0: // "MSR register" or MRS
-                d->fp = PlaceMRSorMSR;
-                d->S = 1; // PlaceMRSorMSR might call CPSR, thereby Setting the flags.
-                d->Rd = Opcode.ControlExtension.Rd;
-                d->Rn = Opcode.ControlExtension.Rn; // this is the mask to use, not an actual Rn register number
-                d->Rm = Opcode.ControlExtension.Operand2 & 0xf;
-                d->Op1 = Opcode.ControlExtension.Op1;
-                if (d->Op1 == 0 && d->Rd == R15) {  // MRS R15, ...
-                    d->R15Modified = true;
-                }
-                return true;
+    case 2:  // 010 - SingleDataTransfer
+        Class = ArmDecodeSingleDataTransfer;
+        break;
+    case 4:  // 100 - BlockDataTransfer
+        Class = ArmDecodeBlockDataTransfer;
+        break;
+    case 5:  // 101 - Branch
+        Class = ArmDecodeBranch;
+        break;
+    default:
+        Class = ArmDecodeTable.Class[ARM_DECODE_INDEX(Opcode.Word)];
+        break;
+    }
 
-            case 1:
-                switch (Opcode.ControlExtension.Op1) {
-                case 1:    // BX
-                    d->fp = PlaceBx;
-                    d->Rd = Opcode.BranchExchange.Rd;
-                    d->R15Modified = true;
-                    return true;
-
-                case 3: // CLX
-                    goto RaiseException;
+    switch (Class) {
+    case ArmDecodeDataProcessing:
+        DecodeDataProcessingFields(d, Opcode.DataProcessing.Opcode, Opcode.DataProcessing.S, Opcode.DataProcessing.I,
+                                   Opcode.DataProcessing.Rn, Opcode.DataProcessing.Rd, Opcode.DataProcessing.Operand2);
+        return true;
 
-                default:
-                    goto RaiseException;
-                }
-                break;
+    case ArmDecodeMRSorMSR: // "MSR register" or MRS
+        d->fp = PlaceMRSorMSR;
+        d->S = 1; // PlaceMRSorMSR might call CPSR, thereby Setting the flags.
+        d->Rd = Opcode.ControlExtension.Rd;
+        d->Rn = Opcode.ControlExtension.Rn; // this is the mask to use, not an actual Rn register number
+        d->Rm = Opcode.ControlExtension.Operand2 & 0xf;
+        d->Op1 = Opcode.ControlExtension.Op1;
+        if (d->Op1 == 0 && d->Rd == R15) {  // MRS R15, ...
+            d->R15Modified = true;
+        }
+        return true;
 
-            case 3:
-                if (Opcode.ControlExtension.Op1 == 1) { // BLX
-                    goto RaiseException;
-                } else {
-                    goto RaiseException;
-                }
-                break;
+    case ArmDecodeBx:
+        d->fp = PlaceBx;
+        d->Rd = Opcode.BranchExchange.Rd;
+        d->R15Modified = true;
+        return true;
 
-            case 5:
-                if (!(Configuration.ProcessorFeatures & Feature_DSP)) {
-                    // Instruction only supported when the feature is turned on
-                    goto RaiseException;
-                }
-                d->Rn=Opcode.DSPExtension.Rn;
-                d->Rm=Opcode.DSPExtension.Rm;
-                d->Rd=Opcode.DSPExtension.Rd;
-                if (d->Rn==R15 || d->Rm==R15 || d->Rd==R15) {
-                    // R15 not allowed in any operand
-                    goto RaiseException;
-                }
-                d->Op1=Opcode.DSPExtension.Op1;
-                d->fp=PlaceQADD;
-                return true;
+    case ArmDecodeQADD:
+        if (!(Configuration.ProcessorFeatures & Feature_DSP)) {
+            // Instruction only supported when the feature is turned on
+            goto RaiseException;
+        }
+        d->Rn=Opcode.DSPExtension.Rn;
+        d->Rm=Opcode.DSPExtension.Rm;
+        d->Rd=Opcode.DSPExtension.Rd;
+        if (d->Rn==R15 || d->Rm==R15 || d->Rd==R15) {
+            // R15 not allowed in any operand
+            goto RaiseException;
+        }
+        d->Op1=Opcode.DSPExtension.Op1;
+        d->fp=PlaceQADD;
+        return true;
 
-            case 7:
-                if (Opcode.ControlExtension.Op1 == 1) { // BKPT
-                    d->fp = PlaceBKPT;
-                    return true;
-                } else {
-                    goto RaiseException;
-                }
-                break;
+    case ArmDecodeBKPT:
+        d->fp = PlaceBKPT;
+        return true;
 
-            case 8:
-            case 0xa:
-            case 0xc:
-            case 0xe:
-                if (!(Configuration.ProcessorFeatures & Feature_DSP)) {
-                    // Instruction only supported when the feature is turned on
-                    goto RaiseException;
-                }
-                d->Rn=Opcode.DSPExtension.Rn;
-                d->Rm=Opcode.DSPExtension.Rm;
-                d->Rd=Opcode.DSPExtension.Rd;
-                d->Rs=Opcode.DSPExtension.Rs;
-                if (d->Rn==R15 || d->Rm==R15 || d->Rd==R15 || d->Rs==R15) {
-                    // R15 not allowed in any operand
-                    goto RaiseException;
-                }
-                d->Op1=Opcode.DSPExtension.Op1;
-                d->X=Opcode.DSPExtension.X;
-                d->Y=Opcode.DSPExtension.Y;
-                d->fp=PlaceDSPMul;
-                return true;
+    case ArmDecodeDSPMul:
+        if (!(Configuration.ProcessorFeatures & Feature_DSP)) {
+            // Instruction only supported when the feature is turned on
+            goto RaiseException;
+        }
+        d->Rn=Opcode.DSPExtension.Rn;
+        d->Rm=Opcode.DSPExtension.Rm;
+        d->Rd=Opcode.DSPExtension.Rd;
+        d->Rs=Opcode.DSPExtension.Rs;
+        if (d->Rn==R15 || d->Rm==R15 || d->Rd==R15 || d->Rs==R15) {
+            // R15 not allowed in any operand
+            goto RaiseException;
+        }
+        d->Op1=Opcode.DSPExtension.Op1;
+        d->X=Opcode.DSPExtension.X;
+        d->Y=Opcode.DSPExtension.Y;
+        d->fp=PlaceDSPMul;
+        return true;
 
-            default:
-                goto RaiseException;
-            }
-        }else if (Opcode.ArithmeticExtension.Reserved2==0 && Opcode.ArithmeticExtension.Reserved1==9) {
-            d->Rm = Opcode.ArithmeticExtension.Rm;
-            d->Rs = Opcode.ArithmeticExtension.Rs;
-            d->Rn = Opcode.ArithmeticExtension.Rn;
-            d->Rd = Opcode.ArithmeticExtension.Rd;
-            d->Op1 = Opcode.ArithmeticExtension.op1;
+    case ArmDecodeMultiply:
+        d->Rm = Opcode.ArithmeticExtension.Rm;
+        d->Rs = Opcode.ArithmeticExtension.Rs;
+        d->Rn = Opcode.ArithmeticExtension.Rn;
+        d->Rd = Opcode.ArithmeticExtension.Rd;
+        d->Op1 = Opcode.ArithmeticExtension.op1;
 
-            if ((  d->Op1 != 0 && (d->Rd == 15 || d->Rn == 15 || d->Rm == 15 || d->Rs == 15))
-                || d->Op1 == 0 && (d->Rd == 15 || d->Rn != 0  || d->Rm == 15 || d->Rs == 15))
-            {
-                goto RaiseException;
-            }
-            d->fp = PlaceArithmeticExtension;
-            d->S = Opcode.ArithmeticExtension.S;
-            return true;
-        } else if (Opcode.LoadStoreExtension.Reserved1==1 && Opcode.LoadStoreExtension.Reserved2==1 &&
-                    !(Opcode.LoadStoreExtension.P==0 && Opcode.LoadStoreExtension.op1==0)) {
-            if (Opcode.DoubleLoadStoreExtension.Reserved3==0 && Opcode.DoubleLoadStoreExtension.Reserved2==3) {
-                if (!(Configuration.ProcessorFeatures & Feature_LoadStoreDouble)) {
-                    // Instruction only supported when the feature is turned on
-                    goto RaiseException;
-                }
-                d->L = !Opcode.DoubleLoadStoreExtension.L;  // 0 for LDRD, 1 for STRD
-                d->Rm = Opcode.DoubleLoadStoreExtension.Rm;
-                d->Rs = Opcode.DoubleLoadStoreExtension.Rs;
-                d->Rd = Opcode.DoubleLoadStoreExtension.Rd;
-                if ((d->Rd&1) || d->Rd == R14) {
-                    // Only even-numbered destination registers can be used with this instruction
-                    // R14/R15 is not allowed
-                    goto RaiseException;
-                }
-                d->Rn = Opcode.DoubleLoadStoreExtension.Rn;
-                d->W = Opcode.DoubleLoadStoreExtension.W;
-                d->P = Opcode.DoubleLoadStoreExtension.P;
-                d->I = Opcode.DoubleLoadStoreExtension.I;
-                d->U = Opcode.DoubleLoadStoreExtension.U;
-
-                if (d->I == 0) { //register offset
-                    if(d->Rm == 15){
-                        goto RaiseException;
-                    }
-                }
-                if (d->P == 0){
-                    // Post-index always writes back.  The assembler convention is to
-                    // leave W set to 0 in the opcode.  To simplify logic below,
-                    // set W when post-indexing is enabled->
-                    d->W = 1;
-                }
-                if (d->W &&    d->Rn == R15){
-                    // Write-back to R15 not allowed
-                    goto RaiseException;
-                }
+        if ((  d->Op1 != 0 && (d->Rd == 15 || d->Rn == 15 || d->Rm == 15 || d->Rs == 15))
+            || d->Op1 == 0 && (d->Rd == 15 || d->Rn != 0  || d->Rm == 15 || d->Rs == 15))
+        {
+            goto RaiseException;
+        }
+        d->fp = PlaceArithmeticExtension;
+        d->S = Opcode.ArithmeticExtension.S;
+        return true;
 
-                d->fp = PlaceDoubleLoadStoreExtension;
-                return true;
-            }
-
-            d->Op1 = Opcode.LoadStoreExtension.op1;
-            d->Rm = Opcode.LoadStoreExtension.Rm;                
-            d->Rs = Opcode.LoadStoreExtension.Rs;
-            d->Rd = Opcode.LoadStoreExtension.Rd;
-            d->Rn = Opcode.LoadStoreExtension.Rn;
-            d->W = Opcode.LoadStoreExtension.W;
-            d->P = Opcode.LoadStoreExtension.P;
-            d->L = Opcode.LoadStoreExtension.L;
-            d->Reserved3 = Opcode.HalfWordSignedTransferRegister.Reserved3;
-            if(d->Op1 == 0){// SWP/SWPB
-                if(d->Rd == 15 || d->Rm == 15 || d->Rn == 15){
-                    // ARM ARM 4.1.52 use of R15 as Rd, Rm or Rn is UNPREDICTABLE
-                    goto RaiseException;
-                }
-            } else {// HalfWordSignedTransferRegister or Immediate
-                if(d->Reserved3 == 0){ //register offset
-                    if(d->Rm == 15){
-                        goto RaiseException;
-                    }
-                }
-                if (d->P == 0){
-                    // Post-index always writes back.  The assembler convention is to
-                    // leave W set to 0 in the opcode.  To simplify logic below,
-                    // set W when post-indexing is enabled->
-                    d->W = 1;
-                }
-                if (d->W &&    d->Rn == R15){
-                    // Write-back to R15 not allowed
-                    goto RaiseException;
-                }
+    case ArmDecodeDoubleLoadStoreExtension:
+        if (!(Configuration.ProcessorFeatures & Feature_LoadStoreDouble)) {
+            // Instruction only supported when the feature is turned on
+            goto RaiseException;
+        }
+        d->L = !Opcode.DoubleLoadStoreExtension.L;  // 0 for LDRD, 1 for STRD
+        d->Rm = Opcode.DoubleLoadStoreExtension.Rm;
+        d->Rs = Opcode.DoubleLoadStoreExtension.Rs;
+        d->Rd = Opcode.DoubleLoadStoreExtension.Rd;
+        if ((d->Rd&1) || d->Rd == R14) {
+            // Only even-numbered destination registers can be used with this instruction
+            // R14/R15 is not allowed
+            goto RaiseException;
+        }
+        d->Rn = Opcode.DoubleLoadStoreExtension.Rn;
+        d->W = Opcode.DoubleLoadStoreExtension.W;
+        d->P = Opcode.DoubleLoadStoreExtension.P;
+        d->I = Opcode.DoubleLoadStoreExtension.I;
+        d->U = Opcode.DoubleLoadStoreExtension.U;
 
-                if (d->L && d->Rd == R15) { // load into R15 - BUG!!! d->L not set yet
-                    d->R15Modified = true;
-                }
+        if (d->I == 0) { //register offset
+            if(d->Rm == 15){
+                goto RaiseException;
             }
+        }
+        if (d->P == 0){
+            // Post-index always writes back.  The assembler convention is to
+            // leave W set to 0 in the opcode.  To simplify logic below,
+            // set W when post-indexing is enabled->
+            d->W = 1;
+        }
+        if (d->W &&    d->Rn == R15){
+            // Write-back to R15 not allowed
+            goto RaiseException;
+        }
 
-            d->fp = PlaceLoadStoreExtension;
-            d->B = Opcode.LoadStoreExtension.B;
-            d->U = Opcode.LoadStoreExtension.U;
-            // performloadstoreextension also uses the halfwords
-            d->Offset = (Opcode.HalfWordSignedTransferImmediate.OffsetHigh << 4) |
-                            Opcode.HalfWordSignedTransferImmediate.OffsetLow;
-            d->H = Opcode.HalfWordSignedTransferRegister.H;
-            d->S = Opcode.HalfWordSignedTransferRegister.S;
-            return true;
-        } else {
-DataProcessingCode:
-            d->fp = PlaceDataProcessing;
-            d->Operand2 = Opcode.DataProcessing.Operand2;
-            d->S = Opcode.DataProcessing.S;
-            d->Opcode = Opcode.DataProcessing.Opcode;
-            d->I = Opcode.DataProcessing.I;
-            if (d->I) {
-                d->Reserved3 = _rotr((unsigned __int8)d->Operand2, (d->Operand2 >> 8) << 1);
-            }
-            switch (d->Opcode) {
-                case 0: // 0000 = AND - Rd = Rn AND Immediate
-                case 1: // 0001 = EOR - Rd = Rn EOR Immediate
-                case 2: // 0010 = SUB - Rd = Rn - Immediate
-                case 3: // 0011 = RSB - Rd = Immediate - Rn
-                case 4: // 0100 = ADD - Rd = Rn + Immediate
-                case 5: // 0101 = ADC - Rd = Rn + Immediate + C
-                case 6: // 0110 = SBC - Rd = Rn - Immediate + C - 1
-                case 7: // 0111 = RSC - Rd = Immediate - Rn + C - 1
-                case 12: // 1100 = ORR - Rd = Rn OR Immediate
-                case 14: // 1110 = BIC = Rd = Rn AND NOT Immediate
-                    d->Rn = Opcode.DataProcessing.Rn;
-                    d->Rd = Opcode.DataProcessing.Rd;
-                    if (d->Rd == R15) {
-                        d->R15Modified=true;
-                    }
-                    break;
-
-                case 8: // 1000 = TST - set condition codes on Rn AND Immediate
-                case 9: // 1001 = TEQ - set condition codes on Rn EOR Immediate
-                case 10: // 1010 = CMP - set condition codes on Rn - Immediate
-                case 11: // 1011 = CMN - set condition codes on Rn + Immediate
-                    d->Rn = Opcode.DataProcessing.Rn;
-                    d->Rd = 0; // The UPDATE_FLAGS_ARITHMETIC_SUB macro consumes Rd.  We just have to
-                                // ensure that it is not R15 here.
-                    break;
-
-                case 13: // 1101 = MOV = Rd = Immediate
-                case 15: // 1111 = MVN = Rd = NOT Immediate
-                    d->Rd = Opcode.DataProcessing.Rd;
-                    if (d->Rd == R15) {
-                        d->R15Modified=true;
-                    }
-                    d->Rm = d->Operand2 & 0xf;
-                    break;
+        d->fp = PlaceDoubleLoadStoreExtension;
+        return true;
 
-                default:
-                    ASSERT(FALSE);
-                    break;
-            }
-            return true;
-        }
-    case 1:  // 001 - DataProcessing
-        if (Opcode.ControlExtension.Reserved3 == 6 && Opcode.ControlExtension.Reserved2==0) {
-            // Control extension with Opcode[25]==1.  There is only one opcode
-            // in this space - "MSR (immediate form)"
-            if ((Opcode.ControlExtension.Op1 & 1) == 1) {
-                // MSR (immediate form)
-                d->fp=PlaceMSRImmediate;
-                d->S = 1;    // PlaceMSRImmediate might call UpdateCPSR, thereby Setting the flags
-                d->Op1 = Opcode.ControlExtension.Op1;
-                d->Rn = Opcode.ControlExtension.Rn; // this is the mask used when updating, not actually an Rn register number
-                d->Immediate = _rotr((unsigned __int8)Opcode.ControlExtension.Operand2,(Opcode.ControlExtension.Operand2 >> 8) << 1);
-                return true;
-            } else {
+    case ArmDecodeLoadStoreExtension:
+        d->Op1 = Opcode.LoadStoreExtension.op1;
+        d->Rm = Opcode.LoadStoreExtension.Rm;                
+        d->Rs = Opcode.LoadStoreExtension.Rs;
+        d->Rd = Opcode.LoadStoreExtension.Rd;
+        d->Rn = Opcode.LoadStoreExtension.Rn;
+        d->W = Opcode.LoadStoreExtension.W;
+        d->P = Opcode.LoadStoreExtension.P;
+        d->L = Opcode.LoadStoreExtension.L;
+        d->Reserved3 = Opcode.HalfWordSignedTransferRegister.Reserved3;
+        if(d->Op1 == 0){// SWP/SWPB
+            if(d->Rd == 15 || d->Rm == 15 || d->Rn == 15){
+                // ARM ARM 4.1.52 use of R15 as Rd, Rm or Rn is UNPREDICTABLE
                 goto RaiseException;
             }
-        } else {                
-            goto DataProcessingCode;
-        }
-    case 2: {  // 010 - SingleDataTransfer
-SingleDataTransferCode:                
-            d->Offset = Opcode.SingleDataTransfer.Offset;
-            d->I = Opcode.SingleDataTransfer.I;
-            d->Rn = Opcode.SingleDataTransfer.Rn;
-            d->W = Opcode.SingleDataTransfer.W;
-            d->P = Opcode.SingleDataTransfer.P;
-            d->U = Opcode.SingleDataTransfer.U;
-            d->fp = PlaceSingleDataTransfer;
-            d->Rd = Opcode.SingleDataTransfer.Rd;
-            d->L = Opcode.SingleDataTransfer.L;
-            d->B = Opcode.SingleDataTransfer.B;
-            d->Operand2 = Opcode.DataProcessing.Operand2;
-            if(d->P==0){
+        } else {// HalfWordSignedTransferRegister or Immediate
+            if(d->Reserved3 == 0){ //register offset
+                if(d->Rm == 15){
+                    goto RaiseException;
+                }
+            }
+            if (d->P == 0){
                 // Post-index always writes back.  The assembler convention is to
                 // leave W set to 0 in the opcode.  To simplify logic below,
-                // set W when post-indexing is enabled.
-                d->W=1;
+                // set W when post-indexing is enabled->
+                d->W = 1;
             }
-            if (d->W && d->Rn == R15){
-                // ARM ARM 5.5.4: Specifying Rn==R15 has UNPREDICTABLE results with writeback enabled
+            if (d->W &&    d->Rn == R15){
+                // Write-back to R15 not allowed
                 goto RaiseException;
             }
-            if (d->Rd == R15 && d->L) { // load into R15
-                d->R15Modified=true;
-            }
-            if (d->Rn == R15 && d->I == 0) {
-                // Pre-compute R15+/-Offset and cache it in Reserved3.
-                if (d->U) {
-                    d->Reserved3 = d->GuestAddress + d->Offset + ((Cpu.CPSR.Bits.ThumbMode) ? 4 : 8);
-                } else {
-                    d->Reserved3 = d->GuestAddress - d->Offset + ((Cpu.CPSR.Bits.ThumbMode) ? 4 : 8);
-                }
-            }
-            if (d->I && (d->Offset & 0xf) == R15) {  // Rm cannot be R15
-                goto RaiseException;
+
+            if (d->L && d->Rd == R15) { // load into R15 - BUG!!! d->L not set yet
+                d->R15Modified = true;
             }
-            return true;
         }
-    case 3:  // 011 - SingleDataTransfer or Undefined
-        // Undefined shall not be used by software.  Disambiguation is done
-        // by coprocessors.  If all refuse to accept it as Undefined, then
-        // it is treated as a SingleDataTranfer.
-        if (Opcode.UndefinedExtension.Reserved1 == 1)
+
+        d->fp = PlaceLoadStoreExtension;
+        d->B = Opcode.LoadStoreExtension.B;
+        d->U = Opcode.LoadStoreExtension.U;
+        // performloadstoreextension also uses the halfwords
+        d->Offset = (Opcode.HalfWordSignedTransferImmediate.OffsetHigh << 4) |
+                        Opcode.HalfWordSignedTransferImmediate.OffsetLow;
+        d->H = Opcode.HalfWordSignedTransferRegister.H;
+        d->S = Opcode.HalfWordSignedTransferRegister.S;
+        return true;
+
+    case ArmDecodeMSRImmediate:
+        // Control extension with Opcode[25]==1.  There is only one opcode
+        // in this space - "MSR (immediate form)"
+        d->fp=PlaceMSRImmediate;
+        d->S = 1;    // PlaceMSRImmediate might call UpdateCPSR, thereby Setting the flags
+        d->Op1 = Opcode.ControlExtension.Op1;
+        d->Rn = Opcode.ControlExtension.Rn; // this is the mask used when updating, not actually an Rn register number
+        d->Immediate = _rotr((unsigned __int8)Opcode.ControlExtension.Operand2,(Opcode.ControlExtension.Operand2 >> 8) << 1);
+        return true;
+
+    case ArmDecodeSingleDataTransfer:
+        if (!DecodeSingleDataTransferFields(d, Opcode.SingleDataTransfer.I, Opcode.SingleDataTransfer.P,
+                                            Opcode.SingleDataTransfer.U, Opcode.SingleDataTransfer.B,
+                                            Opcode.SingleDataTransfer.W, Opcode.SingleDataTransfer.L,
+                                            Opcode.SingleDataTransfer.Rn, Opcode.SingleDataTransfer.Rd,
+                                            Opcode.SingleDataTransfer.Offset)) {
             goto RaiseException;
-        else
-            goto SingleDataTransferCode;
-    case 4:{  // 100 - BlockDataTransfer
-            d->Rn = Opcode.BlockDataTransfer.Rn;
-            if(d->Rn == R15){
-                // ARM ARM 5.5.4: Specifying Rn==R15 has UNPREDICTABLE results with writeback enabled
-                goto RaiseException;
-            }
-            d->fp = PlaceBlockDataTransfer;
-            d->RegisterList = Opcode.BlockDataTransfer.RegisterList;                
-            d->L = Opcode.BlockDataTransfer.L;
-            d->W = Opcode.BlockDataTransfer.W;
-            d->S = Opcode.BlockDataTransfer.S;
-            d->U = Opcode.BlockDataTransfer.U;
-            d->P = Opcode.BlockDataTransfer.P;
-            if ((d->RegisterList & (1 << R15)) && d->L) { // LDM including R15
-                d->R15Modified = true;
-            }
-            return true;
-            }
-    case 5:{  // 101 - Branch
-            d->fp = PlaceBranch;
-            d->Offset = d->GuestAddress+8+4*Opcode.Branch.Offset; // account for the 2-word instruction prefetch
-            d->L = Opcode.Branch.L;
-            d->R15Modified = true;
-            return true;
-            }
-    case 6:  // 110 - CoprocDataTransfer
-        if (Opcode.CoprocessorExtension.Reserved2 == 24 && Opcode.CoprocessorExtension.Reserved1==0) {
-            d->fp = PlaceCoprocExtension;
-            d->Offset = Opcode.CoprocessorExtension.Offset;
-            d->CPNum = Opcode.CoprocessorExtension.cp_num;
-            d->CRd = Opcode.CoprocessorExtension.CRd;
-            d->Rn = Opcode.CoprocessorExtension.Rn;
-            d->X1 = Opcode.CoprocessorExtension.x1;
-            d->X2 = Opcode.CoprocessorExtension.x2;
-            return true;
-        } else {
-            d->W = Opcode.CoprocDataTransfer.W;
-            d->Rn = Opcode.CoprocDataTransfer.Rn;
-            d->P = Opcode.CoprocDataTransfer.P;
-            if(!d->P){ // not pre-index
-                // Post index always sets writeback
-                d->W = 1;
-            }
-            if (d->W && d->Rn == R15){
-                // ARM ARM 5.5.4: Specifying Rn==R15 has UNPREDICTABLE results with writeback enabled
-                goto RaiseException;
-            }
-            d->Offset = ((unsigned __int32)Opcode.CoprocDataTransfer.Offset)<<2;
-            if(!d->U)
-                d->Offset = -d->Offset;
+        }
+        return true;
 
-            d->fp = PlaceCoprocDataTransfer;
-            d->CPNum = Opcode.CoprocDataTransfer.CPNum;
-            d->CRd = Opcode.CoprocDataTransfer.CRd;
-            d->L = Opcode.CoprocDataTransfer.L;
-            d->N = Opcode.CoprocDataTransfer.N;
-            d->U = Opcode.CoprocDataTransfer.U;
-            return true;
+    case ArmDecodeBlockDataTransfer:
+        if (!DecodeBlockDataTransferFields(d, Opcode.BlockDataTransfer.P, Opcode.BlockDataTransfer.U,
+                                           Opcode.BlockDataTransfer.S, Opcode.BlockDataTransfer.W,
+                                           Opcode.BlockDataTransfer.L, Opcode.BlockDataTransfer.Rn,
+                                           Opcode.BlockDataTransfer.RegisterList)) {
+            goto RaiseException;
         }
-    case 7:  // 111 - CoprocDataOperation or CoprocRegisterTransfer or SoftwareInterrupt
-        if (Opcode.SoftwareInterrupt.Reserved1 == 15) {
-            if (ProcessorConfig.ARM.GenerateSyscalls && Opcode.SoftwareInterrupt.Ignored == 0x123456) {
-                d->fp = PlaceSyscall;
-            } else {
-                d->fp = PlaceSoftwareInterrupt;
-                d->R15Modified = true;
-            }
-            return true;
-        } else if (Opcode.CoprocDataOperation.Reserved1 == 0) {
-            d->fp = PlaceCoprocDataOperation;
-            d->CRm = Opcode.CoprocDataOperation.CRm;
-            d->CP = Opcode.CoprocDataOperation.CP;
-            d->CPNum = Opcode.CoprocDataOperation.CPNum;
-            d->CRd = Opcode.CoprocDataOperation.CRd;
-            d->CRn = Opcode.CoprocDataOperation.CRn;
-            d->CPOpc = Opcode.CoprocDataOperation.CPOpc;
-            return true;
+        return true;
+
+    case ArmDecodeBranch:
+        d->fp = PlaceBranch;
+        d->Offset = d->GuestAddress+8+4*Opcode.Branch.Offset; // account for the 2-word instruction prefetch
+        d->L = Opcode.Branch.L;
+        d->R15Modified = true;
+        return true;
+
+    case ArmDecodeCoprocessorExtension:
+        d->fp = PlaceCoprocExtension;
+        d->Offset = Opcode.CoprocessorExtension.Offset;
+        d->CPNum = Opcode.CoprocessorExtension.cp_num;
+        d->CRd = Opcode.CoprocessorExtension.CRd;
+        d->Rn = Opcode.CoprocessorExtension.Rn;
+        d->X1 = Opcode.CoprocessorExtension.x1;
+        d->X2 = Opcode.CoprocessorExtension.x2;
+        return true;
+
+    case ArmDecodeCoprocDataTransfer:
+        d->W = Opcode.CoprocDataTransfer.W;
+        d->Rn = Opcode.CoprocDataTransfer.Rn;
+        d->P = Opcode.CoprocDataTransfer.P;
+        if(!d->P){ // not pre-index
+            // Post index always sets writeback
+            d->W = 1;
+        }
+        if (d->W && d->Rn == R15){
+            // ARM ARM 5.5.4: Specifying Rn==R15 has UNPREDICTABLE results with writeback enabled
+            goto RaiseException;
+        }
+        d->Offset = ((unsigned __int32)Opcode.CoprocDataTransfer.Offset)<<2;
+        if(!d->U)
+            d->Offset = -d->Offset;
+
+        d->fp = PlaceCoprocDataTransfer;
+        d->CPNum = Opcode.CoprocDataTransfer.CPNum;
+        d->CRd = Opcode.CoprocDataTransfer.CRd;
+        d->L = Opcode.CoprocDataTransfer.L;
+        d->N = Opcode.CoprocDataTransfer.N;
+        d->U = Opcode.CoprocDataTransfer.U;
+        return true;
+
+    case ArmDecodeSoftwareInterrupt:
+        if (ProcessorConfig.ARM.GenerateSyscalls && Opcode.SoftwareInterrupt.Ignored == 0x123456) {
+            d->fp = PlaceSyscall;
         } else {
-            d->fp = PlaceCoprocRegisterTransfer;
-            d->CRm = Opcode.CoprocRegisterTransfer.CRm;
-            d->CP = Opcode.CoprocRegisterTransfer.CP;
-            d->CPNum = Opcode.CoprocRegisterTransfer.CPNum;
-            d->Rd = Opcode.CoprocRegisterTransfer.Rd;
-            d->CRn = Opcode.CoprocRegisterTransfer.CRn;
-            d->L = Opcode.CoprocRegisterTransfer.L;
-            d->CPOpc = Opcode.CoprocRegisterTransfer.CPOpc;
-            return true;
+            d->fp = PlaceSoftwareInterrupt;
+            d->R15Modified = true;
         }
+        return true;
+
+    case ArmDecodeCoprocDataOperation:
+        d->fp = PlaceCoprocDataOperation;
+        d->CRm = Opcode.CoprocDataOperation.CRm;
+        d->CP = Opcode.CoprocDataOperation.CP;
+        d->CPNum = Opcode.CoprocDataOperation.CPNum;
+        d->CRd = Opcode.CoprocDataOperation.CRd;
+        d->CRn = Opcode.CoprocDataOperation.CRn;
+        d->CPOpc = Opcode.CoprocDataOperation.CPOpc;
+        return true;
+
+    case ArmDecodeCoprocRegisterTransfer:
+        d->fp = PlaceCoprocRegisterTransfer;
+        d->CRm = Opcode.CoprocRegisterTransfer.CRm;
+        d->CP = Opcode.CoprocRegisterTransfer.CP;
+        d->CPNum = Opcode.CoprocRegisterTransfer.CPNum;
+        d->Rd = Opcode.CoprocRegisterTransfer.Rd;
+        d->CRn = Opcode.CoprocRegisterTransfer.CRn;
+        d->L = Opcode.CoprocRegisterTransfer.L;
+        d->CPOpc = Opcode.CoprocRegisterTransfer.CPOpc;
+        return true;
+
+    case ArmDecodeUndefined:
+        // Includes CLZ and BLX(2), which are ARMv5 and are not implemented
+        goto RaiseException;
+
     default:
         ASSERT(FALSE);
         break;
@@ -5407,41 +5570,33 @@ unsigned __int8* PlaceSingleStepCheck(unsigned __int8* CodeLocation, Decoded *d)
     return CodeLocation;
 }
 
+// The Thumb decoders below fill in the Decoded fields of the equivalent ARM
+// instruction directly, using the same field helpers as DecodeARMInstruction().
+// The halfword loads/stores and SWI are still re-encoded as ARM opcodes, as the
+// LoadStoreExtension fields alias each other and SWI may be turned into a syscall.
 void DecodeThumbMoveAddSub(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
-
-    ArmOpcode.DataProcessing.Cond = 0xe;
-    ArmOpcode.DataProcessing.Reserved1 = 0;
-    ArmOpcode.DataProcessing.S = 1; // update CPSR flags
-
     switch (Opcode.MoveShiftedRegister.Op2) {
     case 0: // THUMB: LSL Rd,Rs,#Offset5     ARM:  MOVS Rd,Rs,LSL#Offset5
     case 1: // THUMB: LSR Rd,Rs,#Offset5     ARM: MOVS Rd,Rs,LSR#Offset5
     case 2: // THUMB: ASR Rd,Rs,#Offset5     ARM: MOVS Rd,Rs,ASR#Offset5
-        ArmOpcode.DataProcessing.Rd = Opcode.MoveShiftedRegister.Rd;
-        ArmOpcode.DataProcessing.I = 0;
-        ArmOpcode.DataProcessing.Operand2 = (Opcode.MoveShiftedRegister.Offset5 << 7) |
-                                            (Opcode.MoveShiftedRegister.Op2 << 5) |
-                                            Opcode.MoveShiftedRegister.Rs; // shift Rs left/right/asr by 5-bit unsigned integer
-        ArmOpcode.DataProcessing.Rn = 0; // ignored
-        ArmOpcode.DataProcessing.Opcode = 13; // MOV Rd:=Op2
+        DecodeDataProcessingFields(d, 13 /* MOV Rd:=Op2 */, 1 /* update CPSR flags */, 0,
+                                   0 /* ignored */, Opcode.MoveShiftedRegister.Rd,
+                                   (Opcode.MoveShiftedRegister.Offset5 << 7) |
+                                   (Opcode.MoveShiftedRegister.Op2 << 5) |
+                                   Opcode.MoveShiftedRegister.Rs); // shift Rs left/right/asr by 5-bit unsigned integer
         break;
 
     case 3: // add/subtract
-        ArmOpcode.DataProcessing.Opcode = (Opcode.AddSubtract.Op == 0) ? 4 : 2; // ADD ? SUB
-        ArmOpcode.DataProcessing.Rn = Opcode.AddSubtract.Rs;
-        ArmOpcode.DataProcessing.Rd = Opcode.AddSubtract.Rd;
-        ArmOpcode.DataProcessing.I = Opcode.AddSubtract.I;
-        ArmOpcode.DataProcessing.Operand2 = Opcode.AddSubtract.RnOffset;
+        DecodeDataProcessingFields(d, (Opcode.AddSubtract.Op == 0) ? 4 : 2 /* ADD ? SUB */, 1,
+                                   Opcode.AddSubtract.I, Opcode.AddSubtract.Rs, Opcode.AddSubtract.Rd,
+                                   Opcode.AddSubtract.RnOffset);
         break;
 
     default:
         ASSERT(FALSE);
         break;
     }
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceDataProcessing);
 }
 
 const unsigned __int8 MathImmediateToARM[] = {
@@ -5454,20 +5609,9 @@ const unsigned __int8 MathImmediateToARM[] = {
 
 void DecodeThumbMathImmediate(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
-
-    ArmOpcode.DataProcessing.Cond = 0xe;
-    ArmOpcode.DataProcessing.Reserved1 = 0;
-    ArmOpcode.DataProcessing.Opcode = MathImmediateToARM[Opcode.MathImmediate.Op];
-    ArmOpcode.DataProcessing.S = 1; // update CPSR flags
-    ArmOpcode.DataProcessing.Rn = Opcode.MathImmediate.Rd;  // Op1 is Rd
-    ArmOpcode.DataProcessing.Rd = Opcode.MathImmediate.Rd;
-    // Rotate immediate value by zero
-    ArmOpcode.DataProcessing.I = 1;
-    ArmOpcode.DataProcessing.Operand2 = Opcode.MathImmediate.Offset8;
-
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceDataProcessing);
+    // Op1 is Rd, and the immediate value is rotated by zero
+    DecodeDataProcessingFields(d, MathImmediateToARM[Opcode.MathImmediate.Op], 1 /* update CPSR flags */, 1,
+                               Opcode.MathImmediate.Rd, Opcode.MathImmediate.Rd, Opcode.MathImmediate.Offset8);
 }
 
 const unsigned __int8 ALUOperationToARM[16] = {
@@ -5502,52 +5646,40 @@ const unsigned __int8 ALUOperationToARMShift[] = {
 };
 void DecodeThumbALUOperation(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
+    unsigned __int32 ArmOpcode;
 
     if (Opcode.ALUOperation.Op == 13) {
         // THUMB:  MUL Rd, Rs    ARM: MULS Rd, Rs, Rd
-        ArmOpcode.ArithmeticExtension.Cond = 0xe;
-        ArmOpcode.ArithmeticExtension.Reserved2 = 0;
-        ArmOpcode.ArithmeticExtension.op1=0; // MUL
-        ArmOpcode.ArithmeticExtension.S = 1;
-        ArmOpcode.ArithmeticExtension.Rd = Opcode.ALUOperation.Rd;
-        ArmOpcode.ArithmeticExtension.Rs = Opcode.ALUOperation.Rs;
-        ArmOpcode.ArithmeticExtension.Rn = 0;
-        ArmOpcode.ArithmeticExtension.Reserved1 = 9;
-        ArmOpcode.ArithmeticExtension.Rm = Opcode.ALUOperation.Rd;
-        DecodeARMInstruction(d, ArmOpcode);
-        ASSERT(d->fp == PlaceArithmeticExtension);
+        d->Rm = Opcode.ALUOperation.Rd;
+        d->Rs = Opcode.ALUOperation.Rs;
+        d->Rn = 0;
+        d->Rd = Opcode.ALUOperation.Rd;
+        d->Op1 = 0; // MUL
+        d->fp = PlaceArithmeticExtension;
+        d->S = 1;
+        return;
+    }
+
+    ArmOpcode = ALUOperationToARM[Opcode.ALUOperation.Op];
+    if (ArmOpcode == 13) {
+        // MOV
+        // Operand1, Rn, is ignored for MOV instructions
+        // Operand2 is Rd {LSL,LSR,ASR} Rs
+        ASSERT(Opcode.ALUOperation.Op < sizeof(ALUOperationToARMShift));
+        DecodeDataProcessingFields(d, ArmOpcode, 1, 0, 0, Opcode.ALUOperation.Rd,
+                                   (Opcode.ALUOperation.Rs << 8) |
+                                   (ALUOperationToARMShift[Opcode.ALUOperation.Op] << 5) |
+                                   0x10 |
+                                   Opcode.ALUOperation.Rd);
+    } else if (ArmOpcode == 3) {
+        // Op1 is Rs
+        // Op2 is #0 rotated 0
+        DecodeDataProcessingFields(d, ArmOpcode, 1, 1, Opcode.ALUOperation.Rs, Opcode.ALUOperation.Rd, 0);
     } else {
-        ArmOpcode.DataProcessing.Cond = 0xe;
-        ArmOpcode.DataProcessing.Reserved1 = 0;
-        ArmOpcode.DataProcessing.Opcode = ALUOperationToARM[Opcode.ALUOperation.Op];
-        ArmOpcode.DataProcessing.S = 1;
-        ArmOpcode.DataProcessing.Rd = Opcode.ALUOperation.Rd;
-        if (ArmOpcode.DataProcessing.Opcode == 13) {
-            // MOV
-            ArmOpcode.DataProcessing.I=0;
-            ArmOpcode.DataProcessing.Rn=0;  // Operand1, Rn, is ignored for MOV instructions
-            // Operand2 is Rd {LSL,LSR,ASR} Rs
-            ASSERT(Opcode.ALUOperation.Op < sizeof(ALUOperationToARMShift));
-            ArmOpcode.DataProcessing.Operand2 = (Opcode.ALUOperation.Rs << 8) |
-                                                (ALUOperationToARMShift[Opcode.ALUOperation.Op] << 5) |
-                                                0x10 |
-                                                Opcode.ALUOperation.Rd;
-        } else if (ArmOpcode.DataProcessing.Opcode == 3) {
-            // Op1 is Rs
-            // Op2 is #0
-            ArmOpcode.DataProcessing.I=1;
-            ArmOpcode.DataProcessing.Rn = Opcode.ALUOperation.Rs;
-            ArmOpcode.DataProcessing.Operand2=0;  // 0 rotated 0
-        } else {
-            // Op1 is Rd
-            // Op2 is Rs << 0
-            ArmOpcode.DataProcessing.I=0;
-            ArmOpcode.DataProcessing.Rn = Opcode.ALUOperation.Rd;
-            ArmOpcode.DataProcessing.Operand2=Opcode.ALUOperation.Rs; // Rs << 0
-        }
-        DecodeARMInstruction(d, ArmOpcode);
-        ASSERT(d->fp == PlaceDataProcessing);
+        // Op1 is Rd
+        // Op2 is Rs << 0
+        DecodeDataProcessingFields(d, ArmOpcode, 1, 0, Opcode.ALUOperation.Rd, Opcode.ALUOperation.Rd,
+                                   Opcode.ALUOperation.Rs);
     }
 }
 
@@ -5559,8 +5691,6 @@ const unsigned __int8 HiOpsToArm[] = {
 
 void DecodeThumbHiOps(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
-
     if (Opcode.HiOps.Op == 3) { // Branch and exchange (Bx)
         d->RsHs = Opcode.HiOps.RsHs;
         d->H2 =    Opcode.HiOps.H2;
@@ -5569,65 +5699,39 @@ void DecodeThumbHiOps(Decoded *d, THUMB_OPCODE Opcode)
     } else {
         // ADD, SUB, CMP, where H1 and H2 control whether the register number
         // is 0-7 or 8-15.
-        ArmOpcode.DataProcessing.Cond = 0xe;
-        ArmOpcode.DataProcessing.Reserved1 = 0;
-        ArmOpcode.DataProcessing.I = 0;
-        ArmOpcode.DataProcessing.Opcode = HiOpsToArm[Opcode.HiOps.Op];
-        ArmOpcode.DataProcessing.Rn = Opcode.HiOps.RdHd + 8*Opcode.HiOps.H1;
-        if (ArmOpcode.DataProcessing.Opcode == 10) {    // CMP is special-cased:
-            ArmOpcode.DataProcessing.Rd = 0;            // Rd is set to 0
-            ArmOpcode.DataProcessing.S = 1;             // Flags are updated
+        unsigned __int32 ArmOpcode = HiOpsToArm[Opcode.HiOps.Op];
+        unsigned __int32 Rn = Opcode.HiOps.RdHd + 8*Opcode.HiOps.H1;
+        unsigned __int32 Operand2 = Opcode.HiOps.RsHs + 8*Opcode.HiOps.H2;
+
+        if (ArmOpcode == 10) {    // CMP is special-cased:
+            // Rd is set to 0 and the flags are updated
+            DecodeDataProcessingFields(d, ArmOpcode, 1, 0, Rn, 0, Operand2);
         } else {
-            ArmOpcode.DataProcessing.Rd = ArmOpcode.DataProcessing.Rn;
-            ArmOpcode.DataProcessing.S = 0;
+            DecodeDataProcessingFields(d, ArmOpcode, 0, 0, Rn, Rn, Operand2);
         }
-        ArmOpcode.DataProcessing.Operand2 = Opcode.HiOps.RsHs + 8*Opcode.HiOps.H2;
-        DecodeARMInstruction(d, ArmOpcode);
-        ASSERT(d->fp == PlaceDataProcessing);
     }
 }
 
 void DecodeThumbPCRelativeLoad(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
+    __int32 Offset;
 
-    ArmOpcode.SingleDataTransfer.Cond = 0xe;
-    ArmOpcode.SingleDataTransfer.Reserved1=1; // this was 2. needs to be 1.
-    ArmOpcode.SingleDataTransfer.I=0; // Offset is an immediate value
-    ArmOpcode.SingleDataTransfer.P=1; // pre index
-    ArmOpcode.SingleDataTransfer.U=1; // up; add offset to base
-    ArmOpcode.SingleDataTransfer.B=0; // word, not byte
-    ArmOpcode.SingleDataTransfer.W=0; // no writeback
-    ArmOpcode.SingleDataTransfer.L=1; // load, not store
-    ArmOpcode.SingleDataTransfer.Rn = R15;
-    ArmOpcode.SingleDataTransfer.Rd = Opcode.PCRelativeLoad.Rd;
-    ArmOpcode.SingleDataTransfer.Offset = Opcode.PCRelativeLoad.Word8 << 2;
+    Offset = Opcode.PCRelativeLoad.Word8 << 2;
     if ((d->GuestAddress+4) & 2) {
-        // Force bit 2 clear in the PC by adjusting the offset a little
-        ArmOpcode.SingleDataTransfer.Offset -= 2;
+        // Force bit 2 clear in the PC by adjusting the offset a little.  This
+        // goes negative for Word8==0, which an ARM opcode could not encode.
+        Offset -= 2;
     }
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceSingleDataTransfer);
+    // LDR Rd, [R15, #Offset]:  pre-indexed, up, word, no writeback
+    DecodeSingleDataTransferFields(d, 0, 1, 1, 0, 0, 1, R15, Opcode.PCRelativeLoad.Rd, Offset);
 }
 
 void DecodeThumbLoadStoreRegisterOffset(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
-
-    ArmOpcode.SingleDataTransfer.Cond=0xe;
-    ArmOpcode.SingleDataTransfer.Reserved1=1;
-    ArmOpcode.SingleDataTransfer.I=1; // offset is a register
-    ArmOpcode.SingleDataTransfer.P=1; // pre index
-    ArmOpcode.SingleDataTransfer.U=1; // up; add offset to base
-    ArmOpcode.SingleDataTransfer.B=Opcode.LoadStoreRegisterOffset.B; // transfer byte or word
-    ArmOpcode.SingleDataTransfer.W=0; // no writeback
-    ArmOpcode.SingleDataTransfer.L=Opcode.LoadStoreRegisterOffset.L; // load or store
-    ArmOpcode.SingleDataTransfer.Rn=Opcode.LoadStoreRegisterOffset.Rb; // base register
-    ArmOpcode.SingleDataTransfer.Rd=Opcode.LoadStoreRegisterOffset.Rd; // destintation register
-    ArmOpcode.SingleDataTransfer.Offset=Opcode.LoadStoreRegisterOffset.Ro; // offset register with no shift
-
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceSingleDataTransfer);
+    // LDR/STR{B} Rd, [Rb, Ro]:  register offset with no shift, pre-indexed, up, no writeback
+    DecodeSingleDataTransferFields(d, 1, 1, 1, Opcode.LoadStoreRegisterOffset.B, 0,
+                                   Opcode.LoadStoreRegisterOffset.L, Opcode.LoadStoreRegisterOffset.Rb,
+                                   Opcode.LoadStoreRegisterOffset.Rd, Opcode.LoadStoreRegisterOffset.Ro);
 }
 
 void DecodeThumbLoadStoreByteHalfWord(Decoded *d, THUMB_OPCODE Opcode)
@@ -5647,69 +5751,31 @@ void DecodeThumbLoadStoreByteHalfWord(Decoded *d, THUMB_OPCODE Opcode)
         ArmOpcode.HalfWordSignedTransferRegister.S == 0) {
         // STRH is encoded for thumb with H and S both 0.  ARM encodes it differently.    
         ArmOpcode.HalfWordSignedTransferRegister.L=0;
-        ArmOpcode.HalfWordSignedTransferRegister.H=1;
-    } else {
-        ArmOpcode.HalfWordSignedTransferRegister.L=1;
-    }
-
-    ArmOpcode.HalfWordSignedTransferRegister.Rn=Opcode.LoadStoreByteHalfWord.Rb;
-    ArmOpcode.HalfWordSignedTransferRegister.Rd=Opcode.LoadStoreByteHalfWord.Rd;
-    ArmOpcode.HalfWordSignedTransferRegister.Reserved2=1;
-    ArmOpcode.HalfWordSignedTransferRegister.Reserved1=1;
-    ArmOpcode.HalfWordSignedTransferRegister.Rm=Opcode.LoadStoreByteHalfWord.Ro;
-
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceLoadStoreExtension);
-}
-
-void DecodeThumbCase2(Decoded *d, THUMB_OPCODE Opcode)
-{
-    switch (Opcode.ALUOperation.Reserved) {
-    case 0: // ALU operation
-        DecodeThumbALUOperation(d, Opcode);
-        break;
-
-    case 1: // Hi register operations / branch exchange
-        DecodeThumbHiOps(d, Opcode);
-        break;
-
-    case 2: // PC-relative load
-    case 3: // PC-relative load
-        DecodeThumbPCRelativeLoad(d, Opcode);
-        break;
-
-    default: // load/store of some sort
-        if (Opcode.LoadStoreRegisterOffset.Reserved1 == 0) {
-            // load/store with register offset
-            DecodeThumbLoadStoreRegisterOffset(d, Opcode);
-        } else {
-            // load/store sign-extended byte/halfword
-            DecodeThumbLoadStoreByteHalfWord(d, Opcode);
-        }
-        break;
+        ArmOpcode.HalfWordSignedTransferRegister.H=1;
+    } else {
+        ArmOpcode.HalfWordSignedTransferRegister.L=1;
     }
+
+    ArmOpcode.HalfWordSignedTransferRegister.Rn=Opcode.LoadStoreByteHalfWord.Rb;
+    ArmOpcode.HalfWordSignedTransferRegister.Rd=Opcode.LoadStoreByteHalfWord.Rd;
+    ArmOpcode.HalfWordSignedTransferRegister.Reserved2=1;
+    ArmOpcode.HalfWordSignedTransferRegister.Reserved1=1;
+    ArmOpcode.HalfWordSignedTransferRegister.Rm=Opcode.LoadStoreByteHalfWord.Ro;
+
+    DecodeARMInstruction(d, ArmOpcode);
+    ASSERT(d->fp == PlaceLoadStoreExtension);
 }
 
 void DecodeThumbLoadStoreImmediateOffset(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
-
-    ArmOpcode.SingleDataTransfer.Cond=0xe;
-    ArmOpcode.SingleDataTransfer.Reserved1=1;
-    ArmOpcode.SingleDataTransfer.I=0; // offset is an immediate
-    ArmOpcode.SingleDataTransfer.P=1; // pre index
-    ArmOpcode.SingleDataTransfer.U=1; // up; add offset to base
-    ArmOpcode.SingleDataTransfer.B=Opcode.LoadStoreImmediateOffset.B; // transfer byte or word
-    ArmOpcode.SingleDataTransfer.W=0; // no writeback
-    ArmOpcode.SingleDataTransfer.L=Opcode.LoadStoreImmediateOffset.L; // load or store
-    ArmOpcode.SingleDataTransfer.Rn=Opcode.LoadStoreImmediateOffset.Rb; // base register
-    ArmOpcode.SingleDataTransfer.Rd=Opcode.LoadStoreImmediateOffset.Rd; // destination register
-    ArmOpcode.SingleDataTransfer.Offset=(Opcode.LoadStoreImmediateOffset.B) ?
-                                          Opcode.LoadStoreImmediateOffset.Offset5 : // byte accesses use the offset unmodified
-                                          Opcode.LoadStoreImmediateOffset.Offset5 << 2; // word accesses multiply the offset by 4
-    
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceSingleDataTransfer);
+    // LDR/STR{B} Rd, [Rb, #Offset]:  pre-indexed, up, no writeback.  Byte
+    // accesses use the offset unmodified, word accesses multiply it by 4.
+    DecodeSingleDataTransferFields(d, 0, 1, 1, Opcode.LoadStoreImmediateOffset.B, 0,
+                                   Opcode.LoadStoreImmediateOffset.L, Opcode.LoadStoreImmediateOffset.Rb,
+                                   Opcode.LoadStoreImmediateOffset.Rd,
+                                   (Opcode.LoadStoreImmediateOffset.B) ?
+                                       Opcode.LoadStoreImmediateOffset.Offset5 :
+                                       Opcode.LoadStoreImmediateOffset.Offset5 << 2);
 }
 
 void DecodeThumbLoadStoreHalfWord(Decoded *d, THUMB_OPCODE Opcode)
@@ -5738,22 +5804,9 @@ void DecodeThumbLoadStoreHalfWord(Decoded *d, THUMB_OPCODE Opcode)
 
 void DecodeThumbLoadStoreSPRelative(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
-
-    ArmOpcode.SingleDataTransfer.Cond=0xe;
-    ArmOpcode.SingleDataTransfer.Reserved1=1;
-    ArmOpcode.SingleDataTransfer.I=0; // offset is an immediate
-    ArmOpcode.SingleDataTransfer.P=1; // pre index
-    ArmOpcode.SingleDataTransfer.U=1; // up; add offset to base
-    ArmOpcode.SingleDataTransfer.B=0; // transfer word
-    ArmOpcode.SingleDataTransfer.W=0; // no writeback
-    ArmOpcode.SingleDataTransfer.L=Opcode.LoadStoreSPRelative.L; // load or store
-    ArmOpcode.SingleDataTransfer.Rn=R13; // R13 is the stack pointer
-    ArmOpcode.SingleDataTransfer.Rd=Opcode.LoadStoreSPRelative.Rd; // destintation register
-    ArmOpcode.SingleDataTransfer.Offset=Opcode.LoadStoreSPRelative.Word8 << 2; // immediate
-
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceSingleDataTransfer);
+    // LDR/STR Rd, [R13, #Offset]:  pre-indexed, up, word, no writeback
+    DecodeSingleDataTransferFields(d, 0, 1, 1, 0, 0, Opcode.LoadStoreSPRelative.L, R13,
+                                   Opcode.LoadStoreSPRelative.Rd, Opcode.LoadStoreSPRelative.Word8 << 2);
 }
 
 
@@ -5767,28 +5820,21 @@ void DecodeThumbLoadAddress(Decoded *d, THUMB_OPCODE Opcode)
     // However, the 'SP' version does have an exact match.
 
     if (Opcode.LoadAddress.SP) {
-        OPCODE ArmOpcode;
-
-        ArmOpcode.DataProcessing.Cond=0xe;
-        ArmOpcode.DataProcessing.Reserved1=0;
-        ArmOpcode.DataProcessing.I=1; // op2 is rotated immediate
-        ArmOpcode.DataProcessing.Opcode=4; // add
-        ArmOpcode.DataProcessing.S=0; // do not set condition codes
-        ArmOpcode.DataProcessing.Rn=R13;
-        ArmOpcode.DataProcessing.Rd=Opcode.LoadAddress.Rd;
+        unsigned __int32 Operand2;
+
         if ((Opcode.LoadAddress.Word8 & 0xc0)) {
             // One or more of the top two bits are set.  If the value is
             // shifted left by 2, they'll overflow the 8-bit immediate
             // value allowed by the ARM data processing opcode.  Instead,
             // encode the value via a rotation.  Rotate the value right by
             // 30 bits to accomplish the shift of 2.
-            ArmOpcode.DataProcessing.Operand2 = 0xf00 | Opcode.LoadAddress.Word8;
+            Operand2 = 0xf00 | Opcode.LoadAddress.Word8;
         } else {
-            ArmOpcode.DataProcessing.Operand2=Opcode.LoadAddress.Word8 << 2;
-            ASSERT((ArmOpcode.DataProcessing.Operand2 & 0xf00) == 0); // ensure no rotate is accidentally encoded
+            Operand2 = Opcode.LoadAddress.Word8 << 2;
+            ASSERT((Operand2 & 0xf00) == 0); // ensure no rotate is accidentally encoded
         }
-        DecodeARMInstruction(d, ArmOpcode);
-        ASSERT(d->fp == PlaceDataProcessing);
+        // ADD Rd, R13, #Operand2, without setting the condition codes
+        DecodeDataProcessingFields(d, 4, 0, 1, R13, Opcode.LoadAddress.Rd, Operand2);
     } else {
         d->Rd = Opcode.LoadAddress.Rd;
         d->Word8 = Opcode.LoadAddress.Word8;
@@ -5798,201 +5844,207 @@ void DecodeThumbLoadAddress(Decoded *d, THUMB_OPCODE Opcode)
 
 void DecodeThumbAddToStackPointer(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
     unsigned __int16 Immediate;
 
-    ArmOpcode.DataProcessing.Cond=0xe;
-    ArmOpcode.DataProcessing.Reserved1=0;
-    ArmOpcode.DataProcessing.I=1; // offset is an immediate
-    ArmOpcode.DataProcessing.Opcode=(Opcode.AddToStackPointer.S) ? 2 :4; // subtract or add
-    ArmOpcode.DataProcessing.S=0; // do not set condidion codes
-    ArmOpcode.DataProcessing.Rn=R13;
-    ArmOpcode.DataProcessing.Rd=R13;
     Immediate=Opcode.AddToStackPointer.SWord7*4; // Shift immed left by 2
     if (Immediate > 0xff) {
         // Operand2 can only accept an 8-bit immediate value.  Re-encode
         // as an 8-bit immediate with a rotate-right of 30
         Immediate = (15 << 8) | Opcode.AddToStackPointer.SWord7;
     }
-    ArmOpcode.DataProcessing.Operand2=Immediate;
+    // SUB or ADD R13, R13, #Immediate, without setting the condition codes
+    DecodeDataProcessingFields(d, (Opcode.AddToStackPointer.S) ? 2 : 4, 0, 1, R13, R13, Immediate);
+}
 
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceDataProcessing);
+void DecodeThumbBKPT(Decoded *d, THUMB_OPCODE Opcode)
+{
+    UNREFERENCED_PARAMETER(Opcode);
+
+    d->fp = PlaceBKPT;
 }
 
 void DecodeThumbPushPopRegisters(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
+    unsigned __int32 RegisterList;
 
-    ArmOpcode.BlockDataTransfer.Cond=0xe;
-    ArmOpcode.BlockDataTransfer.Reserved1=4;
-    ArmOpcode.BlockDataTransfer.S=0; // do not load PSR or force user mode
-    ArmOpcode.BlockDataTransfer.W=1; // do write-back
-    ArmOpcode.BlockDataTransfer.L = Opcode.PushPopRegisters.L;
-    if (Opcode.PushPopRegisters.L) { // POP
-        // LDMIA
-        ArmOpcode.BlockDataTransfer.P=0; // post-indexed
-        ArmOpcode.BlockDataTransfer.U=1; // up (add offset from base)
-    } else { // PUSH
-        // STMDB
-        ArmOpcode.BlockDataTransfer.P=1; // pre-indexed
-        ArmOpcode.BlockDataTransfer.U=0; // down (subtract offset from base)
-    }
-    ArmOpcode.BlockDataTransfer.Rn=R13; // base address - the stack pointer
-    ArmOpcode.BlockDataTransfer.RegisterList=Opcode.PushPopRegisters.Rlist;
+    RegisterList = Opcode.PushPopRegisters.Rlist;
     if (Opcode.PushPopRegisters.R) {
         if (Opcode.PushPopRegisters.L) {
             // POP - Include the PC register, R15
-            ArmOpcode.BlockDataTransfer.RegisterList |= 1<<15;
+            RegisterList |= 1<<15;
         } else {
             // PUSH - Include the Link register, R14
-            ArmOpcode.BlockDataTransfer.RegisterList |= 1<<14;
+            RegisterList |= 1<<14;
         }
     }
 
-    DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceBlockDataTransfer);
+    // The base address is the stack pointer, with write-back.  The PSR is not
+    // loaded and user mode is not forced.
+    if (Opcode.PushPopRegisters.L) { // POP
+        // LDMIA:  post-indexed, up (add offset from base)
+        DecodeBlockDataTransferFields(d, 0, 1, 0, 1, 1, R13, RegisterList);
+    } else { // PUSH
+        // STMDB:  pre-indexed, down (subtract offset from base)
+        DecodeBlockDataTransferFields(d, 1, 0, 0, 1, 0, R13, RegisterList);
+    }
 }
 
 void DecodeThumbMultipleLoadStore(Decoded *d, THUMB_OPCODE Opcode)
 {
-    OPCODE ArmOpcode;
+    // LDMIA/STMIA Rb!:  post-indexed, up, with write-back
+    DecodeBlockDataTransferFields(d, 0, 1, 0, 1, Opcode.MultipleLoadStore.L, Opcode.MultipleLoadStore.Rb,
+                                  Opcode.MultipleLoadStore.Rlist);
+}
 
-    ArmOpcode.BlockDataTransfer.Cond=0xe;
-    ArmOpcode.BlockDataTransfer.Reserved1=4;
-    ArmOpcode.BlockDataTransfer.S=0; // do not load PSR or force user mode
-    ArmOpcode.BlockDataTransfer.W=1; // do write-back
-    // Generate LDMIA/STMIA
-    ArmOpcode.BlockDataTransfer.L = Opcode.MultipleLoadStore.L;
-    ArmOpcode.BlockDataTransfer.P=0; // post-indexed
-    ArmOpcode.BlockDataTransfer.U=1; // up (add offset from base)
-    ArmOpcode.BlockDataTransfer.Rn=Opcode.MultipleLoadStore.Rb;
-    ArmOpcode.BlockDataTransfer.RegisterList=Opcode.MultipleLoadStore.Rlist;
 
+
+void DecodeThumbSoftwareInterrupt(Decoded *d, THUMB_OPCODE Opcode)
+{
+    OPCODE ArmOpcode;
+
+    ArmOpcode.SoftwareInterrupt.Cond=0xe;
+    ArmOpcode.SoftwareInterrupt.Reserved1=0xf;
+    if (ProcessorConfig.ARM.GenerateSyscalls && Opcode.SoftwareInterrupt.Value8 == 0xAB) {
+        ArmOpcode.SoftwareInterrupt.Ignored=0x123456;
+    } else {
+        ArmOpcode.SoftwareInterrupt.Ignored=Opcode.SoftwareInterrupt.Value8;
+    }
     DecodeARMInstruction(d, ArmOpcode);
-    ASSERT(d->fp == PlaceBlockDataTransfer);
+    ASSERT(d->fp == PlaceSoftwareInterrupt || d->fp == PlaceSyscall);
 }
 
+void DecodeThumbUndefined(Decoded *d, THUMB_OPCODE Opcode)
+{
+    UNREFERENCED_PARAMETER(Opcode);
 
+    // Includes the break opcode (not BKPT, but identified as "break" by the
+    // disassembler), which WinCE uses in its assert mechanism.
+    d->fp = PlaceRaiseUndefinedException;
+}
 
 void DecodeThumbConditionalBranch(Decoded *d, THUMB_OPCODE Opcode)
 {
-    if (Opcode.ConditionalBranch.Cond == 0xf) {
-        OPCODE ArmOpcode;
+    // Branch, accounting for 1-word prefetch here.
+    d->Cond = Opcode.ConditionalBranch.Cond;
+    d->Offset = d->GuestAddress+2*Opcode.ConditionalBranch.Soffset8+4;
+    d->L=0;
+    d->R15Modified = true;
+    d->fp = PlaceBranch;
+}
 
-        // Software interrupt
-        ArmOpcode.SoftwareInterrupt.Cond=0xe;
-        ArmOpcode.SoftwareInterrupt.Reserved1=0xf;
-        if (ProcessorConfig.ARM.GenerateSyscalls && Opcode.SoftwareInterrupt.Value8 == 0xAB) {
-            ArmOpcode.SoftwareInterrupt.Ignored=0x123456;
-        } else {
-            ArmOpcode.SoftwareInterrupt.Ignored=Opcode.SoftwareInterrupt.Value8;
-        }
-        DecodeARMInstruction(d, ArmOpcode);
-        ASSERT(d->fp == PlaceSoftwareInterrupt);
-    } else if (Opcode.ConditionalBranch.Cond == 0xe) {
-        // break opcode (not BKPT, but identified as "break" by the disassembler).  WinCE
-        // uses this in its assert mechanism.
-        d->fp = PlaceRaiseUndefinedException;
-    } else {
-        // Branch, accounting for 1-word prefetch here.
-        d->Cond = Opcode.ConditionalBranch.Cond;
-        d->Offset = d->GuestAddress+2*Opcode.ConditionalBranch.Soffset8+4;
-        d->L=0;
-        d->R15Modified = true;
-        d->fp = PlaceBranch;
+void DecodeThumbLongBranch(Decoded *d, THUMB_OPCODE Opcode)
+{
+    d->HTwoBits = Opcode.LongBranch.H;         // 2 bits
+    switch(d->HTwoBits){
+        case 0:
+            d->Offset = 2* Opcode.UnconditionalBranch.Offset11;
+            d->R15Modified=true;
+            break;
+        case 2:
+            if (Opcode.LongBranch.Offset & 0x200) {
+                // Offset is negative
+                d->Offset = (0xfffffc00 | Opcode.LongBranch.Offset) << 12;
+            } else {
+                d->Offset = Opcode.LongBranch.Offset << 12;
+            }
+            break;
+        case 1: // fall through into case 3
+        case 3:
+            d->Offset = Opcode.LongBranch.Offset << 1;
+            d->R15Modified = true;
+            break;
+        default:
+            ASSERT(FALSE);
+            break;
     }
+    d->fp = PlaceThumbLongBranch;
 }
 
+typedef void (*PFNDECODETHUMB)(Decoded *d, THUMB_OPCODE Opcode);
 
-bool DecodeThumbInstruction(Decoded *d, THUMB_OPCODE Opcode){
-    d->Cond=14;
-    switch (Opcode.Generic.Opcode) {
+// Selects the decoder for a Thumb opcode from its top 8 bits, which identify
+// the format of every Thumb instruction.
+static constexpr PFNDECODETHUMB ThumbDecoderOf(unsigned __int32 High)
+{
+    switch (High >> 5) {            // bits 15-13
     case 0:
         // Move shifted register or Add/subtract
-        DecodeThumbMoveAddSub(d, Opcode);
-        break;
+        return DecodeThumbMoveAddSub;
 
     case 1:
         // Move/compare/add/subtract immediate
-        DecodeThumbMathImmediate(d, Opcode);
-        break;
+        return DecodeThumbMathImmediate;
 
     case 2:
         // ALU operations, Hi register operations, PC-relative load, load/store with register
         // offset, or load/store with sign-extended byte/halfword
-        DecodeThumbCase2(d, Opcode);
-        break;
+        switch ((High >> 2) & 7) {  // bits 12-10
+        case 0: // ALU operation
+            return DecodeThumbALUOperation;
+        case 1: // Hi register operations / branch exchange
+            return DecodeThumbHiOps;
+        case 2: // PC-relative load
+        case 3: // PC-relative load
+            return DecodeThumbPCRelativeLoad;
+        default: // load/store of some sort
+            if ((High & 2) == 0) {
+                // load/store with register offset
+                return DecodeThumbLoadStoreRegisterOffset;
+            }
+            // load/store sign-extended byte/halfword
+            return DecodeThumbLoadStoreByteHalfWord;
+        }
 
     case 3:
         // Load/store with immediate offset
-        DecodeThumbLoadStoreImmediateOffset(d, Opcode);
-        break;
+        return DecodeThumbLoadStoreImmediateOffset;
 
     case 4:
-        if (Opcode.LoadStoreHalfWord.Reserved1 == 0) {
-            DecodeThumbLoadStoreHalfWord(d, Opcode);
-        } else {
-            DecodeThumbLoadStoreSPRelative(d, Opcode);
-        }
-        break;
+        return (High & 0x10) ? DecodeThumbLoadStoreSPRelative : DecodeThumbLoadStoreHalfWord;
 
     case 5:
-        if (Opcode.LoadAddress.Reserved1 == 0) {
-            DecodeThumbLoadAddress(d, Opcode);
-        } else if (Opcode.AddToStackPointer.Reserved1 == 0x10) {
-            DecodeThumbAddToStackPointer(d, Opcode);
-        } else if (Opcode.AddToStackPointer.Reserved1 == 0x1E) {
-            d->fp = PlaceBKPT;
-        } else if (Opcode.PushPopRegisters.Reserved2 == 1 && Opcode.PushPopRegisters.Reserved1 == 2) {
-            DecodeThumbPushPopRegisters(d, Opcode);
-        } else {
-            d->fp = PlaceRaiseUndefinedException;
+        if ((High & 0x10) == 0) {
+            return DecodeThumbLoadAddress;
+        } else if ((High & 0x1f) == 0x10) {
+            return DecodeThumbAddToStackPointer;
+        } else if ((High & 0x1f) == 0x1e) {
+            return DecodeThumbBKPT;
+        } else if ((High & 6) == 4) {
+            return DecodeThumbPushPopRegisters;
         }
-        break;
+        return DecodeThumbUndefined;
 
     case 6:
-        if (Opcode.MultipleLoadStore.Reserved1 == 0) {
-            DecodeThumbMultipleLoadStore(d, Opcode);
-        } else {
-            // This also handles Software Interrupt
-            DecodeThumbConditionalBranch(d, Opcode);
+        if ((High & 0x10) == 0) {
+            return DecodeThumbMultipleLoadStore;
+        } else if ((High & 0xf) == 0xf) {
+            return DecodeThumbSoftwareInterrupt;
+        } else if ((High & 0xf) == 0xe) {
+            return DecodeThumbUndefined;
         }
-        break;
+        return DecodeThumbConditionalBranch;
 
+    default:
+        return DecodeThumbLongBranch;
+    }
+}
 
-    case 7:
-        d->Cond = 14;
-        d->HTwoBits = Opcode.LongBranch.H;         // 2 bits
-        switch(d->HTwoBits){
-            case 0:
-                d->Offset = 2* Opcode.UnconditionalBranch.Offset11;
-                d->R15Modified=true;
-                break;
-            case 2:
-                if (Opcode.LongBranch.Offset & 0x200) {
-                    // Offset is negative
-                    d->Offset = (0xfffffc00 | Opcode.LongBranch.Offset) << 12;
-                } else {
-                    d->Offset = Opcode.LongBranch.Offset << 12;
-                }
-                break;
-            case 1: // fall through into case 3
-            case 3:
-                d->Offset = Opcode.LongBranch.Offset << 1;
-                d->R15Modified = true;
-                break;
-            default:
-                ASSERT(FALSE);
-                break;
-        }
-        d->fp = PlaceThumbLongBranch;
-        break;
+// Thumb decoder for every value of the top 8 bits of an opcode, built by the compiler
+struct ThumbDecodeTableType {
+    PFNDECODETHUMB Decoder[256];
 
-    default:
-        ASSERT(FALSE);
-        break;
+    constexpr ThumbDecodeTableType() : Decoder() {
+        for (unsigned __int32 i=0; i<ARRAY_SIZE(Decoder); ++i) {
+            Decoder[i] = ThumbDecoderOf(i);
+        }
     }
+};
+
+static constexpr ThumbDecodeTableType ThumbDecodeTable;
+
+bool DecodeThumbInstruction(Decoded *d, THUMB_OPCODE Opcode){
+    d->Cond=14;
+    ThumbDecodeTable.Decoder[Opcode.HalfWord >> 8](d, Opcode);
 
     if (d->fp == PlaceRaiseUndefinedException) {
         // Stop disassembling if an undefined opcode is detected
@@ -6109,6 +6161,84 @@ void JitDecode(PENTRYPOINT ContainingEntrypoint, unsigned __int32 InstructionPoi
     NumberOfInstructions = i;
 }
 
+// The longest loop, in instructions including the branch, that IsPollingLoop()
+// is asked about
+#define IDLE_LOOP_MAX_INSTRUCTIONS 8
+
+// Returns true if Instructions[First] through Instructions[Last-1], followed by
+// a branch back to First, are a loop that only polls:  nothing is stored, and
+// every register read was already loaded or computed in the same iteration.
+// Each iteration then sees the same values until an interrupt arrives or some
+// other agent writes the memory or I/O it loads from.
+static bool IsPollingLoop(unsigned __int32 First, unsigned __int32 Last)
+{
+    unsigned __int32 LoopWritten = 0;
+    unsigned __int32 Written = 0;
+    unsigned __int32 j;
+
+    for (j=First; j<Last; ++j) {
+        const Decoded *d = &Instructions[j];
+
+        if (d->Cond != 14) {
+            return false;
+        }
+        if (d->fp == PlaceDataProcessing) {
+            if (d->Opcode == 5 || d->Opcode == 6 || d->Opcode == 7 ||
+                (d->I == 0 && (d->Operand2 & 0xff0) == 0x060)) {
+                // ADC, SBC, RSC and RRX carry the C flag from one iteration to the next
+                return false;
+            }
+            if (d->Opcode < 8 || d->Opcode > 11) {
+                if (d->Rd == R15) {
+                    return false;
+                }
+                LoopWritten |= 1 << d->Rd;
+            }
+        } else if (d->fp == PlaceSingleDataTransfer) {
+            // LDR Rd, [Rn+offset] without writeback
+            if (d->L == 0 || d->W || d->Rd == R15) {
+                return false;
+            }
+            LoopWritten |= 1 << d->Rd;
+        } else {
+            return false;
+        }
+    }
+
+    for (j=First; j<Last; ++j) {
+        const Decoded *d = &Instructions[j];
+        unsigned __int32 Read = 0;
+
+        if (d->fp == PlaceDataProcessing) {
+            if (d->Opcode != 13 && d->Opcode != 15) {
+                Read |= 1 << d->Rn;
+            }
+            if (d->I == 0) {
+                Read |= 1 << (d->Operand2 & 0xf);
+                if (d->Operand2 & 0x10) {
+                    // shift by register
+                    Read |= 1 << ((d->Operand2 >> 8) & 0xf);
+                }
+            }
+            if (d->Opcode < 8 || d->Opcode > 11) {
+                Written |= 1 << d->Rd;
+            }
+        } else {
+            Read |= 1 << d->Rn;
+            if (d->I) {
+                Read |= 1 << (d->Offset & 0xf);
+            }
+            Written |= 1 << d->Rd;
+        }
+        if (Read & LoopWritten & ~Written) {
+            // The register carries a value from the previous iteration, as a
+            // loop counter does
+            return false;
+        }
+    }
+    return true;
+}
+
 int LocateEntrypoints(void)
 {
     unsigned __int32 i;
@@ -6190,6 +6320,19 @@ int LocateEntrypoints(void)
                     // loop which intends to be broken only when an interrupt
                     // arrives.
                     Instructions[i].fp = PlaceIdleLoop;
+                } else if (ProcessorConfig.ARM.GenerateSyscalls == 0 &&
+                           Offset <= i &&
+                           i - Offset < IDLE_LOOP_MAX_INSTRUCTIONS &&
+                           IsPollingLoop(Offset, i)) {
+                    // A short loop that waits for an interrupt, or for memory or
+                    // I/O to change.  Park the CPU thread between iterations
+                    // instead of spinning.  An interrupt wakes it at once, and it
+                    // polls again after IDLE_POLL_TIMEOUT in case the loop is
+                    // waiting on something that does not raise one.  Loops that
+                    // poll a time-varying register are not parked - see
+                    // PollingLoopHelper.
+                    Instructions[i].fp = PlacePollingLoop;
+                    Instructions[Offset].PollingLoopHead = 1;
                 }
             }
         } else if (Instructions[i].fp == PlaceDataProcessing &&
@@ -6922,13 +7065,11 @@ NoDisplay:
 
 #endif
 
-unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decoded *d, unsigned __int8** Skip1, unsigned __int8** Skip2)
+// Returns true if the previous instruction left the guest CNZ flags in AH, and
+// sets *pfAllFlagsSet if they are still in EFLAGS as well.
+bool JitConditionFlagsInAH(unsigned __int8* CodeLocation, const Decoded *d, bool *pfAllFlagsSet)
 {
-    bool fCNZFlagsLoaded;
-    bool fAllFlagsSet;
-
-    fCNZFlagsLoaded=false;
-    fAllFlagsSet=false;
+    *pfAllFlagsSet=false;
 
     if (d->Cond < 14 &&                                    // if the instruction is conditional...
         d != &Instructions[0] &&                        // and it isn't the first instruction...
@@ -6937,15 +7078,18 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         *(__int16*)(CodeLocation-6) == 0x2588 &&        // and the previous generated instruction was "MOV BYTE PTR &x86_Flags, AH"
         *(__int32*)(CodeLocation-4) == PtrToLong(&Cpu.x86_Flags)){ // then flags are already in AH;
         
-            fCNZFlagsLoaded=true;                        
-        
             if ((d-1)->FlagsSet == ALL_FLAGS)            //If all flags was set, then no mask was generated and 
-                fAllFlagsSet=true;                        //the condition flags will still be in the EFLAGS register, hence no SAHF
-                                                        //This flag can only be set if fCNZFlagsLoaded is true.
+                *pfAllFlagsSet=true;                    //the condition flags will still be in the EFLAGS register, hence no SAHF
+                                                        //This flag can only be set if the CNZ flags are loaded.
+            return true;
     }
-    
-    
+    return false;
+}
 
+// Loads the guest flags that d->Cond tests into EFLAGS, and returns the x86
+// condition that is true when the instruction is to be skipped in *pSkipCond.
+unsigned __int8* PlaceConditionFlags(unsigned __int8* CodeLocation, const Decoded *d, bool fCNZFlagsLoaded, bool fAllFlagsSet, unsigned __int8 *pSkipCond)
+{
     switch (d->Cond) {
     case 0:    // EQ - Z set
 
@@ -6958,7 +7102,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
             Emit8(0x9e);                                                //SAHF
         }
         
-        Emit_JNZLabelFar(*Skip1);                                        // JE skipinstruction
+        *pSkipCond = NE_Cond;                                            // JE skipinstruction
         break;
 
     case 1: // NE - Z clear
@@ -6970,7 +7114,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         else if (!fAllFlagsSet){
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JZLabelFar(*Skip1);                                        // JNE skipinstruction
+        *pSkipCond = E_Cond;                                            // JNE skipinstruction
         break;
 
     case 2: // CS - C set
@@ -6981,7 +7125,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         else if (!fAllFlagsSet){
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JNCLabelFar(*Skip1);                                        // JNB skipinstruction
+        *pSkipCond = AE_Cond;                                            // JNB skipinstruction
         break;
 
     case 3: // CC - C clear
@@ -6992,7 +7136,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         else if (!fAllFlagsSet){
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JCLabelFar(*Skip1);                                        // JB skipinstruction
+        *pSkipCond = B_Cond;                                            // JB skipinstruction
         break;
 
     case 4: // MI - N set
@@ -7004,7 +7148,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         else if (!fAllFlagsSet){
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JNSLabelFar(*Skip1);                                        // JNS skipinstruction
+        *pSkipCond = NS_Cond;                                            // JNS skipinstruction
         break;
 
     case 5: // PL - N clear
@@ -7015,7 +7159,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         else if (!fAllFlagsSet){
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JSLabelFar(*Skip1);                                        // JS skipinstruction
+        *pSkipCond = S_Cond;                                            // JS skipinstruction
         break;
 
     case 6: // VS - V set
@@ -7023,7 +7167,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         Emit_MOV_Reg_BYTEPTR(AH_Reg, &Cpu.x86_Overflow.Byte);            //Mov Byte Ptr AH, &Cpu.x86_Overflow
         Emit8(0xD0); EmitModRmReg(3,AH_Reg,1);                            //ROR AH, 1
         
-        Emit_JNOLabelFar(*Skip1);                                        // JNO skipinstruction
+        *pSkipCond = NO_Cond;                                            // JNO skipinstruction
         break;
 
     case 7: // VC - V clear
@@ -7031,7 +7175,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
         Emit_MOV_Reg_BYTEPTR(AH_Reg, &Cpu.x86_Overflow.Byte);            //Mov Byte Ptr AH, &Cpu.x86_Overflow
         Emit8(0xD0); EmitModRmReg(3,AH_Reg,1);                            //ROR AH, 1
         
-        Emit_JOLabelFar(*Skip1);                                        // JO skipinstruction
+        *pSkipCond = O_Cond;                                            // JO skipinstruction
         break;
 
     case 8: // HI - C set and Z clear
@@ -7045,7 +7189,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
 	// brif C clear or Z set
 	Emit_CMC();
 	// now... brif c set or z set
-	Emit_JBELabelFar(*Skip1); // JBE skipinstruction
+	*pSkipCond = BE_Cond;     // JBE skipinstruction
         break;
 
     case 9: // LS - C clear or Z set
@@ -7060,7 +7204,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
 	// brif c set and z clear
 	Emit_CMC();
 	// now... brif c clear and z clear
-        Emit_JALabelFar(*Skip1); // JA SkipInstruction
+        *pSkipCond = A_Cond;     // JA SkipInstruction
         break;
 
     case 10: // GC - N set and V set, or N clear and V clear
@@ -7076,7 +7220,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
             Emit8(0xD0); EmitModRmReg(3,AL_Reg,1);                        //ROR AH, 1
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JLLabelFar(*Skip1);                                        // JL skipinstruction - SF <> OF
+        *pSkipCond = L_Cond;                                            // JL skipinstruction - SF <> OF
         break;
 
     case 11: // LT - N set and V clear, or N clear and V set
@@ -7095,7 +7239,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
             Emit8(0xD0); EmitModRmReg(3,AL_Reg,1);                        //ROR AH, 1
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JGELabelFar(*Skip1);                                        // JZ skipinstruction  - both are clear
+        *pSkipCond = GE_Cond;                                            // JZ skipinstruction  - both are clear
         break;
 
     case 12: // GT - Z clear, and either N set and V set, or N clear and V clear
@@ -7112,7 +7256,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
             Emit8(0xD0); EmitModRmReg(3,AL_Reg,1);                        //ROR AH, 1
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JLELabelFar(*Skip1);                                        // JLE skipinstruction - ZF = 1 or SF<>OF
+        *pSkipCond = LE_Cond;                                            // JLE skipinstruction - ZF = 1 or SF<>OF
         break;
 
     case 13: // LE - Z set, or N set and V clear, or  N clear and V set
@@ -7129,7 +7273,7 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
             Emit8(0xD0); EmitModRmReg(3,AL_Reg,1);                        //ROR AH, 1
             Emit8(0x9e);                                                //SAHF
         }
-        Emit_JGLabelFar(*Skip1);                                        // JG skipinstruction - Z = 0 and N == V
+        *pSkipCond = G_Cond;                                            // JG skipinstruction - Z = 0 and N == V
         break;
 
     case 14:
@@ -7147,6 +7291,178 @@ unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decode
     return CodeLocation;
 }
 
+unsigned __int8* PlaceConditionCheck(unsigned __int8* CodeLocation, const Decoded *d, unsigned __int8** Skip1, unsigned __int8** Skip2)
+{
+    bool fCNZFlagsLoaded;
+    bool fAllFlagsSet;
+    unsigned __int8 SkipCond = NO_Cond;
+
+    fCNZFlagsLoaded = JitConditionFlagsInAH(CodeLocation, d, &fAllFlagsSet);
+    CodeLocation = PlaceConditionFlags(CodeLocation, d, fCNZFlagsLoaded, fAllFlagsSet, &SkipCond);
+    Emit_JccLabelFar(SkipCond, *Skip1);                                 // Jcc skipinstruction
+    return CodeLocation;
+}
+
+// Returns true if Instructions[i] is a conditional instruction that can be
+// generated without a branch:  a data-processing instruction that does not set
+// the flags, reads at most one unshifted register operand besides Rn, and does
+// not touch R15.  Memory operations and anything with side effects keep the
+// branch form.
+bool JitCanPredicate(unsigned __int32 i)
+{
+    const Decoded *d = &Instructions[i];
+
+    if (!g_fOptimizeCode || !g_fPredicateConditionals) {
+        return false;
+    }
+    if (d->fp != PlaceDataProcessing || d->Cond >= 14 || d->S || d->R15Modified || d->Rd == R15) {
+        return false;
+    }
+    if (d->I == 0 && ((d->Operand2 & 0xff0) != 0 || (d->Operand2 & 0xf) == R15)) {
+        // Shifted register operand, or a read of R15
+        return false;
+    }
+    switch (d->Opcode) {
+    case 0: // AND
+    case 1: // EOR
+    case 2: // SUB
+    case 3: // RSB
+    case 4: // ADD
+    case 12: // ORR
+    case 14: // BIC
+        if (d->Rn == R15) {
+            return false;
+        }
+        break;
+
+    case 13: // MOV
+    case 15: // MVN
+        break;
+
+    default: // ADC, SBC and RSC consume the carry flag
+        return false;
+    }
+
+    // Longer runs of the same condition share one branch
+    if (i+1 < NumberOfInstructions &&
+        Instructions[i+1].Cond == d->Cond &&
+        Instructions[i+1].Entrypoint == d->Entrypoint) {
+        return false;
+    }
+    return true;
+}
+
+// Generates a conditional data-processing instruction as straight-line code:
+// the result is computed into ECX unconditionally, then a CMOV on the inverse
+// condition puts the old value of Rd back before it is stored.
+unsigned __int8* PlacePredicatedDataProcessing(unsigned __int8* CodeLocation, Decoded *d)
+{
+    bool fCNZFlagsLoaded;
+    bool fAllFlagsSet;
+    unsigned __int8 SkipCond = NO_Cond;
+    const unsigned __int32 Rm = d->Operand2 & 0xf;
+
+    // ECX is computed without touching AH, which may still hold the flags.  The
+    // computation overwrites EFLAGS, so SAHF is needed even if all flags were set.
+    fCNZFlagsLoaded = JitConditionFlagsInAH(CodeLocation, d, &fAllFlagsSet);
+
+    LogPlace((CodeLocation,"Predicated: "));
+    switch (d->Opcode) {
+    case 13: // MOV
+        if (d->I) {
+            Emit_MOV_Reg_Imm32(ECX_Reg, d->Reserved3);                  // MOV ECX, Immediate
+        } else {
+            Emit_MOV_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);              // MOV ECX, Cpu.GPRs[Rm]
+        }
+        break;
+
+    case 15: // MVN
+        if (d->I) {
+            Emit_MOV_Reg_Imm32(ECX_Reg, ~d->Reserved3);                 // MOV ECX, NOT Immediate
+        } else {
+            Emit_MOV_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);              // MOV ECX, Cpu.GPRs[Rm]
+            Emit_NOT_Reg(ECX_Reg);                                      // NOT ECX
+        }
+        break;
+
+    case 3: // RSB
+        if (d->I) {
+            Emit_MOV_Reg_Imm32(ECX_Reg, d->Reserved3);                  // MOV ECX, Immediate
+        } else {
+            Emit_MOV_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);              // MOV ECX, Cpu.GPRs[Rm]
+        }
+        Emit_SUB_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[d->Rn]);               // SUB ECX, Cpu.GPRs[Rn]
+        break;
+
+    case 14: // BIC
+        if (d->I) {
+            Emit_MOV_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[d->Rn]);           // MOV ECX, Cpu.GPRs[Rn]
+            Emit_AND_Reg_Imm32(ECX_Reg, ~d->Reserved3);                 // AND ECX, NOT Immediate
+        } else {
+            Emit_MOV_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);              // MOV ECX, Cpu.GPRs[Rm]
+            Emit_NOT_Reg(ECX_Reg);                                      // NOT ECX
+            Emit_AND_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[d->Rn]);           // AND ECX, Cpu.GPRs[Rn]
+        }
+        break;
+
+    default: // AND, EOR, SUB, ADD, ORR
+        Emit_MOV_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[d->Rn]);               // MOV ECX, Cpu.GPRs[Rn]
+        switch (d->Opcode) {
+        case 0: // AND
+            if (d->I) {
+                Emit_AND_Reg_Imm32(ECX_Reg, d->Reserved3);              // AND ECX, Immediate
+            } else {
+                Emit_AND_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);          // AND ECX, Cpu.GPRs[Rm]
+            }
+            break;
+
+        case 1: // EOR
+            if (d->I) {
+                Emit_XOR_Reg_Imm32(ECX_Reg, d->Reserved3);              // XOR ECX, Immediate
+            } else {
+                Emit_XOR_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);          // XOR ECX, Cpu.GPRs[Rm]
+            }
+            break;
+
+        case 2: // SUB
+            if (d->I) {
+                Emit_SUB_Reg_Imm32(ECX_Reg, d->Reserved3);              // SUB ECX, Immediate
+            } else {
+                Emit_SUB_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);          // SUB ECX, Cpu.GPRs[Rm]
+            }
+            break;
+
+        case 4: // ADD
+            if (d->I) {
+                Emit_ADD_Reg_Imm32(ECX_Reg, d->Reserved3);              // ADD ECX, Immediate
+            } else {
+                Emit_ADD_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);          // ADD ECX, Cpu.GPRs[Rm]
+            }
+            break;
+
+        case 12: // ORR
+            if (d->I) {
+                Emit_OR_Reg_Imm32(ECX_Reg, d->Reserved3);               // OR ECX, Immediate
+            } else {
+                Emit_OR_Reg_DWORDPTR(ECX_Reg, &Cpu.GPRs[Rm]);           // OR ECX, Cpu.GPRs[Rm]
+            }
+            break;
+
+        default:
+            ASSERT(FALSE);
+            break;
+        }
+        break;
+    }
+    LogPlace((CodeLocation,"DataProcessing Opcode=%d Rd=%d\n", d->Opcode, d->Rd));
+
+    CodeLocation = PlaceConditionFlags(CodeLocation, d, fCNZFlagsLoaded, false, &SkipCond);
+    Emit_CMOVcc_Reg_DWORDPTR(SkipCond, ECX_Reg, &Cpu.GPRs[d->Rd]);      // CMOVcc ECX, Cpu.GPRs[Rd] - keep Rd if skipped
+    Emit_MOV_DWORDPTR_Reg(&Cpu.GPRs[d->Rd], ECX_Reg);                   // MOV Cpu.GPRs[Rd], ECX
+
+    return CodeLocation;
+}
+
 void PlaceEndConditionCheck(unsigned __int8* CodeLocation)
 {
     while(BigSkipCount){
@@ -7169,6 +7485,7 @@ size_t JitGenerateCode(unsigned __int8 *OriginalCodeLocation, int EntrypointCoun
     unsigned __int8 *CodeLocation = OriginalCodeLocation;
     PENTRYPOINT ep;
     unsigned __int32 PreviousCond;
+    bool fPredicated;
 
     ep = NULL;
     PreviousCond = 16; // start with an illegal value
@@ -7202,12 +7519,25 @@ size_t JitGenerateCode(unsigned __int8 *OriginalCodeLocation, int EntrypointCoun
 #if ENTRYPOINT_HITCOUNTS
             Emit8(0xff); EmitModRmReg(0,5,0); EmitPtr(&ep->HitCount);    // INC ep->HitCount
 #endif // ENTRYPOINT_HITCOUNTS
+            if (Instructions[i].PollingLoopHead) {
+                Emit8(0xc6); EmitModRmReg(0,5,0); EmitPtr(&BoardTimeVaryingRead); Emit8(0); // MOV BoardTimeVaryingRead, 0
+            }
         }
 
+        if (Instructions[i].Cond < 14) {
+            JitConditionalCount++;
+        }
+        fPredicated = false;
         if(Instructions[i].Cond != PreviousCond) {
             PlaceEndConditionCheck(CodeLocation);
             PreviousCond = Instructions[i].Cond;
-            if(PreviousCond < 14){
+            if (PreviousCond < 14 && JitCanPredicate(i)) {
+                // A lone conditional ALU instruction is generated without a
+                // branch.  It leaves no condition check open for the next one.
+                fPredicated = true;
+                PreviousCond = 16;
+                JitPredicatedCount++;
+            } else if(PreviousCond < 14){
                 BigSkips1[BigSkipCount] = NULL;
                 BigSkips2[BigSkipCount] = NULL;
                 CodeLocation = PlaceConditionCheck(CodeLocation, &Instructions[i], &BigSkips1[BigSkipCount], &BigSkips2[BigSkipCount]);
@@ -7253,7 +7583,11 @@ size_t JitGenerateCode(unsigned __int8 *OriginalCodeLocation, int EntrypointCoun
         LogPlace((CodeLocation,"%s %s %s", FlagStrings[Instructions[i].FlagsNeeded],
             FlagStrings[Instructions[i].FlagsSet], CondStrings[Instructions[i].Cond]));
 #endif
-        CodeLocation = (Instructions[i].fp)(CodeLocation, &Instructions[i]);
+        if (fPredicated) {
+            CodeLocation = PlacePredicatedDataProcessing(CodeLocation, &Instructions[i]);
+        } else {
+            CodeLocation = (Instructions[i].fp)(CodeLocation, &Instructions[i]);
+        }
     }
 
     PlaceEndConditionCheck(CodeLocation);
@@ -7297,6 +7631,7 @@ PVOID JitCompile(PENTRYPOINT ContainingEntrypoint, unsigned __int32 InstructionP
     size_t NativeSize;
     unsigned __int32 CachedMmuFaultStatus;
     unsigned __int32 CachedMmuFaultAddress;
+    TraceScope Trace("JitCompile", TraceJit, InstructionPointer);
 
     // Preserve the original MMU FaultAddress/FaultStatus values.  They'll be restored after the JIT
     // decoder and optimizer have finished using the MMU (unless the first instruction the JIT tries
@@ -7498,6 +7833,41 @@ void __fastcall CpuClearInterruptPending(void)
     LeaveCriticalSection(&InterruptLock);
 }
 
+// Note: this can be called on any thread, with or without the IOLock.  The board
+//       calls it only for the first interrupt posted since the CPU last called
+//       BoardDeliverPostedInterrupts(), so the InterruptLock is rarely contended.
+void __fastcall CpuPostInterrupt(void)
+{
+    EnterCriticalSection(&InterruptLock);
+    Cpu.DebuggerInterruptPending |= DEBUGGER_INTERRUPT_POSTED;
+    EnableInterruptOnPoll();
+    LeaveCriticalSection(&InterruptLock);
+
+    // Wake the CPU if it is idle.  See CpuSetInterruptPending().
+    SetEvent(hIdleEvent);
+}
+
+void __fastcall CpuGetPredicationCounts(unsigned __int32 *pConditional, unsigned __int32 *pPredicated)
+{
+    *pConditional = JitConditionalCount;
+    *pPredicated = JitPredicatedCount;
+}
+
+// Note: this is called on the profiler's sampling thread
+bool __fastcall CpuRequestProfileSample(void)
+{
+    bool fRequested = false;
+
+    EnterCriticalSection(&InterruptLock);
+    if ((Cpu.DebuggerInterruptPending & DEBUGGER_INTERRUPT_PROFILE) == 0) {
+        Cpu.DebuggerInterruptPending |= DEBUGGER_INTERRUPT_PROFILE;
+        EnableInterruptOnPoll();
+        fRequested = true;
+    }
+    LeaveCriticalSection(&InterruptLock);
+    return fRequested;
+}
+
 void __fastcall CpuFlushCachedTranslations(void)
 {
     StackCount=0;
@@ -115,6 +115,8 @@ typedef enum _PrivModeValue {
 // Values for Cpu.DebuggerInterruptPending
 #define DEBUGGER_INTERRUPT_BREAKPOINT   1
 #define DEBUGGER_INTERRUPT_BREAKIN      2
+#define DEBUGGER_INTERRUPT_PROFILE      4   // the profiler wants a PC sample (/profile)
+#define DEBUGGER_INTERRUPT_POSTED       8   // a device has posted interrupts, see CpuPostInterrupt()
 
 typedef struct _CPU {
 	unsigned __int32 GPRs[16];	// R0...R15
@@ -210,6 +212,7 @@ typedef struct _Decoded{
 	unsigned __int32 X1:4;		
 	unsigned __int32 X2:12;
 	unsigned __int32 R15Modified:1;	// set if the instruction is known to modify R15
+	unsigned __int32 PollingLoopHead:1; // set if the instruction begins a loop placed by PlacePollingLoop
 
     // Bits used by DSP instructions
 	unsigned __int32 X:1;
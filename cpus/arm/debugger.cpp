@@ -25,6 +25,7 @@
 #include "ARMCpu.h"
 #include "tc.h"
 #include "mmu.h"
+#include "profiler.h"
 
 
 #ifndef InitializeListHead
@@ -245,15 +246,27 @@ typedef
         
     } CONTEXT_ARM3, *PCONTEXT_ARM3;
 
-typedef struct {
+typedef struct _DEBUGGER_BREAKPOINT {
     LIST_ENTRY Entry;               // This must be the first field in the structure
+    struct _DEBUGGER_BREAKPOINT *pHashNext; // Next breakpoint in the same m_BreakpointHash bucket
     unsigned __int32 GuestAddress;  // Breakpoint address
     bool fIsVirtual;                // True if virtual, false if physical
     DWORD dwBypassCount;            // Count that the BP should hit before actually breaking (-1 = no count)
     DWORD dwBypassOccurrences;      // Count of times that the BP has actually been hit
 } DEBUGGER_BREAKPOINT;
 
-class CEmulatorDebugger : public IDeviceEmulatorDebugger
+// The decoder asks whether each instruction has a breakpoint.  Breakpoints are
+// summarized by guest page, so that it can rule out nearly every instruction
+// without taking m_Lock.
+#define BREAKPOINT_PAGE_SHIFT           12
+#define BREAKPOINT_PAGE_BITMAP_LONGS    ((0xffffffff >> BREAKPOINT_PAGE_SHIFT) / 32 + 1)
+#define BREAKPOINT_HASH_BUCKETS         256 // must be a power of 2
+
+// Guest memory is copied in spans that stay within one of these:  the smallest
+// ARM page, so one translation covers the whole span.
+#define DEBUGGER_MEMORY_CHUNK           0x400
+
+class CEmulatorDebugger : public IDeviceEmulatorDebugger2
 {
 public:
     // IUnknown methods:
@@ -336,6 +349,17 @@ public:
         /* [in] */ DWORD dwContextSize,
         /* [in] */ DWORD dwCpuNum);
 
+    // IDeviceEmulatorDebugger2
+    virtual HRESULT STDMETHODCALLTYPE ReadMemoryRanges( 
+        /* [in] */ boolean fIsVirtual,
+        /* [in] */ DWORD dwRangeCount,
+        /* [size_is][in] */ const DWORD64 *pAddresses,
+        /* [size_is][in] */ const DWORD *pNumBytesToRead,
+        /* [in] */ DWORD dwCpuNum,
+        /* [in] */ DWORD dwBufferSize,
+        /* [size_is][out] */ BYTE *pbReadBuffer,
+        /* [size_is][out] */ DWORD *pNumBytesActuallyRead);
+
     // Other methods
     CEmulatorDebugger();
     ~CEmulatorDebugger();
@@ -345,12 +369,22 @@ public:
 
 private:
     PVOID NotifyDebugger(unsigned __int32 InstructionPointer, DEVICEEMULATOR_HALT_REASON_TYPE HaltReason, DWORD dwCode);
+    void UpdateBreakpointPage(unsigned __int32 GuestAddress, bool fIsVirtual);
+    HRESULT CopyGuestMemory(unsigned __int32 GuestAddress, bool fIsVirtual, bool fWrite,
+                            BYTE *pbBuffer, DWORD NumBytes, DWORD *pNumBytesCopied);
+
+    static inline unsigned __int32 BreakpointHash(unsigned __int32 GuestAddress)
+        { return (GuestAddress >> 1) & (BREAKPOINT_HASH_BUCKETS-1); }
 
     ULONG m_RefCount;
     IDeviceEmulatorDebuggerHaltNotificationSink *m_pHaltNotification;
     CRITICAL_SECTION m_Lock;
     unsigned __int32 m_SingleStepCount;
     LIST_ENTRY m_BreakpointList;       // List of DEBUGGER_BREAKPOINT structures
+    DEBUGGER_BREAKPOINT *m_BreakpointHash[BREAKPOINT_HASH_BUCKETS]; // The same breakpoints, by address
+    // Bit n is set while a breakpoint is in guest page n.  Indexed by fIsVirtual.
+    // Written under m_Lock, read without it.
+    volatile LONG m_BreakpointPages[2][BREAKPOINT_PAGE_BITMAP_LONGS];
     bool m_fTranslationCacheFlushed;
 };
 
@@ -366,6 +400,8 @@ CEmulatorDebugger::CEmulatorDebugger() :
 {
     InitializeCriticalSection(&m_Lock);
     InitializeListHead(&m_BreakpointList);
+    memset(m_BreakpointHash, 0, sizeof(m_BreakpointHash));
+    memset((void*)m_BreakpointPages, 0, sizeof(m_BreakpointPages));
 }
 
 CEmulatorDebugger::~CEmulatorDebugger()
@@ -382,7 +418,8 @@ CEmulatorDebugger::~CEmulatorDebugger()
 
 HRESULT STDMETHODCALLTYPE CEmulatorDebugger::QueryInterface(REFIID inInterfaceID,void** outInterface)
 {
-    if (inInterfaceID == IID_IUnknown || inInterfaceID == IID_IDeviceEmulatorDebugger) {
+    if (inInterfaceID == IID_IUnknown || inInterfaceID == IID_IDeviceEmulatorDebugger ||
+        inInterfaceID == IID_IDeviceEmulatorDebugger2) {
         AddRef();
         *outInterface = (void*)this;
         return S_OK;
@@ -515,30 +552,12 @@ HRESULT STDMETHODCALLTYPE CEmulatorDebugger::ReadVirtualMemory(
         return E_INVALIDARG;
     }
 
-    DWORD GuestAddress = (DWORD)Address;
-    __int8 TLBCache = 0;
-    DWORD BytesRead;
-    HRESULT hr = S_OK;
+    HRESULT hr;
 
     EnterCriticalSection(&m_Lock);
-    for (BytesRead=0; BytesRead < NumBytesToRead; ++BytesRead) {
-        size_t HostAddress = Mmu.MmuMapRead.MapGuestVirtualToHost(GuestAddress+BytesRead, &TLBCache);
-        if (HostAddress == 0) {
-            // Don't allow access to I/O space.  If anything goes wrong, the peripheral device will TerminateWithMessage()
-            //if (BoardIOAddress) {
-            //    pbReadBuffer[BytesRead] = IOReadByte(&IOIndexHint);
-            //} else {
-                hr = HRESULT_FROM_WIN32(ERROR_NOACCESS);
-                break; // invalid address hit
-            //}
-        } else {
-            pbReadBuffer[BytesRead] = *(unsigned __int8*)HostAddress;
-        }
-    }
+    hr = CopyGuestMemory((unsigned __int32)Address, true, false, pbReadBuffer, NumBytesToRead, pNumBytesActuallyRead);
     LeaveCriticalSection(&m_Lock);
 
-    *pNumBytesActuallyRead = BytesRead;
-
     return hr;
 }
     
@@ -555,30 +574,12 @@ HRESULT STDMETHODCALLTYPE CEmulatorDebugger::WriteVirtualMemory(
         return E_INVALIDARG;
     }
 
-    DWORD GuestAddress = (DWORD)Address;
-    __int8 TLBCache = 0;
-    DWORD BytesWritten;
-    HRESULT hr = S_OK;
+    HRESULT hr;
 
     EnterCriticalSection(&m_Lock);
-    for (BytesWritten=0; BytesWritten < NumBytesToWrite; ++BytesWritten) {
-        size_t HostAddress = Mmu.MmuMapWrite.MapGuestVirtualToHost(GuestAddress+BytesWritten, &TLBCache);
-        if (HostAddress == 0) {
-            // Don't allow access to I/O space.  If anything goes wrong, the peripheral device will TerminateWithMessage()
-            //if (BoardIOAddress) {
-            //    IOWriteByte(pbWriteBuffer[BytesWritten], &IOIndexHint);
-            //} else {
-                hr = HRESULT_FROM_WIN32(ERROR_NOACCESS);
-                break; // invalid address hit
-            //}
-        } else {
-            *(unsigned __int8*)HostAddress = pbWriteBuffer[BytesWritten];
-        }
-    }
+    hr = CopyGuestMemory((unsigned __int32)Address, true, true, (BYTE*)pbWriteBuffer, NumBytesToWrite, pNumBytesActuallyWritten);
     LeaveCriticalSection(&m_Lock);
 
-    *pNumBytesActuallyWritten = BytesWritten;
-
     return hr;
 }
 
@@ -599,30 +600,12 @@ HRESULT STDMETHODCALLTYPE CEmulatorDebugger::ReadPhysicalMemory(
         return E_INVALIDARG;
     }
 
-    DWORD GuestAddress = (DWORD)Address;
-    DWORD BytesRead;
-    HRESULT hr = S_OK;
+    HRESULT hr;
 
     EnterCriticalSection(&m_Lock);
-    for (BytesRead=0; BytesRead < NumBytesToRead; ++BytesRead) {
-        size_t HostAdjust;
-        size_t HostAddress = BoardMapGuestPhysicalToHost(GuestAddress+BytesRead, &HostAdjust);
-        if (HostAddress == 0) {
-            // Don't allow access to I/O space.  If anything goes wrong, the peripheral device will TerminateWithMessage()
-            //if (BoardIOAddress) {
-            //    pbReadBuffer[BytesRead] = IOReadByte(&IOIndexHint);
-            //} else {
-                hr = HRESULT_FROM_WIN32(ERROR_NOACCESS);
-                break; // invalid address hit
-            //}
-        } else {
-            pbReadBuffer[BytesRead] = *(unsigned __int8*)HostAddress;
-        }
-    }
+    hr = CopyGuestMemory((unsigned __int32)Address, false, false, pbReadBuffer, NumBytesToRead, pNumBytesActuallyRead);
     LeaveCriticalSection(&m_Lock);
 
-    *pNumBytesActuallyRead = BytesRead;
-
     return hr;
 }
 
@@ -643,30 +626,110 @@ HRESULT STDMETHODCALLTYPE CEmulatorDebugger::WritePhysicalMemory(
         return E_INVALIDARG;
     }
 
-    DWORD GuestAddress = (DWORD)Address;
-    DWORD BytesWritten;
+    HRESULT hr;
+
+    EnterCriticalSection(&m_Lock);
+    hr = CopyGuestMemory((unsigned __int32)Address, false, true, (BYTE*)pbWriteBuffer, NumBytesToWrite, pNumBytesActuallyWritten);
+    LeaveCriticalSection(&m_Lock);
+
+    return hr;
+}
+
+    
+HRESULT STDMETHODCALLTYPE CEmulatorDebugger::ReadMemoryRanges( 
+        /* [in] */ boolean fIsVirtual,
+        /* [in] */ DWORD dwRangeCount,
+        /* [size_is][in] */ const DWORD64 *pAddresses,
+        /* [size_is][in] */ const DWORD *pNumBytesToRead,
+        /* [in] */ DWORD dwCpuNum,
+        /* [in] */ DWORD dwBufferSize,
+        /* [size_is][out] */ BYTE *pbReadBuffer,
+        /* [size_is][out] */ DWORD *pNumBytesActuallyRead)
+{
+    DWORD64 TotalBytes = 0;
+    DWORD i;
+
+    if (dwCpuNum != 0) {
+        return E_INVALIDARG;
+    }
+    for (i=0; i<dwRangeCount; ++i) {
+        if (pAddresses[i] > 0xffffffff || pAddresses[i]+(DWORD64)pNumBytesToRead[i] > 0x100000000ull) {
+            return E_INVALIDARG;
+        }
+        TotalBytes += pNumBytesToRead[i];
+    }
+    if (TotalBytes > dwBufferSize) {
+        return E_INVALIDARG;
+    }
+
+    // The ranges are packed into pbReadBuffer in order, each taking its full
+    // requested size whether or not it could all be read.
     HRESULT hr = S_OK;
+    BYTE *pb = pbReadBuffer;
 
+    memset(pbReadBuffer, 0, dwBufferSize);
     EnterCriticalSection(&m_Lock);
-    for (BytesWritten=0; BytesWritten < NumBytesToWrite; ++BytesWritten) {
-        size_t HostAdjust;
-        size_t HostAddress = BoardMapGuestPhysicalToHostWrite(GuestAddress+BytesWritten, &HostAdjust);
+    for (i=0; i<dwRangeCount; ++i) {
+        HRESULT hrRange = CopyGuestMemory((unsigned __int32)pAddresses[i], (fIsVirtual) ? true : false, false,
+                                          pb, pNumBytesToRead[i], &pNumBytesActuallyRead[i]);
+        if (FAILED(hrRange)) {
+            hr = hrRange;  // keep going:  the caller checks pNumBytesActuallyRead for each range
+        }
+        pb += pNumBytesToRead[i];
+    }
+    LeaveCriticalSection(&m_Lock);
+
+    return hr;
+}
+
+// Copies between guest memory and pbBuffer, translating each DEBUGGER_MEMORY_CHUNK
+// only once.  Stops at the first byte that is not RAM or flash.  m_Lock must be held.
+HRESULT CEmulatorDebugger::CopyGuestMemory(unsigned __int32 GuestAddress, bool fIsVirtual, bool fWrite,
+                                           BYTE *pbBuffer, DWORD NumBytes, DWORD *pNumBytesCopied)
+{
+    __int8 TLBCache = 0;
+    DWORD BytesCopied = 0;
+    HRESULT hr = S_OK;
+
+    ASSERT_CRITSEC_OWNED(m_Lock);
+
+    while (BytesCopied < NumBytes) {
+        unsigned __int32 ChunkAddress = GuestAddress+BytesCopied;
+        DWORD ChunkSize = DEBUGGER_MEMORY_CHUNK - (ChunkAddress & (DEBUGGER_MEMORY_CHUNK-1));
+        size_t HostAddress;
+
+        if (ChunkSize > NumBytes-BytesCopied) {
+            ChunkSize = NumBytes-BytesCopied;
+        }
+        if (fIsVirtual) {
+            if (fWrite) {
+                HostAddress = Mmu.MmuMapWrite.MapGuestVirtualToHost(ChunkAddress, &TLBCache);
+            } else {
+                HostAddress = Mmu.MmuMapRead.MapGuestVirtualToHost(ChunkAddress, &TLBCache);
+            }
+        } else {
+            size_t HostAdjust;
+
+            if (fWrite) {
+                HostAddress = BoardMapGuestPhysicalToHostWrite(ChunkAddress, &HostAdjust);
+            } else {
+                HostAddress = BoardMapGuestPhysicalToHost(ChunkAddress, &HostAdjust);
+            }
+        }
         if (HostAddress == 0) {
             // Don't allow access to I/O space.  If anything goes wrong, the peripheral device will TerminateWithMessage()
-            //if (BoardIOAddress) {
-            //    IOWriteByte(pbWriteBuffer[BytesWritten], &IOIndexHint);
-            //} else {
-                hr = HRESULT_FROM_WIN32(ERROR_NOACCESS);
-                break; // invalid address hit
-            //}
+            hr = HRESULT_FROM_WIN32(ERROR_NOACCESS);
+            break; // invalid address hit
+        }
+        if (fWrite) {
+            memcpy((void*)HostAddress, pbBuffer+BytesCopied, ChunkSize);
         } else {
-            *(unsigned __int8*)HostAddress = pbWriteBuffer[BytesWritten];
+            memcpy(pbBuffer+BytesCopied, (const void*)HostAddress, ChunkSize);
         }
+        BytesCopied += ChunkSize;
     }
-    LeaveCriticalSection(&m_Lock);
-
-    *pNumBytesActuallyWritten = BytesWritten;
 
+    *pNumBytesCopied = BytesCopied;
     return hr;
 }
 
@@ -691,6 +754,9 @@ HRESULT STDMETHODCALLTYPE CEmulatorDebugger::AddCodeBreakpoint(
     p->dwBypassCount = dwBypassCount;
     p->dwBypassOccurrences = 0;
     InsertHeadList(&m_BreakpointList, (LIST_ENTRY*)p);
+    p->pHashNext = m_BreakpointHash[BreakpointHash(p->GuestAddress)];
+    m_BreakpointHash[BreakpointHash(p->GuestAddress)] = p;
+    UpdateBreakpointPage(p->GuestAddress, p->fIsVirtual);
 
     // Flush the TC for this instruction.  Size needs to be only long enough to
     // represent a Thumb breakpoint.
@@ -732,10 +798,39 @@ HRESULT STDMETHODCALLTYPE CEmulatorDebugger::DeleteBreakpoint(
     FlushTranslationCache(p->GuestAddress, 2);
     m_fTranslationCacheFlushed = true;
     RemoveEntryList(&p->Entry);
+    for (DEBUGGER_BREAKPOINT **pp = &m_BreakpointHash[BreakpointHash(p->GuestAddress)]; *pp; pp = &(*pp)->pHashNext) {
+        if (*pp == p) {
+            *pp = p->pHashNext;
+            break;
+        }
+    }
+    UpdateBreakpointPage(p->GuestAddress, p->fIsVirtual);
     LeaveCriticalSection(&m_Lock);
     return S_OK;
 }
 
+// Sets or clears the page bit for GuestAddress, according to whether any
+// breakpoint of the same kind remains in its page.  m_Lock must be held.
+void CEmulatorDebugger::UpdateBreakpointPage(unsigned __int32 GuestAddress, bool fIsVirtual)
+{
+    const unsigned __int32 Page = GuestAddress >> BREAKPOINT_PAGE_SHIFT;
+    volatile LONG *pBits = &m_BreakpointPages[fIsVirtual][Page / 32];
+    const LONG Mask = (LONG)(1u << (Page % 32));
+    LIST_ENTRY *pList;
+
+    ASSERT_CRITSEC_OWNED(m_Lock);
+
+    for (pList = m_BreakpointList.Flink; pList != &m_BreakpointList; pList = pList->Flink) {
+        DEBUGGER_BREAKPOINT *p = (DEBUGGER_BREAKPOINT*)pList;
+
+        if (p->fIsVirtual == fIsVirtual && (p->GuestAddress >> BREAKPOINT_PAGE_SHIFT) == Page) {
+            *pBits |= Mask;
+            return;
+        }
+    }
+    *pBits &= ~Mask;
+}
+
     
 HRESULT STDMETHODCALLTYPE CEmulatorDebugger::SetContext( 
         /* [size_is][out][in] */ BYTE *pbContext,
@@ -869,12 +964,14 @@ PVOID CEmulatorDebugger::DebugEntry(unsigned __int32 InstructionPointer, EARMExc
         // be reported even if the same instruction is the target of a breakpoint
         // or single-step.  All debugger events should pre-empt an IRQ, so that
         // single-steps do not step into interrupts.
+        // Profile and posted-interrupt requests are left pending:  their
+        // requesters do not ask again until they have been served.
         if (Cpu.DebuggerInterruptPending & DEBUGGER_INTERRUPT_BREAKIN) {
-            Cpu.DebuggerInterruptPending = 0;
+            Cpu.DebuggerInterruptPending &= ~(DEBUGGER_INTERRUPT_BREAKIN|DEBUGGER_INTERRUPT_BREAKPOINT);
             dwCode = STATUS_BREAKPOINT;
             HaltReason = haltreasonUser;
         } else if (Cpu.DebuggerInterruptPending & DEBUGGER_INTERRUPT_BREAKPOINT) {
-            Cpu.DebuggerInterruptPending = 0;
+            Cpu.DebuggerInterruptPending &= ~DEBUGGER_INTERRUPT_BREAKPOINT;
             dwCode = STATUS_BREAKPOINT;
             HaltReason = haltreasonBp;
         } else if (Cpu.IRQInterruptPending && Cpu.CPSR.Bits.IRQDisable == 0) {
@@ -944,17 +1041,20 @@ PVOID CEmulatorDebugger::SingleStepEntry(unsigned __int32 InstructionPointer)
 //       address to guest physical and making the comparison based on guest physical.
 bool CEmulatorDebugger::DebugHardwareBreakpointPresent(unsigned __int32 InstructionPointer)
 {
+    // Virtual breakpoints apply while the MMU is enabled, physical ones while it is disabled
+    const bool fIsVirtual = (Mmu.ControlRegister.Bits.M != 0);
+    const unsigned __int32 Page = InstructionPointer >> BREAKPOINT_PAGE_SHIFT;
+
+    if (((unsigned __int32)m_BreakpointPages[fIsVirtual][Page / 32] & (1u << (Page % 32))) == 0) {
+        return false;   // the common case:  no breakpoint anywhere in this page
+    }
+
     EnterCriticalSection(&m_Lock);
-    LIST_ENTRY *pList = m_BreakpointList.Flink;
-    while (pList != &m_BreakpointList) {
-        DEBUGGER_BREAKPOINT *p = (DEBUGGER_BREAKPOINT*)pList;
-        if ( (   (p->fIsVirtual && Mmu.ControlRegister.Bits.M)          // virtual address and MMU is enabled
-              || (!p->fIsVirtual && Mmu.ControlRegister.Bits.M == 0))   // physical address and MMU is disabled
-              && p->GuestAddress == InstructionPointer) {
+    for (DEBUGGER_BREAKPOINT *p = m_BreakpointHash[BreakpointHash(InstructionPointer)]; p; p = p->pHashNext) {
+        if (p->fIsVirtual == fIsVirtual && p->GuestAddress == InstructionPointer) {
             LeaveCriticalSection(&m_Lock);
             return true;
         }
-        pList = pList->Flink;
     }
     LeaveCriticalSection(&m_Lock);
     return false;
@@ -1001,6 +1101,23 @@ Returns:
 
 --*/
 {
+    if (etReason == etDebuggerInterrupt && (Cpu.DebuggerInterruptPending & DEBUGGER_INTERRUPT_PROFILE)) {
+        EnterCriticalSection(&InterruptLock);
+        Cpu.DebuggerInterruptPending &= ~DEBUGGER_INTERRUPT_PROFILE;
+        UpdateInterruptOnPoll();
+        LeaveCriticalSection(&InterruptLock);
+        ProfilerRecordSample(MmuActualGuestAddress(InstructionPointer), Cpu.CPSR.Bits.Mode);
+    }
+    if (etReason == etDebuggerInterrupt && (Cpu.DebuggerInterruptPending & DEBUGGER_INTERRUPT_POSTED)) {
+        // Clear the request before delivering, so that an interrupt posted
+        // during delivery asks again.
+        EnterCriticalSection(&InterruptLock);
+        Cpu.DebuggerInterruptPending &= ~DEBUGGER_INTERRUPT_POSTED;
+        UpdateInterruptOnPoll();
+        LeaveCriticalSection(&InterruptLock);
+        BoardDeliverPostedInterrupts(); // may set Cpu.IRQInterruptPending, which is checked below
+    }
+
     if (g_pDebugger) {
         return g_pDebugger->DebugEntry(InstructionPointer, etReason);
     } else if (etReason == etDebuggerInterrupt && Cpu.IRQInterruptPending && Cpu.CPSR.Bits.IRQDisable == 0) {
@@ -0,0 +1,1506 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+
+
+JIT verification (/jitverify) runs short instruction streams through both the
+JIT and a reference interpreter, and compares the registers, flags and memory
+that each leaves behind.  The interpreter works from the Decoded IR as
+JitDecode() produces it, before JitOptimizeIR() and OptimizeARMFlags() rewrite
+it, so any difference points at an optimization or at a Place* function.
+
+Each stream is a single block:  straight-line code ending in an undefined
+instruction.  The undefined-instruction vector is never compiled, so the
+jitted code returns to CpuVerifyJit() as soon as it raises the exception, with
+the block's results in the CPU state.  The streams are:
+
+  - random ARM and Thumb blocks built from the instruction classes the
+    interpreter supports, biased towards the patterns JitOptimizeIR() looks
+    for:  literal-pool loads, STR then LDR through SP, and MVN then ADD.
+  - the recorded streams in RecordedStreams[] below.  Paste a block from the
+    report there to keep it as a regression test.
+
+Everything runs twice:  once with the MMU off, and once with a flat 1:1
+section map in which the code is read-only, which is what lets JitOptimizeIR()
+inline literal-pool loads.  Guest RAM is used from the start of physical RAM:
+
+  +0x200000 - the block being verified, followed by its literal pool
+  +0x300000 - the data window the loads and stores use
+  +0x400000 - the translation table for the MMU-on pass
+
+--*/
+
+#include "emulator.h"
+#include "Config.h"
+#include "Cpu.h"
+#include "entrypt.h"
+#include "ARMCpu.h"
+#include "mmu.h"
+#include "State.h"
+#include "Board.h"
+#include "tc.h"
+#include "resource.h"
+
+// Defined in armcpu.cpp
+extern Decoded Instructions[];
+extern unsigned __int32 NumberOfInstructions;
+void JitDecode(PENTRYPOINT ContainingEntrypoint, unsigned __int32 InstructionPointer);
+PVOID JitCompile(PENTRYPOINT ContainingEntrypoint, unsigned __int32 InstructionPointer);
+void __fastcall RunTranslatedCode(void *NativeAddress);
+unsigned __int8* PlaceDataProcessing(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceSingleDataTransfer(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceBlockDataTransfer(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceNop(unsigned __int8* CodeLocation, Decoded* d);
+unsigned __int8* PlaceArithmeticExtension(unsigned __int8* CodeLocation, Decoded* d);
+unsigned __int8* PlaceLoadStoreExtension(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceDoubleLoadStoreExtension(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceQADD(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceDSPMul(unsigned __int8* CodeLocation, Decoded *d);
+unsigned __int8* PlaceThumbLoadAddressPC(unsigned __int8* CodeLocation, Decoded* d);
+unsigned __int8* PlaceRaiseUndefinedException(unsigned __int8* CodeLocation, Decoded* d);
+
+#define JITVERIFY_CODE_OFFSET       0x200000
+#define JITVERIFY_DATA_OFFSET       0x300000
+#define JITVERIFY_TABLE_OFFSET      0x400000
+#define JITVERIFY_CODE_SIZE         0x400
+#define JITVERIFY_DATA_SIZE         0x1000
+
+// Random blocks per instruction set per MMU pass, and the number of random
+// initial states each recorded stream is run from
+#define JITVERIFY_RANDOM_BLOCKS     5000
+#define JITVERIFY_RECORDED_RUNS     16
+// Longest random block, not counting the end marker
+#define JITVERIFY_MAX_BLOCK         24
+#define JITVERIFY_LITERAL_COUNT     8
+// Mismatches described in full in the report.  The rest are only counted.
+#define JITVERIFY_REPORT_LIMIT      25
+
+#define JITVERIFY_ARM_END           0xe7f000f0  // permanently undefined
+#define JITVERIFY_THUMB_END         0xdefe      // undefined (conditional branch with cond=AL)
+
+// Fixed registers in the random blocks.  Loads and stores address the data
+// window through the base registers and the index register, which hold the
+// values below and are only changed by writeback.
+#define ARM_BASE1                   R8
+#define ARM_BASE2                   R9
+#define ARM_INDEX                   R10
+#define THUMB_INDEX                 R5
+#define THUMB_BASE1                 R6
+#define THUMB_BASE2                 R7
+#define BASE1_OFFSET                0x400
+#define BASE2_OFFSET                0xc00
+#define STACK_OFFSET                0x800
+
+#define PSR_FLAGS_MASK              0xf8000000  // N, Z, C, V and Q
+
+typedef enum {
+    ReferenceExecuted,
+    ReferenceUnsupported,   // an instruction the interpreter does not implement
+    ReferenceOutOfRange     // an access outside the data window, or unaligned
+} ReferenceResult;
+
+typedef struct {
+    unsigned __int32 GPRs[16];
+    unsigned __int32 PSR;       // only the PSR_FLAGS_MASK bits are used
+} ReferenceState;
+
+typedef struct {
+    const char *Name;
+    bool Thumb;
+    size_t Size;                // bytes, including the end marker and any literal pool
+    const void *Code;
+} RecordedStream;
+
+typedef struct {
+    unsigned __int32 Blocks;
+    unsigned __int32 Skipped;
+    unsigned __int32 Mismatches;
+} VerifyCounts;
+
+static const unsigned __int32 RecordedArmStoreLoadSP[] = {
+    0xe58d1010, // str r1, [sp, #16]
+    0xe59d2010, // ldr r2, [sp, #16]
+    0x058d3014, // streq r3, [sp, #20]
+    0x059d4014, // ldreq r4, [sp, #20]
+    0xe7f000f0, // end
+};
+
+static const unsigned __int32 RecordedArmMvnAdd[] = {
+    0xe3e010ff, // mvn r1, #255
+    0xe0821001, // add r1, r2, r1
+    0xe3e03001, // mvn r3, #1
+    0xe0833003, // add r3, r3, r3
+    0x13e04c01, // mvnne r4, #256
+    0x10854004, // addne r4, r5, r4
+    0xe7f000f0, // end
+};
+
+static const unsigned __int32 RecordedArmLiteralPool[] = {
+    0xe59f1008, // ldr r1, [pc, #8]
+    0xe59f2008, // ldr r2, [pc, #8]
+    0xc59f3000, // ldrgt r3, [pc, #0]
+    0xe7f000f0, // end
+    0x12345678, // literal
+    0x80000001, // literal
+};
+
+static const unsigned __int32 RecordedArmConditionalFlags[] = {
+    0xe3b01000, // movs r1, #0
+    0x02112001, // andseq r2, r1, #1
+    0x03a03001, // moveq r3, #1
+    0xe0944005, // adds r4, r4, r5
+    0xe0b66007, // adcs r6, r6, r7
+    0xe1b0e064, // movs lr, r4, rrx
+    0xe7f000f0, // end
+};
+
+static const unsigned __int16 RecordedThumbStoreLoadSP[] = {
+    0x9101,     // str r1, [sp, #4]
+    0x9a01,     // ldr r2, [sp, #4]
+    0xb406,     // push {r1, r2}
+    0xbc18,     // pop {r3, r4}
+    0xdefe,     // end
+    0x0000,
+};
+
+static const unsigned __int16 RecordedThumbLiteralPool[] = {
+    0x4901,     // ldr r1, [pc, #4]
+    0x4a02,     // ldr r2, [pc, #8]
+    0xa301,     // add r3, pc, #4
+    0xdefe,     // end
+    0x5678,     // literal 0x12345678
+    0x1234,
+    0x0001,     // literal 0x80000001
+    0x8000,
+};
+
+static const RecordedStream RecordedStreams[] = {
+    {"STR/LDR through SP", false, sizeof(RecordedArmStoreLoadSP), RecordedArmStoreLoadSP},
+    {"MVN then ADD", false, sizeof(RecordedArmMvnAdd), RecordedArmMvnAdd},
+    {"Literal pool", false, sizeof(RecordedArmLiteralPool), RecordedArmLiteralPool},
+    {"Conditional flags", false, sizeof(RecordedArmConditionalFlags), RecordedArmConditionalFlags},
+    {"Thumb STR/LDR through SP", true, sizeof(RecordedThumbStoreLoadSP), RecordedThumbStoreLoadSP},
+    {"Thumb literal pool", true, sizeof(RecordedThumbLiteralPool), RecordedThumbLiteralPool},
+};
+
+static unsigned __int32 VerifyCodeAddress;
+static unsigned __int8 *VerifyCodeHost;
+static unsigned __int32 VerifyDataAddress;
+static unsigned __int8 *VerifyDataHost;
+static unsigned __int8 ReferenceData[JITVERIFY_DATA_SIZE];     // the interpreter's copy of the data window
+static unsigned __int8 InitialData[JITVERIFY_DATA_SIZE];
+static Decoded ReferenceInstructions[JITVERIFY_MAX_BLOCK+JITVERIFY_LITERAL_COUNT];
+static unsigned __int32 ReferenceInstructionCount;
+
+static unsigned __int32 RandomState = 0x2545f491;
+static FILE *ReportFile;
+static unsigned __int32 ReportedMismatches;
+
+static unsigned __int32 __fastcall Random(void)
+{
+    // xorshift32:  a fixed seed keeps runs reproducible
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+    return RandomState;
+}
+
+static unsigned __int32 __fastcall RandomBelow(unsigned __int32 Limit)
+{
+    return Random() % Limit;
+}
+
+static unsigned __int32 __fastcall RandomPick(const unsigned __int8 *Choices, unsigned __int32 Count)
+{
+    return Choices[RandomBelow(Count)];
+}
+
+// Values that sit on the edges of the flag calculations, mixed with random ones
+static unsigned __int32 __fastcall RandomValue(void)
+{
+    static const unsigned __int32 Interesting[] = {
+        0, 1, 2, 0x1f, 0x20, 0x21, 0xff, 0x7fff, 0x8000, 0xffff,
+        0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff
+    };
+
+    switch (RandomBelow(4)) {
+    case 0:
+        return Interesting[RandomBelow(ARRAY_SIZE(Interesting))];
+    case 1:
+        return RandomBelow(64);     // a useful shift amount
+    default:
+        return Random();
+    }
+}
+
+//
+// Reference interpreter
+//
+
+static bool __fastcall ReferenceConditionPassed(unsigned __int32 PSR, unsigned __int32 Cond)
+{
+    bool N = (PSR >> PSR_NEGATIVE_FLAG) & 1;
+    bool Z = (PSR >> PSR_ZERO_FLAG) & 1;
+    bool C = (PSR >> PSR_CARRY_FLAG) & 1;
+    bool V = (PSR >> PSR_OVERFLOW_FLAG) & 1;
+
+    switch (Cond) {
+    case 0:  return Z;              // EQ
+    case 1:  return !Z;             // NE
+    case 2:  return C;              // CS
+    case 3:  return !C;             // CC
+    case 4:  return N;              // MI
+    case 5:  return !N;             // PL
+    case 6:  return V;              // VS
+    case 7:  return !V;             // VC
+    case 8:  return C && !Z;        // HI
+    case 9:  return !C || Z;        // LS
+    case 10: return N == V;         // GE
+    case 11: return N != V;         // LT
+    case 12: return !Z && N == V;   // GT
+    case 13: return Z || N != V;    // LE
+    default: return true;           // AL, and NV for the instructions the decoder maps to AL
+    }
+}
+
+static void __fastcall ReferenceSetFlag(ReferenceState *s, int Flag, bool Value)
+{
+    s->PSR = (s->PSR & ~(1u << Flag)) | ((unsigned __int32)Value << Flag);
+}
+
+static void __fastcall ReferenceSetNZ(ReferenceState *s, unsigned __int32 Result)
+{
+    ReferenceSetFlag(s, PSR_NEGATIVE_FLAG, (Result >> 31) != 0);
+    ReferenceSetFlag(s, PSR_ZERO_FLAG, Result == 0);
+}
+
+// Reads a register as an operand:  R15 reads as the address of the
+// instruction plus 8 (ARM) or 4 (Thumb).
+static unsigned __int32 __fastcall ReferenceRead(const ReferenceState *s, const Decoded *d, unsigned __int32 Reg, bool Thumb)
+{
+    if (Reg == R15) {
+        return d->GuestAddress + (Thumb ? 4 : 8);
+    }
+    return s->GPRs[Reg];
+}
+
+// Maps a guest address to the interpreter's copy of the data window, or to
+// the code (read-only) for PC-relative loads
+static unsigned __int8 * __fastcall ReferenceMap(unsigned __int32 Address, unsigned __int32 Size, bool Write)
+{
+    if (Address & (Size-1)) {
+        // ARM rotates unaligned word loads, which the random blocks never do
+        return NULL;
+    }
+    if (Address - VerifyDataAddress < JITVERIFY_DATA_SIZE) {
+        return &ReferenceData[Address - VerifyDataAddress];
+    }
+    if (!Write && Address - VerifyCodeAddress < JITVERIFY_CODE_SIZE) {
+        return &VerifyCodeHost[Address - VerifyCodeAddress];
+    }
+    return NULL;
+}
+
+static bool __fastcall ReferenceLoad(unsigned __int32 Address, unsigned __int32 Size, unsigned __int32 *pValue)
+{
+    unsigned __int8 *p = ReferenceMap(Address, Size, false);
+
+    if (p == NULL) {
+        return false;
+    }
+    switch (Size) {
+    case 1:  *pValue = *p; break;
+    case 2:  *pValue = *(unsigned __int16 *)p; break;
+    default: *pValue = *(unsigned __int32 *)p; break;
+    }
+    return true;
+}
+
+static bool __fastcall ReferenceStore(unsigned __int32 Address, unsigned __int32 Size, unsigned __int32 Value)
+{
+    unsigned __int8 *p = ReferenceMap(Address, Size, true);
+
+    if (p == NULL) {
+        return false;
+    }
+    switch (Size) {
+    case 1:  *p = (unsigned __int8)Value; break;
+    case 2:  *(unsigned __int16 *)p = (unsigned __int16)Value; break;
+    default: *(unsigned __int32 *)p = Value; break;
+    }
+    return true;
+}
+
+// Computes a register-form shifter operand or load/store offset, as the ARM ARM
+// describes in A5.1.  Returns false for the forms the interpreter does not model.
+static bool __fastcall ReferenceShift(const ReferenceState *s, const Decoded *d, unsigned __int32 Operand2, bool Thumb,
+                                      unsigned __int32 *pValue, bool *pCarry)
+{
+    unsigned __int32 Value = ReferenceRead(s, d, Operand2 & 0xf, Thumb);
+    unsigned __int32 Type = (Operand2 >> 5) & 3;
+    bool Carry = (s->PSR >> PSR_CARRY_FLAG) & 1;
+    unsigned __int32 Amount;
+
+    if (Operand2 & 0x10) {
+        // Shift by register.  R15 as any operand reads 12 ahead in this form.
+        if ((Operand2 & 0xf) == R15 || ((Operand2 >> 8) & 0xf) == R15) {
+            return false;
+        }
+        Amount = s->GPRs[(Operand2 >> 8) & 0xf] & 0xff;
+        if (Amount == 0) {
+            // Value and carry are unchanged
+        } else if (Type == 0) { // LSL
+            Carry = (Amount <= 32) ? ((Value >> (32-Amount)) & 1) != 0 : false;
+            Value = (Amount < 32) ? Value << Amount : 0;
+        } else if (Type == 1) { // LSR
+            Carry = (Amount <= 32) ? ((Value >> (Amount-1)) & 1) != 0 : false;
+            Value = (Amount < 32) ? Value >> Amount : 0;
+        } else if (Type == 2) { // ASR
+            if (Amount < 32) {
+                Carry = ((Value >> (Amount-1)) & 1) != 0;
+                Value = (unsigned __int32)((__int32)Value >> Amount);
+            } else {
+                Carry = (Value >> 31) != 0;
+                Value = (Carry) ? 0xffffffff : 0;
+            }
+        } else {                // ROR
+            Amount &= 31;
+            if (Amount == 0) {
+                Carry = (Value >> 31) != 0;
+            } else {
+                Carry = ((Value >> (Amount-1)) & 1) != 0;
+                Value = _rotr(Value, Amount);
+            }
+        }
+    } else {
+        Amount = (Operand2 >> 7) & 0x1f;
+        if (Type == 0) {        // LSL
+            if (Amount) {
+                Carry = ((Value >> (32-Amount)) & 1) != 0;
+                Value <<= Amount;
+            }
+        } else if (Type == 1) { // LSR, where 0 encodes 32
+            if (Amount) {
+                Carry = ((Value >> (Amount-1)) & 1) != 0;
+                Value >>= Amount;
+            } else {
+                Carry = (Value >> 31) != 0;
+                Value = 0;
+            }
+        } else if (Type == 2) { // ASR, where 0 encodes 32
+            if (Amount) {
+                Carry = ((Value >> (Amount-1)) & 1) != 0;
+                Value = (unsigned __int32)((__int32)Value >> Amount);
+            } else {
+                Carry = (Value >> 31) != 0;
+                Value = (Carry) ? 0xffffffff : 0;
+            }
+        } else if (Amount) {    // ROR
+            Carry = ((Value >> (Amount-1)) & 1) != 0;
+            Value = _rotr(Value, Amount);
+        } else {                // RRX
+            bool OldCarry = Carry;
+
+            Carry = (Value & 1) != 0;
+            Value = (Value >> 1) | ((unsigned __int32)OldCarry << 31);
+        }
+    }
+    *pValue = Value;
+    *pCarry = Carry;
+    return true;
+}
+
+static ReferenceResult __fastcall ReferenceDataProcessing(ReferenceState *s, const Decoded *d, bool Thumb)
+{
+    unsigned __int32 Op1;
+    unsigned __int32 Op2 = 0;
+    unsigned __int32 Result;
+    unsigned __int64 Wide;
+    bool Carry = false;
+    bool CarryIn = (s->PSR >> PSR_CARRY_FLAG) & 1;
+    bool Arithmetic = true;
+    bool Overflow = false;
+
+    if (d->R15Modified) {
+        return ReferenceUnsupported;
+    }
+    if (d->I) {
+        // The decoder leaves the rotated immediate in Reserved3
+        Op2 = d->Reserved3;
+        Carry = (d->Operand2 & 0xf00) ? (Op2 >> 31) != 0 : CarryIn;
+    } else if (!ReferenceShift(s, d, d->Operand2, Thumb, &Op2, &Carry)) {
+        return ReferenceUnsupported;
+    }
+    Op1 = ReferenceRead(s, d, d->Rn, Thumb);
+
+    switch (d->Opcode) {
+    case 0:  // AND
+    case 8:  // TST
+        Result = Op1 & Op2;
+        Arithmetic = false;
+        break;
+    case 1:  // EOR
+    case 9:  // TEQ
+        Result = Op1 ^ Op2;
+        Arithmetic = false;
+        break;
+    case 12: // ORR
+        Result = Op1 | Op2;
+        Arithmetic = false;
+        break;
+    case 13: // MOV
+        Result = Op2;
+        Arithmetic = false;
+        break;
+    case 14: // BIC
+        Result = Op1 & ~Op2;
+        Arithmetic = false;
+        break;
+    case 15: // MVN
+        Result = ~Op2;
+        Arithmetic = false;
+        break;
+    case 2:  // SUB
+    case 10: // CMP
+        Op2 = ~Op2;
+        CarryIn = true;
+        goto AddWithCarry;
+    case 3:  // RSB
+        Op1 = ~Op1;
+        CarryIn = true;
+        goto AddWithCarry;
+    case 6:  // SBC
+        Op2 = ~Op2;
+        goto AddWithCarry;
+    case 7:  // RSC
+        Op1 = ~Op1;
+        goto AddWithCarry;
+    case 4:  // ADD
+    case 11: // CMN
+        CarryIn = false;
+        // fall through
+    case 5:  // ADC
+AddWithCarry:
+        // Subtraction is addition of the complement with a carry in, so one
+        // calculation covers every arithmetic opcode.
+        Wide = (unsigned __int64)Op1 + Op2 + CarryIn;
+        Result = (unsigned __int32)Wide;
+        Carry = (Wide >> 32) != 0;
+        Overflow = ((~(Op1 ^ Op2) & (Op1 ^ Result)) >> 31) != 0;
+        break;
+    default:
+        return ReferenceUnsupported;
+    }
+
+    if (d->Opcode < 8 || d->Opcode > 11) {
+        s->GPRs[d->Rd] = Result;
+    }
+    if (d->S) {
+        ReferenceSetNZ(s, Result);
+        ReferenceSetFlag(s, PSR_CARRY_FLAG, Carry);
+        if (Arithmetic) {
+            ReferenceSetFlag(s, PSR_OVERFLOW_FLAG, Overflow);
+        }
+    }
+    return ReferenceExecuted;
+}
+
+static ReferenceResult __fastcall ReferenceMultiply(ReferenceState *s, const Decoded *d)
+{
+    // Bits 19-16 are in d->Rd and bits 15-12 in d->Rn:  Rd and Rn for MUL and
+    // MLA, RdHi and RdLo for the long multiplies.
+    unsigned __int32 Rm = s->GPRs[d->Rm];
+    unsigned __int32 Rs = s->GPRs[d->Rs];
+    unsigned __int64 Result;
+
+    switch (d->Op1) {
+    case 0: // MUL
+    case 1: // MLA
+        Result = (unsigned __int32)(Rm * Rs + ((d->Op1) ? s->GPRs[d->Rn] : 0));
+        s->GPRs[d->Rd] = (unsigned __int32)Result;
+        if (d->S) {
+            ReferenceSetNZ(s, (unsigned __int32)Result);
+        }
+        return ReferenceExecuted;
+
+    case 4: // UMULL
+    case 5: // UMLAL
+        Result = (unsigned __int64)Rm * Rs;
+        break;
+
+    case 6: // SMULL
+    case 7: // SMLAL
+        Result = (unsigned __int64)((__int64)(__int32)Rm * (__int32)Rs);
+        break;
+
+    default:
+        return ReferenceUnsupported;
+    }
+    if (d->Op1 & 1) {
+        Result += ((unsigned __int64)s->GPRs[d->Rd] << 32) | s->GPRs[d->Rn];
+    }
+    s->GPRs[d->Rn] = (unsigned __int32)Result;
+    s->GPRs[d->Rd] = (unsigned __int32)(Result >> 32);
+    if (d->S) {
+        // The multiplies leave C and V unchanged on ARMv5
+        ReferenceSetFlag(s, PSR_NEGATIVE_FLAG, (Result >> 63) != 0);
+        ReferenceSetFlag(s, PSR_ZERO_FLAG, Result == 0);
+    }
+    return ReferenceExecuted;
+}
+
+static unsigned __int32 __fastcall ReferenceSaturate(ReferenceState *s, __int64 Value)
+{
+    if (Value > 0x7fffffff) {
+        ReferenceSetFlag(s, PSR_SATURATE_FLAG, true);
+        return 0x7fffffff;
+    } else if (Value < -(__int64)0x80000000) {
+        ReferenceSetFlag(s, PSR_SATURATE_FLAG, true);
+        return 0x80000000;
+    }
+    return (unsigned __int32)Value;
+}
+
+static ReferenceResult __fastcall ReferenceQADD(ReferenceState *s, const Decoded *d)
+{
+    __int64 Rm = (__int32)s->GPRs[d->Rm];
+    __int64 Rn = (__int32)s->GPRs[d->Rn];
+
+    if (d->Op1 & 2) {
+        // QDADD, QDSUB:  saturate 2*Rn first
+        Rn = (__int32)ReferenceSaturate(s, 2*Rn);
+    }
+    s->GPRs[d->Rd] = ReferenceSaturate(s, (d->Op1 & 1) ? Rm - Rn : Rm + Rn);
+    return ReferenceExecuted;
+}
+
+static ReferenceResult __fastcall ReferenceDSPMul(ReferenceState *s, const Decoded *d)
+{
+    // Bits 19-16 (d->Rn) are the destination, or RdHi for SMLAL<x><y>.  Bits
+    // 15-12 (d->Rd) are the accumulator, or RdLo.
+    unsigned __int32 Rm = s->GPRs[d->Rm];
+    unsigned __int32 Rs = s->GPRs[d->Rs];
+    __int32 RsHalf = (__int16)((d->Y) ? (Rs >> 16) : Rs);
+    __int32 RmHalf = (__int16)((d->X) ? (Rm >> 16) : Rm);
+    __int64 Result;
+
+    switch (d->Op1) {
+    case 0: // SMLA<x><y>
+        Result = (__int64)(RmHalf * RsHalf) + (__int32)s->GPRs[d->Rd];
+        if (Result != (__int32)Result) {
+            ReferenceSetFlag(s, PSR_SATURATE_FLAG, true);
+        }
+        s->GPRs[d->Rn] = (unsigned __int32)Result;
+        break;
+
+    case 1: // SMLAW<y>, or SMULW<y> when X is set
+        Result = ((__int64)(__int32)Rm * RsHalf) >> 16;
+        if (!d->X) {
+            Result = (__int64)(__int32)Result + (__int32)s->GPRs[d->Rd];
+            if (Result != (__int32)Result) {
+                ReferenceSetFlag(s, PSR_SATURATE_FLAG, true);
+            }
+        }
+        s->GPRs[d->Rn] = (unsigned __int32)Result;
+        break;
+
+    case 2: // SMLAL<x><y>
+        Result = (__int64)(((unsigned __int64)s->GPRs[d->Rn] << 32) | s->GPRs[d->Rd]);
+        Result += (__int64)(RmHalf * RsHalf);
+        s->GPRs[d->Rd] = (unsigned __int32)Result;
+        s->GPRs[d->Rn] = (unsigned __int32)((unsigned __int64)Result >> 32);
+        break;
+
+    default: // SMUL<x><y>
+        s->GPRs[d->Rn] = (unsigned __int32)(RmHalf * RsHalf);
+        break;
+    }
+    return ReferenceExecuted;
+}
+
+static ReferenceResult __fastcall ReferenceSingleDataTransfer(ReferenceState *s, const Decoded *d, bool Thumb)
+{
+    unsigned __int32 Base;
+    unsigned __int32 Offset;
+    unsigned __int32 Address;
+    unsigned __int32 Size = (d->B) ? 1 : 4;
+    unsigned __int32 Value = 0;
+    bool Carry;
+
+    if (d->R15Modified || (!d->L && d->Rd == R15)) {
+        return ReferenceUnsupported;
+    }
+    if (d->Rn == R15 && d->I == 0) {
+        // The decoder precomputes PC+/-offset, word-aligned for Thumb
+        Base = d->Reserved3;
+        Offset = 0;
+    } else {
+        Base = ReferenceRead(s, d, d->Rn, Thumb);
+        if (d->I) {
+            if (!ReferenceShift(s, d, d->Offset & 0xfff, Thumb, &Offset, &Carry)) {
+                return ReferenceUnsupported;
+            }
+        } else {
+            Offset = d->Offset;
+        }
+        if (!d->U) {
+            Offset = 0-Offset;
+        }
+    }
+    Address = (d->P) ? Base+Offset : Base;
+
+    if (d->L) {
+        if (!ReferenceLoad(Address, Size, &Value)) {
+            return ReferenceOutOfRange;
+        }
+    } else if (!ReferenceStore(Address, Size, s->GPRs[d->Rd])) {
+        return ReferenceOutOfRange;
+    }
+    if (d->W) {
+        s->GPRs[d->Rn] = Base+Offset;
+    }
+    if (d->L) {
+        s->GPRs[d->Rd] = Value;
+    }
+    return ReferenceExecuted;
+}
+
+static ReferenceResult __fastcall ReferenceLoadStoreExtension(ReferenceState *s, const Decoded *d, bool Thumb)
+{
+    unsigned __int32 Base = ReferenceRead(s, d, d->Rn, Thumb);
+    unsigned __int32 Offset;
+    unsigned __int32 Address;
+    unsigned __int32 Value = 0;
+
+    if (d->Op1 == 0) {
+        // SWP, SWPB
+        unsigned __int32 Size = (d->B) ? 1 : 4;
+
+        if (!ReferenceLoad(Base, Size, &Value) || !ReferenceStore(Base, Size, s->GPRs[d->Rm])) {
+            return ReferenceOutOfRange;
+        }
+        s->GPRs[d->Rd] = Value;
+        return ReferenceExecuted;
+    }
+    if (d->R15Modified || d->Rd == R15) {
+        return ReferenceUnsupported;
+    }
+
+    // Reserved3 is bit 22:  set for an immediate offset
+    Offset = (d->Reserved3) ? d->Offset : s->GPRs[d->Rm];
+    if (!d->U) {
+        Offset = 0-Offset;
+    }
+    Address = (d->P) ? Base+Offset : Base;
+
+    if (d->L) {
+        switch (d->Op1) {
+        case 1: // LDRH
+            if (!ReferenceLoad(Address, 2, &Value)) {
+                return ReferenceOutOfRange;
+            }
+            break;
+        case 2: // LDRSB
+            if (!ReferenceLoad(Address, 1, &Value)) {
+                return ReferenceOutOfRange;
+            }
+            Value = (unsigned __int32)(__int32)(__int8)Value;
+            break;
+        default: // LDRSH
+            if (!ReferenceLoad(Address, 2, &Value)) {
+                return ReferenceOutOfRange;
+            }
+            Value = (unsigned __int32)(__int32)(__int16)Value;
+            break;
+        }
+    } else if (d->Op1 != 1 || !ReferenceStore(Address, 2, s->GPRs[d->Rd])) {
+        // Stores other than STRH are LDRD/STRD, which decode separately
+        return (d->Op1 != 1) ? ReferenceUnsupported : ReferenceOutOfRange;
+    }
+    if (d->W) {
+        s->GPRs[d->Rn] = Base+Offset;
+    }
+    if (d->L) {
+        s->GPRs[d->Rd] = Value;
+    }
+    return ReferenceExecuted;
+}
+
+static ReferenceResult __fastcall ReferenceDoubleLoadStore(ReferenceState *s, const Decoded *d, bool Thumb)
+{
+    unsigned __int32 Base = ReferenceRead(s, d, d->Rn, Thumb);
+    unsigned __int32 Offset;
+    unsigned __int32 Address;
+    unsigned __int32 Low = 0;
+    unsigned __int32 High = 0;
+
+    // I is set for an immediate offset, which is split across the Rs and Rm fields
+    Offset = (d->I) ? ((d->Rs << 4) | d->Rm) : s->GPRs[d->Rm];
+    if (!d->U) {
+        Offset = 0-Offset;
+    }
+    Address = (d->P) ? Base+Offset : Base;
+    if (Address & 7) {
+        // Unpredictable.  The JIT rounds the address down.
+        return ReferenceOutOfRange;
+    }
+
+    // d->L is set for LDRD
+    if (d->L) {
+        if (!ReferenceLoad(Address, 4, &Low) || !ReferenceLoad(Address+4, 4, &High)) {
+            return ReferenceOutOfRange;
+        }
+    } else if (!ReferenceStore(Address, 4, s->GPRs[d->Rd]) || !ReferenceStore(Address+4, 4, s->GPRs[d->Rd+1])) {
+        return ReferenceOutOfRange;
+    }
+    if (d->W) {
+        s->GPRs[d->Rn] = Base+Offset;
+    }
+    if (d->L) {
+        s->GPRs[d->Rd] = Low;
+        s->GPRs[d->Rd+1] = High;
+    }
+    return ReferenceExecuted;
+}
+
+static ReferenceResult __fastcall ReferenceBlockDataTransfer(ReferenceState *s, const Decoded *d)
+{
+    unsigned __int32 Count = 0;
+    unsigned __int32 Base = s->GPRs[d->Rn];
+    unsigned __int32 Address;
+    unsigned __int32 Loaded[16];
+    unsigned __int32 i;
+
+    if (d->S || d->R15Modified || (d->RegisterList & (1 << R15)) || d->RegisterList == 0) {
+        // User-bank transfers, loads of the PC and stores of it are not modeled
+        return ReferenceUnsupported;
+    }
+    for (i=0; i<16; ++i) {
+        if (d->RegisterList & (1 << i)) {
+            Count++;
+        }
+    }
+    // The lowest register always goes at the lowest address
+    if (d->U) {
+        Address = (d->P) ? Base+4 : Base;
+    } else {
+        Address = (d->P) ? Base-4*Count : Base-4*Count+4;
+    }
+    for (i=0; i<16; ++i) {
+        if (d->RegisterList & (1 << i)) {
+            if (d->L) {
+                if (!ReferenceLoad(Address, 4, &Loaded[i])) {
+                    return ReferenceOutOfRange;
+                }
+            } else if (!ReferenceStore(Address, 4, s->GPRs[i])) {
+                return ReferenceOutOfRange;
+            }
+            Address += 4;
+        }
+    }
+    if (d->W) {
+        s->GPRs[d->Rn] = (d->U) ? Base+4*Count : Base-4*Count;
+    }
+    if (d->L) {
+        for (i=0; i<16; ++i) {
+            if (d->RegisterList & (1 << i)) {
+                s->GPRs[i] = Loaded[i];
+            }
+        }
+    }
+    return ReferenceExecuted;
+}
+
+// Executes one decoded instruction against the reference state
+static ReferenceResult __fastcall ReferenceExecute(ReferenceState *s, const Decoded *d, bool Thumb)
+{
+    if (!ReferenceConditionPassed(s->PSR, d->Cond)) {
+        return ReferenceExecuted;
+    }
+    if (d->fp == PlaceDataProcessing) {
+        return ReferenceDataProcessing(s, d, Thumb);
+    } else if (d->fp == PlaceSingleDataTransfer) {
+        return ReferenceSingleDataTransfer(s, d, Thumb);
+    } else if (d->fp == PlaceLoadStoreExtension) {
+        return ReferenceLoadStoreExtension(s, d, Thumb);
+    } else if (d->fp == PlaceDoubleLoadStoreExtension) {
+        return ReferenceDoubleLoadStore(s, d, Thumb);
+    } else if (d->fp == PlaceBlockDataTransfer) {
+        return ReferenceBlockDataTransfer(s, d);
+    } else if (d->fp == PlaceArithmeticExtension) {
+        return ReferenceMultiply(s, d);
+    } else if (d->fp == PlaceQADD) {
+        return ReferenceQADD(s, d);
+    } else if (d->fp == PlaceDSPMul) {
+        return ReferenceDSPMul(s, d);
+    } else if (d->fp == PlaceThumbLoadAddressPC) {
+        s->GPRs[d->Rd] = ((d->GuestAddress+4) & 0xfffffffc) + d->Word8*4;
+        return ReferenceExecuted;
+    } else if (d->fp == PlaceNop) {
+        return ReferenceExecuted;
+    }
+    // Branches, exceptions, coprocessors and PSR transfers
+    return ReferenceUnsupported;
+}
+
+//
+// Random block generator.  Each function appends one instruction, or a pair,
+// at Code[*pCount].
+//
+
+static const unsigned __int8 ArmDestinations[] = {R0, R1, R2, R3, R4, R5, R6, R7, R11, R12, R14};
+static const unsigned __int8 ArmSources[] = {R0, R1, R2, R3, R4, R5, R6, R7, R8, R9, R10, R11, R12, R13, R14};
+static const unsigned __int8 ArmBases[] = {ARM_BASE1, ARM_BASE2, R13};
+static const unsigned __int8 ThumbLowDestinations[] = {R0, R1, R2, R3, R4};
+static const unsigned __int8 ThumbHighDestinations[] = {R0, R1, R2, R3, R4, R8, R9, R10, R11, R12, R14};
+static const unsigned __int8 ThumbBases[] = {THUMB_BASE1, THUMB_BASE2};
+
+#define ArmDestination()    RandomPick(ArmDestinations, ARRAY_SIZE(ArmDestinations))
+#define ArmSource()         RandomPick(ArmSources, ARRAY_SIZE(ArmSources))
+#define ArmBase()           RandomPick(ArmBases, ARRAY_SIZE(ArmBases))
+#define ThumbDestination()  RandomPick(ThumbLowDestinations, ARRAY_SIZE(ThumbLowDestinations))
+#define ThumbSource()       RandomBelow(8)
+
+static unsigned __int32 __fastcall ArmCondition(void)
+{
+    // Mostly unconditional, so that most instructions execute
+    return (RandomBelow(4) == 0) ? RandomBelow(14) : 14;
+}
+
+static unsigned __int32 __fastcall ArmShifterOperand(void)
+{
+    if (RandomBelow(2)) {
+        // Shift by immediate
+        return (RandomBelow(32) << 7) | (RandomBelow(4) << 5) | ArmSource();
+    }
+    // Shift by register
+    return (ArmSource() << 8) | (RandomBelow(4) << 5) | 0x10 | ArmSource();
+}
+
+static void __fastcall GenerateArmDataProcessing(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 Opcode = RandomBelow(16);
+    unsigned __int32 S = (Opcode >= 8 && Opcode <= 11) ? 1 : RandomBelow(2);   // S=0 is MRS/MSR there
+    unsigned __int32 I = RandomBelow(2);
+    unsigned __int32 Operand2 = (I) ? (RandomBelow(16) << 8) | RandomBelow(256) : ArmShifterOperand();
+
+    Code[(*pCount)++] = (ArmCondition() << 28) | (I << 25) | (Opcode << 21) | (S << 20) |
+                        (ArmSource() << 16) | (ArmDestination() << 12) | Operand2;
+}
+
+static void __fastcall GenerateArmMultiply(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    static const unsigned __int8 Ops[] = {0, 1, 4, 5, 6, 7};
+    unsigned __int32 Op1 = RandomPick(Ops, ARRAY_SIZE(Ops));
+    unsigned __int32 Rd = ArmDestination();
+    unsigned __int32 Rn;
+    unsigned __int32 Rm;
+
+    // Rd, RdLo and Rm must all differ on ARMv4.  Bits 15-12 must be zero for MUL.
+    if (Op1 == 0) {
+        Rn = R0;
+    } else if (Op1 == 1) {
+        Rn = ArmSource();
+    } else {
+        do {
+            Rn = ArmDestination();
+        } while (Rn == Rd);
+    }
+    do {
+        Rm = ArmSource();
+    } while (Rm == Rd || (Op1 >= 4 && Rm == Rn));
+
+    Code[(*pCount)++] = (ArmCondition() << 28) | (Op1 << 21) | (RandomBelow(2) << 20) |
+                        (Rd << 16) | (Rn << 12) | (ArmSource() << 8) | 0x90 | Rm;
+}
+
+static void __fastcall GenerateArmDSP(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 Rd = ArmDestination();
+    unsigned __int32 Rn;
+
+    if (RandomBelow(3) == 0) {
+        // QADD, QSUB, QDADD, QDSUB
+        Code[(*pCount)++] = (ArmCondition() << 28) | 0x01000050 | (RandomBelow(4) << 21) |
+                            (ArmSource() << 16) | (Rd << 12) | ArmSource();
+        return;
+    }
+    // SMLA<x><y>, SMLAW<y>/SMULW<y>, SMLAL<x><y>, SMUL<x><y>
+    unsigned __int32 Op1 = RandomBelow(4);
+
+    do {
+        Rn = (Op1 == 2) ? ArmDestination() : ArmSource();
+    } while (Op1 == 2 && Rn == Rd);
+    Code[(*pCount)++] = (ArmCondition() << 28) | 0x01000080 | (Op1 << 21) | (Rd << 16) | (Rn << 12) |
+                        (ArmSource() << 8) | (RandomBelow(4) << 5) | ArmSource();
+}
+
+static void __fastcall GenerateArmLoadStore(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 L = RandomBelow(2);
+    unsigned __int32 B = RandomBelow(2);
+    unsigned __int32 P = (RandomBelow(4) != 0);
+    unsigned __int32 W = (P) ? (RandomBelow(4) == 0) : 0;
+    unsigned __int32 Rn = (P && !W) ? ArmBase() : RandomBelow(2) + ARM_BASE1;
+    unsigned __int32 Rd = (L) ? ArmDestination() : ArmSource();
+    unsigned __int32 I = RandomBelow(2);
+    unsigned __int32 Offset;
+
+    if (!L && (P == 0 || W) && Rd == Rn) {
+        Rd = R0;
+    }
+    if (I) {
+        // [Rn, +/-index, LSL #0-2], keeping word accesses aligned
+        Offset = (((B) ? RandomBelow(3) : 0) << 7) | ARM_INDEX;
+    } else if (P == 0 || W) {
+        // Keep writeback small, so the base stays inside the data window
+        Offset = RandomBelow(5) * ((B) ? 1 : 4);
+    } else {
+        Offset = RandomBelow(64) * ((B) ? 1 : 4);
+    }
+    Code[(*pCount)++] = (ArmCondition() << 28) | 0x04000000 | (I << 25) | (P << 24) | (RandomBelow(2) << 23) |
+                        (B << 22) | (W << 21) | (L << 20) | (Rn << 16) | (Rd << 12) | Offset;
+}
+
+static void __fastcall GenerateArmHalfword(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 L = RandomBelow(2);
+    unsigned __int32 SH = (L) ? RandomBelow(3) + 1 : 1;    // LDRH, LDRSB, LDRSH, or STRH
+    unsigned __int32 P = (RandomBelow(4) != 0);
+    unsigned __int32 W = (P) ? (RandomBelow(4) == 0) : 0;
+    unsigned __int32 Rn = RandomBelow(2) + ARM_BASE1;
+    unsigned __int32 Rd = (L) ? ArmDestination() : ArmSource();
+    unsigned __int32 I = RandomBelow(2);
+    unsigned __int32 Offset;
+
+    if (!L && (P == 0 || W) && Rd == Rn) {
+        Rd = R0;
+    }
+    if (I) {
+        Offset = ((SH == 2) ? RandomBelow(64) : RandomBelow(32)*2);
+        Offset = ((Offset & 0xf0) << 4) | (Offset & 0xf);
+    } else {
+        Offset = ARM_INDEX;
+    }
+    Code[(*pCount)++] = (ArmCondition() << 28) | (P << 24) | (RandomBelow(2) << 23) | (I << 22) | (W << 21) |
+                        (L << 20) | (Rn << 16) | (Rd << 12) | 0x90 | (SH << 5) | Offset;
+}
+
+static void __fastcall GenerateArmDoubleword(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    static const unsigned __int8 LoadPairs[] = {R0, R2, R4, R6};
+    static const unsigned __int8 StorePairs[] = {R0, R2, R4, R6, R8, R10, R12};
+    unsigned __int32 Load = RandomBelow(2);
+    unsigned __int32 Rd = (Load) ? RandomPick(LoadPairs, ARRAY_SIZE(LoadPairs)) : RandomPick(StorePairs, ARRAY_SIZE(StorePairs));
+    unsigned __int32 Offset = RandomBelow(32) * 8;
+
+    // LDRD/STRD Rd, [Rn, #+/-offset] with no writeback
+    Code[(*pCount)++] = (ArmCondition() << 28) | 0x01400000 | (1 << 24) | (RandomBelow(2) << 23) |
+                        (ArmBase() << 16) | (Rd << 12) | ((Offset & 0xf0) << 4) | ((Load) ? 0xd0 : 0xf0) | (Offset & 0xf);
+}
+
+static void __fastcall GenerateArmBlockTransfer(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 L = RandomBelow(2);
+    unsigned __int32 W = RandomBelow(2);
+    unsigned __int32 Rn = ArmBase();
+    unsigned __int32 List = 0;
+    unsigned __int32 Count = RandomBelow(6) + 1;
+
+    // At most six registers, so that writeback keeps the base inside the window
+    while (Count--) {
+        List |= 1 << ((L) ? ArmDestination() : ArmSource());
+    }
+    if (W) {
+        List &= ~(1 << Rn);
+        if (List == 0) {
+            List = 1;
+        }
+    }
+    Code[(*pCount)++] = (ArmCondition() << 28) | 0x08000000 | (RandomBelow(2) << 24) | (RandomBelow(2) << 23) |
+                        (W << 21) | (L << 20) | (Rn << 16) | List;
+}
+
+static void __fastcall GenerateArmSwap(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 Rn = RandomBelow(2) + ARM_BASE1;
+    unsigned __int32 Rm;
+
+    do {
+        Rm = ArmSource();
+    } while (Rm == Rn);
+    Code[(*pCount)++] = (ArmCondition() << 28) | 0x01000090 | (RandomBelow(2) << 22) |
+                        (Rn << 16) | (ArmDestination() << 12) | Rm;
+}
+
+// STR then LDR at the same offset from SP, which JitOptimizeIR() turns into a MOV
+static void __fastcall GenerateArmStoreLoadSP(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 Cond = ArmCondition();
+    unsigned __int32 U = RandomBelow(2);
+    unsigned __int32 Offset = RandomBelow(64) * 4;
+
+    Code[(*pCount)++] = (Cond << 28) | 0x05000000 | (U << 23) | (R13 << 16) | (ArmSource() << 12) | Offset;
+    Code[(*pCount)++] = (Cond << 28) | 0x05100000 | (U << 23) | (R13 << 16) | (ArmDestination() << 12) | Offset;
+}
+
+// MVN X, #imm then ADD X, Y, X, which JitOptimizeIR() folds into one ADD
+static void __fastcall GenerateArmMvnAdd(unsigned __int32 *Code, unsigned __int32 *pCount)
+{
+    unsigned __int32 Cond = ArmCondition();
+    unsigned __int32 Rd = ArmDestination();
+    unsigned __int32 Rn = (RandomBelow(4) == 0) ? Rd : ArmSource();
+
+    Code[(*pCount)++] = (Cond << 28) | 0x03e00000 | (Rd << 12) | (RandomBelow(16) << 8) | RandomBelow(256);
+    Code[(*pCount)++] = (Cond << 28) | 0x00800000 | (Rn << 16) | (Rd << 12) | Rd;
+}
+
+// LDR Rd, [PC, #offset] from the literal pool after the end marker
+static void __fastcall GenerateArmLiteral(unsigned __int32 *Code, unsigned __int32 *pCount, unsigned __int32 Length)
+{
+    unsigned __int32 Target = (Length+1 + RandomBelow(JITVERIFY_LITERAL_COUNT)) * 4;
+    unsigned __int32 Offset = Target - (*pCount*4 + 8);
+
+    Code[*pCount] = (ArmCondition() << 28) | 0x059f0000 | (ArmDestination() << 12) | Offset;
+    (*pCount)++;
+}
+
+// Fills Code with Length random instructions, the end marker and a literal pool.
+// Returns the size in bytes.
+static size_t __fastcall GenerateArmBlock(unsigned __int32 *Code, unsigned __int32 Length)
+{
+    unsigned __int32 Count = 0;
+    unsigned __int32 i;
+
+    while (Count < Length) {
+        unsigned __int32 Kind = RandomBelow(20);
+
+        if (Kind < 7) {
+            GenerateArmDataProcessing(Code, &Count);
+        } else if (Kind < 8) {
+            GenerateArmMultiply(Code, &Count);
+        } else if (Kind < 9) {
+            GenerateArmDSP(Code, &Count);
+        } else if (Kind < 12) {
+            GenerateArmLoadStore(Code, &Count);
+        } else if (Kind < 13) {
+            GenerateArmHalfword(Code, &Count);
+        } else if (Kind < 14) {
+            GenerateArmDoubleword(Code, &Count);
+        } else if (Kind < 15) {
+            GenerateArmBlockTransfer(Code, &Count);
+        } else if (Kind < 16) {
+            GenerateArmSwap(Code, &Count);
+        } else if (Kind < 18) {
+            GenerateArmLiteral(Code, &Count, Length);
+        } else if (Count+2 <= Length) {
+            if (Kind == 18) {
+                GenerateArmStoreLoadSP(Code, &Count);
+            } else {
+                GenerateArmMvnAdd(Code, &Count);
+            }
+        }
+    }
+    Code[Count++] = JITVERIFY_ARM_END;
+    for (i=0; i<JITVERIFY_LITERAL_COUNT; ++i) {
+        Code[Count++] = RandomValue();
+    }
+    return Count*4;
+}
+
+static unsigned __int16 __fastcall GenerateThumbInstruction(unsigned __int32 Index, unsigned __int32 LiteralPool)
+{
+    unsigned __int32 Rd = ThumbDestination();
+    unsigned __int32 Rb = RandomPick(ThumbBases, ARRAY_SIZE(ThumbBases));
+
+    switch (RandomBelow(17)) {
+    case 0: // LSL, LSR, ASR Rd, Rs, #imm
+        return (unsigned __int16)((RandomBelow(3) << 11) | (RandomBelow(32) << 6) | (ThumbSource() << 3) | Rd);
+
+    case 1: // ADD, SUB Rd, Rs, Rn or #imm3
+        return (unsigned __int16)(0x1800 | (RandomBelow(4) << 9) | (ThumbSource() << 6) | (ThumbSource() << 3) | Rd);
+
+    case 2: // MOV, CMP, ADD, SUB Rd, #imm8
+        return (unsigned __int16)(0x2000 | (RandomBelow(4) << 11) | (Rd << 8) | RandomBelow(256));
+
+    case 3:
+    case 4: // ALU operations, including MUL
+        return (unsigned __int16)(0x4000 | (RandomBelow(16) << 6) | (ThumbSource() << 3) | Rd);
+
+    case 5: // ADD, CMP, MOV with a high register
+        {
+            unsigned __int32 Op = RandomBelow(3);
+            unsigned __int32 Rs = ArmSource();
+
+            Rd = (Op == 1) ? ArmSource() : RandomPick(ThumbHighDestinations, ARRAY_SIZE(ThumbHighDestinations));
+            if (Rd < 8 && Rs < 8) {
+                Rs = R8;
+            }
+            return (unsigned __int16)(0x4400 | (Op << 8) | ((Rd >> 3) << 7) | ((Rs >> 3) << 6) | ((Rs & 7) << 3) | (Rd & 7));
+        }
+
+    case 6: // LDR Rd, [PC, #imm]
+        return (unsigned __int16)(0x4800 | (Rd << 8) |
+                                  ((LiteralPool + RandomBelow(JITVERIFY_LITERAL_COUNT)*4 - ((Index*2+4) & ~3)) >> 2));
+
+    case 7: // LDR, STR, LDRB, STRB Rd, [Rb, Ro]
+        {
+            unsigned __int32 L = RandomBelow(2);
+
+            return (unsigned __int16)(0x5000 | (L << 11) | (RandomBelow(2) << 10) | (THUMB_INDEX << 6) | (Rb << 3) |
+                                      ((L) ? Rd : ThumbSource()));
+        }
+
+    case 8: // STRH, LDSB, LDRH, LDSH Rd, [Rb, Ro]
+        {
+            unsigned __int32 Op = RandomBelow(4);
+
+            return (unsigned __int16)(0x5200 | (Op << 10) | (THUMB_INDEX << 6) | (Rb << 3) | ((Op) ? Rd : ThumbSource()));
+        }
+
+    case 9: // LDR, STR, LDRB, STRB Rd, [Rb, #imm]
+        {
+            unsigned __int32 L = RandomBelow(2);
+
+            return (unsigned __int16)(0x6000 | (RandomBelow(2) << 12) | (L << 11) | (RandomBelow(32) << 6) | (Rb << 3) |
+                                      ((L) ? Rd : ThumbSource()));
+        }
+
+    case 10: // LDRH, STRH Rd, [Rb, #imm]
+        {
+            unsigned __int32 L = RandomBelow(2);
+
+            return (unsigned __int16)(0x8000 | (L << 11) | (RandomBelow(32) << 6) | (Rb << 3) | ((L) ? Rd : ThumbSource()));
+        }
+
+    case 11: // LDR, STR Rd, [SP, #imm]
+        {
+            unsigned __int32 L = RandomBelow(2);
+
+            return (unsigned __int16)(0x9000 | (L << 11) | (((L) ? Rd : ThumbSource()) << 8) | RandomBelow(64));
+        }
+
+    case 12: // ADD Rd, PC or SP, #imm
+        return (unsigned __int16)(0xa000 | (RandomBelow(2) << 11) | (Rd << 8) | RandomBelow(256));
+
+    case 13: // ADD SP, #+/-imm
+        return (unsigned __int16)(0xb000 | (RandomBelow(2) << 7) | RandomBelow(9));
+
+    case 14: // PUSH {rlist, LR}, POP {rlist}
+        if (RandomBelow(2)) {
+            return (unsigned __int16)(0xb400 | (RandomBelow(2) << 8) | (RandomBelow(255)+1));
+        }
+        return (unsigned __int16)(0xbc00 | (RandomBelow(31)+1));
+
+    default: // LDMIA, STMIA Rb!, {rlist}
+        if (RandomBelow(2)) {
+            return (unsigned __int16)(0xc800 | (Rb << 8) | (RandomBelow(31)+1));
+        }
+        return (unsigned __int16)(0xc000 | (Rb << 8) | (RandomBelow(63)+1));
+    }
+}
+
+// Fills Code with Length random Thumb instructions, the end marker and a
+// literal pool.  Returns the size in bytes.
+static size_t __fastcall GenerateThumbBlock(unsigned __int16 *Code, unsigned __int32 Length)
+{
+    unsigned __int32 LiteralPool = ((Length+1)*2 + 3) & ~3;
+    unsigned __int32 Count;
+    unsigned __int32 i;
+
+    for (Count=0; Count < Length; ++Count) {
+        Code[Count] = GenerateThumbInstruction(Count, LiteralPool);
+    }
+    Code[Count++] = JITVERIFY_THUMB_END;
+    if (Count & 1) {
+        Code[Count++] = 0;
+    }
+    for (i=0; i<JITVERIFY_LITERAL_COUNT; ++i) {
+        unsigned __int32 Value = RandomValue();
+
+        Code[Count++] = (unsigned __int16)Value;
+        Code[Count++] = (unsigned __int16)(Value >> 16);
+    }
+    return Count*2;
+}
+
+static void __fastcall RandomInitialState(ReferenceState *s, bool Thumb)
+{
+    for (int i=0; i<15; ++i) {
+        s->GPRs[i] = RandomValue();
+    }
+    if (Thumb) {
+        s->GPRs[THUMB_BASE1] = VerifyDataAddress + BASE1_OFFSET;
+        s->GPRs[THUMB_BASE2] = VerifyDataAddress + BASE2_OFFSET;
+        s->GPRs[THUMB_INDEX] = RandomBelow(16)*4;
+    } else {
+        s->GPRs[ARM_BASE1] = VerifyDataAddress + BASE1_OFFSET;
+        s->GPRs[ARM_BASE2] = VerifyDataAddress + BASE2_OFFSET;
+        s->GPRs[ARM_INDEX] = RandomBelow(16)*4;
+    }
+    s->GPRs[R13] = VerifyDataAddress + STACK_OFFSET;
+    s->GPRs[R15] = VerifyCodeAddress;
+    s->PSR = Random() & PSR_FLAGS_MASK;
+}
+
+//
+// Running a block
+//
+
+// Switches back to System mode from the mode the block's exception left it in
+static void __fastcall ReturnToSystemMode(void)
+{
+    if (Cpu.CPSR.Bits.Mode != SystemModeValue) {
+        PSR_FULL SavedPSR;
+
+        SavedPSR.Word = Cpu.SPSR.Word;
+        SavedPSR.Bits.Mode = SystemModeValue;
+        UpdateCPSRWithFlags(SavedPSR);
+    }
+}
+
+static void __fastcall LoadCpuState(const ReferenceState *s, bool Thumb)
+{
+    PSR_FULL NewPSR;
+
+    NewPSR.Word = s->PSR;
+    NewPSR.Bits.Mode = SystemModeValue;
+    NewPSR.Bits.ThumbMode = Thumb;
+    NewPSR.Bits.IRQDisable = 1;
+    NewPSR.Bits.FIQDisable = 1;
+    UpdateCPSRWithFlags(NewPSR);
+    memcpy(Cpu.GPRs, s->GPRs, sizeof(Cpu.GPRs));
+}
+
+// Copies the block into guest RAM, discards old translations of it, and
+// decodes it the way the JIT will.  Returns false if the decoder does not stop
+// at the end marker.
+static bool __fastcall PrepareBlock(const void *Code, size_t Size, const ReferenceState *Initial, bool Thumb)
+{
+    unsigned __int32 EndAddress;
+    const Decoded *pLast;
+
+    memcpy(VerifyCodeHost, Code, Size);
+    FlushTranslationCache(0, 0xffffffff);
+
+    LoadCpuState(Initial, Thumb);
+    JitDecode(NULL, VerifyCodeAddress);
+    if (NumberOfInstructions == 0 || NumberOfInstructions > ARRAY_SIZE(ReferenceInstructions)) {
+        return false;
+    }
+    pLast = &Instructions[NumberOfInstructions-1];
+    EndAddress = VerifyCodeAddress;
+    while (EndAddress - VerifyCodeAddress < Size) {
+        if ((Thumb) ? *(unsigned __int16 *)&VerifyCodeHost[EndAddress - VerifyCodeAddress] == JITVERIFY_THUMB_END
+                    : *(unsigned __int32 *)&VerifyCodeHost[EndAddress - VerifyCodeAddress] == JITVERIFY_ARM_END) {
+            break;
+        }
+        EndAddress += (Thumb) ? 2 : 4;
+    }
+    if (pLast->fp != PlaceRaiseUndefinedException || pLast->GuestAddress != EndAddress) {
+        return false;
+    }
+    ReferenceInstructionCount = NumberOfInstructions-1;
+    memcpy(ReferenceInstructions, Instructions, ReferenceInstructionCount*sizeof(Decoded));
+    return true;
+}
+
+static void __fastcall ReportBlock(const char *Description, const void *Code, size_t Size, bool Thumb,
+                                   const ReferenceState *Initial)
+{
+    fprintf(ReportFile, "\n%s (%s, MMU %s)\n", Description, (Thumb) ? "Thumb" : "ARM",
+            (Mmu.ControlRegister.Bits.M) ? "on" : "off");
+    for (size_t i=0; i<Size; i += (Thumb) ? 2 : 4) {
+        if (Thumb) {
+            fprintf(ReportFile, "    0x%4.4x,     // %2.2x\n", *(unsigned __int16 *)((unsigned __int8 *)Code+i), (unsigned)i);
+        } else {
+            fprintf(ReportFile, "    0x%8.8x, // %2.2x\n", *(unsigned __int32 *)((unsigned __int8 *)Code+i), (unsigned)i);
+        }
+    }
+    fprintf(ReportFile, "  initial:");
+    for (int i=0; i<15; ++i) {
+        fprintf(ReportFile, " r%d=%8.8x", i, Initial->GPRs[i]);
+    }
+    fprintf(ReportFile, " psr=%8.8x\n", Initial->PSR);
+}
+
+// Runs one block through the interpreter and the JIT and compares the
+// results.  Returns false on a mismatch.
+static bool __fastcall VerifyBlock(const char *Description, const void *Code, size_t Size, bool Thumb,
+                                   const ReferenceState *Initial, VerifyCounts *pCounts)
+{
+    ReferenceState Reference = *Initial;
+    unsigned __int32 EndAddress;
+    unsigned __int32 JitPSR;
+    bool Matched = true;
+    unsigned __int32 i;
+
+    // Both sides start from the same random data
+    for (i=0; i<JITVERIFY_DATA_SIZE; i += 4) {
+        *(unsigned __int32 *)&InitialData[i] = Random();
+    }
+    memcpy(ReferenceData, InitialData, JITVERIFY_DATA_SIZE);
+    memcpy(VerifyDataHost, InitialData, JITVERIFY_DATA_SIZE);
+
+    pCounts->Blocks++;
+    if (!PrepareBlock(Code, Size, Initial, Thumb)) {
+        pCounts->Skipped++;
+        ReturnToSystemMode();
+        return true;
+    }
+    for (i=0; i<ReferenceInstructionCount; ++i) {
+        if (ReferenceExecute(&Reference, &ReferenceInstructions[i], Thumb) != ReferenceExecuted) {
+            pCounts->Skipped++;
+            return true;
+        }
+    }
+    EndAddress = ReferenceInstructions[ReferenceInstructionCount-1].GuestAddress + ((Thumb) ? 2 : 4);
+
+    // Run the jitted block.  The end marker raises an undefined instruction
+    // exception, whose vector has no translation, so it returns here.
+    LoadCpuState(Initial, Thumb);
+    Cpu.GPRs[R15] = VerifyCodeAddress;
+    RunTranslatedCode(JitCompile(NULL, VerifyCodeAddress));
+
+    if (Cpu.CPSR.Bits.Mode != UndefinedModeValue || Cpu.GPRs[R14] != EndAddress + ((Thumb) ? 2 : 4)) {
+        if (ReportedMismatches++ < JITVERIFY_REPORT_LIMIT) {
+            ReportBlock(Description, Code, Size, Thumb, Initial);
+            fprintf(ReportFile, "  the jitted block did not reach its end:  mode %u, r14 %8.8x\n",
+                    Cpu.CPSR.Bits.Mode, Cpu.GPRs[R14]);
+        }
+        pCounts->Mismatches++;
+        ReturnToSystemMode();
+        return false;
+    }
+    ReturnToSystemMode();
+    JitPSR = GetCPSRWithFlags() & PSR_FLAGS_MASK;
+
+    Matched = (memcmp(Cpu.GPRs, Reference.GPRs, 15*sizeof(unsigned __int32)) == 0 &&
+               JitPSR == Reference.PSR &&
+               memcmp(VerifyDataHost, ReferenceData, JITVERIFY_DATA_SIZE) == 0);
+    if (!Matched) {
+        pCounts->Mismatches++;
+        if (ReportedMismatches++ < JITVERIFY_REPORT_LIMIT) {
+            ReportBlock(Description, Code, Size, Thumb, Initial);
+            fprintf(ReportFile, "           reference   jit\n");
+            for (i=0; i<15; ++i) {
+                if (Cpu.GPRs[i] != Reference.GPRs[i]) {
+                    fprintf(ReportFile, "  r%-7u %8.8x    %8.8x\n", i, Reference.GPRs[i], Cpu.GPRs[i]);
+                }
+            }
+            if (JitPSR != Reference.PSR) {
+                fprintf(ReportFile, "  nzcvq    %8.8x    %8.8x\n", Reference.PSR, JitPSR);
+            }
+            for (i=0; i<JITVERIFY_DATA_SIZE; i += 4) {
+                if (*(unsigned __int32 *)&VerifyDataHost[i] != *(unsigned __int32 *)&ReferenceData[i]) {
+                    fprintf(ReportFile, "  [%8.8x] %8.8x    %8.8x\n", VerifyDataAddress+i,
+                            *(unsigned __int32 *)&ReferenceData[i], *(unsigned __int32 *)&VerifyDataHost[i]);
+                }
+            }
+        }
+    }
+    return Matched;
+}
+
+static void __fastcall VerifyPass(const char *PassName)
+{
+    VerifyCounts ArmCounts = {0};
+    VerifyCounts ThumbCounts = {0};
+    VerifyCounts RecordedCounts = {0};
+    ReferenceState Initial;
+    unsigned __int32 Code[JITVERIFY_MAX_BLOCK+1+JITVERIFY_LITERAL_COUNT];
+    size_t Size;
+    char Description[64];
+
+    for (unsigned __int32 i=0; i<ARRAY_SIZE(RecordedStreams); ++i) {
+        const RecordedStream *pStream = &RecordedStreams[i];
+
+        for (unsigned __int32 Run=0; Run<JITVERIFY_RECORDED_RUNS; ++Run) {
+            RandomInitialState(&Initial, pStream->Thumb);
+            VerifyBlock(pStream->Name, pStream->Code, pStream->Size, pStream->Thumb, &Initial, &RecordedCounts);
+        }
+    }
+    for (unsigned __int32 i=0; i<JITVERIFY_RANDOM_BLOCKS; ++i) {
+        sprintf_s(Description, sizeof(Description), "Random block %u", i);
+        RandomInitialState(&Initial, false);
+        Size = GenerateArmBlock(Code, RandomBelow(JITVERIFY_MAX_BLOCK)+1);
+        VerifyBlock(Description, Code, Size, false, &Initial, &ArmCounts);
+
+        RandomInitialState(&Initial, true);
+        Size = GenerateThumbBlock((unsigned __int16 *)Code, RandomBelow(JITVERIFY_MAX_BLOCK)+1);
+        VerifyBlock(Description, Code, Size, true, &Initial, &ThumbCounts);
+    }
+
+    fprintf(ReportFile, "\n%-8s %-9s %8s %8s %10s\n", PassName, "Streams", "Blocks", "Skipped", "Mismatches");
+    fprintf(ReportFile, "%-8s %-9s %8u %8u %10u\n", "", "recorded", RecordedCounts.Blocks, RecordedCounts.Skipped, RecordedCounts.Mismatches);
+    fprintf(ReportFile, "%-8s %-9s %8u %8u %10u\n", "", "ARM", ArmCounts.Blocks, ArmCounts.Skipped, ArmCounts.Mismatches);
+    fprintf(ReportFile, "%-8s %-9s %8u %8u %10u\n", "", "Thumb", ThumbCounts.Blocks, ThumbCounts.Skipped, ThumbCounts.Mismatches);
+}
+
+// Turns the MMU on with a flat section map in which the code section is
+// read-only, by running MCRs through the JIT in the same way the guest would
+static bool __fastcall EnableMmu(void)
+{
+    static const unsigned __int32 EnableMmuCode[] = {
+        0xee020f10, // mcr p15, #0, r0, c2, c0, #0
+        0xee031f10, // mcr p15, #0, r1, c3, c0, #0
+        0xee012f10, // mcr p15, #0, r2, c1, c0, #0
+        0xe1a00000, // mov r0, r0
+        0xe7f000f0, // end
+    };
+    unsigned __int32 TableAddress = (unsigned __int32)BoardGetPhysicalRAMBase() + JITVERIFY_TABLE_OFFSET;
+    unsigned __int32 *pTable = (unsigned __int32 *)BoardMapGuestPhysicalToHostRAM(TableAddress);
+    ReferenceState Initial = {0};
+
+    for (unsigned __int32 i=0; i<4096; ++i) {
+        // Section descriptors in domain 0:  AP=3 (read/write), or AP=0
+        // (read-only with R set) for the code
+        pTable[i] = (i << 20) | (((i << 20) == (VerifyCodeAddress & 0xfff00000)) ? 0 : (3 << 10)) | 0x12;
+    }
+    Initial.GPRs[R0] = TableAddress;
+    Initial.GPRs[R1] = 0x55555555;  // client access to every domain
+    Initial.GPRs[R2] = Mmu.ControlRegister.Word | 0x201;   // M and R
+    memcpy(VerifyCodeHost, EnableMmuCode, sizeof(EnableMmuCode));
+    FlushTranslationCache(0, 0xffffffff);
+    LoadCpuState(&Initial, false);
+    Cpu.GPRs[R15] = VerifyCodeAddress;
+    RunTranslatedCode(JitCompile(NULL, VerifyCodeAddress));
+    ReturnToSystemMode();
+
+    return Mmu.ControlRegister.Bits.M != 0;
+}
+
+__declspec(noreturn) void __fastcall CpuVerifyJit(__in_z const wchar_t *ReportFileName)
+{
+    unsigned __int32 RAMBase = (unsigned __int32)BoardGetPhysicalRAMBase();
+
+    if (_wfopen_s(&ReportFile, ReportFileName, L"w")) {
+        ShowDialog(ID_MESSAGE_UNABLE_TO_OPEN, ReportFileName);
+        exit(1);
+    }
+    VerifyCodeAddress = RAMBase + JITVERIFY_CODE_OFFSET;
+    VerifyCodeHost = (unsigned __int8 *)BoardMapGuestPhysicalToHostRAM(VerifyCodeAddress);
+    VerifyDataAddress = RAMBase + JITVERIFY_DATA_OFFSET;
+    VerifyDataHost = (unsigned __int8 *)BoardMapGuestPhysicalToHostRAM(VerifyDataAddress);
+    ASSERT(VerifyCodeHost && VerifyDataHost);
+
+    fprintf(ReportFile, "JIT verification against the reference interpreter\n");
+    VerifyPass("MMU off");
+    if (EnableMmu()) {
+        VerifyPass("MMU on");
+    } else {
+        fprintf(ReportFile, "\nThe MMU could not be turned on; the MMU-on pass was skipped.\n");
+        ReportedMismatches++;
+    }
+    fprintf(ReportFile, "\n%s\n", (ReportedMismatches) ? "FAILED" : "PASSED");
+    fclose(ReportFile);
+    exit((ReportedMismatches) ? 1 : 0);
+}
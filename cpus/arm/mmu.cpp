@@ -178,6 +178,7 @@ void __fastcall MMU::FlushAllTLBs(TLBUnit *pTLBUnit)
 {
 	int i;
 
+	TraceInstant((pTLBUnit == &Mmu.InstructionTLB) ? "FlushAllTLBs ITLB" : "FlushAllTLBs DTLB", TraceMmu, 0);
 	for (i=0; i<MAX_TLB_REGISTERS; ++i) {
 		pTLBUnit->TLBRegisters[i].Valid = false;
 		pTLBUnit->TLBRegisters[i].PTE=3;	// smallpagepte
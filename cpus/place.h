@@ -42,6 +42,22 @@ const unsigned __int8 MM6_Reg=6;
 const unsigned __int8 MM7_Reg=7;
 typedef unsigned __int8 IntelReg;
 
+// x86 condition codes:  the low nibble of the Jcc, SETcc and CMOVcc opcodes
+const unsigned __int8 O_Cond=0x0;
+const unsigned __int8 NO_Cond=0x1;
+const unsigned __int8 B_Cond=0x2;
+const unsigned __int8 AE_Cond=0x3;
+const unsigned __int8 E_Cond=0x4;
+const unsigned __int8 NE_Cond=0x5;
+const unsigned __int8 BE_Cond=0x6;
+const unsigned __int8 A_Cond=0x7;
+const unsigned __int8 S_Cond=0x8;
+const unsigned __int8 NS_Cond=0x9;
+const unsigned __int8 L_Cond=0xc;
+const unsigned __int8 GE_Cond=0xd;
+const unsigned __int8 LE_Cond=0xe;
+const unsigned __int8 G_Cond=0xf;
+
 #define Emit8(b) \
 { \
 	*CodeLocation = (b); \
@@ -164,6 +180,7 @@ typedef unsigned __int8 IntelReg;
 #define Emit_JBELabelFar(LabelName) { Emit16(0x860f); Emit32(0); LabelName=CodeLocation; }
 #define Emit_JAELabelFar(LabelName) { Emit16(0x830f); Emit32(0); LabelName=CodeLocation; }
 #define Emit_JALabelFar(LabelName) { Emit16(0x870f); Emit32(0); LabelName=CodeLocation; }
+#define Emit_JccLabelFar(Cond, LabelName) { Emit8(0x0f); Emit8(0x80 | (Cond)); Emit32(0); LabelName=CodeLocation; }
 
 
 #define FixupLabelFar(LabelName) { *(unsigned __int32*)(LabelName-4) = (unsigned __int32)(CodeLocation - LabelName); }
@@ -224,6 +241,15 @@ typedef unsigned __int8 IntelReg;
 #define Emit_ADC_DWORDPTR_Reg(p,Reg); { Emit8(0x11); EmitModRmReg(0,5,Reg); EmitPtr(p); } // ADC D[p],Reg
 
 #define Emit_SUB_Reg_DWORDPTR(Reg,p); { Emit8(0x2b); EmitModRmReg(0,5,Reg); EmitPtr(p); } // SUB Reg,D[p]
+#define Emit_AND_Reg_DWORDPTR(Reg,p) { Emit8(0x23); EmitModRmReg(0,5,Reg); EmitPtr(p); } // AND Reg,D[p]
+#define Emit_OR_Reg_DWORDPTR(Reg,p)  { Emit8(0x0b); EmitModRmReg(0,5,Reg); EmitPtr(p); } // OR Reg,D[p]
+#define Emit_XOR_Reg_DWORDPTR(Reg,p) { Emit8(0x33); EmitModRmReg(0,5,Reg); EmitPtr(p); } // XOR Reg,D[p]
+
+#define Emit_OR_Reg_Imm32(Reg, Imm)  { Emit8(0x81); EmitModRmReg(3,Reg,1); Emit32(Imm); } // OR Reg,Imm
+#define Emit_XOR_Reg_Imm32(Reg, Imm) { Emit8(0x81); EmitModRmReg(3,Reg,6); Emit32(Imm); } // XOR Reg,Imm
+#define Emit_NOT_Reg(Reg) { Emit8(0xf7); EmitModRmReg(3,Reg,2); } // NOT Reg
+
+#define Emit_CMOVcc_Reg_DWORDPTR(Cond,Reg,p) { Emit8(0x0f); Emit8(0x40 | (Cond)); EmitModRmReg(0,5,Reg); EmitPtr(p); } // CMOVcc Reg,D[p]
 
 #define Emit_AND_Reg_Imm32(Reg, Imm) { \
 	if ((signed __int32)(Imm) >= -128 && (signed __int32)(Imm) < 128) { \
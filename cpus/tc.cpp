@@ -94,11 +94,42 @@ bool ITranslationCache::Initialize(void)
         m_DecommitOnFlush = false;
         LOG_INFO(CACHE, "Turning off resize on flush");
     }
+    // Runs before the command line is parsed, so /largepages is not known yet
+    bool UseLargePages = false;
+    dwRet = GetEnvironmentVariableW(L"DE_LARGEPAGES", EnvValue, 4);
+    if ( dwRet != 0 && dwRet <= 3 && EnvValue[0] == '1' )
+    {
+        UseLargePages = true;
+    }
 
     m_MaxSize =     cacheSize*1024*1024;  // 32mb of reserve
     m_MinCommit =      256*1024;  // 256k of commit
     m_ChunkSize =       16*1024;  // commit in 16k chunks
 
+    size_t LargePageSize = UseLargePages ? GetLargePageSize() : 0;
+    if (LargePageSize) {
+        //
+        // Large pages are committed when they are allocated and can't be
+        // decommitted, so commit the whole cache now and keep it across flushes.
+        //
+        size_t LargeSize = (m_MaxSize + LargePageSize - 1) & ~(LargePageSize - 1);
+
+        m_StartAddress = (unsigned __int8 *)VirtualAlloc(NULL, LargeSize, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_EXECUTE_READWRITE);
+        if (m_StartAddress) {
+            m_MaxSize = LargeSize;
+            m_MinCommit = LargeSize;
+            m_CommitIndex = LargeSize;
+            m_DecommitOnFlush = false;
+            m_LastCommitTime = GetTickCount();
+            LOG_INFO(CACHE, "Committed a %d MB cache in large pages", LargeSize/(1024*1024));
+#ifdef DEBUG
+            memset(m_StartAddress, DBG_FILL_VALUE, m_CommitIndex);
+#endif //DEBUG
+            return true;
+        }
+        LOG_WARN(CACHE, "Failed to allocate the cache in large pages (%d), using small pages", GetLastError());
+    }
+
     // Create the cache reserve
     m_StartAddress = (unsigned __int8 *)VirtualAlloc(NULL, m_MaxSize, MEM_RESERVE, PAGE_EXECUTE_READWRITE);
     if (!m_StartAddress) {
@@ -419,6 +450,7 @@ Return Value:
     }
     if (GuestLength == 0xffffffff ||
         IsGuestRangeInCache(GuestAddr, GuestLength)) {
+        TraceScope Trace("FlushTranslationCache", TraceCache, GuestAddr);
 
         CpuFlushCachedTranslations();
         FlushEntrypoints();
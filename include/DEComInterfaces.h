@@ -87,6 +87,13 @@ typedef interface IDeviceEmulatorDebugger IDeviceEmulatorDebugger;
 #endif 	/* __IDeviceEmulatorDebugger_FWD_DEFINED__ */
 
 
+#ifndef __IDeviceEmulatorDebugger2_FWD_DEFINED__
+#define __IDeviceEmulatorDebugger2_FWD_DEFINED__
+typedef interface IDeviceEmulatorDebugger2 IDeviceEmulatorDebugger2;
+
+#endif 	/* __IDeviceEmulatorDebugger2_FWD_DEFINED__ */
+
+
 #ifndef __IDeviceEmulatorItem_FWD_DEFINED__
 #define __IDeviceEmulatorItem_FWD_DEFINED__
 typedef interface IDeviceEmulatorItem IDeviceEmulatorItem;
@@ -1070,6 +1077,260 @@ EXTERN_C const IID IID_IDeviceEmulatorDebugger;
 #endif 	/* __IDeviceEmulatorDebugger_INTERFACE_DEFINED__ */
 
 
+#ifndef __IDeviceEmulatorDebugger2_INTERFACE_DEFINED__
+#define __IDeviceEmulatorDebugger2_INTERFACE_DEFINED__
+
+/* interface IDeviceEmulatorDebugger2 */
+/* [hidden][unique][helpstring][uuid][object] */ 
+
+
+EXTERN_C const IID IID_IDeviceEmulatorDebugger2;
+
+#if defined(__cplusplus) && !defined(CINTERFACE)
+    
+    MIDL_INTERFACE("f3198f19-0932-499a-861d-9426078296a8")
+    IDeviceEmulatorDebugger2 : public IDeviceEmulatorDebugger
+    {
+    public:
+        virtual HRESULT STDMETHODCALLTYPE ReadMemoryRanges( 
+            /* [in] */ boolean fIsVirtual,
+            /* [in] */ DWORD dwRangeCount,
+            /* [size_is][in] */ const DWORD64 *pAddresses,
+            /* [size_is][in] */ const DWORD *pNumBytesToRead,
+            /* [in] */ DWORD dwCpuNum,
+            /* [in] */ DWORD dwBufferSize,
+            /* [size_is][out] */ BYTE *pbReadBuffer,
+            /* [size_is][out] */ DWORD *pNumBytesActuallyRead) = 0;
+        
+    };
+    
+    
+#else 	/* C style interface */
+
+    typedef struct IDeviceEmulatorDebugger2Vtbl
+    {
+        BEGIN_INTERFACE
+        
+        DECLSPEC_XFGVIRT(IUnknown, QueryInterface)
+        HRESULT ( STDMETHODCALLTYPE *QueryInterface )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ REFIID riid,
+            /* [annotation][iid_is][out] */ 
+            _COM_Outptr_  void **ppvObject);
+        
+        DECLSPEC_XFGVIRT(IUnknown, AddRef)
+        ULONG ( STDMETHODCALLTYPE *AddRef )( 
+            IDeviceEmulatorDebugger2 * This);
+        
+        DECLSPEC_XFGVIRT(IUnknown, Release)
+        ULONG ( STDMETHODCALLTYPE *Release )( 
+            IDeviceEmulatorDebugger2 * This);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, GetProcessorFamily)
+        HRESULT ( STDMETHODCALLTYPE *GetProcessorFamily )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [out] */ DWORD *pdwProcessorFamily);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, ContinueExecution)
+        HRESULT ( STDMETHODCALLTYPE *ContinueExecution )( 
+            IDeviceEmulatorDebugger2 * This);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, ContinueWithSingleStep)
+        HRESULT ( STDMETHODCALLTYPE *ContinueWithSingleStep )( 
+            IDeviceEmulatorDebugger2 * This,
+            DWORD dwNumberOfSteps,
+            /* [in] */ DWORD dwCpuNum);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, Halt)
+        HRESULT ( STDMETHODCALLTYPE *Halt )( 
+            IDeviceEmulatorDebugger2 * This);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, RegisterHaltNotification)
+        HRESULT ( STDMETHODCALLTYPE *RegisterHaltNotification )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ IDeviceEmulatorDebuggerHaltNotificationSink *pSink,
+            /* [out] */ DWORD *pdwNotificationCookie);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, UnregisterHaltNotification)
+        HRESULT ( STDMETHODCALLTYPE *UnregisterHaltNotification )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD dwNotificationCookie);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, ReadVirtualMemory)
+        HRESULT ( STDMETHODCALLTYPE *ReadVirtualMemory )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD64 Address,
+            /* [in] */ DWORD NumBytesToRead,
+            /* [in] */ DWORD dwCpuNum,
+            /* [size_is][out] */ BYTE *pbReadBuffer,
+            /* [out] */ DWORD *pNumBytesActuallyRead);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, WriteVirtualMemory)
+        HRESULT ( STDMETHODCALLTYPE *WriteVirtualMemory )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD64 Address,
+            /* [in] */ DWORD NumBytesToWrite,
+            /* [in] */ DWORD dwCpuNum,
+            /* [size_is][in] */ const BYTE *pbWriteBuffer,
+            /* [out] */ DWORD *pNumBytesActuallyWritten);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, ReadPhysicalMemory)
+        HRESULT ( STDMETHODCALLTYPE *ReadPhysicalMemory )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD64 Address,
+            /* [in] */ boolean fUseIOSpace,
+            /* [in] */ DWORD NumBytesToRead,
+            /* [in] */ DWORD dwCpuNum,
+            /* [size_is][out] */ BYTE *pbReadBuffer,
+            /* [out] */ DWORD *pNumBytesActuallyRead);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, WritePhysicalMemory)
+        HRESULT ( STDMETHODCALLTYPE *WritePhysicalMemory )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD64 Address,
+            /* [in] */ boolean fUseIOSpace,
+            /* [in] */ DWORD NumBytesToWrite,
+            /* [in] */ DWORD dwCpuNum,
+            /* [size_is][in] */ const BYTE *pbWriteBuffer,
+            /* [out] */ DWORD *pNumBytesActuallyWritten);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, AddCodeBreakpoint)
+        HRESULT ( STDMETHODCALLTYPE *AddCodeBreakpoint )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD64 Address,
+            /* [in] */ boolean fIsVirtual,
+            /* [in] */ DWORD dwBypassCount,
+            /* [out] */ DWORD *pdwBreakpointCookie);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, SetBreakpointState)
+        HRESULT ( STDMETHODCALLTYPE *SetBreakpointState )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD dwBreakpointCookie,
+            /* [in] */ boolean fResetBypassCount);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, GetBreakpointState)
+        HRESULT ( STDMETHODCALLTYPE *GetBreakpointState )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD dwBreakpointCookie,
+            /* [out] */ DWORD *pdwBypassedOccurrences);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, DeleteBreakpoint)
+        HRESULT ( STDMETHODCALLTYPE *DeleteBreakpoint )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ DWORD dwBreakpointCookie);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, GetContext)
+        HRESULT ( STDMETHODCALLTYPE *GetContext )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [size_is][out][in] */ BYTE *pbContext,
+            /* [in] */ DWORD dwContextSize,
+            /* [in] */ DWORD dwCpuNum);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger, SetContext)
+        HRESULT ( STDMETHODCALLTYPE *SetContext )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [size_is][out][in] */ BYTE *pbContext,
+            /* [in] */ DWORD dwContextSize,
+            /* [in] */ DWORD dwCpuNum);
+        
+        DECLSPEC_XFGVIRT(IDeviceEmulatorDebugger2, ReadMemoryRanges)
+        HRESULT ( STDMETHODCALLTYPE *ReadMemoryRanges )( 
+            IDeviceEmulatorDebugger2 * This,
+            /* [in] */ boolean fIsVirtual,
+            /* [in] */ DWORD dwRangeCount,
+            /* [size_is][in] */ const DWORD64 *pAddresses,
+            /* [size_is][in] */ const DWORD *pNumBytesToRead,
+            /* [in] */ DWORD dwCpuNum,
+            /* [in] */ DWORD dwBufferSize,
+            /* [size_is][out] */ BYTE *pbReadBuffer,
+            /* [size_is][out] */ DWORD *pNumBytesActuallyRead);
+        
+        END_INTERFACE
+    } IDeviceEmulatorDebugger2Vtbl;
+
+    interface IDeviceEmulatorDebugger2
+    {
+        CONST_VTBL struct IDeviceEmulatorDebugger2Vtbl *lpVtbl;
+    };
+
+    
+
+#ifdef COBJMACROS
+
+
+#define IDeviceEmulatorDebugger2_QueryInterface(This,riid,ppvObject)	\
+    ( (This)->lpVtbl -> QueryInterface(This,riid,ppvObject) ) 
+
+#define IDeviceEmulatorDebugger2_AddRef(This)	\
+    ( (This)->lpVtbl -> AddRef(This) ) 
+
+#define IDeviceEmulatorDebugger2_Release(This)	\
+    ( (This)->lpVtbl -> Release(This) ) 
+
+
+#define IDeviceEmulatorDebugger2_GetProcessorFamily(This,pdwProcessorFamily)	\
+    ( (This)->lpVtbl -> GetProcessorFamily(This,pdwProcessorFamily) ) 
+
+#define IDeviceEmulatorDebugger2_ContinueExecution(This)	\
+    ( (This)->lpVtbl -> ContinueExecution(This) ) 
+
+#define IDeviceEmulatorDebugger2_ContinueWithSingleStep(This,dwNumberOfSteps,dwCpuNum)	\
+    ( (This)->lpVtbl -> ContinueWithSingleStep(This,dwNumberOfSteps,dwCpuNum) ) 
+
+#define IDeviceEmulatorDebugger2_Halt(This)	\
+    ( (This)->lpVtbl -> Halt(This) ) 
+
+#define IDeviceEmulatorDebugger2_RegisterHaltNotification(This,pSink,pdwNotificationCookie)	\
+    ( (This)->lpVtbl -> RegisterHaltNotification(This,pSink,pdwNotificationCookie) ) 
+
+#define IDeviceEmulatorDebugger2_UnregisterHaltNotification(This,dwNotificationCookie)	\
+    ( (This)->lpVtbl -> UnregisterHaltNotification(This,dwNotificationCookie) ) 
+
+#define IDeviceEmulatorDebugger2_ReadVirtualMemory(This,Address,NumBytesToRead,dwCpuNum,pbReadBuffer,pNumBytesActuallyRead)	\
+    ( (This)->lpVtbl -> ReadVirtualMemory(This,Address,NumBytesToRead,dwCpuNum,pbReadBuffer,pNumBytesActuallyRead) ) 
+
+#define IDeviceEmulatorDebugger2_WriteVirtualMemory(This,Address,NumBytesToWrite,dwCpuNum,pbWriteBuffer,pNumBytesActuallyWritten)	\
+    ( (This)->lpVtbl -> WriteVirtualMemory(This,Address,NumBytesToWrite,dwCpuNum,pbWriteBuffer,pNumBytesActuallyWritten) ) 
+
+#define IDeviceEmulatorDebugger2_ReadPhysicalMemory(This,Address,fUseIOSpace,NumBytesToRead,dwCpuNum,pbReadBuffer,pNumBytesActuallyRead)	\
+    ( (This)->lpVtbl -> ReadPhysicalMemory(This,Address,fUseIOSpace,NumBytesToRead,dwCpuNum,pbReadBuffer,pNumBytesActuallyRead) ) 
+
+#define IDeviceEmulatorDebugger2_WritePhysicalMemory(This,Address,fUseIOSpace,NumBytesToWrite,dwCpuNum,pbWriteBuffer,pNumBytesActuallyWritten)	\
+    ( (This)->lpVtbl -> WritePhysicalMemory(This,Address,fUseIOSpace,NumBytesToWrite,dwCpuNum,pbWriteBuffer,pNumBytesActuallyWritten) ) 
+
+#define IDeviceEmulatorDebugger2_AddCodeBreakpoint(This,Address,fIsVirtual,dwBypassCount,pdwBreakpointCookie)	\
+    ( (This)->lpVtbl -> AddCodeBreakpoint(This,Address,fIsVirtual,dwBypassCount,pdwBreakpointCookie) ) 
+
+#define IDeviceEmulatorDebugger2_SetBreakpointState(This,dwBreakpointCookie,fResetBypassCount)	\
+    ( (This)->lpVtbl -> SetBreakpointState(This,dwBreakpointCookie,fResetBypassCount) ) 
+
+#define IDeviceEmulatorDebugger2_GetBreakpointState(This,dwBreakpointCookie,pdwBypassedOccurrences)	\
+    ( (This)->lpVtbl -> GetBreakpointState(This,dwBreakpointCookie,pdwBypassedOccurrences) ) 
+
+#define IDeviceEmulatorDebugger2_DeleteBreakpoint(This,dwBreakpointCookie)	\
+    ( (This)->lpVtbl -> DeleteBreakpoint(This,dwBreakpointCookie) ) 
+
+#define IDeviceEmulatorDebugger2_GetContext(This,pbContext,dwContextSize,dwCpuNum)	\
+    ( (This)->lpVtbl -> GetContext(This,pbContext,dwContextSize,dwCpuNum) ) 
+
+#define IDeviceEmulatorDebugger2_SetContext(This,pbContext,dwContextSize,dwCpuNum)	\
+    ( (This)->lpVtbl -> SetContext(This,pbContext,dwContextSize,dwCpuNum) ) 
+
+
+#define IDeviceEmulatorDebugger2_ReadMemoryRanges(This,fIsVirtual,dwRangeCount,pAddresses,pNumBytesToRead,dwCpuNum,dwBufferSize,pbReadBuffer,pNumBytesActuallyRead)	\
+    ( (This)->lpVtbl -> ReadMemoryRanges(This,fIsVirtual,dwRangeCount,pAddresses,pNumBytesToRead,dwCpuNum,dwBufferSize,pbReadBuffer,pNumBytesActuallyRead) ) 
+
+#endif /* COBJMACROS */
+
+
+#endif 	/* C style interface */
+
+
+
+
+#endif 	/* __IDeviceEmulatorDebugger2_INTERFACE_DEFINED__ */
+
+
 #ifndef __IDeviceEmulatorItem_INTERFACE_DEFINED__
 #define __IDeviceEmulatorItem_INTERFACE_DEFINED__
 
@@ -33,6 +33,7 @@ struct ParseErrorStruct {
 
 extern unsigned __int32 BoardIOAddress;
 extern unsigned __int32 BoardIOAddressAdj;
+extern bool BoardTimeVaryingRead; // see MappedIODevice::IsTimeVarying() and PollingLoopHelper()
 
 extern const __int32 StatePlatform;
 
@@ -42,9 +43,15 @@ size_t __fastcall BoardGetPhysicalRAMBase();
 size_t __fastcall BoardMapGuestPhysicalToHost(unsigned __int32 EffectiveAddress, size_t *pHostAdjust);
 size_t __fastcall BoardMapGuestPhysicalToHostWrite(unsigned __int32 EffectiveAddress, size_t *pHostAdjust);
 bool __fastcall BoardIsHostAddressInRAM(size_t HostAddress);
+void __fastcall BoardMakeGuestRAMResident(size_t HostAddress, size_t Length); // before handing a guest buffer to host I/O
+bool __fastcall BoardShareGuestMemory(HANDLE *phSections); // FleetSectionCount inheritable handles, see Fleet.h
+bool __fastcall BoardBeginLazyImageLoad(class MappedStateFile *pImageFile, const struct GuestMemoryExtent *Extents, size_t ExtentCount); // /lazyrom, see GuestMemory.h
 size_t __fastcall BoardMapGuestPhysicalToFlash(unsigned __int32 EffectiveAddress);
+void __fastcall BoardDeliverPostedInterrupts(void); // called on the CPU thread, see CpuPostInterrupt()
 bool __fastcall BoardLoadImage(const wchar_t *ImageFile);
 bool __fastcall BoardLoadSavedState(bool default_state);
+bool __fastcall BoardLoadBenchmark(void); // /benchmark, in place of an OS image or saved state
+bool __fastcall BoardLoadJitVerify(void); // /jitverify, in place of an OS image or saved state
 void __fastcall BoardSaveState(StateFiler& filer);
 void __fastcall BoardRestoreState(StateFiler& filer);
 void PerformSyscall(void);
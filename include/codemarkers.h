@@ -13,6 +13,7 @@
 
 #pragma once
 
-#define CodeMarker(x)
+// Code markers are recorded as trace events (see traceevents.h)
+#define CodeMarker(x) TraceInstant(#x, TraceBoot, 0)
 #define InitPerformanceDLL(x, y)
 #define UninitializePerformanceDLL(x)
@@ -31,6 +31,7 @@ enum CfgVideoRetType
 class XMLSkin;
 
 enum ToolTipStateEnum { ToolTipOn, ToolTipOff, ToolTipDelay };
+enum NetBackendEnum { NetBackendVPC, NetBackendTap, NetBackendSwitch };
 
 class EmulatorConfig
 {
@@ -149,6 +150,16 @@ public:
     bool NoSecurityPrompt;      // Do not promt when powering on potentially unsafe peripherals
     bool Board64RamRegion;      // There is a single 64MB RAM region so assume CE5.0 layout
     bool DialogOnly;            // This instance of DE was started to display configuration dialog
+    bool LazyRestore;           // Restore guest memory from the saved state on first access
+    bool LazyROM;               // Copy the ROM image into guest memory on first access
+    bool LargePages;            // Use large pages for guest memory and the translation cache
+    unsigned __int32 FleetSize; // Number of emulators to launch from the saved state (/fleet)
+    NetBackendEnum NetBackend;  // Host side of the network adapters (/nettap, /netswitch)
+    wchar_t NetBackendName[64]; // TAP adapter or virtual switch name, may be empty for TAP
+    wchar_t TraceFileName[MAX_PATH]; // Trace events are written here at exit (/trace), if not empty
+    wchar_t BenchmarkFileName[MAX_PATH]; // Run the built-in benchmarks and report here (/benchmark), if not empty
+    wchar_t JitVerifyFileName[MAX_PATH]; // Verify the JIT against the reference interpreter and report here (/jitverify), if not empty
+    wchar_t ProfileFileName[MAX_PATH]; // Sample the guest PC and write the profile here at exit (/profile), if not empty
 };
 
 #endif //EMULATORCONFIG__H_
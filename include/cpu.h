@@ -27,6 +27,11 @@ void __fastcall CpuSetStackPointer(unsigned __int32 StackPointer);
 void __fastcall CpuSetResetPending(void);
 void __fastcall CpuSetInterruptPending(void);
 void __fastcall CpuClearInterruptPending(void);
+
+// Asks the CPU thread to call BoardDeliverPostedInterrupts() at its next
+// interrupt poll, waking it if it is idle.  Unlike CpuSetInterruptPending(),
+// this may be called on any thread without the IOLock.
+void __fastcall CpuPostInterrupt(void);
 CSystemCallbacks * __fastcall CpuGetSystemCallbacks(void);
 void __fastcall CpuFlushCachedTranslations(void);
 bool __fastcall CpuAreInterruptsEnabled();
@@ -35,6 +40,20 @@ bool __fastcall CpuAreInterruptsEnabled();
 // process exits.
 __declspec(noreturn) void CpuSimulate(void);
 
+// Runs randomized and recorded instruction streams through the JIT and a
+// reference interpreter, writes the comparison to ReportFileName, and exits
+// with 1 if they differed (/jitverify).  Guest memory must be allocated.
+__declspec(noreturn) void __fastcall CpuVerifyJit(__in_z const wchar_t *ReportFileName);
+
+// Returns the number of conditional guest instructions the JIT has translated,
+// and how many of them it generated without a branch.
+void __fastcall CpuGetPredicationCounts(unsigned __int32 *pConditional, unsigned __int32 *pPredicated);
+
+// Asks the CPU to pass its PC to ProfilerRecordSample() at its next interrupt
+// poll.  Returns false, without asking again, if it has not yet polled since
+// the previous request.  Called by the profiler's sampling thread.
+bool __fastcall CpuRequestProfileSample(void);
+
 // CPU configuration specified by the board
 typedef union {
 	struct {
@@ -40,14 +40,16 @@
 #include <strsafe.h>
 #pragma warning(pop)
 
+#include "traceevents.h"
+
 #ifndef DISABLE_CODEMARKERS
 // Code markers are only applicable to VS performance testing
 #include "codemarkers.h"
 #else
-// Define the codemarker call to nothing to remove the dependency
+// Define the performance DLL calls to nothing to remove the dependency
 #define InitPerformanceDLL(x, y)
 #define UninitializePerformanceDLL(x)
-#define CodeMarker(x)
+#define CodeMarker(x) TraceInstant(#x, TraceBoot, 0)
 #endif
 
 // Call exit() instead of ExitProcess() within the DeviceEmulator:  it
@@ -136,6 +138,11 @@ void __fastcall DecodeLastError( unsigned int ErrorCode, int buffSize, __out_eco
 int SafeWcsicmp(const wchar_t *s1, const wchar_t *s2);
 wchar_t * RemoveEscapes( __inout_z wchar_t * input );
 
+// Returns the host's large page size, or 0 if the host or the user's rights don't
+// allow large pages.  Guest memory (/largepages) and the translation cache
+// (DE_LARGEPAGES=1) use small pages when it is 0.
+size_t __fastcall GetLargePageSize(void);
+
 
 #if FEATURE_COM_INTERFACE
 bool RegisterUnregisterServer(BOOL bRegister);
@@ -0,0 +1,33 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef PROFILER_H__
+#define PROFILER_H__
+
+// The guest PC sampling profiler (/profile).  A thread asks the CPU for a sample
+// every millisecond, using the same interrupt poll as the debugger:  the
+// translated code only knows the guest PC at a poll, so samples are taken at
+// taken branches.  Samples are aggregated by address and mode as they arrive.
+// At exit they are symbolized against the modules in the ROM image and written
+// as a flat profile to the profile file, and as folded stacks, one
+// "frame;frame;... count" line per address, to the same name plus ".folded".
+// The folded stacks can be fed to flamegraph.pl or speedscope.
+
+// Starts the sampling thread.  Call just before CpuSimulate().
+bool __fastcall ProfilerStart(__in_z const wchar_t *FileName);
+
+// Called on the CPU thread when a requested sample is taken.  Address is the
+// modified virtual address of the PC, and Mode is the CPSR mode bits.
+void __fastcall ProfilerRecordSample(unsigned __int32 Address, unsigned __int32 Mode);
+
+#endif // PROFILER_H__
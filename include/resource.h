@@ -123,6 +123,8 @@
 #define ID_MESSAGE_ENABLE_NETWORKING    332
 #define ID_MESSAGE_ENABLE_SERIAL        333
 #define ID_MESSAGE_INVALID_SAVED_FILE_VERSION_DELETE_OPTION 334
+#define ID_MESSAGE_FAILED_TAP_NETWORK_OPEN 335
+#define ID_MESSAGE_FAILED_NETWORK_SWITCH_OPEN 336
 
 #define IDC_EDIT_FLASH_FILE_NAME        1011
 #define IDC_CHECK_ROM_BASE_ADDRESS      1012
@@ -22,7 +22,7 @@ __int32 Int32FromString(const char* str);
 class StateFiler
 {
 public:
-	StateFiler() { succeeded = false; delete_saved_state = false; }
+	StateFiler() { succeeded = false; delete_saved_state = false; pMappedFile = NULL; }
 	void Save();
 	void Restore(EmulatorConfig * PrivateConfiguration = NULL);
 
@@ -95,9 +95,27 @@ public:
 		succeeded = LZRead(data, length, hFile);
 	}
 
+	// Writes data as independently-compressed GUEST_MEMORY_BLOCK_SIZE blocks, so that
+	// it can later be restored lazily, one block at a time.
+	void BlockLZWrite(unsigned __int8* data, size_t length)
+	{
+		succeeded = BlockLZWrite(data, length, hFile);
+	}
+
+	// Restores a region of guest memory.  When lazy restore is enabled and the data
+	// was saved uncompressed or block-compressed, the region is populated on first
+	// access instead of being read now.
+	void LZReadLazy(class GuestMemoryRegion& Region);
+
+	// Skips over a memory record written by LZWrite or BlockLZWrite, for memory
+	// whose contents are supplied some other way.
+	void LZSkip(void);
+
 	bool LZWrite(unsigned __int8* data,size_t length, HANDLE fileHandle );
 	bool LZRead(unsigned __int8* data,size_t length, HANDLE fileHandle );
 	bool LZRead(unsigned __int8* data,size_t length, unsigned __int8 * input );
+	bool BlockLZWrite(unsigned __int8* data,size_t length, HANDLE fileHandle );
+	bool BlockLZRead(unsigned __int8* data,size_t length, HANDLE fileHandle );
 
     void WriteString(__in_z const wchar_t *data)
     {
@@ -163,6 +181,7 @@ private:
 	bool delete_saved_state;
 	__int32 FileStateVersion;
 	HANDLE hFile;
+	class MappedStateFile *pMappedFile; // shared with lazily-restored regions
 };
 
 #endif // STATE_H_INCLUDED
@@ -0,0 +1,89 @@
+/*++
+
+ Copyright (c) 2006 Microsoft Corporation.  All rights reserved.
+
+ The use and distribution terms for this software are contained in the file
+ named license.rtf, which can be found in the root of this distribution.
+ By using this software in any fashion, you are agreeing to be bound by the
+ terms of this license.
+
+ You must not remove this notice, or any other, from this software.
+
+--*/
+
+#ifndef TRACEEVENTS_H__
+#define TRACEEVENTS_H__
+
+// Trace events are compiled into every build.  Nothing is recorded until
+// TraceStart() is called for /trace, so the cost of an event site is a test of
+// TraceEnabled.  Each thread records into its own ring buffer, which keeps the
+// most recent events.  Boot and save-state events go to a separate log instead,
+// so that a long run does not overwrite them.  The events are written to the
+// trace file at exit in the Chrome trace event format, which can be loaded by
+// chrome://tracing and by the Perfetto UI.
+
+// The "cat" field of each event.  Keep TraceCategoryNames in TraceEvents.cpp in
+// the same order.
+enum TraceCategory {
+    TraceBoot,
+    TraceState,
+    TraceJit,
+    TraceCache,
+    TraceMmu,
+    TraceIO,
+    TraceInterrupt
+};
+
+extern volatile bool TraceEnabled;
+
+// Opens the trace file and begins recording.  The events are written to the
+// file when the emulator exits.
+bool __fastcall TraceStart(__in_z const wchar_t *FileName);
+
+// Names the current thread in the trace.  Name must be a string literal.
+void __fastcall TraceNameThread(const char *Name);
+
+// Records an event.  Name must remain valid until exit:  a string literal, or a
+// string in a constant table.  StartTime is a QueryPerformanceCounter() value.
+void __fastcall TraceRecordInstant(const char *Name, TraceCategory Category, unsigned __int32 Arg);
+void __fastcall TraceRecordComplete(const char *Name, TraceCategory Category, unsigned __int32 Arg, unsigned __int64 StartTime);
+
+__forceinline void TraceInstant(const char *Name, TraceCategory Category, unsigned __int32 Arg)
+{
+    if (TraceEnabled) {
+        TraceRecordInstant(Name, Category, Arg);
+    }
+}
+
+// Records the time from its construction to its destruction as one event
+class TraceScope {
+public:
+    __forceinline TraceScope(const char *Name, TraceCategory Category, unsigned __int32 Arg)
+    {
+        this->Name = Name;
+        this->Category = Category;
+        this->Arg = Arg;
+        StartTime = 0;
+        if (TraceEnabled) {
+            LARGE_INTEGER Now;
+
+            QueryPerformanceCounter(&Now);
+            StartTime = Now.QuadPart;
+        }
+    }
+
+    __forceinline ~TraceScope()
+    {
+        if (StartTime) {
+            TraceRecordComplete(Name, Category, Arg, StartTime);
+        }
+    }
+
+private:
+    const char *Name;
+    TraceCategory Category;
+    unsigned __int32 Arg;
+    unsigned __int64 StartTime;
+};
+
+#endif // TRACEEVENTS_H__